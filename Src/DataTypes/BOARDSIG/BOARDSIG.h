@@ -0,0 +1,165 @@
+/*
+ * BOARDSIG.h
+ *      Implementation of the board signatures used by the nearest-position GiST index on FEN.
+ *
+ * A signature holds one bitboard per square content (empty square and the twelve
+ * pieces). The signature of a position has exactly one bit set per square; inner
+ * entries hold the bitwise OR of the signatures below them, i.e. every content
+ * each square has in one of their positions. The distance between two positions
+ * ('<->') is the number of squares whose content differs, and is bounded for an
+ * inner entry by the number of squares whose content in the query it never has.
+ * It's part of a PostgreSQL extension for storing and querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "port/pg_bitutils.h"
+
+#ifndef BOARDSIG_H
+#define BOARDSIG_H
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+// Number of square contents: the empty square, then "PNBRQKpnbrqk".
+#define BOARDSIG_CONTENTS 13
+
+/**
+ * Structure representing the board signature of one or several positions.
+ *
+ * @param vl_len_ Varlena header (do not touch directly).
+ * @param padding Keeps the bitboards 8-byte aligned.
+ * @param boards One bitboard per square content, square 0 being a8 and 63 h1
+ *        (the order of the FEN board positions field).
+ */
+typedef struct
+{
+    int32 vl_len_;
+    int32 padding;
+    uint64 boards[BOARDSIG_CONTENTS];
+} BOARDSIG;
+
+#define DatumGetBOARDSIG(x) ((BOARDSIG *) PG_DETOAST_DATUM(x))
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+BOARDSIG *boardsig_new(void);
+BOARDSIG *boardsig_from_positions(const char *positions);
+void boardsig_union_into(BOARDSIG *dest, const BOARDSIG *src);
+int boardsig_distance(const BOARDSIG *key, const BOARDSIG *query);
+int boardsig_added_bits(const BOARDSIG *orig, const BOARDSIG *add);
+int boardsig_bit_distance(const BOARDSIG *a, const BOARDSIG *b);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+/**
+ * Allocates an empty signature.
+ */
+BOARDSIG *boardsig_new(void)
+{
+    BOARDSIG *sig = (BOARDSIG *) palloc0(sizeof(BOARDSIG));
+
+    SET_VARSIZE(sig, sizeof(BOARDSIG));
+
+    return sig;
+}
+
+/**
+ * Builds the signature of a position.
+ *
+ * @param positions The board positions field of a FEN (FEN.positions), already
+ *        validated by the FEN parser.
+ * @return A palloc'd signature with one bit set per square.
+ */
+BOARDSIG *boardsig_from_positions(const char *positions)
+{
+    static const char pieces[] = "PNBRQKpnbrqk";
+    BOARDSIG *sig = boardsig_new();
+    int square = 0;
+
+    for (const char *p = positions; *p != '\0' && *p != ' ' && square < 64; p++) {
+        if (*p >= '1' && *p <= '8') {
+            for (int i = 0; i < *p - '0' && square < 64; i++)
+                sig->boards[0] |= UINT64CONST(1) << square++;
+        } else if (*p != '/') {
+            const char *piece = strchr(pieces, *p);
+
+            if (piece != NULL)
+                sig->boards[1 + (piece - pieces)] |= UINT64CONST(1) << square;
+            square++;
+        }
+    }
+
+    return sig;
+}
+
+/**
+ * ORs a signature into another one.
+ */
+void boardsig_union_into(BOARDSIG *dest, const BOARDSIG *src)
+{
+    for (int i = 0; i < BOARDSIG_CONTENTS; i++)
+        dest->boards[i] |= src->boards[i];
+}
+
+/**
+ * Counts the squares whose content in a position is never found in a signature.
+ *
+ * When the signature is the one of a single position, this is the number of
+ * differing squares; otherwise it is a lower bound of the number of squares
+ * differing from each position below it.
+ *
+ * @param key The signature of the entry.
+ * @param query The signature of the position.
+ * @return The number of squares, between 0 and 64.
+ */
+int boardsig_distance(const BOARDSIG *key, const BOARDSIG *query)
+{
+    int matching = 0;
+
+    for (int i = 0; i < BOARDSIG_CONTENTS; i++)
+        matching += pg_popcount64(key->boards[i] & query->boards[i]);
+
+    return 64 - matching;
+}
+
+/**
+ * Counts the bits that a signature would add to another one.
+ *
+ * This is the GiST penalty of inserting 'add' below 'orig'.
+ */
+int boardsig_added_bits(const BOARDSIG *orig, const BOARDSIG *add)
+{
+    int count = 0;
+
+    for (int i = 0; i < BOARDSIG_CONTENTS; i++)
+        count += pg_popcount64(add->boards[i] & ~orig->boards[i]);
+
+    return count;
+}
+
+/**
+ * Computes the Hamming distance between two signatures.
+ */
+int boardsig_bit_distance(const BOARDSIG *a, const BOARDSIG *b)
+{
+    int count = 0;
+
+    for (int i = 0; i < BOARDSIG_CONTENTS; i++)
+        count += pg_popcount64(a->boards[i] ^ b->boards[i]);
+
+    return count;
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //BOARDSIG_H
@@ -8,14 +8,20 @@
  *
  */
 
-#include <regex.h>
+#include <ctype.h>
 #include <utils/elog.h>
+#include <common/hashfn.h>
+#include <utils/array.h>
+#include <utils/lsyscache.h>
 
 #ifndef FEN_H
 #define FEN_H
 
 #define MAX_FEN_LENGTH 69
 
+// Size of a formatted FEN string: the board positions, the other fields and two 10-digit clocks.
+#define FEN_STR_LENGTH (MAX_FEN_LENGTH + 32)
+
 //---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
 
 /**
@@ -48,9 +54,16 @@ typedef struct
 
 //---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
 
-static bool isValidFEN(const char *fen);
 char* parseFEN_ToStr(const FEN *cb);
 void parseStr_ToFEN(const char *fenStr, FEN *result);
+uint32 fen_position_hash(const char *fenStr);
+int64 fen_position_hash64(const char *fenStr);
+text *fen_position_ply_text(const char *fenStr, int bucket);
+int fen_state_length(const char *fenStr);
+text *fen_state_ply_text(const char *fenStr, int bucket);
+bool fen_same_state(const char *fenStr, const char *state);
+bool fen_same_position(const char *fenStr, const char *positions);
+FEN **fen_array_elements(ArrayType *array, int *nFens);
 
 //---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
 
@@ -70,10 +83,10 @@ void parseStr_ToFEN(const char *fenStr, FEN *result);
  * @return A pointer to a formatted FEN string.
  */
 char* parseFEN_ToStr(const FEN *cb){
-    static char result[MAX_FEN_LENGTH];
+    static char result[FEN_STR_LENGTH];
 
     // Format the FEN structure into a string using snprintf for safe string handling.
-    snprintf(result, MAX_FEN_LENGTH, "%s %c %s %s %d %d",
+    snprintf(result, FEN_STR_LENGTH, "%s %c %s %s %d %d",
              cb->positions,
              cb->turn,
              cb->castling,
@@ -84,62 +97,373 @@ char* parseFEN_ToStr(const FEN *cb){
     return result;
 }
 
+/**
+ * Reports an invalid FEN string.
+ *
+ * @param fenStr The FEN string being parsed.
+ * @param p The position of the error in the string.
+ * @param detail The description of the error.
+ */
+static void fen_parse_error(const char *fenStr, const char *p, const char *detail) pg_attribute_noreturn();
+
+static void fen_parse_error(const char *fenStr, const char *p, const char *detail)
+{
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+             errmsg("invalid FEN representation: \"%s\"", fenStr),
+             errdetail("%s at position %d.", detail, (int) (p - fenStr) + 1)));
+}
+
+/**
+ * Skips the spaces separating two FEN fields.
+ *
+ * @param fenStr The FEN string being parsed.
+ * @param p The current position, which must be a space.
+ * @return The position of the next field.
+ */
+static const char *fen_skip_separator(const char *fenStr, const char *p)
+{
+    if (*p != ' ')
+        fen_parse_error(fenStr, p, *p ? "Expected a space" : "Unexpected end of string");
+
+    while (*p == ' ')
+        p++;
+
+    return p;
+}
+
+/**
+ * Parses a FEN clock field (halfmove clock or fullmove number).
+ *
+ * @param fenStr The FEN string being parsed.
+ * @param p The current position, updated past the field.
+ * @param min The smallest valid value of the field.
+ * @param name The name of the field, for error messages.
+ * @return The value of the field.
+ */
+static int fen_parse_clock(const char *fenStr, const char **p, int min, const char *name)
+{
+    const char *begin = *p;
+    int64 value = 0;
+
+    if (!isdigit((unsigned char) **p))
+        fen_parse_error(fenStr, *p, psprintf("Expected the %s", name));
+
+    while (isdigit((unsigned char) **p)) {
+        value = value * 10 + (**p - '0');
+
+        if (value > PG_INT32_MAX)
+            fen_parse_error(fenStr, begin, psprintf("The %s is out of range", name));
+
+        (*p)++;
+    }
+
+    if (value < min)
+        fen_parse_error(fenStr, begin, psprintf("The %s must be at least %d", name, min));
+
+    return (int) value;
+}
+
 /**
  * Parses a FEN string to a FEN structure.
  *
- * This function takes a FEN string and populates a FEN structure based on the content.
- * It uses sscanf for parsing. If parsing fails, an error is raised.
+ * The string is validated and copied into the structure in a single pass: the board
+ * positions must describe 8 ranks of 8 squares (empty square counts are not repeated),
+ * with one king per side, at most 8 pawns and 16 pieces per side and no pawn on the
+ * first or last rank; the side to move must be 'w' or 'b', the castling rights a
+ * subset of 'KQkq' in that order, the en passant square a square of the 3rd or 6th
+ * rank matching the side to move, and the clocks non-negative integers (the fullmove
+ * number starting at 1). Errors report the position of the offending character.
  *
  * @param fenStr A string containing the FEN data.
  * @param result A pointer to the FEN structure to populate.
  */
-void parseStr_ToFEN(const char *fenStr, FEN *result){
-    if (sscanf(fenStr, "%s %c %s %s %d %d",
-               result->positions,
-               &result->turn,
-               result->castling,
-               result->en_passant,
-               &result->halfmove_clock,
-               &result->fullmove_number) != 6)
-    {
-        // Raise an error if the FEN string doesn't match the expected format.
-        ereport(ERROR,
-                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                 errmsg("failed to parse FEN string: %s", fenStr)));
+void parseStr_ToFEN(const char *fenStr, FEN *result)
+{
+    const char *p = fenStr;
+    const char *positions;
+    int rank = 0, file = 0, length = 0;
+    int kings[2] = {0, 0}, pawns[2] = {0, 0}, pieces[2] = {0, 0};
+    bool afterDigit = false;
+    const char *castlingOrder = "KQkq";
+    int nCastling = 0;
+
+    memset(result, 0, sizeof(FEN));
+
+    while (isspace((unsigned char) *p))
+        p++;
+
+    // Board positions, from the 8th rank to the 1st.
+    positions = p;
+
+    for (; *p != '\0' && *p != ' '; p++) {
+        if (*p == '/') {
+            if (file != 8)
+                fen_parse_error(fenStr, p, psprintf("Rank %d has %d squares instead of 8", 8 - rank, file));
+            if (++rank > 7)
+                fen_parse_error(fenStr, p, "The board has more than 8 ranks");
+
+            file = 0;
+            afterDigit = false;
+        } else if (*p >= '1' && *p <= '8') {
+            if (afterDigit)
+                fen_parse_error(fenStr, p, "Empty squares must be counted with a single digit");
+            if ((file += *p - '0') > 8)
+                fen_parse_error(fenStr, p, psprintf("Rank %d has more than 8 squares", 8 - rank));
+
+            afterDigit = true;
+        } else if (strchr("KQRBNPkqrbnp", *p) != NULL) {
+            int side = isupper((unsigned char) *p) ? 0 : 1;
+
+            if (++file > 8)
+                fen_parse_error(fenStr, p, psprintf("Rank %d has more than 8 squares", 8 - rank));
+            if (toupper((unsigned char) *p) == 'P' && (rank == 0 || rank == 7))
+                fen_parse_error(fenStr, p, "Pawns cannot stand on the first or last rank");
+
+            kings[side] += toupper((unsigned char) *p) == 'K';
+            pawns[side] += toupper((unsigned char) *p) == 'P';
+            pieces[side]++;
+            afterDigit = false;
+        } else {
+            fen_parse_error(fenStr, p, psprintf("Unexpected character \"%c\" in the board positions", *p));
+        }
+
+        if (length == MAX_FEN_LENGTH - 1)
+            fen_parse_error(fenStr, p, "The board positions are too long");
+
+        result->positions[length++] = *p;
+    }
+
+    if (rank != 7)
+        fen_parse_error(fenStr, p, psprintf("The board has %d ranks instead of 8", rank + 1));
+    if (file != 8)
+        fen_parse_error(fenStr, p, psprintf("Rank 1 has %d squares instead of 8", file));
+
+    for (int side = 0; side < 2; side++) {
+        const char *color = side == 0 ? "White" : "Black";
+
+        if (kings[side] != 1)
+            fen_parse_error(fenStr, positions, psprintf("%s has %d kings instead of 1", color, kings[side]));
+        if (pawns[side] > 8)
+            fen_parse_error(fenStr, positions, psprintf("%s has %d pawns", color, pawns[side]));
+        if (pieces[side] > 16)
+            fen_parse_error(fenStr, positions, psprintf("%s has %d pieces", color, pieces[side]));
+    }
+
+    // Side to move.
+    p = fen_skip_separator(fenStr, p);
+
+    if (*p != 'w' && *p != 'b')
+        fen_parse_error(fenStr, p, "The side to move must be \"w\" or \"b\"");
+
+    result->turn = *p++;
+
+    // Castling rights.
+    p = fen_skip_separator(fenStr, p);
+
+    if (*p == '-') {
+        result->castling[nCastling++] = *p++;
+    } else {
+        for (; *p != '\0' && *p != ' '; p++) {
+            const char *right = strchr(castlingOrder, *p);
+
+            if (right == NULL)
+                fen_parse_error(fenStr, p, "Castling rights must be \"-\" or a subset of \"KQkq\" in that order");
+
+            result->castling[nCastling++] = *p;
+            castlingOrder = right + 1;
+        }
+
+        if (nCastling == 0)
+            fen_parse_error(fenStr, p, "Expected the castling rights");
+    }
+
+    // En passant square.
+    p = fen_skip_separator(fenStr, p);
+
+    if (*p == '-') {
+        result->en_passant[0] = *p++;
+    } else {
+        if (p[0] < 'a' || p[0] > 'h' || p[1] != (result->turn == 'w' ? '6' : '3'))
+            fen_parse_error(fenStr, p, psprintf("The en passant square must be \"-\" or a square of rank %c",
+                                                result->turn == 'w' ? '6' : '3'));
+
+        result->en_passant[0] = *p++;
+        result->en_passant[1] = *p++;
+    }
+
+    // Halfmove clock and fullmove number.
+    p = fen_skip_separator(fenStr, p);
+    result->halfmove_clock = fen_parse_clock(fenStr, &p, 0, "halfmove clock");
+
+    p = fen_skip_separator(fenStr, p);
+    result->fullmove_number = fen_parse_clock(fenStr, &p, 1, "fullmove number");
+
+    while (isspace((unsigned char) *p))
+        p++;
+
+    if (*p != '\0')
+        fen_parse_error(fenStr, p, "Unexpected characters after the fullmove number");
+}
+
+/**
+ * Hashes the piece placement of a FEN string.
+ *
+ * Only the first field of the FEN (the board positions) takes part in the hash,
+ * so that the result matches the position comparisons done on FEN.positions.
+ *
+ * @param fenStr A FEN string, or just its board positions field.
+ * @return A 32-bit hash of the board positions.
+ */
+uint32 fen_position_hash(const char *fenStr)
+{
+    int length = strcspn(fenStr, " ");
+
+    return hash_bytes((const unsigned char *) fenStr, length);
+}
+
+/**
+ * Hashes the piece placement of a FEN string into 64 bits.
+ *
+ * This is the position key stored in the chess_positions side table.
+ *
+ * @param fenStr A FEN string, or just its board positions field.
+ * @return A 64-bit hash of the board positions.
+ */
+int64 fen_position_hash64(const char *fenStr)
+{
+    int length = strcspn(fenStr, " ");
+
+    return (int64) hash_bytes_extended((const unsigned char *) fenStr, length, 0);
+}
+
+/**
+ * Extracts the piece placement of a FEN string tagged with a ply bucket.
+ *
+ * The result has the form '<board positions>#<bucket>' and is the key stored in
+ * the GIN index for a board state reached within that bucket of half-moves.
+ *
+ * @param fenStr A FEN string, or just its board positions field.
+ * @param bucket The ply bucket of the board state.
+ * @return A palloc'd text holding the tagged board positions.
+ */
+text *fen_position_ply_text(const char *fenStr, int bucket)
+{
+    char *key = psprintf("%.*s#%d", (int) strcspn(fenStr, " "), fenStr, bucket);
+    text *result = cstring_to_text(key);
+
+    pfree(key);
+
+    return result;
+}
+
+/**
+ * Computes the length of the board state fields of a FEN string.
+ *
+ * The board state is the piece placement, the side to move, the castling rights and
+ * the en passant square: the first four fields, without the clocks.
+ *
+ * @param fenStr A FEN string.
+ * @return The length of its first four fields, separators included.
+ */
+int fen_state_length(const char *fenStr)
+{
+    const char *p = fenStr;
+
+    for (int field = 0; field < 4 && *p != '\0'; field++) {
+        if (field > 0)
+            p++;
+        p += strcspn(p, " ");
     }
+
+    return (int) (p - fenStr);
 }
 
 /**
- * Validates a FEN string using regular expressions.
+ * Extracts the board state of a FEN string tagged with a ply bucket.
  *
- * This function checks if the given FEN string is valid according to the standard
- * FEN notation. It uses POSIX regular expressions for validation.
+ * The result has the form '<board state>#<bucket>' and is the key stored in the
+ * GIN index for a board state when its 'key' option is 'full'.
  *
- * @param fen A string containing the FEN data to validate.
- * @return true if the FEN string is valid, false otherwise.
+ * @param fenStr A FEN string.
+ * @param bucket The ply bucket of the board state.
+ * @return A palloc'd text holding the tagged board state.
  */
-static bool isValidFEN(const char *fen)
+text *fen_state_ply_text(const char *fenStr, int bucket)
 {
-    int ret;
-    /* Regular expression pattern for FEN validation */
-    static const char *fen_pattern = "^[KQRBNPkqrbnp1-8]+(/[KQRBNPkqrbnp1-8]+){7} [wb] (-|[KQkq]+) (-|[a-h36]+) \\d+ \\d+$";
+    char *key = psprintf("%.*s#%d", fen_state_length(fenStr), fenStr, bucket);
+    text *result = cstring_to_text(key);
 
-    /* Compile the regular expression pattern */
-    regex_t re;
-    if (regcomp(&re, fen_pattern, REG_EXTENDED | REG_NOSUB) != 0)
-        return false;
+    pfree(key);
 
-    /* Execute the regular expression and check if it matches the FEN string */
-    ret = regexec(&re, fen, 0, NULL, 0);
+    return result;
+}
+
+/**
+ * Checks if two FEN strings have the same board state (see fen_state_length).
+ *
+ * @param fenStr A FEN string.
+ * @param state Another FEN string.
+ * @return true if the first four fields are identical.
+ */
+bool fen_same_state(const char *fenStr, const char *state)
+{
+    int length = fen_state_length(fenStr);
 
-    /* Free the regex resources */
-    regfree(&re);
+    return fen_state_length(state) == length && strncmp(fenStr, state, length) == 0;
+}
 
-    /* Temporary fix, always returns true for now */
-    ret = 0; // TODO: Address the temporary fix.
+/**
+ * Checks if a FEN string has the given piece placement.
+ *
+ * @param fenStr A FEN string, or just its board positions field.
+ * @param positions The board positions to compare with (FEN.positions).
+ * @return true if the board positions are identical.
+ */
+bool fen_same_position(const char *fenStr, const char *positions)
+{
+    size_t length = strcspn(fenStr, " ");
 
-    /* Return true if the FEN string matches the pattern */
-    return (ret == 0);
+    return strlen(positions) == length && strncmp(fenStr, positions, length) == 0;
+}
+
+/**
+ * Deconstructs a FEN[] array into pointers to its elements.
+ *
+ * The returned pointers point into the array, which must outlive them.
+ * Null elements are rejected.
+ *
+ * @param array The FEN array.
+ * @param nFens Set to the number of elements.
+ * @return A palloc'd array of pointers to the FEN elements.
+ */
+FEN **fen_array_elements(ArrayType *array, int *nFens)
+{
+    Datum *elems;
+    bool *nulls;
+    int16 typlen;
+    bool typbyval;
+    char typalign;
+    FEN **result;
+
+    get_typlenbyvalalign(ARR_ELEMTYPE(array), &typlen, &typbyval, &typalign);
+    deconstruct_array(array, ARR_ELEMTYPE(array), typlen, typbyval, typalign, &elems, &nulls, nFens);
+
+    result = (FEN **) palloc(Max(*nFens, 1) * sizeof(FEN *));
+
+    for (int i = 0; i < *nFens; i++) {
+        if (nulls[i])
+            ereport(ERROR,
+                    (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                     errmsg("FEN array must not contain nulls")));
+
+        result[i] = (FEN *) DatumGetPointer(elems[i]);
+    }
+
+    pfree(elems);
+    pfree(nulls);
+
+    return result;
 }
 
 //--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
@@ -0,0 +1,122 @@
+/*
+ * FENWINDOW.h
+ *      Implementation of the FEN window type used by ply-bounded position searches.
+ *
+ * A window pairs a board state with a range of half-moves, and is the right-hand
+ * side of the 'SAN @> FENWINDOW' operator: the game must reach the board positions
+ * at a half-move within the range. It's part of a PostgreSQL extension for storing
+ * and querying chess games.
+ *
+ */
+
+#include "DataTypes/FEN/FEN.h"
+
+#ifndef FENWINDOW_H
+#define FENWINDOW_H
+
+// Storage size of a window, as declared by the SQL type (internallength).
+#define FENWINDOW_LENGTH 96
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+/**
+ * Structure representing a board state searched within a range of half-moves.
+ *
+ * @param board The board state; only its board positions are searched.
+ * @param min_ply The first half-move of the range (0 is the initial position).
+ * @param max_ply The last half-move of the range, inclusive.
+ */
+typedef struct
+{
+    FEN board;
+    int32 min_ply;
+    int32 max_ply;
+} FENWINDOW;
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+FENWINDOW *make_fen_window(const FEN *board, int32 minPly, int32 maxPly);
+FENWINDOW *parseStr_ToFENWINDOW(const char *str);
+char *parseFENWINDOW_ToStr(const FENWINDOW *window);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+/**
+ * Builds a window from a board state and a range of half-moves.
+ *
+ * @param board The board state to search.
+ * @param minPly The first half-move of the range.
+ * @param maxPly The last half-move of the range, inclusive.
+ * @return A palloc'd window.
+ */
+FENWINDOW *make_fen_window(const FEN *board, int32 minPly, int32 maxPly)
+{
+    FENWINDOW *window;
+
+    if (minPly < 0 || maxPly < minPly)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("invalid half-move range [%d,%d]", minPly, maxPly)));
+
+    window = (FENWINDOW *) palloc0(FENWINDOW_LENGTH);
+    memcpy(&window->board, board, sizeof(FEN));
+    window->min_ply = minPly;
+    window->max_ply = maxPly;
+
+    return window;
+}
+
+/**
+ * Parses a window from its text representation.
+ *
+ * The expected format is a FEN string followed by the range of half-moves,
+ * e.g. 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1 [0,10]'.
+ *
+ * @param str The string to parse.
+ * @return A palloc'd window.
+ */
+FENWINDOW *parseStr_ToFENWINDOW(const char *str)
+{
+    const char *range = strrchr(str, '[');
+    char *fenStr;
+    int32 minPly, maxPly;
+    char end;
+    FEN board;
+
+    if (range == NULL || sscanf(range, "[%d,%d%c", &minPly, &maxPly, &end) != 3 || end != ']')
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                 errmsg("invalid FENWINDOW representation: %s", str),
+                 errhint("Expected a FEN string followed by a half-move range such as [0,10].")));
+
+    fenStr = pnstrdup(str, range - str);
+    parseStr_ToFEN(fenStr, &board);
+    pfree(fenStr);
+
+    return make_fen_window(&board, minPly, maxPly);
+}
+
+/**
+ * Formats a window as a string.
+ *
+ * @param window The window to format.
+ * @return A palloc'd string in the format accepted by parseStr_ToFENWINDOW.
+ */
+char *parseFENWINDOW_ToStr(const FENWINDOW *window)
+{
+    return psprintf("%s [%d,%d]", parseFEN_ToStr(&window->board), window->min_ply, window->max_ply);
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //FENWINDOW_H
@@ -0,0 +1,306 @@
+/*
+ * MOVESEQ.h
+ *      Implementation of the move sequences used by the similarity GiST index on SAN.
+ *
+ * The distance between two games ('<->') is the edit distance between their
+ * mainline move sequences, plus a tie-breaker in [0, 1) favouring games sharing a
+ * longer opening: 1 - shared prefix / longest game. Leaf entries hold the hashed
+ * moves of one game (its first MOVESEQ_MAX_MOVES moves for longer games), inner
+ * entries the moves shared by all the games below them and the range of their
+ * lengths, from which the distance is bounded for KNN searches. It's part of a
+ * PostgreSQL extension for storing and querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "Utils/move_ngrams.h"
+
+#ifndef MOVESEQ_H
+#define MOVESEQ_H
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+// Maximum number of moves stored in an index entry.
+#define MOVESEQ_MAX_MOVES 96
+
+// Flag marking the entry of one game, and an entry holding only its first moves.
+#define MOVESEQ_LEAF 0x01
+#define MOVESEQ_TRUNCATED 0x02
+
+/**
+ * Structure representing the move sequence of one or several chess games.
+ *
+ * @param vl_len_ Varlena header (do not touch directly).
+ * @param flags Entry flags (MOVESEQ_LEAF, MOVESEQ_TRUNCATED).
+ * @param nMoves The number of stored moves: the moves of the game (leaf) or the
+ *        moves shared by all the games (inner).
+ * @param minMoves, maxMoves The range of the number of moves of the games.
+ * @param moves The hashes of the stored moves.
+ */
+typedef struct
+{
+    int32 vl_len_;
+    uint16 flags;
+    uint16 nMoves;
+    int32 minMoves;
+    int32 maxMoves;
+    uint32 moves[FLEXIBLE_ARRAY_MEMBER];
+} MOVESEQ;
+
+#define MOVESEQ_HDRSZ offsetof(MOVESEQ, moves)
+#define MOVESEQ_ISEXACT(x) (((x)->flags & (MOVESEQ_LEAF | MOVESEQ_TRUNCATED)) == MOVESEQ_LEAF)
+#define DatumGetMOVESEQ(x) ((MOVESEQ *) PG_DETOAST_DATUM(x))
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+uint32 *moveseq_game_moves(const char *game, int *nMoves);
+MOVESEQ *moveseq_from_moves(const uint32 *moves, int nMoves);
+MOVESEQ *moveseq_union(MOVESEQ **keys, int nKeys);
+int moveseq_common_prefix(const uint32 *a, int na, const uint32 *b, int nb);
+int moveseq_edit_distance(const uint32 *a, int na, const uint32 *b, int nb);
+float8 moveseq_distance(const uint32 *a, int na, const uint32 *b, int nb);
+float8 moveseq_lower_bound(const MOVESEQ *key, const uint32 *query, int nQuery);
+int moveseq_cmp(const MOVESEQ *a, const MOVESEQ *b);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+/**
+ * Hashes the mainline moves of a game.
+ *
+ * @param game The null-terminated game.
+ * @param nMoves Set to the number of moves.
+ * @return A palloc'd array of move hashes.
+ */
+uint32 *moveseq_game_moves(const char *game, int *nMoves)
+{
+    MoveToken *tokens;
+    uint32 *moves;
+
+    *nMoves = move_mainline_tokens(game, &tokens);
+    moves = (uint32 *) palloc((*nMoves + 1) * sizeof(uint32));
+
+    for (int i = 0; i < *nMoves; i++)
+        moves[i] = move_token_hash(&tokens[i]);
+
+    pfree(tokens);
+
+    return moves;
+}
+
+/**
+ * Builds the leaf entry of a game.
+ *
+ * @param moves The move hashes of the game.
+ * @param nMoves The number of moves.
+ * @return A palloc'd leaf entry.
+ */
+MOVESEQ *moveseq_from_moves(const uint32 *moves, int nMoves)
+{
+    int stored = Min(nMoves, MOVESEQ_MAX_MOVES);
+    Size size = MOVESEQ_HDRSZ + stored * sizeof(uint32);
+    MOVESEQ *key = (MOVESEQ *) palloc(size);
+
+    SET_VARSIZE(key, size);
+    key->flags = MOVESEQ_LEAF | (stored < nMoves ? MOVESEQ_TRUNCATED : 0);
+    key->nMoves = (uint16) stored;
+    key->minMoves = nMoves;
+    key->maxMoves = nMoves;
+    memcpy(key->moves, moves, stored * sizeof(uint32));
+
+    return key;
+}
+
+/**
+ * Returns the number of moves two sequences start with in common.
+ */
+int moveseq_common_prefix(const uint32 *a, int na, const uint32 *b, int nb)
+{
+    int n = 0;
+
+    while (n < na && n < nb && a[n] == b[n])
+        n++;
+
+    return n;
+}
+
+/**
+ * Builds the inner entry covering a set of entries.
+ *
+ * @param keys The entries.
+ * @param nKeys The number of entries (at least one).
+ * @return A palloc'd inner entry holding their shared moves and length range.
+ */
+MOVESEQ *moveseq_union(MOVESEQ **keys, int nKeys)
+{
+    int nMoves = keys[0]->nMoves;
+    int32 minMoves = keys[0]->minMoves, maxMoves = keys[0]->maxMoves;
+    MOVESEQ *result;
+    Size size;
+
+    for (int i = 1; i < nKeys; i++) {
+        nMoves = moveseq_common_prefix(keys[0]->moves, nMoves, keys[i]->moves, keys[i]->nMoves);
+        minMoves = Min(minMoves, keys[i]->minMoves);
+        maxMoves = Max(maxMoves, keys[i]->maxMoves);
+    }
+
+    size = MOVESEQ_HDRSZ + nMoves * sizeof(uint32);
+    result = (MOVESEQ *) palloc(size);
+    SET_VARSIZE(result, size);
+    result->flags = 0;
+    result->nMoves = (uint16) nMoves;
+    result->minMoves = minMoves;
+    result->maxMoves = maxMoves;
+    memcpy(result->moves, keys[0]->moves, nMoves * sizeof(uint32));
+
+    return result;
+}
+
+/**
+ * Computes the edit distance between two move sequences.
+ *
+ * Each inserted, deleted or substituted move costs 1.
+ *
+ * @return The number of edits turning one sequence into the other.
+ */
+int moveseq_edit_distance(const uint32 *a, int na, const uint32 *b, int nb)
+{
+    int *previous = (int *) palloc((nb + 1) * sizeof(int));
+    int *current = (int *) palloc((nb + 1) * sizeof(int));
+    int result;
+
+    for (int j = 0; j <= nb; j++)
+        previous[j] = j;
+
+    for (int i = 1; i <= na; i++) {
+        int *swap;
+
+        current[0] = i;
+
+        for (int j = 1; j <= nb; j++) {
+            int cost = previous[j - 1] + (a[i - 1] == b[j - 1] ? 0 : 1);
+
+            cost = Min(cost, previous[j] + 1);
+            current[j] = Min(cost, current[j - 1] + 1);
+        }
+
+        swap = previous;
+        previous = current;
+        current = swap;
+    }
+
+    result = previous[nb];
+
+    pfree(previous);
+    pfree(current);
+
+    return result;
+}
+
+/**
+ * Computes the distance between two games.
+ *
+ * @return The edit distance between the move sequences, plus 1 - shared prefix /
+ *         longest game (0 for identical games).
+ */
+float8 moveseq_distance(const uint32 *a, int na, const uint32 *b, int nb)
+{
+    int edits = moveseq_edit_distance(a, na, b, nb);
+
+    if (edits == 0)
+        return 0.0;
+
+    return edits + 1.0 - (float8) moveseq_common_prefix(a, na, b, nb) / Max(na, nb);
+}
+
+/**
+ * Computes a lower bound of the distance between a game and the games of an entry.
+ *
+ * Every game of the entry starts with its stored moves P and has between minMoves
+ * and maxMoves moves, so its edit distance to the query q is at least the length
+ * difference and at least the smallest edit distance between P and a prefix of q.
+ * The distance of an exact leaf entry is computed directly.
+ *
+ * @param key The entry.
+ * @param query The move hashes of the query game.
+ * @param nQuery The number of moves of the query game.
+ * @return A lower bound of the distance.
+ */
+float8 moveseq_lower_bound(const MOVESEQ *key, const uint32 *query, int nQuery)
+{
+    int lengthBound = 0, prefixBound;
+    int *previous, *current;
+
+    if (MOVESEQ_ISEXACT(key))
+        return moveseq_distance(key->moves, key->nMoves, query, nQuery);
+
+    if (nQuery < key->minMoves)
+        lengthBound = key->minMoves - nQuery;
+    else if (nQuery > key->maxMoves)
+        lengthBound = nQuery - key->maxMoves;
+
+    // Edit distances between the stored moves and every prefix of the query.
+    previous = (int *) palloc((nQuery + 1) * sizeof(int));
+    current = (int *) palloc((nQuery + 1) * sizeof(int));
+
+    for (int j = 0; j <= nQuery; j++)
+        previous[j] = j;
+
+    for (int i = 1; i <= key->nMoves; i++) {
+        int *swap;
+
+        current[0] = i;
+
+        for (int j = 1; j <= nQuery; j++) {
+            int cost = previous[j - 1] + (key->moves[i - 1] == query[j - 1] ? 0 : 1);
+
+            cost = Min(cost, previous[j] + 1);
+            current[j] = Min(cost, current[j - 1] + 1);
+        }
+
+        swap = previous;
+        previous = current;
+        current = swap;
+    }
+
+    prefixBound = previous[0];
+
+    for (int j = 1; j <= nQuery; j++)
+        prefixBound = Min(prefixBound, previous[j]);
+
+    pfree(previous);
+    pfree(current);
+
+    return (float8) Max(lengthBound, prefixBound);
+}
+
+/**
+ * Orders entries by their stored moves, then by length.
+ */
+int moveseq_cmp(const MOVESEQ *a, const MOVESEQ *b)
+{
+    int n = Min(a->nMoves, b->nMoves);
+
+    for (int i = 0; i < n; i++) {
+        if (a->moves[i] != b->moves[i])
+            return a->moves[i] < b->moves[i] ? -1 : 1;
+    }
+
+    if (a->nMoves != b->nMoves)
+        return a->nMoves < b->nMoves ? -1 : 1;
+
+    return (a->minMoves > b->minMoves) - (a->minMoves < b->minMoves);
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //MOVESEQ_H
@@ -0,0 +1,500 @@
+/*
+ * PGN.h
+ *      Implementation of the PGN type: a game with its parsed header tags.
+ *
+ * A PGN value holds the tag pairs of a game ('[WhiteElo "2750"]') in a compact
+ * dictionary, next to its moves in the stored form of the SAN type. The result and
+ * the number of half-moves are kept in a fixed header, so pgn_result and ply_count
+ * only read the first bytes of the value, and pgn_tag binary-searches the tag names.
+ * PGN values are implicitly cast to SAN by copying their moves, so every SAN
+ * function and operator accepts them. It's part of a PostgreSQL extension for
+ * storing and querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "DataTypes/SAN/SAN.h"
+#include "DataTypes/SAN/SANPACKED.h"
+#include "Utils/chess_stats.h"
+
+#ifndef PGN_H
+#define PGN_H
+
+// Results of a game, as stored in the header.
+#define PGN_RESULT_UNKNOWN 0
+#define PGN_RESULT_WHITE 1
+#define PGN_RESULT_BLACK 2
+#define PGN_RESULT_DRAW 3
+
+// Flag marking a game whose movetext ended with its result.
+#define PGN_FLAG_RESULT_TOKEN 0x01
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+/**
+ * Structure representing the fixed header of a PGN value.
+ *
+ * The varlena data of a PGN value is this header, followed by the index of the tags
+ * sorted by name (uint16 each), the offset of each tag in the tag area (uint32 each,
+ * in input order), the tag area ('name\0value\0' per tag) and the moves, in the
+ * stored SAN form (flags byte and text). The data is not aligned and is read with
+ * memcpy, so values may keep a short varlena header.
+ *
+ * @param result The result of the game (PGN_RESULT_*).
+ * @param flags PGN_FLAG_RESULT_TOKEN.
+ * @param nTags The number of tag pairs.
+ * @param plyCount The number of half-moves of the game.
+ * @param tagsLength The length of the tag area.
+ * @param movesLength The length of the stored moves.
+ */
+typedef struct
+{
+    uint8 result;
+    uint8 flags;
+    uint16 nTags;
+    int32 plyCount;
+    uint32 tagsLength;
+    uint32 movesLength;
+} PGNHeader;
+
+/**
+ * Structure representing a tag pair while parsing a game.
+ */
+typedef struct
+{
+    char *name;
+    char *value;
+} PGNTag;
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+struct varlena *pgn_parse(const char *str, FunctionCallInfo fcinfo);
+char *pgn_to_cstring(struct varlena *pgn, FunctionCallInfo fcinfo);
+PGNHeader pgn_get_header(struct varlena *pgn);
+char *pgn_get_tag(struct varlena *pgn, const char *name);
+const char *pgn_result_str(uint8 result);
+SANPacked *pgn_get_moves(struct varlena *pgn);
+struct varlena *pgn_from_moves(const SAN *game, FunctionCallInfo fcinfo);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+// Retrieves a PGN argument, detoasted (possibly with a short header).
+#define PG_GETARG_PGN_P(n) chess_stats_detoast_packed(PG_GETARG_DATUM(n))
+
+// Retrieves the fixed header of a PGN argument, detoasting only its first bytes.
+#define PG_GETARG_PGN_HEADER(n) pgn_get_header(PG_DETOAST_DATUM_SLICE(PG_GETARG_DATUM(n), 0, sizeof(PGNHeader)))
+
+// Offsets of the parts of a PGN value, from the start of its data.
+#define PGN_SORTED_OFFSET sizeof(PGNHeader)
+#define PGN_OFFSETS_OFFSET(h) (PGN_SORTED_OFFSET + (h)->nTags * sizeof(uint16))
+#define PGN_TAGS_OFFSET(h) (PGN_OFFSETS_OFFSET(h) + (h)->nTags * sizeof(uint32))
+#define PGN_MOVES_OFFSET(h) (PGN_TAGS_OFFSET(h) + (h)->tagsLength)
+
+/**
+ * Reports an invalid PGN input.
+ */
+static void pgn_parse_error(const char *str, const char *detail) pg_attribute_noreturn();
+
+static void pgn_parse_error(const char *str, const char *detail)
+{
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+             errmsg("invalid PGN representation: \"%.64s%s\"", str, strlen(str) > 64 ? "..." : ""),
+             errdetail("%s", detail)));
+}
+
+/**
+ * Returns the result stored for a result token, or -1 if it is not one.
+ */
+static int pgn_result_of(const char *token, int len)
+{
+    if (len == 3 && strncmp(token, "1-0", 3) == 0)
+        return PGN_RESULT_WHITE;
+
+    if (len == 3 && strncmp(token, "0-1", 3) == 0)
+        return PGN_RESULT_BLACK;
+
+    if (len == 7 && strncmp(token, "1/2-1/2", 7) == 0)
+        return PGN_RESULT_DRAW;
+
+    if (len == 1 && token[0] == '*')
+        return PGN_RESULT_UNKNOWN;
+
+    return -1;
+}
+
+/**
+ * Returns the result token of a stored result.
+ */
+const char *pgn_result_str(uint8 result)
+{
+    switch (result) {
+        case PGN_RESULT_WHITE:
+            return "1-0";
+        case PGN_RESULT_BLACK:
+            return "0-1";
+        case PGN_RESULT_DRAW:
+            return "1/2-1/2";
+        default:
+            return "*";
+    }
+}
+
+/**
+ * Reads the fixed header of a PGN value.
+ */
+PGNHeader pgn_get_header(struct varlena *pgn)
+{
+    PGNHeader header;
+
+    memcpy(&header, VARDATA_ANY(pgn), sizeof(PGNHeader));
+
+    return header;
+}
+
+/**
+ * Builds a PGN value from its tags and moves.
+ *
+ * @param tags The tag pairs, in input order.
+ * @param nTags The number of tag pairs.
+ * @param game The moves of the game.
+ * @param result The result of the game.
+ * @param flags The PGN flags.
+ * @param fcinfo Function call info of the calling function (to store the moves).
+ * @return A palloc'd PGN value.
+ */
+static struct varlena *pgn_build(PGNTag *tags, int nTags, const SAN *game, int result, uint8 flags,
+                                 FunctionCallInfo fcinfo)
+{
+    SANPacked *moves = san_pack(game, fcinfo);
+    PGNHeader header;
+    uint16 *sorted = (uint16 *) palloc((nTags + 1) * sizeof(uint16));
+    uint32 *offsets = (uint32 *) palloc((nTags + 1) * sizeof(uint32));
+    struct varlena *pgn;
+    Size size;
+    char *p;
+
+    header.result = (uint8) result;
+    header.flags = flags;
+    header.nTags = (uint16) nTags;
+    header.plyCount = count_half_moves(game->data);
+    header.tagsLength = 0;
+    header.movesLength = VARSIZE(moves) - VARHDRSZ;
+
+    for (int i = 0; i < nTags; i++) {
+        offsets[i] = header.tagsLength;
+        header.tagsLength += strlen(tags[i].name) + strlen(tags[i].value) + 2;
+    }
+
+    // Insertion sort of the tag names; games have a handful of tags.
+    for (int i = 0; i < nTags; i++) {
+        int j = i;
+
+        while (j > 0 && strcmp(tags[sorted[j - 1]].name, tags[i].name) > 0) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+
+        sorted[j] = (uint16) i;
+    }
+
+    size = VARHDRSZ + PGN_MOVES_OFFSET(&header) + header.movesLength;
+    pgn = (struct varlena *) palloc(size);
+    SET_VARSIZE(pgn, size);
+
+    p = VARDATA(pgn);
+    memcpy(p, &header, sizeof(PGNHeader));
+    memcpy(p + PGN_SORTED_OFFSET, sorted, nTags * sizeof(uint16));
+    memcpy(p + PGN_OFFSETS_OFFSET(&header), offsets, nTags * sizeof(uint32));
+
+    p += PGN_TAGS_OFFSET(&header);
+
+    for (int i = 0; i < nTags; i++) {
+        int nameLen = strlen(tags[i].name) + 1;
+        int valueLen = strlen(tags[i].value) + 1;
+
+        memcpy(p, tags[i].name, nameLen);
+        memcpy(p + nameLen, tags[i].value, valueLen);
+        p += nameLen + valueLen;
+    }
+
+    memcpy(p, VARDATA(moves), header.movesLength);
+
+    pfree(sorted);
+    pfree(offsets);
+    pfree(moves);
+
+    return pgn;
+}
+
+/**
+ * Parses a game in PGN format.
+ *
+ * The tag pairs come first ('[Name "value"]', with '\"' and '\\' escapes in the
+ * value), then the movetext. Runs of whitespace of the movetext (line breaks
+ * included) are stored as a single space. A result token ending the movetext
+ * gives the result of the game; otherwise the 'Result' tag does.
+ *
+ * @param str The PGN text.
+ * @param fcinfo Function call info of the calling function (to store the moves).
+ * @return A palloc'd PGN value.
+ */
+struct varlena *pgn_parse(const char *str, FunctionCallInfo fcinfo)
+{
+    const char *p = str;
+    PGNTag *tags = NULL;
+    int nTags = 0, maxTags = 0;
+    int result = PGN_RESULT_UNKNOWN, tokenResult;
+    uint8 flags = 0;
+    StringInfoData moves;
+    char *last, *token;
+    SAN *game;
+    struct varlena *pgn;
+
+    while (isspace((unsigned char) *p))
+        p++;
+
+    // Tag pairs.
+    while (*p == '[') {
+        StringInfoData value;
+        const char *name;
+        int nameLen;
+
+        p++;
+
+        while (*p == ' ' || *p == '\t')
+            p++;
+
+        name = p;
+
+        while (isalnum((unsigned char) *p) || *p == '_')
+            p++;
+
+        nameLen = p - name;
+
+        if (nameLen == 0)
+            pgn_parse_error(str, "Tag name expected after \"[\".");
+
+        while (*p == ' ' || *p == '\t')
+            p++;
+
+        if (*p != '"')
+            pgn_parse_error(str, "Tag value expected after the tag name.");
+
+        initStringInfo(&value);
+
+        for (p++; *p != '"'; p++) {
+            if (*p == '\0' || *p == '\n')
+                pgn_parse_error(str, "Unterminated tag value.");
+
+            if (*p == '\\' && (p[1] == '"' || p[1] == '\\'))
+                p++;
+
+            appendStringInfoChar(&value, *p);
+        }
+
+        p++;
+
+        while (*p == ' ' || *p == '\t')
+            p++;
+
+        if (*p != ']')
+            pgn_parse_error(str, "Tag pair not closed by \"]\".");
+
+        p++;
+
+        for (int i = 0; i < nTags; i++) {
+            if (strlen(tags[i].name) == (size_t) nameLen && strncmp(tags[i].name, name, nameLen) == 0)
+                pgn_parse_error(str, psprintf("Duplicate tag \"%s\".", tags[i].name));
+        }
+
+        if (nTags == PG_UINT16_MAX)
+            pgn_parse_error(str, "Too many tags.");
+
+        if (nTags == maxTags) {
+            maxTags = maxTags == 0 ? 16 : maxTags * 2;
+            tags = tags == NULL ? (PGNTag *) palloc(maxTags * sizeof(PGNTag))
+                                : (PGNTag *) repalloc(tags, maxTags * sizeof(PGNTag));
+        }
+
+        tags[nTags].name = pnstrdup(name, nameLen);
+        tags[nTags].value = value.data;
+
+        if (strcmp(tags[nTags].name, "Result") == 0 && pgn_result_of(value.data, value.len) >= 0)
+            result = pgn_result_of(value.data, value.len);
+
+        nTags++;
+
+        while (isspace((unsigned char) *p))
+            p++;
+    }
+
+    // Movetext, with its whitespace normalized.
+    initStringInfo(&moves);
+
+    for (; *p != '\0'; p++) {
+        if (!isspace((unsigned char) *p))
+            appendStringInfoChar(&moves, *p);
+        else if (moves.len > 0 && moves.data[moves.len - 1] != ' ')
+            appendStringInfoChar(&moves, ' ');
+    }
+
+    if (moves.len > 0 && moves.data[moves.len - 1] == ' ')
+        moves.data[--moves.len] = '\0';
+
+    // A trailing result token is kept out of the moves.
+    last = strrchr(moves.data, ' ');
+    token = last != NULL ? last + 1 : moves.data;
+    tokenResult = pgn_result_of(token, strlen(token));
+
+    if (tokenResult >= 0) {
+        result = tokenResult;
+        flags |= PGN_FLAG_RESULT_TOKEN;
+        moves.len = last != NULL ? last - moves.data : 0;
+        moves.data[moves.len] = '\0';
+    }
+
+    if (moves.len >= MAX_PGN_LENGTH)
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg("PGN movetext exceeds the maximum length of %d bytes", MAX_PGN_LENGTH - 1)));
+
+    game = (SAN *) palloc(sizeof(SAN));
+    parseStr_ToPGN(moves.data, game);
+
+    pgn = pgn_build(tags, nTags, game, result, flags, fcinfo);
+
+    pfree(game);
+    pfree(moves.data);
+
+    return pgn;
+}
+
+/**
+ * Builds a PGN value without tags from a SAN game.
+ *
+ * @param game The game.
+ * @param fcinfo Function call info of the calling function (to store the moves).
+ * @return A palloc'd PGN value.
+ */
+struct varlena *pgn_from_moves(const SAN *game, FunctionCallInfo fcinfo)
+{
+    return pgn_build(NULL, 0, game, PGN_RESULT_UNKNOWN, 0, fcinfo);
+}
+
+/**
+ * Returns the moves of a PGN value as a stored SAN value.
+ *
+ * @param pgn The PGN value.
+ * @return A palloc'd stored SAN value.
+ */
+SANPacked *pgn_get_moves(struct varlena *pgn)
+{
+    PGNHeader header = pgn_get_header(pgn);
+    SANPacked *moves = (SANPacked *) palloc(VARHDRSZ + header.movesLength);
+
+    SET_VARSIZE(moves, VARHDRSZ + header.movesLength);
+    memcpy(VARDATA(moves), VARDATA_ANY(pgn) + PGN_MOVES_OFFSET(&header), header.movesLength);
+
+    return moves;
+}
+
+/**
+ * Finds the value of a tag.
+ *
+ * @param pgn The PGN value.
+ * @param name The tag name (case-sensitive).
+ * @return A palloc'd copy of the value, or NULL if the game has no such tag.
+ */
+char *pgn_get_tag(struct varlena *pgn, const char *name)
+{
+    PGNHeader header = pgn_get_header(pgn);
+    const char *data = VARDATA_ANY(pgn);
+    const char *tagArea = data + PGN_TAGS_OFFSET(&header);
+    int low = 0, high = header.nTags;
+
+    while (low < high) {
+        int middle = (low + high) / 2;
+        uint16 index;
+        uint32 offset;
+        int cmp;
+
+        memcpy(&index, data + PGN_SORTED_OFFSET + middle * sizeof(uint16), sizeof(uint16));
+        memcpy(&offset, data + PGN_OFFSETS_OFFSET(&header) + index * sizeof(uint32), sizeof(uint32));
+
+        cmp = strcmp(tagArea + offset, name);
+
+        if (cmp == 0)
+            return pstrdup(tagArea + offset + strlen(tagArea + offset) + 1);
+
+        if (cmp < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return NULL;
+}
+
+/**
+ * Formats a PGN value: its tag pairs in input order, then its movetext.
+ *
+ * @param pgn The PGN value.
+ * @param fcinfo Function call info of the calling function (to decode the moves).
+ * @return A palloc'd PGN text.
+ */
+char *pgn_to_cstring(struct varlena *pgn, FunctionCallInfo fcinfo)
+{
+    PGNHeader header = pgn_get_header(pgn);
+    const char *tag = VARDATA_ANY(pgn) + PGN_TAGS_OFFSET(&header);
+    SANPacked *moves = pgn_get_moves(pgn);
+    SAN *game = san_unpack(PointerGetDatum(moves), fcinfo);
+    StringInfoData result;
+
+    initStringInfo(&result);
+
+    for (int i = 0; i < header.nTags; i++) {
+        const char *value = tag + strlen(tag) + 1;
+
+        appendStringInfo(&result, "[%s \"", tag);
+
+        for (const char *v = value; *v != '\0'; v++) {
+            if (*v == '"' || *v == '\\')
+                appendStringInfoChar(&result, '\\');
+
+            appendStringInfoChar(&result, *v);
+        }
+
+        appendStringInfoString(&result, "\"]\n");
+        tag = value + strlen(value) + 1;
+    }
+
+    if (header.nTags > 0)
+        appendStringInfoChar(&result, '\n');
+
+    appendStringInfoString(&result, game->data);
+
+    if (header.flags & PGN_FLAG_RESULT_TOKEN)
+        appendStringInfo(&result, "%s%s", game->data[0] != '\0' ? " " : "", pgn_result_str(header.result));
+
+    pfree(moves);
+    pfree(game);
+
+    return result.data;
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //PGN_H
@@ -19,6 +19,9 @@
 // Define the maximum length for a PGN (Portable Game Notation) string.
 #define MAX_PGN_LENGTH 1000
 
+// Version byte leading the binary form of a SAN value (san_send/san_recv), followed by the game text.
+#define SAN_BINARY_VERSION 1
+
 /**
  * Structure to represent a Standard Algebraic Notation (SAN) of a chess game.
  *
@@ -39,6 +42,7 @@ char* skipCommentsAndAnnotations(char* str);
 void parsePGN_ToStr(SAN *game, char **result);
 void parseStr_ToPGN(const char *pgn, SAN *game);
 SAN *truncate_san(SAN *inputGame, int nHalfMoves);
+int count_half_moves(const char *str);
 
 //-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
 
@@ -79,7 +83,8 @@ void parsePGN_ToStr(SAN *game, char **result){
  *
  * This function processes a string containing a chess game and skips
  * over comments and annotations, which are typically enclosed in
- * curly braces {} or parentheses ().
+ * curly braces {} or parentheses (). Parentheses may be nested, as
+ * in variations of variations.
  *
  * @param str A pointer to the string to be processed.
  * @return A pointer to the string, positioned after any comments or annotations.
@@ -92,8 +97,15 @@ char *skipCommentsAndAnnotations(char *str) {
             while (*p && *p != '}') p++; // Skip until the end of the comment block.
             if (*p) p++; // Move past the closing brace.
         } else if (*p == '(') { // Start of an annotation block.
-            while (*p && *p != ')') p++; // Skip until the end of the annotation block.
-            if (*p) p++; // Move past the closing parenthesis.
+            int depth = 0; // Variations may hold variations of their own.
+            do {
+                if (*p == '{') { // Comments inside the block may hold parentheses.
+                    while (*p && *p != '}') p++;
+                    if (!*p) break;
+                } else if (*p == '(') depth++;
+                else if (*p == ')') depth--;
+                p++;
+            } while (*p && depth > 0); // Skip until the end of the outermost annotation block.
         } else if (!isspace((unsigned char)*p)) { // Non-space character marks the end of comments/annotations.
             break;
         } else {
@@ -153,6 +165,41 @@ SAN *truncate_san(SAN *inputGame , int nHalfMoves) {
     return resultGame; // Return the truncated SAN structure.
 }
 
+/**
+ * Counts the half-moves of a SAN string.
+ *
+ * Tokens are read the same way truncate_san reads them: move numbers (tokens
+ * containing a '.') are not counted, and comments and annotations are skipped.
+ * The input string is not modified.
+ *
+ * @param str The SAN string.
+ * @return The number of half-moves in the string.
+ */
+int count_half_moves(const char *str) {
+    const char *p = str; // Pointer to traverse the string.
+    int halfMoveCount = 0; // Counter for the number of half-moves.
+    bool isMoveNumber; // Flag to check if the token is a move number.
+
+    while (*p) {
+        while (*p == ' ') p++; // Skip the separators before the token.
+        if (!*p) break;
+
+        isMoveNumber = false;
+        while (*p && *p != ' ') { // Walk to the end of the token.
+            if (*p == '.') isMoveNumber = true;
+            p++;
+        }
+
+        // Increment the half-move count if the token is not a move number.
+        if (!isMoveNumber)
+            halfMoveCount++;
+
+        p = skipCommentsAndAnnotations((char *) p); // Skip any comments and annotations.
+    }
+
+    return halfMoveCount;
+}
+
 //--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
 
 #endif
\ No newline at end of file
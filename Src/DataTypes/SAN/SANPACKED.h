@@ -0,0 +1,656 @@
+/*
+ * SANPACKED.h
+ *      Implementation of the stored (packed) form of the SAN type.
+ *
+ * SAN values are stored as variable-length values holding the game text, optionally
+ * compressed with the opening dictionary: the longest opening line the game starts
+ * with is replaced by its dictionary id. Functions receive the decoded SAN structure
+ * through PG_GETARG_CHESSGAME_P and return SAN values through PG_RETURN_CHESSGAME_P,
+ * so the stored form is transparent to them. New values start with a header holding
+ * their number of half-moves and, when 'chess.san_checkpoint_interval' is set, the
+ * offset of each move and the position every few half-moves, from which any position
+ * is rebuilt with a short replay. Values built by san_append also carry the final
+ * position of the game, so live games are extended and read without a replay. It's
+ * part of a PostgreSQL extension for storing and querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "utils/guc.h"
+#include "DataTypes/SAN/SAN.h"
+#include "Utils/chess_stats.h"
+#include "Utils/opening_dict.h"
+#include "Utils/move_engine.h"
+#include "Utils/move_ngrams.h"
+
+#ifndef SANPACKED_H
+#define SANPACKED_H
+
+// Flag marking a game whose first moves are an opening dictionary line.
+#define SAN_FLAG_DICT 0x01
+// Flag marking a game followed by its final position (see san_pack_index).
+#define SAN_FLAG_BOARD 0x02
+// Flag marking a game preceded by its header (see SANHeader).
+#define SAN_FLAG_HEADER 0x04
+
+// Size of a stored position: the squares (4 bits each), the side to move and castling
+// rights, the en passant square and the halfmove clock (2 bytes, big-endian). The move
+// number follows from the number of half-moves played, games starting from the
+// initial position.
+#define SAN_BOARD_SIZE 36
+// Size of the final position of a game: the number of half-moves played (2 bytes,
+// big-endian), then the position.
+#define SAN_FINAL_BOARD_SIZE (SAN_BOARD_SIZE + 2)
+
+// Pieces of the stored squares, coded by their index + 1; 0 is an empty square.
+#define SAN_BOARD_PIECES "PNBRQKpnbrqk"
+
+// Largest 'chess.san_checkpoint_interval'.
+#define SAN_MAX_CHECKPOINT_INTERVAL 256
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+/**
+ * Structure representing a stored SAN value.
+ *
+ * The data holds, when SAN_FLAG_HEADER is set, the header of the game (see SANIndex),
+ * then, when SAN_FLAG_DICT is set, the (unaligned) int32 id of the opening line
+ * followed by the continuation of the game, or the whole game otherwise. The text is
+ * not null-terminated. When SAN_FLAG_BOARD is set, the last SAN_FINAL_BOARD_SIZE bytes
+ * are the position reached by playing all the moves of the game. Stored values may have a
+ * short varlena header, so the fields are read through VARDATA_ANY.
+ *
+ * @param vl_len_ Varlena header (do not touch directly).
+ * @param flags Storage flags (SAN_FLAG_DICT, SAN_FLAG_BOARD, SAN_FLAG_HEADER).
+ * @param data The header, the opening line id and the game text.
+ */
+typedef struct
+{
+    int32 vl_len_;
+    uint8 flags;
+    char data[FLEXIBLE_ARRAY_MEMBER];
+} SANPacked;
+
+#define SANPACKED_HDRSZ offsetof(SANPacked, data)
+
+/**
+ * Structure representing the fixed part of the header of a stored SAN value.
+ *
+ * It is followed by the offset of each move played (uint16 each) and by the position
+ * after every 'interval' half-moves (SAN_BOARD_SIZE bytes each). The header is not
+ * aligned and is read with memcpy.
+ *
+ * @param plyCount The number of half-moves of the game, as counted by count_half_moves.
+ * @param nMoves The number of moves with an offset: the moves played from the initial
+ *        position, or 0 without checkpoints.
+ * @param interval The number of half-moves between checkpoints, or 0 without checkpoints.
+ */
+typedef struct
+{
+    uint16 plyCount;
+    uint16 nMoves;
+    uint16 interval;
+} SANHeader;
+
+/**
+ * Structure representing the decoded header of a SAN value.
+ *
+ * Checkpoints are only built for games whose text truncate_san and the move engine
+ * read alike (see san_is_regular), so that they give the same positions as a replay.
+ *
+ * @param header The fixed part of the header.
+ * @param offsets The offset of each move played in the game text.
+ * @param checkpoints The positions after interval, 2 * interval, ... half-moves.
+ */
+typedef struct
+{
+    SANHeader header;
+    uint16 *offsets;
+    char *checkpoints;
+} SANIndex;
+
+#define SAN_INDEX_SIZE(h) \
+    (sizeof(SANHeader) + (h)->nMoves * sizeof(uint16) + \
+     ((h)->interval > 0 ? (h)->nMoves / (h)->interval : 0) * SAN_BOARD_SIZE)
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+void san_packed_init(void);
+void san_index_init(SANIndex *index, int interval);
+void san_index_add_move(SANIndex *index, int offset, const ChessBoard *board);
+void san_index_build(const char *text, SANIndex *index);
+bool san_index_board(const SANIndex *index, const char *text, int ply, ChessBoard *board);
+SANPacked *san_pack(const SAN *game, FunctionCallInfo fcinfo);
+SANPacked *san_pack_index(const SAN *game, const SANIndex *index, const ChessBoard *board, int plies,
+                          FunctionCallInfo fcinfo);
+SAN *san_unpack(Datum datum, FunctionCallInfo fcinfo);
+bool san_unpack_board(Datum datum, ChessBoard *board, int *plies);
+bool san_unpack_index(Datum datum, SANIndex *index);
+int san_ply_count(Datum datum, FunctionCallInfo fcinfo);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+// Retrieves a SAN argument, decoded, and returns a SAN value, encoded.
+#define PG_GETARG_CHESSGAME_P(n) san_unpack(PG_GETARG_DATUM(n), fcinfo)
+#define PG_RETURN_CHESSGAME_P(p) PG_RETURN_POINTER(san_pack(p, fcinfo))
+
+// Half-moves between the checkpoints of new SAN values, 0 for none ('chess.san_checkpoint_interval').
+static int chess_san_checkpoint_interval = 0;
+
+/**
+ * Returns the OID of the function being called, if known.
+ */
+static inline Oid chess_fn_oid(FunctionCallInfo fcinfo)
+{
+    return (fcinfo != NULL && fcinfo->flinfo != NULL) ? fcinfo->flinfo->fn_oid : InvalidOid;
+}
+
+/**
+ * Defines the stored SAN settings.
+ *
+ * Called once from _PG_init.
+ */
+void san_packed_init(void)
+{
+    DefineCustomIntVariable("chess.san_checkpoint_interval",
+                            "Half-moves between the positions stored in new SAN values.",
+                            "get_board_state replays at most this many half-moves from the nearest stored position. 0 stores none.",
+                            &chess_san_checkpoint_interval,
+                            0, 0, SAN_MAX_CHECKPOINT_INTERVAL,
+                            PGC_USERSET,
+                            0,
+                            NULL, NULL, NULL);
+}
+
+/**
+ * Writes a position in its stored form (see SAN_BOARD_SIZE).
+ */
+static void san_board_write(char *dest, const ChessBoard *board)
+{
+    uint8 *p = (uint8 *) dest;
+    int clock = Min(board->halfmoveClock, PG_UINT16_MAX);
+
+    for (int i = 0; i < 64; i += 2) {
+        const char *high = board->squares[i] ? strchr(SAN_BOARD_PIECES, board->squares[i]) : NULL;
+        const char *low = board->squares[i + 1] ? strchr(SAN_BOARD_PIECES, board->squares[i + 1]) : NULL;
+
+        p[i / 2] = (uint8) (((high ? high - SAN_BOARD_PIECES + 1 : 0) << 4) |
+                            (low ? low - SAN_BOARD_PIECES + 1 : 0));
+    }
+
+    p[32] = (uint8) ((board->whiteToMove ? 1 : 0) | (board->castling << 1));
+    p[33] = board->epSquare == BOARD_NO_SQUARE ? 0xFF : (uint8) board->epSquare;
+    p[34] = (uint8) ((clock >> 8) & 0xFF);
+    p[35] = (uint8) (clock & 0xFF);
+}
+
+/**
+ * Reads a position written by san_board_write.
+ *
+ * @param plies The number of half-moves played to reach the position.
+ */
+static void san_board_read(const char *src, int plies, ChessBoard *board)
+{
+    const uint8 *p = (const uint8 *) src;
+
+    for (int i = 0; i < 64; i++) {
+        int code = (i % 2 == 0) ? p[i / 2] >> 4 : p[i / 2] & 0x0F;
+
+        if (code > (int) sizeof(SAN_BOARD_PIECES) - 1)
+            ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                            errmsg("invalid stored position")));
+
+        board->squares[i] = code == 0 ? 0 : SAN_BOARD_PIECES[code - 1];
+    }
+
+    board->whiteToMove = (p[32] & 0x01) != 0;
+    board->castling = (p[32] >> 1) & 0x0F;
+    board->epSquare = p[33] == 0xFF ? BOARD_NO_SQUARE : p[33];
+    board->halfmoveClock = (p[34] << 8) | p[35];
+    board->fullmoveNumber = plies / 2 + 1;
+}
+
+/**
+ * Checks if a game text is read alike by truncate_san and by the move engine.
+ *
+ * The text must only hold move numbers ('12.' or '12...') and moves separated by
+ * spaces, optionally ended by a result: truncate_san then counts each move as a
+ * half-move and the move engine replays the same moves.
+ */
+static bool san_is_regular(const char *text)
+{
+    const char *p = text;
+
+    if (strpbrk(text, "{}();$\t\n\r") != NULL)
+        return false;
+
+    while (*p) {
+        const char *begin;
+        int len, digits = 0;
+
+        while (*p == ' ')
+            p++;
+
+        if (*p == '\0')
+            break;
+
+        begin = p;
+        p += strcspn(p, " ");
+        len = p - begin;
+
+        // A result may only end the game.
+        if (is_result_token(begin, len))
+            return p[strspn(p, " ")] == '\0';
+
+        if (memchr(begin, '.', len) == NULL)
+            continue;
+
+        while (digits < len && isdigit((unsigned char) begin[digits]))
+            digits++;
+
+        if (digits == 0 || digits == len || strspn(begin + digits, ".") < (size_t) (len - digits))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Initializes an empty header.
+ *
+ * With checkpoints, the arrays are sized for the longest games, so moves can be added
+ * to the header.
+ *
+ * @param index The header to initialize.
+ * @param interval The number of half-moves between checkpoints, or 0 for none.
+ */
+void san_index_init(SANIndex *index, int interval)
+{
+    index->header.plyCount = 0;
+    index->header.nMoves = 0;
+    index->header.interval = (uint16) interval;
+    index->offsets = NULL;
+    index->checkpoints = NULL;
+
+    if (interval > 0) {
+        index->offsets = (uint16 *) palloc(MAX_PGN_LENGTH * sizeof(uint16));
+        index->checkpoints = (char *) palloc((MAX_PGN_LENGTH / interval + 1) * SAN_BOARD_SIZE);
+    }
+}
+
+/**
+ * Adds a move played to a header with checkpoints.
+ *
+ * @param index The header to update.
+ * @param offset The offset of the move in the game text.
+ * @param board The position after the move.
+ */
+void san_index_add_move(SANIndex *index, int offset, const ChessBoard *board)
+{
+    SANHeader *header = &index->header;
+
+    if (header->nMoves >= MAX_PGN_LENGTH)
+        elog(ERROR, "san_index_add_move: too many moves in the header");
+
+    index->offsets[header->nMoves++] = (uint16) offset;
+
+    if (header->nMoves % header->interval == 0)
+        san_board_write(index->checkpoints + (header->nMoves / header->interval - 1) * SAN_BOARD_SIZE,
+                        board);
+}
+
+/**
+ * Builds the header of a game text.
+ *
+ * Checkpoints are built, with a replay of the game, when 'chess.san_checkpoint_interval'
+ * is set and the text is regular (see san_is_regular).
+ *
+ * @param text The game text.
+ * @param index Set to the header.
+ */
+void san_index_build(const char *text, SANIndex *index)
+{
+    ChessBoard board;
+    const char *p = text;
+
+    if (chess_san_checkpoint_interval == 0 || !san_is_regular(text)) {
+        san_index_init(index, 0);
+        index->header.plyCount = (uint16) count_half_moves(text);
+        return;
+    }
+
+    san_index_init(index, chess_san_checkpoint_interval);
+    index->header.plyCount = (uint16) count_half_moves(text);
+    board_init(&board);
+
+    while (*p) {
+        int len;
+
+        while (*p == ' ')
+            p++;
+
+        len = strcspn(p, " ");
+
+        // Skip the move numbers, stop at the result or at the first move that cannot be played.
+        if (len > 0 && memchr(p, '.', len) == NULL) {
+            if (!board_play_san(&board, p, len))
+                break;
+
+            san_index_add_move(index, p - text, &board);
+        }
+
+        p += len;
+    }
+
+    // Account for the replay in the extension statistics.
+    chess_stats_count(CHESS_STAT_REPLAYS, 1);
+    chess_stats_count(CHESS_STAT_PLIES_REPLAYED, index->header.nMoves);
+}
+
+/**
+ * Rebuilds the position of a game from its checkpoints.
+ *
+ * The position is the one get_board_state(game, ply) replays: at most 'interval'
+ * moves are played from the nearest checkpoint.
+ *
+ * @param index The header of the game, with checkpoints.
+ * @param text The game text.
+ * @param ply The number of half-moves, at most the number of half-moves of the game.
+ * @param board Set to the position after these half-moves, or after the last move
+ *        played if the game stops earlier.
+ * @return false if the header has no checkpoints.
+ */
+bool san_index_board(const SANIndex *index, const char *text, int ply, ChessBoard *board)
+{
+    const SANHeader *header = &index->header;
+    int target, played;
+
+    if (header->interval == 0)
+        return false;
+
+    target = Min(ply, header->nMoves);
+    played = target - target % header->interval;
+
+    if (played == 0)
+        board_init(board);
+    else
+        san_board_read(index->checkpoints + (played / header->interval - 1) * SAN_BOARD_SIZE, played, board);
+
+    chess_stats_count(CHESS_STAT_CACHE_HITS, 1);
+    chess_stats_count(CHESS_STAT_PLIES_REPLAYED, target - played);
+
+    for (; played < target; played++) {
+        const char *move = text + index->offsets[played];
+
+        board_play_san(board, move, strcspn(move, " "));
+    }
+
+    return true;
+}
+
+/**
+ * Encodes a SAN structure into its stored form.
+ *
+ * @param game The SAN structure to encode.
+ * @param fcinfo Function call info of the calling function.
+ * @return A palloc'd stored SAN value.
+ */
+SANPacked *san_pack(const SAN *game, FunctionCallInfo fcinfo)
+{
+    return san_pack_index(game, NULL, NULL, 0, fcinfo);
+}
+
+/**
+ * Encodes a SAN structure, its header and its final position into its stored form.
+ *
+ * When 'chess.san_compression' is on, the longest opening dictionary line the game
+ * starts with is stored as its id, provided it is longer than the id itself. The
+ * final position must be the one reached by playing all the moves of the game, which
+ * readers take without replaying them (see san_unpack_board).
+ *
+ * @param game The SAN structure to encode.
+ * @param index The header of the game, or NULL to build it (see san_index_build).
+ * @param board The final position of the game, or NULL to store the game without it.
+ * @param plies The number of half-moves played to reach the position.
+ * @param fcinfo Function call info of the calling function.
+ * @return A palloc'd stored SAN value.
+ */
+SANPacked *san_pack_index(const SAN *game, const SANIndex *index, const ChessBoard *board, int plies,
+                          FunctionCallInfo fcinfo)
+{
+    int len = strlen(game->data);
+    int boardSize = board != NULL ? SAN_FINAL_BOARD_SIZE : 0;
+    const OpeningDictEntry *entry = NULL;
+    SANIndex built;
+    SANPacked *result;
+    Size headerSize, size;
+    char *p;
+
+    if (index == NULL) {
+        san_index_build(game->data, &built);
+        index = &built;
+    }
+
+    headerSize = SAN_INDEX_SIZE(&index->header);
+
+    if (chess_san_compression)
+        entry = opening_dict_longest_prefix(game->data, len, chess_fn_oid(fcinfo));
+
+    if (entry != NULL && entry->len > (int) sizeof(int32))
+        size = SANPACKED_HDRSZ + headerSize + sizeof(int32) + (len - entry->len) + boardSize;
+    else
+        size = SANPACKED_HDRSZ + headerSize + len + boardSize;
+
+    result = (SANPacked *) palloc(size);
+    result->flags = SAN_FLAG_HEADER;
+    p = result->data;
+
+    memcpy(p, &index->header, sizeof(SANHeader));
+    p += sizeof(SANHeader);
+
+    if (index->header.interval > 0) {
+        int nCheckpoints = index->header.nMoves / index->header.interval;
+
+        memcpy(p, index->offsets, index->header.nMoves * sizeof(uint16));
+        p += index->header.nMoves * sizeof(uint16);
+        memcpy(p, index->checkpoints, nCheckpoints * SAN_BOARD_SIZE);
+        p += nCheckpoints * SAN_BOARD_SIZE;
+    }
+
+    if (entry != NULL && entry->len > (int) sizeof(int32)) {
+        result->flags |= SAN_FLAG_DICT;
+        memcpy(p, &entry->id, sizeof(int32));
+        memcpy(p + sizeof(int32), game->data + entry->len, len - entry->len);
+    } else {
+        memcpy(p, game->data, len);
+    }
+
+    if (board != NULL) {
+        uint8 *q = (uint8 *) result + size - SAN_FINAL_BOARD_SIZE;
+
+        result->flags |= SAN_FLAG_BOARD;
+        q[0] = (uint8) ((plies >> 8) & 0xFF);
+        q[1] = (uint8) (plies & 0xFF);
+        san_board_write((char *) q + 2, board);
+    }
+
+    SET_VARSIZE(result, size);
+
+    if (index == &built && built.offsets != NULL) {
+        pfree(built.offsets);
+        pfree(built.checkpoints);
+    }
+
+    return result;
+}
+
+/**
+ * Decodes a stored SAN value into a SAN structure.
+ *
+ * @param datum The stored SAN value, possibly toasted. A value already detoasted with
+ *        chess_stats_detoast_packed is read in place, so that functions reading its
+ *        text, header and final position detoast it once.
+ * @param fcinfo Function call info of the calling function.
+ * @return A palloc'd SAN structure.
+ */
+SAN *san_unpack(Datum datum, FunctionCallInfo fcinfo)
+{
+    struct varlena *packed = chess_stats_detoast_packed(datum);
+    const char *payload = VARDATA_ANY(packed);
+    int size = VARSIZE_ANY_EXHDR(packed) - 1;
+    uint8 flags = (uint8) payload[0];
+    SAN *game = (SAN *) palloc(sizeof(SAN));
+    int used = 0;
+
+    payload++;
+
+    if (flags & SAN_FLAG_HEADER) {
+        SANHeader header;
+
+        memcpy(&header, payload, sizeof(SANHeader));
+        payload += SAN_INDEX_SIZE(&header);
+        size -= SAN_INDEX_SIZE(&header);
+    }
+
+    if (flags & SAN_FLAG_BOARD)
+        size -= SAN_FINAL_BOARD_SIZE;
+
+    if (flags & SAN_FLAG_DICT) {
+        const OpeningDictEntry *entry;
+        int32 id;
+
+        memcpy(&id, payload, sizeof(int32));
+        payload += sizeof(int32);
+        size -= sizeof(int32);
+
+        entry = opening_dict_lookup_id(id, chess_fn_oid(fcinfo));
+        used = entry->len;
+
+        if (used >= MAX_PGN_LENGTH)
+            ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                            errmsg("opening dictionary entry %d is too long", id)));
+
+        memcpy(game->data, entry->prefix, used);
+    }
+
+    if (size < 0 || used + size >= MAX_PGN_LENGTH)
+        ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+                        errmsg("invalid stored SAN value")));
+
+    memcpy(game->data + used, payload, size);
+    game->data[used + size] = '\0';
+
+    if (packed != (struct varlena *) DatumGetPointer(datum))
+        pfree(packed);
+
+    return game;
+}
+
+/**
+ * Reads the final position stored with a SAN value, if any.
+ *
+ * @param datum The stored SAN value, possibly toasted (see san_unpack).
+ * @param board Set to the position reached by playing all the moves of the game.
+ * @param plies Set to the number of half-moves played.
+ * @return false if the value was not stored with its final position.
+ */
+bool san_unpack_board(Datum datum, ChessBoard *board, int *plies)
+{
+    struct varlena *packed = chess_stats_detoast_packed(datum);
+    int size = VARSIZE_ANY_EXHDR(packed);
+    bool found = size > SAN_FINAL_BOARD_SIZE && (((uint8) VARDATA_ANY(packed)[0]) & SAN_FLAG_BOARD);
+
+    if (found) {
+        const uint8 *q = (const uint8 *) VARDATA_ANY(packed) + size - SAN_FINAL_BOARD_SIZE;
+
+        *plies = (q[0] << 8) | q[1];
+        san_board_read((const char *) q + 2, *plies, board);
+    }
+
+    if (packed != (struct varlena *) DatumGetPointer(datum))
+        pfree(packed);
+
+    return found;
+}
+
+/**
+ * Reads the header stored with a SAN value, if any.
+ *
+ * @param datum The stored SAN value, possibly toasted (see san_unpack).
+ * @param index Set to a palloc'd copy of the header, sized for the longest games.
+ * @return false if the value was stored without a header.
+ */
+bool san_unpack_index(Datum datum, SANIndex *index)
+{
+    struct varlena *packed = chess_stats_detoast_packed(datum);
+    const char *payload = VARDATA_ANY(packed);
+    bool found = (((uint8) payload[0]) & SAN_FLAG_HEADER) != 0;
+
+    if (found) {
+        SANHeader header;
+
+        payload++;
+        memcpy(&header, payload, sizeof(SANHeader));
+        payload += sizeof(SANHeader);
+
+        san_index_init(index, header.interval);
+        index->header = header;
+
+        if (header.interval > 0) {
+            memcpy(index->offsets, payload, header.nMoves * sizeof(uint16));
+            payload += header.nMoves * sizeof(uint16);
+            memcpy(index->checkpoints, payload, (header.nMoves / header.interval) * SAN_BOARD_SIZE);
+        }
+    }
+
+    if (packed != (struct varlena *) DatumGetPointer(datum))
+        pfree(packed);
+
+    return found;
+}
+
+/**
+ * Returns the number of half-moves of a stored SAN value.
+ *
+ * Only the start of the value is fetched when it has a header.
+ *
+ * @param datum The stored SAN value, possibly toasted.
+ * @param fcinfo Function call info of the calling function.
+ * @return The number of half-moves, as counted by count_half_moves.
+ */
+int san_ply_count(Datum datum, FunctionCallInfo fcinfo)
+{
+    struct varlena *start = PG_DETOAST_DATUM_SLICE(datum, 0, 1 + sizeof(SANHeader));
+    const char *payload = VARDATA_ANY(start);
+    SAN *game;
+    int result;
+
+    if (VARSIZE_ANY_EXHDR(start) >= 1 + sizeof(SANHeader) && (((uint8) payload[0]) & SAN_FLAG_HEADER)) {
+        SANHeader header;
+
+        memcpy(&header, payload + 1, sizeof(SANHeader));
+
+        return header.plyCount;
+    }
+
+    game = san_unpack(datum, fcinfo);
+    result = count_half_moves(game->data);
+    pfree(game);
+
+    return result;
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //SANPACKED_H
@@ -0,0 +1,200 @@
+/*
+ * SANSIG.h
+ *      Implementation of the position signature used by the GiST index on SAN.
+ *
+ * A signature is a fixed-width bloom filter summarizing all the board positions
+ * a chess game goes through. Leaf entries hold the signature of one game, inner
+ * entries the bitwise OR of the signatures below them. It's part of a PostgreSQL
+ * extension for storing and querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "common/hashfn.h"
+#include "port/pg_bitutils.h"
+
+#ifndef SANSIG_H
+#define SANSIG_H
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+// Size of a signature in bytes, and the resulting number of bits.
+#define SANSIG_LEN 128
+#define SANSIG_BITS (SANSIG_LEN * 8)
+
+// Flag marking a signature whose bits are all set (no bitmap is stored).
+#define SANSIG_ALLTRUE 0x01
+
+/**
+ * Structure representing the bloom signature of one or several chess games.
+ *
+ * @param vl_len_ Varlena header (do not touch directly).
+ * @param flag Signature flags (SANSIG_ALLTRUE).
+ * @param sign The bitmap, absent when the signature is all true.
+ */
+typedef struct
+{
+    int32 vl_len_;
+    int32 flag;
+    uint8 sign[FLEXIBLE_ARRAY_MEMBER];
+} SANSIG;
+
+#define SANSIG_HDRSZ offsetof(SANSIG, sign)
+#define SANSIG_ISALLTRUE(x) (((x)->flag & SANSIG_ALLTRUE) != 0)
+#define DatumGetSANSIG(x) ((SANSIG *) PG_DETOAST_DATUM(x))
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+SANSIG *sansig_new(bool allTrue);
+void sansig_add_hash(SANSIG *sig, uint32 hash);
+bool sansig_contains_hash(const SANSIG *sig, uint32 hash);
+void sansig_union_into(SANSIG *dest, const SANSIG *src);
+int sansig_count_bits(const SANSIG *sig);
+int sansig_added_bits(const SANSIG *orig, const SANSIG *add);
+int sansig_distance(const SANSIG *a, const SANSIG *b);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+/**
+ * Allocates an empty or an all-true signature.
+ *
+ * @param allTrue Whether the signature matches every position.
+ * @return A pointer to the new signature.
+ */
+SANSIG *sansig_new(bool allTrue)
+{
+    Size size = allTrue ? SANSIG_HDRSZ : SANSIG_HDRSZ + SANSIG_LEN;
+    SANSIG *sig = (SANSIG *) palloc0(size);
+
+    SET_VARSIZE(sig, size);
+    sig->flag = allTrue ? SANSIG_ALLTRUE : 0;
+
+    return sig;
+}
+
+/**
+ * Computes the two signature bits set for a position hash.
+ */
+static inline void sansig_hash_bits(uint32 hash, int *bit1, int *bit2)
+{
+    *bit1 = hash % SANSIG_BITS;
+    *bit2 = hash_bytes_uint32(hash) % SANSIG_BITS;
+}
+
+/**
+ * Adds a position hash to a signature.
+ *
+ * @param sig The signature to update (must not be all true).
+ * @param hash The position hash, as computed by fen_position_hash.
+ */
+void sansig_add_hash(SANSIG *sig, uint32 hash)
+{
+    int bit1, bit2;
+
+    sansig_hash_bits(hash, &bit1, &bit2);
+
+    sig->sign[bit1 / 8] |= 1 << (bit1 % 8);
+    sig->sign[bit2 / 8] |= 1 << (bit2 % 8);
+}
+
+/**
+ * Checks whether a signature may contain a position hash.
+ *
+ * @param sig The signature to probe.
+ * @param hash The position hash, as computed by fen_position_hash.
+ * @return false if the position is certainly absent, true if it may be present.
+ */
+bool sansig_contains_hash(const SANSIG *sig, uint32 hash)
+{
+    int bit1, bit2;
+
+    if (SANSIG_ISALLTRUE(sig))
+        return true;
+
+    sansig_hash_bits(hash, &bit1, &bit2);
+
+    return (sig->sign[bit1 / 8] & (1 << (bit1 % 8))) != 0 &&
+           (sig->sign[bit2 / 8] & (1 << (bit2 % 8))) != 0;
+}
+
+/**
+ * ORs a signature into another one.
+ *
+ * @param dest The signature to update (must not be all true).
+ * @param src The signature to add.
+ */
+void sansig_union_into(SANSIG *dest, const SANSIG *src)
+{
+    if (SANSIG_ISALLTRUE(src)) {
+        memset(dest->sign, 0xff, SANSIG_LEN);
+        return;
+    }
+
+    for (int i = 0; i < SANSIG_LEN; i++)
+        dest->sign[i] |= src->sign[i];
+}
+
+/**
+ * Counts the bits set in a signature.
+ */
+int sansig_count_bits(const SANSIG *sig)
+{
+    if (SANSIG_ISALLTRUE(sig))
+        return SANSIG_BITS;
+
+    return pg_popcount((const char *) sig->sign, SANSIG_LEN);
+}
+
+/**
+ * Counts the bits that a signature would add to another one.
+ *
+ * This is the GiST penalty of inserting 'add' below 'orig'.
+ */
+int sansig_added_bits(const SANSIG *orig, const SANSIG *add)
+{
+    int count = 0;
+
+    if (SANSIG_ISALLTRUE(orig))
+        return 0;
+
+    if (SANSIG_ISALLTRUE(add))
+        return SANSIG_BITS - sansig_count_bits(orig);
+
+    for (int i = 0; i < SANSIG_LEN; i++)
+        count += pg_number_of_ones[add->sign[i] & ~orig->sign[i]];
+
+    return count;
+}
+
+/**
+ * Computes the Hamming distance between two signatures.
+ */
+int sansig_distance(const SANSIG *a, const SANSIG *b)
+{
+    int count = 0;
+
+    if (SANSIG_ISALLTRUE(a))
+        return SANSIG_BITS - sansig_count_bits(b);
+
+    if (SANSIG_ISALLTRUE(b))
+        return SANSIG_BITS - sansig_count_bits(a);
+
+    for (int i = 0; i < SANSIG_LEN; i++)
+        count += pg_number_of_ones[a->sign[i] ^ b->sign[i]];
+
+    return count;
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif
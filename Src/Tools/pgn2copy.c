@@ -0,0 +1,594 @@
+/*
+ * pgn2copy.c
+ *      Converts PGN files into COPY binary streams of SAN values.
+ *
+ * Usage: pgn2copy [-j jobs] [-o output] [-v] file.pgn ...
+ *
+ * The files are mapped in memory and cut into chunks; each worker thread takes the
+ * next free chunk and converts the games starting in it (a game starts at its first
+ * tag pair). The moves of every game are replayed with the move engine of the
+ * extension: games with an illegal or ambiguous move, a custom start position or a
+ * movetext longer than the SAN type accepts are rejected and counted. The mainline
+ * moves of the other games are written, in their order in the files, as a single
+ * COPY ... (FORMAT binary) stream of the binary form read by san_recv, e.g.
+ *
+ *      pgn2copy games.pgn | psql -c "COPY games(game_notation) FROM STDIN (FORMAT binary)"
+ *
+ * so that the server does not validate or replay the games while loading: it only
+ * counts their half-moves for the stored value header, as for any SAN value, and
+ * replays them when 'chess.san_checkpoint_interval' is set, which is best left unset
+ * during the load. It's part of a PostgreSQL extension for storing and querying
+ * chess games.
+ *
+ */
+
+#include "postgres_fe.h"
+#include "port/pg_bswap.h"
+#include "DataTypes/SAN/SAN.h"
+#include "Utils/move_engine.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Size of the chunks handed to the workers, and the number of chunks converted ahead of the writer per worker.
+#define CHUNK_SIZE (8 * 1024 * 1024)
+#define CHUNKS_AHEAD_PER_JOB 4
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+// Reasons for which a game is not written.
+typedef enum
+{
+    GAME_OK,
+    GAME_EMPTY,
+    GAME_ILLEGAL_MOVE,
+    GAME_CUSTOM_START,
+    GAME_TOO_LONG,
+    GAME_NUM_RESULTS
+} GameResult;
+
+static const char *const gameResultNames[GAME_NUM_RESULTS] = {
+    "written",
+    "without moves",
+    "with an illegal move",
+    "with a custom start position",
+    "too long",
+};
+
+/**
+ * Structure representing a growable output buffer.
+ *
+ * @param data The bytes written.
+ * @param len The number of bytes written.
+ * @param cap The allocated size.
+ */
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} OutBuffer;
+
+/**
+ * Structure representing the conversion of one file, shared by the threads.
+ *
+ * @param path The file name, for messages.
+ * @param data The mapped file.
+ * @param size The size of the file.
+ * @param nChunks The number of chunks of the file.
+ * @param nextChunk The next chunk to be taken by a worker.
+ * @param nWritten The number of chunks already written out.
+ * @param maxAhead The number of chunks that may be converted but not written yet.
+ * @param outputs The output of each chunk, NULL until it is converted.
+ * @param counts The number of games per GameResult.
+ * @param verbose Whether every rejected game is reported.
+ * @param lock Protects the fields above that change.
+ * @param changed Signalled when a chunk is converted or written.
+ */
+typedef struct
+{
+    const char *path;
+    const char *data;
+    size_t size;
+    size_t nChunks;
+    size_t nextChunk;
+    size_t nWritten;
+    size_t maxAhead;
+    OutBuffer **outputs;
+    uint64 counts[GAME_NUM_RESULTS];
+    bool verbose;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} Conversion;
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+static void out_append(OutBuffer *out, const void *bytes, size_t len);
+static bool is_game_start(const char *data, size_t size, size_t pos);
+static size_t next_game_start(const char *data, size_t size, size_t pos);
+static GameResult convert_game(const char *game, size_t len, char *moves, int *movesLen);
+static void convert_chunk(Conversion *conv, size_t chunk, OutBuffer *out, uint64 *counts);
+static void *worker_main(void *arg);
+static void write_all(FILE *output, const void *bytes, size_t len);
+static void convert_file(const char *path, int jobs, bool verbose, FILE *output, uint64 *totals);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+/**
+ * Appends bytes to an output buffer.
+ */
+static void out_append(OutBuffer *out, const void *bytes, size_t len)
+{
+    if (out->len + len > out->cap) {
+        out->cap = Max(out->cap * 2, out->len + len + 4096);
+        out->data = realloc(out->data, out->cap);
+
+        if (out->data == NULL) {
+            fprintf(stderr, "pgn2copy: out of memory\n");
+            exit(1);
+        }
+    }
+
+    memcpy(out->data + out->len, bytes, len);
+    out->len += len;
+}
+
+/**
+ * Checks whether a tag pair ('[Name "') starts at a position.
+ */
+static inline bool is_tag_line(const char *data, size_t size, size_t pos)
+{
+    return pos + 1 < size && data[pos] == '[' && isalpha((unsigned char) data[pos + 1]);
+}
+
+/**
+ * Checks whether a game starts at a position.
+ *
+ * A game starts with the first tag pair of its header: a tag line whose previous
+ * non-blank line, if any, is not a tag line.
+ *
+ * @param data The mapped file.
+ * @param size The size of the file.
+ * @param pos The start of a line.
+ * @return true if the line is the first tag pair of a game.
+ */
+static bool is_game_start(const char *data, size_t size, size_t pos)
+{
+    size_t prev = pos;
+
+    if (!is_tag_line(data, size, pos))
+        return false;
+
+    // Back to the start of the previous non-blank line
+    while (prev > 0 && isspace((unsigned char) data[prev - 1]))
+        prev--;
+
+    if (prev == 0)
+        return true;
+
+    while (prev > 0 && data[prev - 1] != '\n')
+        prev--;
+
+    return !is_tag_line(data, size, prev);
+}
+
+/**
+ * Finds the first game starting at or after a position.
+ *
+ * @param data The mapped file.
+ * @param size The size of the file.
+ * @param pos The position to search from.
+ * @return The start of the game, or the size of the file if there is none.
+ */
+static size_t next_game_start(const char *data, size_t size, size_t pos)
+{
+    // Up to the next line start
+    if (pos > 0 && pos < size && data[pos - 1] != '\n') {
+        const char *eol = memchr(data + pos, '\n', size - pos);
+
+        pos = (eol == NULL) ? size : (size_t) (eol - data) + 1;
+    }
+
+    while (pos < size && !is_game_start(data, size, pos)) {
+        const char *eol = memchr(data + pos, '\n', size - pos);
+
+        pos = (eol == NULL) ? size : (size_t) (eol - data) + 1;
+    }
+
+    return pos;
+}
+
+/**
+ * Converts the text of a game into its mainline moves.
+ *
+ * Tag pairs, comments, variations, NAGs, move numbers, annotation suffixes and the
+ * result are dropped; every move is played on a board, and the game is rejected at
+ * the first move that cannot be played.
+ *
+ * @param game The text of the game, header included.
+ * @param len The length of the text.
+ * @param moves Filled with the moves ("1. e4 e5 2. Nf3"), at least MAX_PGN_LENGTH bytes.
+ * @param movesLen Set to the length of the moves.
+ * @return GAME_OK, or the reason why the game is rejected.
+ */
+static GameResult convert_game(const char *game, size_t len, char *moves, int *movesLen)
+{
+    ChessBoard board;
+    size_t pos = 0;
+    int out = 0, ply = 0;
+
+    board_init(&board);
+
+    // Header: only games from the initial position can be stored as SAN
+    while (pos < len && (is_tag_line(game, len, pos) || isspace((unsigned char) game[pos]))) {
+        if (game[pos] == '[') {
+            if (strncmp(game + pos, "[FEN ", 5) == 0 ||
+                (strncmp(game + pos, "[SetUp \"1\"", 10) == 0))
+                return GAME_CUSTOM_START;
+
+            while (pos < len && game[pos] != '\n')
+                pos++;
+        } else {
+            pos++;
+        }
+    }
+
+    while (pos < len) {
+        char c = game[pos];
+        size_t start;
+        int tokenLen;
+
+        if (isspace((unsigned char) c)) {
+            pos++;
+        } else if (c == '{') {
+            while (pos < len && game[pos] != '}')
+                pos++;
+            pos++;
+        } else if (c == ';' || (c == '%' && (pos == 0 || game[pos - 1] == '\n'))) {
+            while (pos < len && game[pos] != '\n')
+                pos++;
+        } else if (c == '(') {
+            int depth = 0;
+
+            // Nested variations, which may hold comments with parentheses
+            for (; pos < len; pos++) {
+                if (game[pos] == '{') {
+                    while (pos < len && game[pos] != '}')
+                        pos++;
+                } else if (game[pos] == '(') {
+                    depth++;
+                } else if (game[pos] == ')' && --depth == 0) {
+                    pos++;
+                    break;
+                }
+            }
+        } else if (c == '$') {
+            pos++;
+            while (pos < len && isdigit((unsigned char) game[pos]))
+                pos++;
+        } else if (c == '*' || strncmp(game + pos, "1-0", Min(3, len - pos)) == 0 ||
+                   strncmp(game + pos, "0-1", Min(3, len - pos)) == 0 || strncmp(game + pos, "1/2", Min(3, len - pos)) == 0) {
+            // Result: the end of the game
+            break;
+        } else if (isdigit((unsigned char) c) && strncmp(game + pos, "0-0", Min(3, len - pos)) != 0) {
+            // Move number, possibly glued to the move ("12.e4")
+            while (pos < len && isdigit((unsigned char) game[pos]))
+                pos++;
+            while (pos < len && game[pos] == '.')
+                pos++;
+        } else {
+            start = pos;
+            while (pos < len && !isspace((unsigned char) game[pos]) && strchr("{}();$", game[pos]) == NULL)
+                pos++;
+
+            tokenLen = (int) (pos - start);
+            while (tokenLen > 0 && (game[start + tokenLen - 1] == '!' || game[start + tokenLen - 1] == '?'))
+                tokenLen--;
+
+            if (!board_play_san(&board, game + start, tokenLen))
+                return GAME_ILLEGAL_MOVE;
+
+            // "1. e4 e5 2. Nf3": a number before White's moves, a space between tokens
+            if (ply % 2 == 0) {
+                char number[16];
+                int numberLen = snprintf(number, sizeof(number), "%s%d. ", ply > 0 ? " " : "", ply / 2 + 1);
+
+                if (out + numberLen >= MAX_PGN_LENGTH)
+                    return GAME_TOO_LONG;
+
+                memcpy(moves + out, number, numberLen);
+                out += numberLen;
+            } else {
+                if (out + 1 >= MAX_PGN_LENGTH)
+                    return GAME_TOO_LONG;
+
+                moves[out++] = ' ';
+            }
+
+            if (out + tokenLen >= MAX_PGN_LENGTH)
+                return GAME_TOO_LONG;
+
+            memcpy(moves + out, game + start, tokenLen);
+            out += tokenLen;
+            ply++;
+        }
+    }
+
+    *movesLen = out;
+
+    return ply > 0 ? GAME_OK : GAME_EMPTY;
+}
+
+/**
+ * Converts the games starting in a chunk into COPY binary tuples.
+ *
+ * @param conv The conversion.
+ * @param chunk The chunk number.
+ * @param out The buffer receiving the tuples.
+ * @param counts Incremented with the result of each game.
+ */
+static void convert_chunk(Conversion *conv, size_t chunk, OutBuffer *out, uint64 *counts)
+{
+    size_t chunkEnd = Min(conv->size, (chunk + 1) * (size_t) CHUNK_SIZE);
+    size_t pos = next_game_start(conv->data, conv->size, chunk * (size_t) CHUNK_SIZE);
+    char moves[MAX_PGN_LENGTH];
+
+    // Games starting in the chunk, each one running up to the start of the next one
+    while (pos < chunkEnd) {
+        size_t end = next_game_start(conv->data, conv->size, pos + 1);
+        int movesLen = 0;
+        GameResult result = convert_game(conv->data + pos, end - pos, moves, &movesLen);
+
+        counts[result]++;
+
+        if (result == GAME_OK) {
+            // Tuple: one field, its length, then the binary SAN value
+            uint16 nFields = pg_hton16(1);
+            uint32 fieldLen = pg_hton32(movesLen + 1);
+            uint8 version = SAN_BINARY_VERSION;
+
+            out_append(out, &nFields, sizeof(nFields));
+            out_append(out, &fieldLen, sizeof(fieldLen));
+            out_append(out, &version, sizeof(version));
+            out_append(out, moves, movesLen);
+        } else if (conv->verbose) {
+            fprintf(stderr, "pgn2copy: %s: game at byte %zu skipped: %s\n", conv->path, pos, gameResultNames[result]);
+        }
+
+        pos = end;
+    }
+}
+
+/**
+ * Converts chunks until there are none left.
+ *
+ * Workers take the next free chunk, so that faster workers take more of them, but
+ * stay at most maxAhead chunks ahead of the writer to bound the memory used.
+ *
+ * @param arg The conversion.
+ * @return NULL.
+ */
+static void *worker_main(void *arg)
+{
+    Conversion *conv = (Conversion *) arg;
+    uint64 counts[GAME_NUM_RESULTS] = {0};
+
+    for (;;) {
+        OutBuffer *out;
+        size_t chunk;
+
+        pthread_mutex_lock(&conv->lock);
+        while (conv->nextChunk < conv->nChunks && conv->nextChunk >= conv->nWritten + conv->maxAhead)
+            pthread_cond_wait(&conv->changed, &conv->lock);
+        chunk = conv->nextChunk++;
+        pthread_mutex_unlock(&conv->lock);
+
+        if (chunk >= conv->nChunks)
+            break;
+
+        out = calloc(1, sizeof(OutBuffer));
+        if (out == NULL) {
+            fprintf(stderr, "pgn2copy: out of memory\n");
+            exit(1);
+        }
+
+        convert_chunk(conv, chunk, out, counts);
+
+        pthread_mutex_lock(&conv->lock);
+        conv->outputs[chunk] = out;
+        pthread_cond_broadcast(&conv->changed);
+        pthread_mutex_unlock(&conv->lock);
+    }
+
+    pthread_mutex_lock(&conv->lock);
+    for (int i = 0; i < GAME_NUM_RESULTS; i++)
+        conv->counts[i] += counts[i];
+    pthread_mutex_unlock(&conv->lock);
+
+    return NULL;
+}
+
+/**
+ * Writes bytes to the output, exiting on failure.
+ */
+static void write_all(FILE *output, const void *bytes, size_t len)
+{
+    if (len > 0 && fwrite(bytes, 1, len, output) != len) {
+        fprintf(stderr, "pgn2copy: could not write the output: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+/**
+ * Converts a PGN file, appending its games to the output.
+ *
+ * @param path The PGN file.
+ * @param jobs The number of worker threads.
+ * @param verbose Whether every rejected game is reported.
+ * @param output The COPY stream.
+ * @param totals Incremented with the number of games per GameResult.
+ */
+static void convert_file(const char *path, int jobs, bool verbose, FILE *output, uint64 *totals)
+{
+    Conversion conv;
+    pthread_t *threads;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY, 0);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "pgn2copy: could not open file \"%s\": %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    memset(&conv, 0, sizeof(conv));
+    conv.path = path;
+    conv.size = (size_t) st.st_size;
+    conv.data = mmap(NULL, conv.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (conv.data == MAP_FAILED) {
+        fprintf(stderr, "pgn2copy: could not map file \"%s\": %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    madvise((void *) conv.data, conv.size, MADV_SEQUENTIAL);
+
+    conv.nChunks = (conv.size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    conv.maxAhead = (size_t) jobs * CHUNKS_AHEAD_PER_JOB;
+    conv.outputs = calloc(conv.nChunks, sizeof(OutBuffer *));
+    conv.verbose = verbose;
+    pthread_mutex_init(&conv.lock, NULL);
+    pthread_cond_init(&conv.changed, NULL);
+
+    threads = malloc(jobs * sizeof(pthread_t));
+    if (conv.outputs == NULL || threads == NULL) {
+        fprintf(stderr, "pgn2copy: out of memory\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < jobs; i++) {
+        if (pthread_create(&threads[i], NULL, worker_main, &conv) != 0) {
+            fprintf(stderr, "pgn2copy: could not create worker thread\n");
+            exit(1);
+        }
+    }
+
+    // The chunks are written in file order, as soon as each one is converted
+    for (size_t chunk = 0; chunk < conv.nChunks; chunk++) {
+        OutBuffer *out;
+
+        pthread_mutex_lock(&conv.lock);
+        while (conv.outputs[chunk] == NULL)
+            pthread_cond_wait(&conv.changed, &conv.lock);
+        out = conv.outputs[chunk];
+        pthread_mutex_unlock(&conv.lock);
+
+        write_all(output, out->data, out->len);
+        free(out->data);
+        free(out);
+
+        pthread_mutex_lock(&conv.lock);
+        conv.outputs[chunk] = NULL;
+        conv.nWritten++;
+        pthread_cond_broadcast(&conv.changed);
+        pthread_mutex_unlock(&conv.lock);
+    }
+
+    for (int i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < GAME_NUM_RESULTS; i++)
+        totals[i] += conv.counts[i];
+
+    munmap((void *) conv.data, conv.size);
+    pthread_cond_destroy(&conv.changed);
+    pthread_mutex_destroy(&conv.lock);
+    free(conv.outputs);
+    free(threads);
+}
+
+int main(int argc, char **argv)
+{
+    // COPY binary signature, flags and header extension length
+    static const char signature[11] = "PGCOPY\n\377\r\n\0";
+    uint32 flags = pg_hton32(0), extension = pg_hton32(0);
+    uint16 trailer = pg_hton16((uint16) -1);
+    uint64 totals[GAME_NUM_RESULTS] = {0};
+    FILE *output = stdout;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    bool verbose = false;
+    int c;
+
+    while ((c = getopt(argc, argv, "j:o:v")) != -1) {
+        switch (c) {
+            case 'j':
+                jobs = strtol(optarg, NULL, 10);
+                break;
+            case 'o':
+                output = fopen(optarg, "wb");
+                if (output == NULL) {
+                    fprintf(stderr, "pgn2copy: could not open output file \"%s\": %s\n", optarg, strerror(errno));
+                    exit(1);
+                }
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: pgn2copy [-j jobs] [-o output] [-v] file.pgn ...\n");
+                exit(1);
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: pgn2copy [-j jobs] [-o output] [-v] file.pgn ...\n");
+        exit(1);
+    }
+
+    jobs = Max(jobs, 1);
+
+    write_all(output, signature, sizeof(signature));
+    write_all(output, &flags, sizeof(flags));
+    write_all(output, &extension, sizeof(extension));
+
+    for (int i = optind; i < argc; i++)
+        convert_file(argv[i], (int) jobs, verbose, output, totals);
+
+    write_all(output, &trailer, sizeof(trailer));
+
+    if (fflush(output) != 0 || (output != stdout && fclose(output) != 0)) {
+        fprintf(stderr, "pgn2copy: could not write the output: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    fprintf(stderr, "pgn2copy: %llu games written", (unsigned long long) totals[GAME_OK]);
+    for (int i = GAME_OK + 1; i < GAME_NUM_RESULTS; i++) {
+        if (totals[i] > 0)
+            fprintf(stderr, ", %llu skipped %s", (unsigned long long) totals[i], gameResultNames[i]);
+    }
+    fprintf(stderr, "\n");
+
+    return 0;
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
@@ -0,0 +1,453 @@
+/*
+ * Chess statistics
+ *      Runtime instrumentation counters for the chess extension.
+ *
+ * This file keeps backend-local counters for the expensive parts of the extension
+ * (game replays, GIN key extraction, detoasting) together with per-function call
+ * counts and cumulative execution time. When the library is loaded through
+ * shared_preload_libraries the same counters are also accumulated in shared memory,
+ * so that activity can be observed across all backends. Timing is only measured
+ * when the 'chess.track_timing' setting is enabled.
+ *
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "funcapi.h"
+#include "port/atomics.h"
+#include "portability/instr_time.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/tuplestore.h"
+
+#ifndef CHESS_STATS_H
+#define CHESS_STATS_H
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+/**
+ * Event counters tracked by the extension.
+ */
+typedef enum
+{
+    CHESS_STAT_REPLAYS,          // Number of game replays performed (SAN to FEN conversions).
+    CHESS_STAT_PLIES_REPLAYED,   // Number of half-moves replayed across all replays.
+    CHESS_STAT_CACHE_HITS,       // Number of replays avoided thanks to cached board states.
+    CHESS_STAT_GIN_KEYS,         // Number of GIN keys extracted from indexed games.
+    CHESS_STAT_BYTES_DETOASTED,  // Number of bytes produced by detoasting arguments.
+    CHESS_STAT_QUEUED_GAMES,     // Number of queued games processed by the position workers.
+    CHESS_STAT_NUM_COUNTERS
+} ChessStatsCounter;
+
+static const char *const chess_stats_counter_names[CHESS_STAT_NUM_COUNTERS] = {
+    "replays",
+    "plies_replayed",
+    "cache_hits",
+    "gin_keys_extracted",
+    "bytes_detoasted",
+    "queued_games_processed"
+};
+
+/**
+ * SQL-callable functions whose calls and execution time are tracked.
+ */
+typedef enum
+{
+    CHESS_FN_SAN_IN,
+    CHESS_FN_SAN_OUT,
+    CHESS_FN_SAN_RECV,
+    CHESS_FN_SAN_SEND,
+    CHESS_FN_SAN_APPEND,
+    CHESS_FN_CURRENT_BOARD,
+    CHESS_FN_FEN_IN,
+    CHESS_FN_FEN_OUT,
+    CHESS_FN_HAS_OPENING,
+    CHESS_FN_OPENING_BUCKET,
+    CHESS_FN_GET_FIRST_MOVES,
+    CHESS_FN_GET_BOARD_STATE,
+    CHESS_FN_HAS_BOARD,
+    CHESS_FN_SAN_LIKE,
+    CHESS_FN_SAN_NOT_LIKE,
+    CHESS_FN_GIN_EXTRACT_VALUE,
+    CHESS_FN_GIN_EXTRACT_QUERY,
+    CHESS_FN_GIN_CONSISTENT,
+    CHESS_FN_GIN_TRI_CONSISTENT,
+    CHESS_FN_HAS_BOARD_OPERATOR,
+    CHESS_FN_FEN_IN_SAN_EQ,
+    CHESS_FN_HAS_EXACT_BOARD,
+    CHESS_FN_HAS_BOARD_IN_LINES,
+    CHESS_FN_GAME_VARIATIONS,
+    CHESS_FN_HAS_ALL_BOARDS,
+    CHESS_FN_HAS_ANY_BOARD,
+    CHESS_FN_REACHES_IN_ORDER,
+    CHESS_FN_REACHES_IN_ORDER_PLIES,
+    CHESS_FN_REACHES_WINDOW,
+    CHESS_FN_FIRST_PLY_OF,
+    CHESS_FN_HAS_BOARD_MANY,
+    CHESS_FN_CONTAINS_MOVES,
+    CHESS_FN_GAME_FINGERPRINT,
+    CHESS_FN_ECO_CODE,
+    CHESS_FN_ECO_NAME,
+    CHESS_FN_POSITION_KEY,
+    CHESS_FN_GAME_POSITION_KEYS,
+    CHESS_FN_BUILD_POSITION_FILE,
+    CHESS_FN_POSITION_FILE_INVALIDATE,
+    CHESS_FN_OPENING_DICT_CHANGED,
+    CHESS_FN_PGN_IN,
+    CHESS_FN_PGN_OUT,
+    CHESS_FN_PGN_TO_SAN,
+    CHESS_FN_SAN_TO_PGN,
+    CHESS_FN_PGN_TAG,
+    CHESS_FN_PGN_RESULT,
+    CHESS_FN_PLY_COUNT,
+    CHESS_FN_PLY_COUNT_SAN,
+    CHESS_FN_SAN_DISTANCE,
+    CHESS_FN_FEN_DISTANCE,
+    CHESS_FN_NUM_FUNCTIONS
+} ChessStatsFunction;
+
+static const char *const chess_stats_function_names[CHESS_FN_NUM_FUNCTIONS] = {
+    "san_in",
+    "san_out",
+    "san_recv",
+    "san_send",
+    "san_append",
+    "current_board",
+    "fen_in",
+    "fen_out",
+    "has_opening",
+    "opening_bucket",
+    "get_FirstMoves",
+    "get_board_state",
+    "has_Board",
+    "san_like",
+    "san_not_like",
+    "gin_extract_value",
+    "gin_extract_query",
+    "gin_consistent",
+    "gin_tri_consistent",
+    "has_board_fn_operator",
+    "fen_in_san_eq",
+    "has_exact_board",
+    "has_board_in_lines",
+    "game_variations",
+    "has_all_boards",
+    "has_any_board",
+    "reaches_in_order",
+    "reaches_in_order_plies",
+    "reaches_window",
+    "first_ply_of",
+    "has_board_many",
+    "contains_moves",
+    "game_fingerprint",
+    "eco_code",
+    "eco_name",
+    "position_key",
+    "game_position_keys",
+    "chess_build_position_file",
+    "chess_position_file_invalidate",
+    "chess_opening_dict_changed",
+    "pgn_in",
+    "pgn_out",
+    "pgn_to_san",
+    "san_to_pgn",
+    "pgn_tag",
+    "pgn_result",
+    "ply_count",
+    "ply_count_san",
+    "san_distance",
+    "fen_distance"
+};
+
+/**
+ * Backend-local statistics.
+ *
+ * @param counters Event counters, indexed by ChessStatsCounter.
+ * @param calls Number of calls per function, indexed by ChessStatsFunction.
+ * @param time_us Cumulative execution time per function in microseconds.
+ */
+typedef struct
+{
+    uint64 counters[CHESS_STAT_NUM_COUNTERS];
+    uint64 calls[CHESS_FN_NUM_FUNCTIONS];
+    uint64 time_us[CHESS_FN_NUM_FUNCTIONS];
+} ChessStats;
+
+/**
+ * Statistics shared by all backends, only available when the library is
+ * loaded through shared_preload_libraries. Updated with atomic operations.
+ */
+typedef struct
+{
+    pg_atomic_uint64 counters[CHESS_STAT_NUM_COUNTERS];
+    pg_atomic_uint64 calls[CHESS_FN_NUM_FUNCTIONS];
+    pg_atomic_uint64 time_us[CHESS_FN_NUM_FUNCTIONS];
+} ChessSharedStats;
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+void chess_stats_init(void);
+void chess_stats_count(ChessStatsCounter counter, uint64 amount);
+void chess_stats_begin(instr_time *start);
+void chess_stats_end(ChessStatsFunction function, instr_time *start);
+void chess_stats_reset_all(void);
+void chess_stats_fill(Tuplestorestate *tupstore, TupleDesc tupdesc);
+struct varlena *chess_stats_detoast_packed(Datum datum);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+// Detoasts a text argument and accounts for the detoasted bytes.
+#define CHESS_GETARG_TEXT_PP(n) ((text *) chess_stats_detoast_packed(PG_GETARG_DATUM(n)))
+
+// Whether function execution time is measured ('chess.track_timing').
+static bool chess_track_timing = false;
+
+static ChessStats chessLocalStats;
+static ChessSharedStats *chessSharedStats = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type chess_stats_prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type chess_stats_prev_shmem_startup_hook = NULL;
+
+/**
+ * Requests the shared memory used by the shared counters.
+ */
+static void chess_stats_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+    if (chess_stats_prev_shmem_request_hook)
+        chess_stats_prev_shmem_request_hook();
+#endif
+
+    RequestAddinShmemSpace(MAXALIGN(sizeof(ChessSharedStats)));
+}
+
+/**
+ * Allocates (or attaches to) the shared counters.
+ */
+static void chess_stats_shmem_startup(void)
+{
+    bool found;
+
+    if (chess_stats_prev_shmem_startup_hook)
+        chess_stats_prev_shmem_startup_hook();
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+    chessSharedStats = ShmemInitStruct("chess stats", sizeof(ChessSharedStats), &found);
+
+    if (!found) {
+        for (int i = 0; i < CHESS_STAT_NUM_COUNTERS; i++)
+            pg_atomic_init_u64(&chessSharedStats->counters[i], 0);
+
+        for (int i = 0; i < CHESS_FN_NUM_FUNCTIONS; i++) {
+            pg_atomic_init_u64(&chessSharedStats->calls[i], 0);
+            pg_atomic_init_u64(&chessSharedStats->time_us[i], 0);
+        }
+    }
+
+    LWLockRelease(AddinShmemInitLock);
+}
+
+/**
+ * Defines the statistics settings and, when preloaded, installs the shared memory hooks.
+ *
+ * Called once from _PG_init.
+ */
+void chess_stats_init(void)
+{
+    DefineCustomBoolVariable("chess.track_timing",
+                             "Collects timing statistics for chess functions.",
+                             "Cumulative times are reported by chess_stats().",
+                             &chess_track_timing,
+                             false,
+                             PGC_SUSET,
+                             0,
+                             NULL, NULL, NULL);
+
+    if (!process_shared_preload_libraries_in_progress)
+        return;
+
+#if PG_VERSION_NUM >= 150000
+    chess_stats_prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = chess_stats_shmem_request;
+#else
+    chess_stats_shmem_request();
+#endif
+
+    chess_stats_prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = chess_stats_shmem_startup;
+}
+
+/**
+ * Adds an amount to an event counter.
+ *
+ * @param counter The counter to increment.
+ * @param amount The amount to add.
+ */
+void chess_stats_count(ChessStatsCounter counter, uint64 amount)
+{
+    chessLocalStats.counters[counter] += amount;
+
+    if (chessSharedStats != NULL)
+        pg_atomic_fetch_add_u64(&chessSharedStats->counters[counter], (int64) amount);
+}
+
+/**
+ * Marks the start of a tracked function call.
+ *
+ * The clock is only read when 'chess.track_timing' is enabled.
+ *
+ * @param start Where to store the start time.
+ */
+void chess_stats_begin(instr_time *start)
+{
+    if (chess_track_timing)
+        INSTR_TIME_SET_CURRENT(*start);
+    else
+        INSTR_TIME_SET_ZERO(*start);
+}
+
+/**
+ * Marks the end of a tracked function call.
+ *
+ * Counts the call and, if a start time was recorded, adds the elapsed time.
+ *
+ * @param function The function being tracked.
+ * @param start The start time recorded by chess_stats_begin.
+ */
+void chess_stats_end(ChessStatsFunction function, instr_time *start)
+{
+    uint64 elapsed = 0;
+
+    if (!INSTR_TIME_IS_ZERO(*start)) {
+        instr_time end;
+
+        INSTR_TIME_SET_CURRENT(end);
+        INSTR_TIME_SUBTRACT(end, *start);
+        elapsed = INSTR_TIME_GET_MICROSEC(end);
+    }
+
+    chessLocalStats.calls[function]++;
+    chessLocalStats.time_us[function] += elapsed;
+
+    if (chessSharedStats != NULL) {
+        pg_atomic_fetch_add_u64(&chessSharedStats->calls[function], 1);
+        if (elapsed > 0)
+            pg_atomic_fetch_add_u64(&chessSharedStats->time_us[function], (int64) elapsed);
+    }
+}
+
+/**
+ * Resets the backend-local counters and, if available, the shared counters.
+ */
+void chess_stats_reset_all(void)
+{
+    memset(&chessLocalStats, 0, sizeof(ChessStats));
+
+    if (chessSharedStats == NULL)
+        return;
+
+    for (int i = 0; i < CHESS_STAT_NUM_COUNTERS; i++)
+        pg_atomic_write_u64(&chessSharedStats->counters[i], 0);
+
+    for (int i = 0; i < CHESS_FN_NUM_FUNCTIONS; i++) {
+        pg_atomic_write_u64(&chessSharedStats->calls[i], 0);
+        pg_atomic_write_u64(&chessSharedStats->time_us[i], 0);
+    }
+}
+
+/**
+ * Appends one statistics row to a tuplestore.
+ *
+ * Rows have the shape (scope, kind, name, value, total_time_ms); the time is NULL for counters.
+ */
+static void chess_stats_put_row(Tuplestorestate *tupstore, TupleDesc tupdesc, const char *scope,
+                                const char *kind, const char *name, uint64 value, double *time_ms)
+{
+    Datum values[5];
+    bool nulls[5] = {false, false, false, false, false};
+
+    values[0] = CStringGetTextDatum(scope);
+    values[1] = CStringGetTextDatum(kind);
+    values[2] = CStringGetTextDatum(name);
+    values[3] = Int64GetDatum((int64) value);
+
+    if (time_ms != NULL)
+        values[4] = Float8GetDatum(*time_ms);
+    else {
+        values[4] = (Datum) 0;
+        nulls[4] = true;
+    }
+
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+}
+
+/**
+ * Writes the backend-local and shared statistics into a tuplestore.
+ *
+ * @param tupstore The tuplestore receiving the rows.
+ * @param tupdesc The descriptor of the rows.
+ */
+void chess_stats_fill(Tuplestorestate *tupstore, TupleDesc tupdesc)
+{
+    double time_ms;
+
+    for (int i = 0; i < CHESS_STAT_NUM_COUNTERS; i++)
+        chess_stats_put_row(tupstore, tupdesc, "backend", "counter", chess_stats_counter_names[i],
+                            chessLocalStats.counters[i], NULL);
+
+    for (int i = 0; i < CHESS_FN_NUM_FUNCTIONS; i++) {
+        time_ms = chessLocalStats.time_us[i] / 1000.0;
+        chess_stats_put_row(tupstore, tupdesc, "backend", "function", chess_stats_function_names[i],
+                            chessLocalStats.calls[i], &time_ms);
+    }
+
+    if (chessSharedStats == NULL)
+        return;
+
+    for (int i = 0; i < CHESS_STAT_NUM_COUNTERS; i++)
+        chess_stats_put_row(tupstore, tupdesc, "shared", "counter", chess_stats_counter_names[i],
+                            pg_atomic_read_u64(&chessSharedStats->counters[i]), NULL);
+
+    for (int i = 0; i < CHESS_FN_NUM_FUNCTIONS; i++) {
+        time_ms = pg_atomic_read_u64(&chessSharedStats->time_us[i]) / 1000.0;
+        chess_stats_put_row(tupstore, tupdesc, "shared", "function", chess_stats_function_names[i],
+                            pg_atomic_read_u64(&chessSharedStats->calls[i]), &time_ms);
+    }
+}
+
+/**
+ * Detoasts a datum (keeping short headers) and counts the detoasted bytes.
+ *
+ * @param datum The datum to detoast.
+ * @return The detoasted value.
+ */
+struct varlena *chess_stats_detoast_packed(Datum datum)
+{
+    struct varlena *raw = (struct varlena *) DatumGetPointer(datum);
+    struct varlena *result = pg_detoast_datum_packed(raw);
+
+    if (result != raw)
+        chess_stats_count(CHESS_STAT_BYTES_DETOASTED, VARSIZE_ANY(result));
+
+    return result;
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif
@@ -0,0 +1,630 @@
+/*
+ * eco.h
+ *      ECO (Encyclopaedia of Chess Openings) classification of chess games.
+ *
+ * The ECO table is read from a tab-separated file ('chess.eco_file', by default the
+ * chess_eco.tsv file installed with the extension) with 'eco', 'name' and 'pgn'
+ * columns and an optional 'epd' column, the format of the lichess opening tables.
+ * It is flattened into a trie of normalized moves, plus a table of the positions the
+ * lines end in when the 'epd' column is present. When the library is loaded through
+ * shared_preload_libraries the trie is built once by the postmaster and placed in
+ * shared memory, so every backend classifies games with a walk over the same copy;
+ * otherwise each backend builds its own copy on first use. eco_code and eco_name are
+ * declared immutable so they can be stored, which only holds while the table does not
+ * change: the indexes and generated columns using them must be rebuilt when it does.
+ * It's part of a PostgreSQL extension for storing and querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "common/hashfn.h"
+#include "common/string.h"
+#include "lib/stringinfo.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "DataTypes/SAN/SAN.h"
+#include "Utils/chess_stats.h"
+#include "Utils/move_ngrams.h"
+#include "Utils/mapping_san_to_fan.h"
+
+#ifndef ECO_H
+#define ECO_H
+
+// Name of the ECO table installed in the extension directory.
+#define ECO_DEFAULT_FILE "chess_eco.tsv"
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+/**
+ * Structure representing a node of the ECO trie.
+ *
+ * Node 0 is the root (the initial position); the other nodes are reached by one move.
+ *
+ * @param firstChild The first node reached from this one, or -1.
+ * @param nextSibling The next node reached from the same parent, or -1.
+ * @param entry The ECO line ending at this node, or -1.
+ * @param token Offset of the move in the string pool.
+ * @param tokenLen Length of the move.
+ */
+typedef struct
+{
+    int32 firstChild;
+    int32 nextSibling;
+    int32 entry;
+    int32 token;
+    int32 tokenLen;
+} EcoTrieNode;
+
+/**
+ * Structure representing an ECO line.
+ *
+ * @param code The ECO code, e.g. 'B90'.
+ * @param name Offset of the opening name in the string pool.
+ * @param plies The number of half-moves of the line.
+ */
+typedef struct
+{
+    char code[4];
+    int32 name;
+    int32 plies;
+} EcoEntry;
+
+/**
+ * Structure representing the position an ECO line ends in.
+ *
+ * @param hash Hash of the position key.
+ * @param entry The ECO line.
+ * @param key Offset in the string pool of the position key (board positions and side to move).
+ */
+typedef struct
+{
+    uint32 hash;
+    int32 entry;
+    int32 key;
+} EcoPosition;
+
+/**
+ * Structure representing a flattened ECO trie.
+ *
+ * The trie is a single block holding this header followed by the nodes, the entries,
+ * the positions (sorted by hash) and the string pool, so it can be copied as is into
+ * shared memory. Arrays are addressed by their offset from the start of the block.
+ *
+ * @param size Total size of the block.
+ * @param nNodes Number of trie nodes.
+ * @param nEntries Number of ECO lines.
+ * @param nPositions Number of line end positions.
+ * @param maxPlies The number of half-moves of the longest line.
+ * @param nodes Offset of the nodes.
+ * @param entries Offset of the entries.
+ * @param positions Offset of the positions.
+ * @param strings Offset of the string pool.
+ */
+typedef struct
+{
+    Size size;
+    int32 nNodes;
+    int32 nEntries;
+    int32 nPositions;
+    int32 maxPlies;
+    Size nodes;
+    Size entries;
+    Size positions;
+    Size strings;
+} EcoTrie;
+
+#define ECO_TRIE_NODES(t) ((const EcoTrieNode *) ((const char *) (t) + (t)->nodes))
+#define ECO_TRIE_ENTRIES(t) ((const EcoEntry *) ((const char *) (t) + (t)->entries))
+#define ECO_TRIE_POSITIONS(t) ((const EcoPosition *) ((const char *) (t) + (t)->positions))
+#define ECO_TRIE_STRING(t, offset) ((const char *) (t) + (t)->strings + (offset))
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+void eco_init(void);
+EcoTrie *eco_trie_build(const char *path, int elevel);
+const EcoTrie *eco_trie_get(void);
+int eco_classify(const EcoTrie *trie, SAN *game);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+// Path of the ECO table ('chess.eco_file'); empty for the table installed with the extension.
+static char *chess_eco_file = NULL;
+
+// The ECO trie in use, in shared memory or in backend memory.
+static const EcoTrie *ecoTrie = NULL;
+
+// The trie built by the postmaster, copied into shared memory at startup.
+static EcoTrie *ecoPreloadTrie = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type eco_prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type eco_prev_shmem_startup_hook = NULL;
+
+/**
+ * Returns the path of the ECO table.
+ */
+static char *eco_file_path(void)
+{
+    char sharePath[MAXPGPATH];
+
+    if (chess_eco_file != NULL && chess_eco_file[0] != '\0')
+        return pstrdup(chess_eco_file);
+
+    get_share_path(my_exec_path, sharePath);
+
+    return psprintf("%s/extension/%s", sharePath, ECO_DEFAULT_FILE);
+}
+
+/**
+ * Computes the length of the position key of a FEN or EPD string.
+ *
+ * The key is made of the board positions and the side to move, so positions
+ * reached with other castling rights or move counters still match.
+ */
+static int eco_position_key_length(const char *fenStr)
+{
+    int length = strcspn(fenStr, " ");
+
+    if (fenStr[length] == ' ')
+        length += 1 + strcspn(fenStr + length + 1, " ");
+
+    return length;
+}
+
+/**
+ * Orders ECO positions by hash, then by line.
+ */
+static int eco_position_cmp(const void *a, const void *b)
+{
+    const EcoPosition *posA = (const EcoPosition *) a;
+    const EcoPosition *posB = (const EcoPosition *) b;
+
+    if (posA->hash != posB->hash)
+        return posA->hash > posB->hash ? 1 : -1;
+
+    return (posA->entry > posB->entry) - (posA->entry < posB->entry);
+}
+
+/**
+ * Splits a line of the ECO table into its tab-separated fields (in place).
+ *
+ * @return The number of fields.
+ */
+static int eco_split_fields(char *line, char **fields, int maxFields)
+{
+    int count = 0;
+
+    line[strcspn(line, "\r\n")] = '\0';
+
+    while (count < maxFields) {
+        fields[count++] = line;
+        line = strchr(line, '\t');
+
+        if (line == NULL)
+            break;
+
+        *line++ = '\0';
+    }
+
+    return count;
+}
+
+/**
+ * Builds the ECO trie from a table file.
+ *
+ * The first line names the columns; 'eco', 'name' and 'pgn' are required and 'epd'
+ * is optional. Lines are added in file order, so when two lines end on the same
+ * node or position the first one is kept.
+ *
+ * @param path The path of the table.
+ * @param elevel The level of the error reported when the table cannot be read.
+ * @return A palloc'd flattened trie, or NULL if the table cannot be read (and elevel allows it).
+ */
+EcoTrie *eco_trie_build(const char *path, int elevel)
+{
+    FILE *file;
+    StringInfoData line, strings;
+    char *fields[16];
+    int ecoCol = -1, nameCol = -1, pgnCol = -1, epdCol = -1;
+    int nFields, lineNo = 1;
+    EcoTrieNode *nodes;
+    EcoEntry *entries;
+    EcoPosition *positions;
+    int nNodes = 1, nEntries = 0, nPositions = 0, maxPlies = 0;
+    int maxNodes = 256, maxEntries = 64;
+    EcoTrie *trie;
+    Size size;
+
+    file = AllocateFile(path, "r");
+
+    if (file == NULL) {
+        ereport(elevel,
+                (errcode_for_file_access(),
+                 errmsg("could not open ECO table \"%s\": %m", path)));
+        return NULL;
+    }
+
+    initStringInfo(&line);
+    initStringInfo(&strings);
+    appendStringInfoChar(&strings, '\0');
+
+    if (!pg_get_line_buf(file, &line)) {
+        FreeFile(file);
+        ereport(elevel, (errmsg("ECO table \"%s\" is empty", path)));
+        return NULL;
+    }
+
+    nFields = eco_split_fields(line.data, fields, lengthof(fields));
+
+    for (int i = 0; i < nFields; i++) {
+        if (strcmp(fields[i], "eco") == 0)
+            ecoCol = i;
+        else if (strcmp(fields[i], "name") == 0)
+            nameCol = i;
+        else if (strcmp(fields[i], "pgn") == 0)
+            pgnCol = i;
+        else if (strcmp(fields[i], "epd") == 0)
+            epdCol = i;
+    }
+
+    if (ecoCol < 0 || nameCol < 0 || pgnCol < 0) {
+        FreeFile(file);
+        ereport(elevel,
+                (errmsg("ECO table \"%s\" must have \"eco\", \"name\" and \"pgn\" columns", path)));
+        return NULL;
+    }
+
+    nodes = (EcoTrieNode *) palloc(maxNodes * sizeof(EcoTrieNode));
+    entries = (EcoEntry *) palloc(maxEntries * sizeof(EcoEntry));
+    positions = (EcoPosition *) palloc(maxEntries * sizeof(EcoPosition));
+
+    nodes[0].firstChild = nodes[0].nextSibling = nodes[0].entry = -1;
+    nodes[0].token = nodes[0].tokenLen = 0;
+
+    while (pg_get_line_buf(file, &line)) {
+        MoveToken *moves;
+        int nMoves, node = 0;
+        EcoEntry *entry;
+
+        lineNo++;
+        nFields = eco_split_fields(line.data, fields, lengthof(fields));
+
+        if (nFields == 1 && fields[0][0] == '\0')
+            continue;
+
+        if (nFields <= Max(Max(ecoCol, nameCol), Max(pgnCol, epdCol)) || strlen(fields[ecoCol]) != 3) {
+            FreeFile(file);
+            ereport(elevel, (errmsg("invalid ECO table line %d in \"%s\"", lineNo, path)));
+            return NULL;
+        }
+
+        if (nEntries == maxEntries) {
+            maxEntries *= 2;
+            entries = (EcoEntry *) repalloc(entries, maxEntries * sizeof(EcoEntry));
+            positions = (EcoPosition *) repalloc(positions, maxEntries * sizeof(EcoPosition));
+        }
+
+        entry = &entries[nEntries];
+        memcpy(entry->code, fields[ecoCol], 4);
+        entry->name = strings.len;
+        appendStringInfoString(&strings, fields[nameCol]);
+        appendStringInfoChar(&strings, '\0');
+
+        // Follow the moves of the line down the trie, adding the missing nodes.
+        nMoves = move_mainline_tokens(fields[pgnCol], &moves);
+        entry->plies = nMoves;
+        maxPlies = Max(maxPlies, nMoves);
+
+        for (int i = 0; i < nMoves; i++) {
+            int child = nodes[node].firstChild;
+
+            while (child >= 0 && (nodes[child].tokenLen != moves[i].len ||
+                                  memcmp(strings.data + nodes[child].token, moves[i].str, moves[i].len) != 0))
+                child = nodes[child].nextSibling;
+
+            if (child < 0) {
+                if (nNodes == maxNodes) {
+                    maxNodes *= 2;
+                    nodes = (EcoTrieNode *) repalloc(nodes, maxNodes * sizeof(EcoTrieNode));
+                }
+
+                child = nNodes++;
+                nodes[child].firstChild = nodes[child].entry = -1;
+                nodes[child].nextSibling = nodes[node].firstChild;
+                nodes[child].token = strings.len;
+                nodes[child].tokenLen = moves[i].len;
+                nodes[node].firstChild = child;
+                appendBinaryStringInfo(&strings, moves[i].str, moves[i].len);
+            }
+
+            node = child;
+        }
+
+        pfree(moves);
+
+        if (nodes[node].entry < 0)
+            nodes[node].entry = nEntries;
+
+        if (epdCol >= 0 && fields[epdCol][0] != '\0') {
+            int keyLength = eco_position_key_length(fields[epdCol]);
+
+            positions[nPositions].hash = hash_bytes((const unsigned char *) fields[epdCol], keyLength);
+            positions[nPositions].entry = nEntries;
+            positions[nPositions].key = strings.len;
+            appendBinaryStringInfo(&strings, fields[epdCol], keyLength);
+            appendStringInfoChar(&strings, '\0');
+            nPositions++;
+        }
+
+        nEntries++;
+    }
+
+    FreeFile(file);
+
+    qsort(positions, nPositions, sizeof(EcoPosition), eco_position_cmp);
+
+    // Flatten the trie into a single block.
+    size = MAXALIGN(sizeof(EcoTrie));
+    trie = (EcoTrie *) palloc0(size + MAXALIGN(nNodes * sizeof(EcoTrieNode)) +
+                               MAXALIGN(nEntries * sizeof(EcoEntry)) +
+                               MAXALIGN(nPositions * sizeof(EcoPosition)) + MAXALIGN(strings.len));
+
+    trie->nNodes = nNodes;
+    trie->nEntries = nEntries;
+    trie->nPositions = nPositions;
+    trie->maxPlies = maxPlies;
+
+    trie->nodes = size;
+    memcpy((char *) trie + size, nodes, nNodes * sizeof(EcoTrieNode));
+    size += MAXALIGN(nNodes * sizeof(EcoTrieNode));
+
+    trie->entries = size;
+    memcpy((char *) trie + size, entries, nEntries * sizeof(EcoEntry));
+    size += MAXALIGN(nEntries * sizeof(EcoEntry));
+
+    trie->positions = size;
+    memcpy((char *) trie + size, positions, nPositions * sizeof(EcoPosition));
+    size += MAXALIGN(nPositions * sizeof(EcoPosition));
+
+    trie->strings = size;
+    memcpy((char *) trie + size, strings.data, strings.len);
+    size += MAXALIGN(strings.len);
+
+    trie->size = size;
+
+    pfree(nodes);
+    pfree(entries);
+    pfree(positions);
+    pfree(strings.data);
+    pfree(line.data);
+
+    return trie;
+}
+
+/**
+ * Builds the ECO trie from the configured table into long-lived memory.
+ *
+ * @param elevel The level of the error reported when the table cannot be read.
+ * @return The trie, allocated in TopMemoryContext, or NULL.
+ */
+static EcoTrie *eco_trie_load(int elevel)
+{
+    char *path = eco_file_path();
+    EcoTrie *trie = eco_trie_build(path, elevel);
+    EcoTrie *result = NULL;
+
+    if (trie != NULL) {
+        result = (EcoTrie *) MemoryContextAlloc(TopMemoryContext, trie->size);
+        memcpy(result, trie, trie->size);
+        pfree(trie);
+    }
+
+    pfree(path);
+
+    return result;
+}
+
+/**
+ * Builds the ECO trie in the postmaster and requests the shared memory holding it.
+ */
+static void eco_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+    if (eco_prev_shmem_request_hook)
+        eco_prev_shmem_request_hook();
+#endif
+
+    ecoPreloadTrie = eco_trie_load(WARNING);
+
+    if (ecoPreloadTrie != NULL)
+        RequestAddinShmemSpace(MAXALIGN(ecoPreloadTrie->size));
+}
+
+/**
+ * Copies (or attaches to) the ECO trie in shared memory.
+ */
+static void eco_shmem_startup(void)
+{
+    EcoTrie *shared;
+    bool found;
+
+    if (eco_prev_shmem_startup_hook)
+        eco_prev_shmem_startup_hook();
+
+    if (ecoPreloadTrie == NULL)
+        return;
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+    shared = ShmemInitStruct("chess eco trie", ecoPreloadTrie->size, &found);
+
+    if (!found)
+        memcpy(shared, ecoPreloadTrie, ecoPreloadTrie->size);
+
+    LWLockRelease(AddinShmemInitLock);
+
+    ecoTrie = shared;
+}
+
+/**
+ * Defines the ECO settings and, when preloaded, installs the shared memory hooks.
+ *
+ * Called once from _PG_init.
+ */
+void eco_init(void)
+{
+    DefineCustomStringVariable("chess.eco_file",
+                               "Path of the ECO table used to classify games.",
+                               "Empty for the table installed with the extension.",
+                               &chess_eco_file,
+                               "",
+                               PGC_POSTMASTER,
+                               0,
+                               NULL, NULL, NULL);
+
+    if (!process_shared_preload_libraries_in_progress)
+        return;
+
+#if PG_VERSION_NUM >= 150000
+    eco_prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = eco_shmem_request;
+#else
+    eco_shmem_request();
+#endif
+
+    eco_prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = eco_shmem_startup;
+}
+
+/**
+ * Returns the ECO trie, building a backend copy if it is not in shared memory.
+ */
+const EcoTrie *eco_trie_get(void)
+{
+    if (ecoTrie == NULL)
+        ecoTrie = eco_trie_load(ERROR);
+    else
+        chess_stats_count(CHESS_STAT_CACHE_HITS, 1);
+
+    return ecoTrie;
+}
+
+/**
+ * Finds the ECO line ending in the position of a FEN string.
+ *
+ * @return The ECO line, or -1 if none ends in this position.
+ */
+static int eco_lookup_position(const EcoTrie *trie, const char *fenStr)
+{
+    const EcoPosition *positions = ECO_TRIE_POSITIONS(trie);
+    int keyLength = eco_position_key_length(fenStr);
+    uint32 hash = hash_bytes((const unsigned char *) fenStr, keyLength);
+    int low = 0, high = trie->nPositions;
+
+    // Find the first position with this hash, then compare the keys.
+    while (low < high) {
+        int middle = (low + high) / 2;
+
+        if (positions[middle].hash < hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    for (; low < trie->nPositions && positions[low].hash == hash; low++) {
+        const char *key = ECO_TRIE_STRING(trie, positions[low].key);
+
+        if ((int) strlen(key) == keyLength && strncmp(key, fenStr, keyLength) == 0)
+            return positions[low].entry;
+    }
+
+    return -1;
+}
+
+/**
+ * Classifies a game by its longest matching ECO line.
+ *
+ * The mainline moves of the game are first walked down the trie. Unless the game
+ * followed the table until its last move, its opening is then replayed (up to the
+ * length of the longest line) and its positions looked up, deepest first, so a game
+ * transposing into a longer line by another move order gets that line.
+ *
+ * @param trie The ECO trie.
+ * @param game The game to classify.
+ * @return The ECO line, or -1 if the game matches none.
+ */
+int eco_classify(const EcoTrie *trie, SAN *game)
+{
+    const EcoTrieNode *nodes = ECO_TRIE_NODES(trie);
+    const EcoEntry *entries = ECO_TRIE_ENTRIES(trie);
+    MoveToken *moves;
+    int nMoves, node = 0, matched = 0;
+    int best = -1, bestPlies = 0;
+
+    nMoves = move_mainline_tokens(game->data, &moves);
+
+    for (; matched < nMoves; matched++) {
+        int child = nodes[node].firstChild;
+
+        while (child >= 0 && (nodes[child].tokenLen != moves[matched].len ||
+                              memcmp(ECO_TRIE_STRING(trie, nodes[child].token), moves[matched].str,
+                                     moves[matched].len) != 0))
+            child = nodes[child].nextSibling;
+
+        if (child < 0)
+            break;
+
+        node = child;
+
+        if (nodes[node].entry >= 0) {
+            best = nodes[node].entry;
+            bestPlies = entries[best].plies;
+        }
+    }
+
+    pfree(moves);
+
+    if (trie->nPositions > 0 && matched < nMoves && bestPlies < trie->maxPlies) {
+        MemoryContext replayContext = replay_context_create();
+        MemoryContext oldContext = MemoryContextSwitchTo(replayContext);
+        SAN *opening = truncate_san(game, trie->maxPlies);
+        char **fens;
+        int nFens;
+
+        fens = san_to_fens(opening != NULL ? opening : game, &nFens);
+        MemoryContextSwitchTo(oldContext);
+
+        for (int ply = nFens - 1; ply > bestPlies; ply--) {
+            int entry = eco_lookup_position(trie, fens[ply]);
+
+            if (entry >= 0 && entries[entry].plies > bestPlies) {
+                best = entry;
+                break;
+            }
+        }
+
+        MemoryContextDelete(replayContext);
+    }
+
+    return best;
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //ECO_H
@@ -2,17 +2,21 @@
  * Mapping SAN to FEN
  *      Conversion of Standard Algebraic Notation (SAN) to Forsyth-Edwards Notation (FEN).
  *
- * This file contains a function to convert chess game data from SAN format to FEN format.
- * It uses embedded Python scripting to leverage the 'chess' library for the conversion.
+ * This file contains the functions converting chess game data from SAN format to
+ * FEN format. Games are replayed by the native move engine (move_engine.h) over
+ * their mainline moves; comments, variations and annotations are skipped.
  *
  */
 
 #include "postgres.h"
+#include "miscadmin.h"
 #include "utils/elog.h"
+#include "utils/memutils.h"
 #include "DataTypes/SAN/SAN.h"
-
-#define PY_SSIZE_T_CLEAN
-#include <python3.11/Python.h>
+#include "DataTypes/FEN/FEN.h"
+#include "Utils/chess_stats.h"
+#include "Utils/move_engine.h"
+#include "Utils/move_ngrams.h"
 
 
 #ifndef MAPPING_SAN_TO_FAN
@@ -21,88 +25,136 @@
 //---------------------------------------------------------------------FUNCTION DECLARATION------------------------------------------------------------------------//
 
 const char* san_to_fen(SAN *gameTruncated);
+bool san_to_board(SAN *game, ChessBoard *board, int *plies);
+char** san_to_fens(SAN *game, int *nFens);
+MemoryContext replay_context_create(void);
 
 //---------------------------------------------------------------------FUNCTION IMPLEMENTATION---------------------------------------------------------------------//
 
 /**
- * Converts a chess game from SAN to FEN format using Python.
+ * Converts a chess game from SAN to FEN format.
  *
- * This function takes a SAN structure representing a chess game and uses embedded
- * Python with the 'chess' library to convert it into the FEN format. It initializes
- * the Python interpreter, defines a Python function for conversion, and executes it.
+ * The mainline moves of the game are played from the initial position, up to the
+ * first move that cannot be played, and the final position is formatted.
  *
  * @param gameTruncated A pointer to the SAN structure representing the chess game.
- * @return A pointer to a string containing the game in FEN format.
- *         Returns NULL if conversion fails.
+ * @return A palloc'd string containing the final position in FEN format.
  */
 const char* san_to_fen(SAN *gameTruncated) 
 {
-    // Initialize variables for Python interaction.
-    PyObject *pModule, *pFunc, *pArgs, *pValue;
-    const char *result = NULL;
-
-    // Initialize the Python interpreter.
-    Py_Initialize();
-
-    // Define the Python function for SAN to FEN conversion.
-    PyRun_SimpleString(
-        "import chess\n"
-        "import chess.pgn\n"
-        "import io\n"
-        "def get_fen_from_san(san):\n"
-        "    if not san.strip():\n"
-        "       return 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1'  # Default FEN for empty input\n"
-        "    game = chess.pgn.read_game(io.StringIO(san))\n"
-        "    board = game.board()\n"
-        "    for move in game.mainline_moves():\n"
-        "        board.push(move)\n"
-        "    return board.fen()\n"
-    );
-
-    // Add the defined Python function to the '__main__' module.
-    pModule = PyImport_AddModule("__main__");
-
-    // Check if the Python function is loaded and callable.
-    if (pModule != NULL) {
-        pFunc = PyObject_GetAttrString(pModule, "get_fen_from_san");
-        if (pFunc && PyCallable_Check(pFunc)) {
-            // Prepare the arguments for the Python function call.
-            pArgs = PyTuple_New(1);
-            PyTuple_SetItem(pArgs, 0, PyUnicode_FromString(gameTruncated->data));
-            
-            // Call the Python function and retrieve the result.
-            pValue = PyObject_CallObject(pFunc, pArgs);
-            Py_DECREF(pArgs);
-
-            if (pValue != NULL) {
-                // Convert the Python string result to C string.
-                result = PyUnicode_AsUTF8(pValue);
-                Py_DECREF(pValue);
-            } else {
-                // Handle Python call failure.
-                Py_DECREF(pFunc);
-                PyErr_Print();
-                ereport(ERROR, (errmsg("Call to 'get_fen_from_san' failed")));
-            }
-        } else {
-            // Handle errors related to function loading or callability.
-            if (PyErr_Occurred())
-                PyErr_Print();
-            ereport(ERROR, (errmsg("Cannot find function 'get_fen_from_san'")));
-        }
-        Py_XDECREF(pFunc);
-    } else {
-        // Handle errors in loading the '__main__' module.
-        PyErr_Print();
-        ereport(ERROR, (errmsg("Failed to load '__main__' module")));
+    ChessBoard board;
+    MoveToken *moves;
+    int nMoves, played = 0;
+    char *result = (char *) palloc(FEN_STR_LENGTH);
+
+    board_init(&board);
+    nMoves = move_mainline_tokens(gameTruncated->data, &moves);
+
+    while (played < nMoves && board_play_san(&board, moves[played].str, moves[played].len))
+        played++;
+
+    board_to_fen(&board, result);
+
+    pfree(moves);
+
+    // Account for the replay in the extension statistics.
+    chess_stats_count(CHESS_STAT_REPLAYS, 1);
+    chess_stats_count(CHESS_STAT_PLIES_REPLAYED, played);
+
+    return result;
+}
+
+/**
+ * Replays the mainline moves of a chess game.
+ *
+ * @param game A pointer to the SAN structure representing the chess game.
+ * @param board Set to the position after the last move played.
+ * @param plies Set to the number of half-moves played.
+ * @return true if all the moves were played, false if the replay stopped at a move
+ *         that cannot be played.
+ */
+bool san_to_board(SAN *game, ChessBoard *board, int *plies)
+{
+    MoveToken *moves;
+    int nMoves;
+
+    board_init(board);
+    nMoves = move_mainline_tokens(game->data, &moves);
+    *plies = 0;
+
+    while (*plies < nMoves && board_play_san(board, moves[*plies].str, moves[*plies].len))
+        (*plies)++;
+
+    pfree(moves);
+
+    // Account for the replay in the extension statistics.
+    chess_stats_count(CHESS_STAT_REPLAYS, 1);
+    chess_stats_count(CHESS_STAT_PLIES_REPLAYED, *plies);
+
+    return *plies == nMoves;
+}
+
+/**
+ * Converts a chess game from SAN to the list of FEN board states it goes through.
+ *
+ * Unlike san_to_fen, which has to be called once per truncated game, this function
+ * replays the game a single time and collects the FEN of the initial position and
+ * of the position after each half-move, up to the first move that cannot be played.
+ *
+ * @param game A pointer to the SAN structure representing the chess game.
+ * @param nFens Set to the number of FEN strings returned (half-moves + 1).
+ * @return A palloc'd array of palloc'd FEN strings, one per board state.
+ */
+char** san_to_fens(SAN *game, int *nFens)
+{
+    ChessBoard board;
+    MoveToken *moves;
+    int nMoves;
+    char **result;
+
+    board_init(&board);
+    nMoves = move_mainline_tokens(game->data, &moves);
+
+    result = (char **) palloc((nMoves + 1) * sizeof(char *));
+    result[0] = (char *) palloc(FEN_STR_LENGTH);
+    board_to_fen(&board, result[0]);
+    *nFens = 1;
+
+    for (int i = 0; i < nMoves; i++) {
+        CHECK_FOR_INTERRUPTS();
+
+        if (!board_play_san(&board, moves[i].str, moves[i].len))
+            break;
+
+        result[*nFens] = (char *) palloc(FEN_STR_LENGTH);
+        board_to_fen(&board, result[*nFens]);
+        (*nFens)++;
     }
 
-    // Finalize the Python interpreter.
-    Py_Finalize();
+    pfree(moves);
+
+    // Account for the replay in the extension statistics.
+    chess_stats_count(CHESS_STAT_REPLAYS, 1);
+    chess_stats_count(CHESS_STAT_PLIES_REPLAYED, *nFens - 1);
 
     return result;
 }
 
+/**
+ * Creates a short-lived memory context for replaying games.
+ *
+ * Everything allocated while replaying a game (truncated copies, FEN strings) is
+ * allocated in it, so that it is released at once by resetting the context after
+ * each game (or half-move) instead of piling up in the caller's context until the
+ * end of the tuple or of the index build.
+ *
+ * @return A new memory context, child of the current one.
+ */
+MemoryContext replay_context_create(void)
+{
+    return AllocSetContextCreate(CurrentMemoryContext, "chess replay", ALLOCSET_DEFAULT_SIZES);
+}
+
 //--------------------------------------------------------------END FUNCTION IMPLEMENTATION--------------------------------------------------------------------//
 
 #endif
\ No newline at end of file
@@ -0,0 +1,547 @@
+/*
+ * move_engine.h
+ *      Native replay of chess games written in Standard Algebraic Notation (SAN).
+ *
+ * A board is replayed move by move: each SAN move is resolved against the legal
+ * moves of the side to move (disambiguation, pins, castling through check, en
+ * passant, promotions) and the resulting position is formatted as a FEN string,
+ * field for field as python-chess does (the en passant square is only written when
+ * an en passant capture is legal). The replay stops at the first move that cannot
+ * be parsed or played, like the python-chess PGN reader it replaces. Everything is
+ * plain C without global state, so it is safe to run in parallel workers. It's part
+ * of a PostgreSQL extension for storing and querying chess games.
+ *
+ */
+
+// Also built into the pgn2copy tool, outside of the server.
+#ifdef FRONTEND
+#include "postgres_fe.h"
+#else
+#include "postgres.h"
+#endif
+#include <ctype.h>
+#include <string.h>
+
+#ifndef MOVE_ENGINE_H
+#define MOVE_ENGINE_H
+
+// Castling rights.
+#define CASTLE_WHITE_KINGSIDE 0x01
+#define CASTLE_WHITE_QUEENSIDE 0x02
+#define CASTLE_BLACK_KINGSIDE 0x04
+#define CASTLE_BLACK_QUEENSIDE 0x08
+
+// Squares are numbered from a1 (0) to h8 (63), rank by rank.
+#define BOARD_SQUARE(file, rank) ((rank) * 8 + (file))
+#define BOARD_FILE(square) ((square) % 8)
+#define BOARD_RANK(square) ((square) / 8)
+#define BOARD_NO_SQUARE (-1)
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+/**
+ * Structure representing a chess position being replayed.
+ *
+ * @param squares The piece on each square, as a FEN letter, or '\0' when empty.
+ * @param whiteToMove Whether White is to move.
+ * @param castling The castling rights (CASTLE_* flags).
+ * @param epSquare The square behind a pawn that just moved two squares, or BOARD_NO_SQUARE.
+ * @param halfmoveClock Half-moves since the last capture or pawn move.
+ * @param fullmoveNumber The move number, incremented after Black's move.
+ */
+typedef struct
+{
+    char squares[64];
+    bool whiteToMove;
+    uint8 castling;
+    int epSquare;
+    int halfmoveClock;
+    int fullmoveNumber;
+} ChessBoard;
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+void board_init(ChessBoard *board);
+bool board_play_san(ChessBoard *board, const char *san, int len);
+void board_to_fen(const ChessBoard *board, char *fen);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+/**
+ * Sets up the initial position.
+ */
+void board_init(ChessBoard *board)
+{
+    static const char backRank[] = "RNBQKBNR";
+
+    memset(board->squares, 0, sizeof(board->squares));
+
+    for (int file = 0; file < 8; file++) {
+        board->squares[BOARD_SQUARE(file, 0)] = backRank[file];
+        board->squares[BOARD_SQUARE(file, 1)] = 'P';
+        board->squares[BOARD_SQUARE(file, 6)] = 'p';
+        board->squares[BOARD_SQUARE(file, 7)] = (char) tolower(backRank[file]);
+    }
+
+    board->whiteToMove = true;
+    board->castling = CASTLE_WHITE_KINGSIDE | CASTLE_WHITE_QUEENSIDE | CASTLE_BLACK_KINGSIDE | CASTLE_BLACK_QUEENSIDE;
+    board->epSquare = BOARD_NO_SQUARE;
+    board->halfmoveClock = 0;
+    board->fullmoveNumber = 1;
+}
+
+/**
+ * Checks if a piece belongs to White.
+ */
+static inline bool board_is_white(char piece)
+{
+    return piece >= 'A' && piece <= 'Z';
+}
+
+/**
+ * Checks if a square is attacked by a side.
+ *
+ * @param board The position.
+ * @param square The square.
+ * @param byWhite Whether the attacking side is White.
+ * @return true if a piece of the side attacks the square.
+ */
+static bool board_is_attacked(const ChessBoard *board, int square, bool byWhite)
+{
+    static const int knightSteps[8][2] = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+    static const int kingSteps[8][2] = {{1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+    int file = BOARD_FILE(square), rank = BOARD_RANK(square);
+    char pawn = byWhite ? 'P' : 'p', knight = byWhite ? 'N' : 'n', king = byWhite ? 'K' : 'k';
+    char bishop = byWhite ? 'B' : 'b', rook = byWhite ? 'R' : 'r', queen = byWhite ? 'Q' : 'q';
+    int pawnRank = rank + (byWhite ? -1 : 1);
+
+    // Pawns attack diagonally forward, so they stand one rank behind the square.
+    if (pawnRank >= 0 && pawnRank < 8) {
+        if (file > 0 && board->squares[BOARD_SQUARE(file - 1, pawnRank)] == pawn)
+            return true;
+        if (file < 7 && board->squares[BOARD_SQUARE(file + 1, pawnRank)] == pawn)
+            return true;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        int f = file + knightSteps[i][0], r = rank + knightSteps[i][1];
+
+        if (f >= 0 && f < 8 && r >= 0 && r < 8 && board->squares[BOARD_SQUARE(f, r)] == knight)
+            return true;
+
+        f = file + kingSteps[i][0];
+        r = rank + kingSteps[i][1];
+
+        if (f >= 0 && f < 8 && r >= 0 && r < 8 && board->squares[BOARD_SQUARE(f, r)] == king)
+            return true;
+    }
+
+    // Sliding pieces: the first piece met in each direction.
+    for (int i = 0; i < 8; i++) {
+        int df = kingSteps[i][0], dr = kingSteps[i][1];
+        bool diagonal = df != 0 && dr != 0;
+        int f = file + df, r = rank + dr;
+
+        while (f >= 0 && f < 8 && r >= 0 && r < 8) {
+            char piece = board->squares[BOARD_SQUARE(f, r)];
+
+            if (piece != '\0') {
+                if (piece == queen || piece == (diagonal ? bishop : rook))
+                    return true;
+                break;
+            }
+
+            f += df;
+            r += dr;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Checks if the king of a side is in check.
+ */
+static bool board_in_check(const ChessBoard *board, bool white)
+{
+    char king = white ? 'K' : 'k';
+
+    for (int square = 0; square < 64; square++) {
+        if (board->squares[square] == king)
+            return board_is_attacked(board, square, !white);
+    }
+
+    return false;
+}
+
+/**
+ * Checks if the path between two squares on a line or diagonal is empty.
+ */
+static bool board_path_clear(const ChessBoard *board, int from, int to)
+{
+    int df = BOARD_FILE(to) - BOARD_FILE(from), dr = BOARD_RANK(to) - BOARD_RANK(from);
+    int stepF = (df > 0) - (df < 0), stepR = (dr > 0) - (dr < 0);
+    int f = BOARD_FILE(from) + stepF, r = BOARD_RANK(from) + stepR;
+
+    while (BOARD_SQUARE(f, r) != to) {
+        if (board->squares[BOARD_SQUARE(f, r)] != '\0')
+            return false;
+
+        f += stepF;
+        r += stepR;
+    }
+
+    return true;
+}
+
+/**
+ * Checks if a piece can move from a square to another, regardless of pins.
+ *
+ * @param board The position.
+ * @param from The square of the piece of the side to move.
+ * @param to The destination square, empty or holding a piece of the other side.
+ * @return true if the move follows the movement rules of the piece.
+ */
+static bool board_can_reach(const ChessBoard *board, int from, int to)
+{
+    char piece = (char) toupper(board->squares[from]);
+    int df = BOARD_FILE(to) - BOARD_FILE(from), dr = BOARD_RANK(to) - BOARD_RANK(from);
+    int adf = Abs(df), adr = Abs(dr);
+
+    switch (piece) {
+        case 'P': {
+            int forward = board->whiteToMove ? 1 : -1;
+            int startRank = board->whiteToMove ? 1 : 6;
+
+            if (df == 0) {
+                if (board->squares[to] != '\0')
+                    return false;
+                if (dr == forward)
+                    return true;
+                return dr == 2 * forward && BOARD_RANK(from) == startRank &&
+                       board->squares[from + 8 * forward] == '\0';
+            }
+
+            return adf == 1 && dr == forward && (board->squares[to] != '\0' || to == board->epSquare);
+        }
+        case 'N':
+            return (adf == 1 && adr == 2) || (adf == 2 && adr == 1);
+        case 'B':
+            return adf == adr && adf > 0 && board_path_clear(board, from, to);
+        case 'R':
+            return (df == 0) != (dr == 0) && board_path_clear(board, from, to);
+        case 'Q':
+            return ((adf == adr && adf > 0) || (df == 0) != (dr == 0)) && board_path_clear(board, from, to);
+        case 'K':
+            return adf <= 1 && adr <= 1 && (adf + adr) > 0;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Removes the castling rights lost by a move touching a square.
+ */
+static void board_update_castling(ChessBoard *board, int square)
+{
+    if (square == BOARD_SQUARE(4, 0))
+        board->castling &= ~(CASTLE_WHITE_KINGSIDE | CASTLE_WHITE_QUEENSIDE);
+    else if (square == BOARD_SQUARE(7, 0))
+        board->castling &= ~CASTLE_WHITE_KINGSIDE;
+    else if (square == BOARD_SQUARE(0, 0))
+        board->castling &= ~CASTLE_WHITE_QUEENSIDE;
+    else if (square == BOARD_SQUARE(4, 7))
+        board->castling &= ~(CASTLE_BLACK_KINGSIDE | CASTLE_BLACK_QUEENSIDE);
+    else if (square == BOARD_SQUARE(7, 7))
+        board->castling &= ~CASTLE_BLACK_KINGSIDE;
+    else if (square == BOARD_SQUARE(0, 7))
+        board->castling &= ~CASTLE_BLACK_QUEENSIDE;
+}
+
+/**
+ * Plays a move known to follow the movement rules, updating every FEN field.
+ *
+ * Castling is played as the king move, the rook follows.
+ *
+ * @param board The position to update.
+ * @param from The origin square.
+ * @param to The destination square.
+ * @param promotion The promotion piece ('Q', 'R', 'B', 'N'), or '\0'.
+ */
+static void board_apply(ChessBoard *board, int from, int to, char promotion)
+{
+    char piece = board->squares[from];
+    bool pawn = toupper(piece) == 'P';
+    bool capture = board->squares[to] != '\0';
+
+    // An en passant capture removes the pawn behind the destination square.
+    if (pawn && to == board->epSquare && BOARD_FILE(from) != BOARD_FILE(to)) {
+        board->squares[BOARD_SQUARE(BOARD_FILE(to), BOARD_RANK(from))] = '\0';
+        capture = true;
+    }
+
+    if (toupper(piece) == 'K' && Abs(BOARD_FILE(to) - BOARD_FILE(from)) == 2) {
+        int rank = BOARD_RANK(from);
+        bool kingside = BOARD_FILE(to) > BOARD_FILE(from);
+        int rookFrom = BOARD_SQUARE(kingside ? 7 : 0, rank), rookTo = BOARD_SQUARE(kingside ? 5 : 3, rank);
+
+        board->squares[rookTo] = board->squares[rookFrom];
+        board->squares[rookFrom] = '\0';
+    }
+
+    board->squares[to] = promotion != '\0' ? (board->whiteToMove ? promotion : (char) tolower(promotion)) : piece;
+    board->squares[from] = '\0';
+
+    board_update_castling(board, from);
+    board_update_castling(board, to);
+
+    board->epSquare = (pawn && Abs(to - from) == 16) ? (from + to) / 2 : BOARD_NO_SQUARE;
+    board->halfmoveClock = (pawn || capture) ? 0 : board->halfmoveClock + 1;
+
+    if (!board->whiteToMove)
+        board->fullmoveNumber++;
+
+    board->whiteToMove = !board->whiteToMove;
+}
+
+/**
+ * Checks if a move leaves the king of the side to move out of check.
+ */
+static bool board_is_legal(const ChessBoard *board, int from, int to)
+{
+    ChessBoard next = *board;
+
+    board_apply(&next, from, to, '\0');
+
+    return !board_in_check(&next, board->whiteToMove);
+}
+
+/**
+ * Plays a castling move if it is legal.
+ *
+ * @param board The position to update.
+ * @param kingside Whether to castle kingside rather than queenside.
+ * @return true if the move was played.
+ */
+static bool board_castle(ChessBoard *board, bool kingside)
+{
+    int rank = board->whiteToMove ? 0 : 7;
+    uint8 right = board->whiteToMove ? (kingside ? CASTLE_WHITE_KINGSIDE : CASTLE_WHITE_QUEENSIDE)
+                                     : (kingside ? CASTLE_BLACK_KINGSIDE : CASTLE_BLACK_QUEENSIDE);
+    int king = BOARD_SQUARE(4, rank);
+
+    if (!(board->castling & right))
+        return false;
+
+    // The squares between the king and the rook must be empty.
+    for (int file = kingside ? 5 : 1; file <= (kingside ? 6 : 3); file++) {
+        if (board->squares[BOARD_SQUARE(file, rank)] != '\0')
+            return false;
+    }
+
+    // The king may not castle out of, through or into check.
+    for (int file = 4; file != (kingside ? 7 : 1); file += kingside ? 1 : -1) {
+        if (board_is_attacked(board, BOARD_SQUARE(file, rank), !board->whiteToMove))
+            return false;
+    }
+
+    board_apply(board, king, BOARD_SQUARE(kingside ? 6 : 2, rank), '\0');
+
+    return true;
+}
+
+/**
+ * Plays a move written in SAN.
+ *
+ * The move is resolved against the legal moves of the side to move: exactly one
+ * of them must match the piece, the destination, the disambiguation and the
+ * promotion. Check, capture and annotation marks are not verified.
+ *
+ * @param board The position to update.
+ * @param san The move, without move number.
+ * @param len The length of the move.
+ * @return true if the move was played, false if it is malformed, illegal or ambiguous.
+ */
+bool board_play_san(ChessBoard *board, const char *san, int len)
+{
+    char piece = 'P', promotion = '\0';
+    int fromFile = -1, fromRank = -1, to;
+    int pos = 0, from = BOARD_NO_SQUARE;
+
+    while (len > 0 && strchr("+#!?", san[len - 1]) != NULL)
+        len--;
+
+    if ((len == 3 && (strncmp(san, "O-O", 3) == 0 || strncmp(san, "0-0", 3) == 0)) ||
+        (len == 5 && (strncmp(san, "O-O-O", 5) == 0 || strncmp(san, "0-0-0", 5) == 0)))
+        return board_castle(board, len == 3);
+
+    if (len > 0 && strchr("NBKRQ", san[0]) != NULL)
+        piece = san[pos++];
+
+    // Promotion, with or without '='.
+    if (len - pos >= 3 && strchr("nbrqkNBRQK", san[len - 1]) != NULL) {
+        promotion = (char) toupper(san[len - 1]);
+        len -= (san[len - 2] == '=') ? 2 : 1;
+    }
+
+    if (len - pos < 2 || san[len - 2] < 'a' || san[len - 2] > 'h' || san[len - 1] < '1' || san[len - 1] > '8')
+        return false;
+
+    to = BOARD_SQUARE(san[len - 2] - 'a', san[len - 1] - '1');
+    len -= 2;
+
+    if (len > pos && (san[len - 1] == 'x' || san[len - 1] == '-'))
+        len--;
+
+    if (pos < len && san[pos] >= 'a' && san[pos] <= 'h')
+        fromFile = san[pos++] - 'a';
+
+    if (pos < len && san[pos] >= '1' && san[pos] <= '8')
+        fromRank = san[pos++] - '1';
+
+    if (pos != len)
+        return false;
+
+    // Pawn moves without an origin file stay on their file.
+    if (piece == 'P' && fromFile < 0)
+        fromFile = BOARD_FILE(to);
+
+    // Promotions are mandatory on the last rank, and only to a queen, rook, bishop or knight.
+    if (piece == 'P' && (BOARD_RANK(to) == (board->whiteToMove ? 7 : 0)) != (promotion != '\0'))
+        return false;
+
+    if (promotion == 'K' || (promotion != '\0' && piece != 'P'))
+        return false;
+
+    if (board->squares[to] != '\0' && board_is_white(board->squares[to]) == board->whiteToMove)
+        return false;
+
+    for (int square = 0; square < 64; square++) {
+        char own = board->squares[square];
+
+        if (own == '\0' || board_is_white(own) != board->whiteToMove || toupper(own) != piece)
+            continue;
+
+        if ((fromFile >= 0 && BOARD_FILE(square) != fromFile) || (fromRank >= 0 && BOARD_RANK(square) != fromRank))
+            continue;
+
+        if (!board_can_reach(board, square, to) || !board_is_legal(board, square, to))
+            continue;
+
+        // Ambiguous move.
+        if (from != BOARD_NO_SQUARE)
+            return false;
+
+        from = square;
+    }
+
+    if (from == BOARD_NO_SQUARE)
+        return false;
+
+    board_apply(board, from, to, promotion);
+
+    return true;
+}
+
+/**
+ * Checks if the side to move has a legal en passant capture.
+ */
+static bool board_has_legal_en_passant(const ChessBoard *board)
+{
+    char pawn = board->whiteToMove ? 'P' : 'p';
+    int rank, file;
+
+    if (board->epSquare == BOARD_NO_SQUARE)
+        return false;
+
+    rank = BOARD_RANK(board->epSquare) + (board->whiteToMove ? -1 : 1);
+    file = BOARD_FILE(board->epSquare);
+
+    for (int df = -1; df <= 1; df += 2) {
+        int square = BOARD_SQUARE(file + df, rank);
+
+        if (file + df < 0 || file + df > 7 || board->squares[square] != pawn)
+            continue;
+
+        if (board_is_legal(board, square, board->epSquare))
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Formats a position as a FEN string.
+ *
+ * @param board The position.
+ * @param fen The buffer receiving the string, of at least FEN_STR_LENGTH bytes.
+ */
+void board_to_fen(const ChessBoard *board, char *fen)
+{
+    char *p = fen;
+
+    for (int rank = 7; rank >= 0; rank--) {
+        int empty = 0;
+
+        for (int file = 0; file < 8; file++) {
+            char piece = board->squares[BOARD_SQUARE(file, rank)];
+
+            if (piece == '\0') {
+                empty++;
+                continue;
+            }
+
+            if (empty > 0)
+                *p++ = (char) ('0' + empty);
+
+            empty = 0;
+            *p++ = piece;
+        }
+
+        if (empty > 0)
+            *p++ = (char) ('0' + empty);
+
+        if (rank > 0)
+            *p++ = '/';
+    }
+
+    *p++ = ' ';
+    *p++ = board->whiteToMove ? 'w' : 'b';
+    *p++ = ' ';
+
+    if (board->castling == 0)
+        *p++ = '-';
+    if (board->castling & CASTLE_WHITE_KINGSIDE)
+        *p++ = 'K';
+    if (board->castling & CASTLE_WHITE_QUEENSIDE)
+        *p++ = 'Q';
+    if (board->castling & CASTLE_BLACK_KINGSIDE)
+        *p++ = 'k';
+    if (board->castling & CASTLE_BLACK_QUEENSIDE)
+        *p++ = 'q';
+
+    *p++ = ' ';
+
+    if (board_has_legal_en_passant(board)) {
+        *p++ = (char) ('a' + BOARD_FILE(board->epSquare));
+        *p++ = (char) ('1' + BOARD_RANK(board->epSquare));
+    } else {
+        *p++ = '-';
+    }
+
+    sprintf(p, " %d %d", board->halfmoveClock, board->fullmoveNumber);
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //MOVE_ENGINE_H
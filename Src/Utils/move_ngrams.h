@@ -0,0 +1,532 @@
+/*
+ * move_ngrams.h
+ *      Extraction of the move n-gram keys used by the san_moves_gin_ops index.
+ *
+ * The index stores the unigrams and bigrams of the normalized tokens of a game:
+ * move numbers and check/annotation suffixes are dropped, so '12.Bxh7+' and 'Bxh7'
+ * give the same key. Two token sequences are indexed:
+ *  - the whitespace-delimited tokens of the whole text, comments and variations
+ *    included, which makes LIKE searches on literal tokens index-backed;
+ *  - the mainline moves, which makes move sequence searches index-backed.
+ * The piece moves embedded anywhere in the text are indexed as well, so that
+ * substring patterns such as '%Bxh7+%' can use the index too.
+ * It's part of a PostgreSQL extension for storing and querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "common/hashfn.h"
+#include "lib/stringinfo.h"
+#include "utils/builtins.h"
+#include <ctype.h>
+#include <string.h>
+
+#ifndef MOVE_NGRAMS_H
+#define MOVE_NGRAMS_H
+
+// Prefixes of the unigram and bigram keys.
+#define MOVE_NGRAM_UNIGRAM "1:"
+#define MOVE_NGRAM_BIGRAM "2:"
+#define MOVE_NGRAM_PIECE_MOVE "3:"
+
+// Characters starting an embedded piece move, and characters continuing it.
+#define MOVE_PIECE_CHARS "KQRBN"
+#define MOVE_SQUARE_CHARS "abcdefgh12345678x"
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+/**
+ * Structure referencing a normalized token inside a string.
+ *
+ * @param str Start of the token.
+ * @param len Length of the token.
+ */
+typedef struct
+{
+    const char *str;
+    int len;
+} MoveToken;
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+int normalize_move_token(const char *token, int len, const char **start);
+int move_raw_tokens(const char *str, int len, MoveToken **tokens);
+int move_mainline_tokens(const char *str, MoveToken **tokens);
+bool move_tokens_contain(const MoveToken *game, int nGame, const MoveToken *moves, int nMoves);
+uint64 move_tokens_fingerprint(const MoveToken *moves, int nMoves);
+uint32 move_token_hash(const MoveToken *move);
+int piece_move_length(const char *str, int len);
+Datum *move_ngram_value_keys(const char *str, int32 *nkeys);
+Datum *move_ngram_sequence_keys(const MoveToken *moves, int nMoves, int32 *nkeys);
+Datum *move_ngram_like_keys(const char *pattern, int len, int32 *nkeys, bool **partial);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+/**
+ * Normalizes a token by dropping its move number prefix and check/annotation suffix.
+ *
+ * '12.Bxh7+' and '12...Bxh7!?' both give 'Bxh7'. A bare move number gives an empty token.
+ *
+ * @param token The token.
+ * @param len The length of the token.
+ * @param start Set to the start of the normalized token.
+ * @return The length of the normalized token.
+ */
+int normalize_move_token(const char *token, int len, const char **start)
+{
+    int begin = 0, end = len;
+
+    while (begin < len && isdigit((unsigned char) token[begin]))
+        begin++;
+
+    if (begin > 0 && begin < len && token[begin] == '.') {
+        while (begin < len && token[begin] == '.')
+            begin++;
+    } else {
+        begin = 0;
+    }
+
+    while (end > begin && strchr("+#!?", token[end - 1]) != NULL)
+        end--;
+
+    *start = token + begin;
+
+    return end - begin;
+}
+
+/**
+ * Splits a string into its normalized whitespace-delimited tokens.
+ *
+ * Tokens that are empty once normalized (bare move numbers) are left out.
+ *
+ * @param str The string to split.
+ * @param len The length of the string.
+ * @param tokens Set to a palloc'd array of tokens pointing into the string.
+ * @return The number of tokens.
+ */
+int move_raw_tokens(const char *str, int len, MoveToken **tokens)
+{
+    int count = 0;
+    int pos = 0;
+
+    *tokens = (MoveToken *) palloc((len / 2 + 1) * sizeof(MoveToken));
+
+    while (pos < len) {
+        int begin;
+
+        while (pos < len && isspace((unsigned char) str[pos]))
+            pos++;
+
+        begin = pos;
+
+        while (pos < len && !isspace((unsigned char) str[pos]))
+            pos++;
+
+        if (pos > begin) {
+            MoveToken *token = &(*tokens)[count];
+
+            token->len = normalize_move_token(str + begin, pos - begin, &token->str);
+
+            if (token->len > 0)
+                count++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Checks if a normalized token is a game result.
+ */
+static bool is_result_token(const char *token, int len)
+{
+    return (len == 1 && token[0] == '*') ||
+           (len == 3 && (strncmp(token, "1-0", 3) == 0 || strncmp(token, "0-1", 3) == 0)) ||
+           (len == 7 && strncmp(token, "1/2-1/2", 7) == 0);
+}
+
+/**
+ * Extracts the normalized mainline moves of a game.
+ *
+ * Comments ('{...}' and ';' to the end of the line), variations (nested parentheses),
+ * numeric annotation glyphs ('$n'), move numbers and results are left out.
+ *
+ * @param str The null-terminated game.
+ * @param tokens Set to a palloc'd array of tokens pointing into the string.
+ * @return The number of moves.
+ */
+int move_mainline_tokens(const char *str, MoveToken **tokens)
+{
+    const char *p = str;
+    int depth = 0;
+    int count = 0;
+
+    *tokens = (MoveToken *) palloc((strlen(str) / 2 + 1) * sizeof(MoveToken));
+
+    while (*p) {
+        const char *begin;
+        MoveToken *token;
+
+        if (*p == '{') {
+            while (*p && *p != '}')
+                p++;
+            if (*p)
+                p++;
+            continue;
+        }
+
+        if (*p == ';') {
+            while (*p && *p != '\n')
+                p++;
+            continue;
+        }
+
+        if (*p == '(' || *p == ')') {
+            depth += (*p == '(') ? 1 : (depth > 0 ? -1 : 0);
+            p++;
+            continue;
+        }
+
+        if (isspace((unsigned char) *p)) {
+            p++;
+            continue;
+        }
+
+        begin = p;
+
+        while (*p && !isspace((unsigned char) *p) && strchr("{};()", *p) == NULL)
+            p++;
+
+        if (depth > 0 || *begin == '$')
+            continue;
+
+        token = &(*tokens)[count];
+        token->len = normalize_move_token(begin, p - begin, &token->str);
+
+        if (token->len > 0 && !is_result_token(token->str, token->len))
+            count++;
+    }
+
+    return count;
+}
+
+/**
+ * Checks if a sequence of moves appears contiguously in a game.
+ *
+ * @param game The mainline moves of the game.
+ * @param nGame The number of moves of the game.
+ * @param moves The moves searched.
+ * @param nMoves The number of moves searched.
+ * @return true if the moves are found one after the other in the game.
+ */
+bool move_tokens_contain(const MoveToken *game, int nGame, const MoveToken *moves, int nMoves)
+{
+    for (int i = 0; i + nMoves <= nGame; i++) {
+        int j = 0;
+
+        while (j < nMoves && game[i + j].len == moves[j].len &&
+               strncmp(game[i + j].str, moves[j].str, moves[j].len) == 0)
+            j++;
+
+        if (j == nMoves)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Computes the fingerprint of a sequence of moves.
+ *
+ * The moves are hashed in order, each followed by a separator, so the fingerprint
+ * depends only on the normalized mainline: formatting, move numbers, comments and
+ * annotations do not change it. Castling written with zeros ('0-0') is hashed as
+ * with letters ('O-O').
+ *
+ * @param moves The mainline moves, as returned by move_mainline_tokens.
+ * @param nMoves The number of moves.
+ * @return The 64-bit fingerprint.
+ */
+uint64 move_tokens_fingerprint(const MoveToken *moves, int nMoves)
+{
+    StringInfoData buf;
+    uint64 result;
+
+    initStringInfo(&buf);
+
+    for (int i = 0; i < nMoves; i++) {
+        if (moves[i].len > 0 && moves[i].str[0] == '0') {
+            for (int j = 0; j < moves[i].len; j++)
+                appendStringInfoChar(&buf, moves[i].str[j] == '0' ? 'O' : moves[i].str[j]);
+        } else {
+            appendBinaryStringInfo(&buf, moves[i].str, moves[i].len);
+        }
+
+        appendStringInfoChar(&buf, ' ');
+    }
+
+    result = hash_bytes_extended((const unsigned char *) buf.data, buf.len, 0);
+    pfree(buf.data);
+
+    return result;
+}
+
+/**
+ * Computes the hash of one normalized move.
+ *
+ * Castling written with zeros ('0-0') is hashed as with letters ('O-O').
+ *
+ * @param move The move, as returned by move_mainline_tokens.
+ * @return The 32-bit hash of the move.
+ */
+uint32 move_token_hash(const MoveToken *move)
+{
+    char castling[8];
+
+    if (move->len > 0 && move->len < (int) sizeof(castling) && move->str[0] == '0') {
+        for (int j = 0; j < move->len; j++)
+            castling[j] = move->str[j] == '0' ? 'O' : move->str[j];
+
+        return hash_bytes((const unsigned char *) castling, move->len);
+    }
+
+    return hash_bytes((const unsigned char *) move->str, move->len);
+}
+
+/**
+ * Measures the piece move starting a string.
+ *
+ * A piece move is a piece letter followed by the longest run of file, rank and
+ * capture characters, e.g. 'Bxh7' in 'Bxh7+' or 'Nbd7' in '8.Nbd7'.
+ *
+ * @param str The string, starting with a piece letter.
+ * @param len The length of the string.
+ * @return The length of the piece move.
+ */
+int piece_move_length(const char *str, int len)
+{
+    int end = 1;
+
+    while (end < len && str[end] != '\0' && strchr(MOVE_SQUARE_CHARS, str[end]) != NULL)
+        end++;
+
+    return end;
+}
+
+/**
+ * Builds the key of a piece move.
+ */
+static Datum move_piece_key(const char *str, int len)
+{
+    char *key = psprintf(MOVE_NGRAM_PIECE_MOVE "%.*s", len, str);
+    Datum result = PointerGetDatum(cstring_to_text(key));
+
+    pfree(key);
+
+    return result;
+}
+
+/**
+ * Builds the unigram key of a token.
+ */
+static Datum move_unigram_key(const MoveToken *token)
+{
+    char *key = psprintf(MOVE_NGRAM_UNIGRAM "%.*s", token->len, token->str);
+    Datum result = PointerGetDatum(cstring_to_text(key));
+
+    pfree(key);
+
+    return result;
+}
+
+/**
+ * Builds the bigram key of two consecutive tokens.
+ */
+static Datum move_bigram_key(const MoveToken *first, const MoveToken *second)
+{
+    char *key = psprintf(MOVE_NGRAM_BIGRAM "%.*s %.*s", first->len, first->str, second->len, second->str);
+    Datum result = PointerGetDatum(cstring_to_text(key));
+
+    pfree(key);
+
+    return result;
+}
+
+/**
+ * Appends the unigram and bigram keys of a token sequence.
+ *
+ * @param keys The array of keys to fill, large enough for 2 * nTokens more keys.
+ * @param nkeys The number of keys already in the array, updated.
+ * @param tokens The tokens.
+ * @param nTokens The number of tokens.
+ */
+static void add_move_ngram_keys(Datum *keys, int32 *nkeys, const MoveToken *tokens, int nTokens)
+{
+    for (int i = 0; i < nTokens; i++) {
+        keys[(*nkeys)++] = move_unigram_key(&tokens[i]);
+
+        if (i > 0)
+            keys[(*nkeys)++] = move_bigram_key(&tokens[i - 1], &tokens[i]);
+    }
+}
+
+/**
+ * Extracts the index keys of a game.
+ *
+ * @param str The null-terminated game.
+ * @param nkeys Set to the number of keys.
+ * @return A palloc'd array of text keys; duplicates are removed by GIN.
+ */
+Datum *move_ngram_value_keys(const char *str, int32 *nkeys)
+{
+    MoveToken *raw, *mainline;
+    int nRaw, nMainline;
+    int len = strlen(str);
+    Datum *keys;
+
+    nRaw = move_raw_tokens(str, len, &raw);
+    nMainline = move_mainline_tokens(str, &mainline);
+
+    *nkeys = 0;
+    keys = (Datum *) palloc((2 * (nRaw + nMainline) + len + 1) * sizeof(Datum));
+
+    add_move_ngram_keys(keys, nkeys, raw, nRaw);
+    add_move_ngram_keys(keys, nkeys, mainline, nMainline);
+
+    // Every piece letter of the text starts an embedded piece move.
+    for (int i = 0; i < len; i++) {
+        if (strchr(MOVE_PIECE_CHARS, str[i]) != NULL)
+            keys[(*nkeys)++] = move_piece_key(str + i, piece_move_length(str + i, len - i));
+    }
+
+    pfree(raw);
+    pfree(mainline);
+
+    return keys;
+}
+
+/**
+ * Extracts the query keys of a sequence of moves.
+ *
+ * @param moves The moves searched, as returned by move_mainline_tokens.
+ * @param nMoves The number of moves.
+ * @param nkeys Set to the number of keys.
+ * @return A palloc'd array of text keys.
+ */
+Datum *move_ngram_sequence_keys(const MoveToken *moves, int nMoves, int32 *nkeys)
+{
+    Datum *keys = (Datum *) palloc((2 * nMoves + 1) * sizeof(Datum));
+
+    *nkeys = 0;
+    add_move_ngram_keys(keys, nkeys, moves, nMoves);
+
+    return keys;
+}
+
+/**
+ * Appends the piece move keys of a pattern token containing wildcards.
+ *
+ * A piece move followed by a wildcard may go on in the game, so its key is only
+ * a prefix of the key to look for. Tokens with an escape character are skipped.
+ *
+ * @param keys The array of keys to fill.
+ * @param partial The array of prefix flags of the keys.
+ * @param nkeys The number of keys already in the array, updated.
+ * @param token The pattern token.
+ * @param len The length of the token.
+ */
+static void add_like_piece_keys(Datum *keys, bool *partial, int32 *nkeys, const char *token, int len)
+{
+    if (memchr(token, '\\', len) != NULL)
+        return;
+
+    for (int i = 0; i < len; i++) {
+        int moveLen;
+
+        if (strchr(MOVE_PIECE_CHARS, token[i]) == NULL)
+            continue;
+
+        moveLen = piece_move_length(token + i, len - i);
+
+        partial[*nkeys] = (i + moveLen < len && (token[i + moveLen] == '%' || token[i + moveLen] == '_'));
+        keys[(*nkeys)++] = move_piece_key(token + i, moveLen);
+    }
+}
+
+/**
+ * Extracts the query keys of a LIKE pattern.
+ *
+ * The whitespace-delimited tokens of the pattern without any wildcard or escape
+ * character give unigram and bigram keys: a matching game contains each of them as a
+ * whole token, and the tokens of a run of such tokens one after the other. Within the
+ * other tokens, each literal piece move gives a piece move key, matched as a prefix when
+ * a wildcard follows it.
+ *
+ * @param pattern The LIKE pattern.
+ * @param len The length of the pattern.
+ * @param nkeys Set to the number of keys, possibly 0.
+ * @param partial Set to a palloc'd array flagging the keys to match as prefixes.
+ * @return A palloc'd array of text keys.
+ */
+Datum *move_ngram_like_keys(const char *pattern, int len, int32 *nkeys, bool **partial)
+{
+    Datum *keys = (Datum *) palloc((2 * len + 1) * sizeof(Datum));
+    MoveToken previous = {NULL, 0};
+    int pos = 0;
+
+    *nkeys = 0;
+    *partial = (bool *) palloc0((2 * len + 1) * sizeof(bool));
+
+    while (pos < len) {
+        MoveToken token;
+        int begin;
+
+        while (pos < len && isspace((unsigned char) pattern[pos]))
+            pos++;
+
+        begin = pos;
+
+        while (pos < len && !isspace((unsigned char) pattern[pos]))
+            pos++;
+
+        if (pos == begin)
+            break;
+
+        // A wildcard breaks the run of literal tokens.
+        if (memchr(pattern + begin, '%', pos - begin) != NULL ||
+            memchr(pattern + begin, '_', pos - begin) != NULL ||
+            memchr(pattern + begin, '\\', pos - begin) != NULL) {
+            add_like_piece_keys(keys, *partial, nkeys, pattern + begin, pos - begin);
+            previous.len = 0;
+            continue;
+        }
+
+        token.len = normalize_move_token(pattern + begin, pos - begin, &token.str);
+
+        if (token.len == 0)
+            continue;
+
+        keys[(*nkeys)++] = move_unigram_key(&token);
+
+        if (previous.len > 0)
+            keys[(*nkeys)++] = move_bigram_key(&previous, &token);
+
+        previous = token;
+    }
+
+    return keys;
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //MOVE_NGRAMS_H
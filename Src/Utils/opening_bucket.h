@@ -0,0 +1,210 @@
+/*
+ * opening_bucket.h
+ *      Opening buckets of SAN games, used as partition keys.
+ *
+ * opening_bucket(game, depth) hashes the first 'depth' mainline half-moves of a game,
+ * so a table partitioned by it keeps all the games of an opening in one partition.
+ * When 'chess.opening_bucket_depth' is set to the depth of the partition key, the
+ * planner support function of has_opening adds the bucket of the searched opening as
+ * an equality condition, from which the other partitions are pruned. It's part of a
+ * PostgreSQL extension for storing and querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "catalog/pg_operator_d.h"
+#include "catalog/pg_type_d.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/supportnodes.h"
+#include "optimizer/optimizer.h"
+#include "parser/parse_func.h"
+#include "utils/fmgroids.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "Utils/move_ngrams.h"
+#include "DataTypes/SAN/SANPACKED.h"
+
+#ifndef OPENING_BUCKET_H
+#define OPENING_BUCKET_H
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+void opening_bucket_init(void);
+int32 opening_bucket_of_moves(const MoveToken *moves, int nMoves, int depth);
+int opening_complete_moves(const char *opening, const MoveToken *moves, int nMoves);
+Node *opening_bucket_simplify(FuncExpr *hasOpening, FunctionCallInfo fcinfo);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+// Depth of the opening_bucket partition key, 0 to leave has_opening unchanged ('chess.opening_bucket_depth').
+static int chess_opening_bucket_depth = 0;
+
+/**
+ * Defines the opening bucket settings.
+ *
+ * Called once from _PG_init.
+ */
+void opening_bucket_init(void)
+{
+    DefineCustomIntVariable("chess.opening_bucket_depth",
+                            "Depth of the opening_bucket partition key used to prune has_opening searches.",
+                            "has_opening(game, opening) also checks opening_bucket(game, depth) when the opening has that many half-moves. 0 disables it.",
+                            &chess_opening_bucket_depth,
+                            0, 0, MAX_PGN_LENGTH,
+                            PGC_USERSET,
+                            0,
+                            NULL, NULL, NULL);
+}
+
+/**
+ * Computes the opening bucket of a sequence of moves.
+ *
+ * The bucket is the fingerprint of the first moves folded into 32 bits, so it does
+ * not depend on formatting, move numbers, comments or annotations.
+ *
+ * @param moves The mainline moves, as returned by move_mainline_tokens.
+ * @param nMoves The number of moves.
+ * @param depth The number of half-moves hashed; shorter games hash all their moves.
+ * @return The bucket.
+ */
+int32 opening_bucket_of_moves(const MoveToken *moves, int nMoves, int depth)
+{
+    uint64 fingerprint = move_tokens_fingerprint(moves, Min(depth, nMoves));
+
+    return (int32) (fingerprint ^ (fingerprint >> 32));
+}
+
+/**
+ * Checks if a move cannot be the start of a longer one.
+ *
+ * Pawn moves to ranks 2 to 7, queenside castling and promotions are complete, while
+ * a piece move may be extended by a disambiguation ('Nb1' in 'Nb1d2') and kingside
+ * castling by queenside castling.
+ */
+static bool opening_move_is_final(const MoveToken *move)
+{
+    const char *str = move->str;
+    int len = move->len;
+
+    if (len == 5 && (strncmp(str, "O-O-O", 5) == 0 || strncmp(str, "0-0-0", 5) == 0))
+        return true;
+
+    if (len >= 2 && str[len - 2] == '=' && strchr("QRBN", str[len - 1]) != NULL)
+        return true;
+
+    return len >= 2 && str[0] >= 'a' && str[0] <= 'h' &&
+           str[len - 2] >= 'a' && str[len - 2] <= 'h' &&
+           str[len - 1] >= '2' && str[len - 1] <= '7';
+}
+
+/**
+ * Counts the moves of an opening that every game starting with its text shares.
+ *
+ * has_opening compares text prefixes, so the last move of the opening is only shared
+ * when something follows it or when it cannot be extended.
+ *
+ * @param opening The opening text.
+ * @param moves The mainline moves of the opening, as returned by move_mainline_tokens.
+ * @param nMoves The number of moves.
+ * @return The number of leading moves shared by the games.
+ */
+int opening_complete_moves(const char *opening, const MoveToken *moves, int nMoves)
+{
+    const char *end;
+
+    if (nMoves == 0)
+        return 0;
+
+    // Skip the suffix dropped by the normalization
+    end = moves[nMoves - 1].str + moves[nMoves - 1].len;
+
+    while (*end && !isspace((unsigned char) *end) && strchr("{};()", *end) == NULL)
+        end++;
+
+    return (*end != '\0' || opening_move_is_final(&moves[nMoves - 1])) ? nMoves : nMoves - 1;
+}
+
+/**
+ * Adds the opening bucket condition to a has_opening call.
+ *
+ * 'has_opening(game, opening)' becomes 'has_opening(game, opening) AND
+ * opening_bucket(game, depth) = bucket' when the opening is a constant with at least
+ * 'chess.opening_bucket_depth' complete moves. The condition matches the partition
+ * key 'opening_bucket(game, depth)', so partitions of other buckets are pruned.
+ *
+ * @param hasOpening The has_opening call.
+ * @param fcinfo Function call info of the support function.
+ * @return The new expression, or NULL to keep the call.
+ */
+Node *opening_bucket_simplify(FuncExpr *hasOpening, FunctionCallInfo fcinfo)
+{
+    int depth = chess_opening_bucket_depth;
+    Node *gameArg, *openingArg;
+    SAN *opening;
+    MoveToken *moves;
+    int nMoves;
+    int32 bucket;
+    List *bucketName;
+    Oid argTypes[2];
+    Oid bucketFn;
+    FuncExpr *bucketCall;
+    Expr *condition;
+
+    if (depth <= 0 || list_length(hasOpening->args) != 2)
+        return NULL;
+
+    gameArg = (Node *) linitial(hasOpening->args);
+    openingArg = (Node *) lsecond(hasOpening->args);
+
+    if (!IsA(openingArg, Const) || ((Const *) openingArg)->constisnull || contain_volatile_functions(gameArg))
+        return NULL;
+
+    opening = san_unpack(((Const *) openingArg)->constvalue, fcinfo);
+    nMoves = move_mainline_tokens(opening->data, &moves);
+
+    if (opening_complete_moves(opening->data, moves, nMoves) < depth) {
+        pfree(moves);
+        pfree(opening);
+        return NULL;
+    }
+
+    bucket = opening_bucket_of_moves(moves, nMoves, depth);
+
+    pfree(moves);
+    pfree(opening);
+
+    // opening_bucket is in the schema of has_opening, the extension schema
+    bucketName = list_make2(makeString(get_namespace_name(get_func_namespace(hasOpening->funcid))),
+                            makeString("opening_bucket"));
+    argTypes[0] = exprType(gameArg);
+    argTypes[1] = INT4OID;
+    bucketFn = LookupFuncName(bucketName, 2, argTypes, true);
+
+    if (!OidIsValid(bucketFn))
+        return NULL;
+
+    bucketCall = makeFuncExpr(bucketFn, INT4OID,
+                              list_make2(copyObject(gameArg),
+                                         makeConst(INT4OID, -1, InvalidOid, sizeof(int32),
+                                                   Int32GetDatum(depth), false, true)),
+                              InvalidOid, InvalidOid, COERCE_EXPLICIT_CALL);
+
+    condition = make_opclause(Int4EqualOperator, BOOLOID, false, (Expr *) bucketCall,
+                              (Expr *) makeConst(INT4OID, -1, InvalidOid, sizeof(int32),
+                                                 Int32GetDatum(bucket), false, true),
+                              InvalidOid, InvalidOid);
+    ((OpExpr *) condition)->opfuncid = F_INT4EQ;
+
+    // The call is a stack copy owned by the planner
+    return (Node *) make_andclause(list_make2(copyObject(hasOpening), condition));
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //OPENING_BUCKET_H
@@ -0,0 +1,298 @@
+/*
+ * opening_dict.h
+ *      Backend cache of the opening dictionary used to compress stored games.
+ *
+ * The dictionary is the chess_opening_dict table of the extension schema: each row
+ * maps an id to an opening line (a game prefix). When 'chess.san_compression' is on,
+ * stored SAN values reference the longest dictionary line they start with and keep
+ * only the continuation inline. The table is read through SPI and kept in backend
+ * memory until a relcache invalidation of the table, which a statement trigger sends
+ * on every insert, so that all sessions compress with the lines added. The table is
+ * append-only (a trigger rejects updates, deletes and truncations), as stored games
+ * are decoded with the lines they reference. It's part of a PostgreSQL extension for
+ * storing and querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "executor/spi.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "Utils/chess_stats.h"
+
+#ifndef OPENING_DICT_H
+#define OPENING_DICT_H
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+/**
+ * Structure representing an opening line of the dictionary.
+ *
+ * @param id The id referenced by the stored games.
+ * @param prefix The opening line, a prefix of the games that reference it.
+ * @param len The length of the opening line.
+ */
+typedef struct
+{
+    int32 id;
+    char *prefix;
+    int len;
+} OpeningDictEntry;
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+void opening_dict_init(void);
+void opening_dict_changed(Relation rel);
+const OpeningDictEntry *opening_dict_lookup_id(int32 id, Oid fnOid);
+const OpeningDictEntry *opening_dict_longest_prefix(const char *game, int len, Oid fnOid);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+// Whether new SAN values are compressed with the opening dictionary ('chess.san_compression').
+static bool chess_san_compression = false;
+
+// The dictionary entries, sorted by id and by opening line.
+static MemoryContext openingDictContext = NULL;
+static OpeningDictEntry *openingDictById = NULL;
+static OpeningDictEntry *openingDictByPrefix = NULL;
+static int openingDictSize = 0;
+static bool openingDictLoaded = false;
+
+// The chess_opening_dict table read, whose invalidations discard the dictionary.
+static Oid openingDictRelid = InvalidOid;
+static bool openingDictInvalidated = false;
+
+/**
+ * Discards the dictionary when the table is invalidated, so that the next use
+ * reads it again.
+ *
+ * @param arg Unused.
+ * @param relid The invalidated relation, InvalidOid for all of them.
+ */
+static void opening_dict_relcache_callback(Datum arg, Oid relid)
+{
+    if (!OidIsValid(relid) || relid == openingDictRelid) {
+        openingDictLoaded = false;
+        openingDictInvalidated = true;
+    }
+}
+
+/**
+ * Defines the opening dictionary settings and registers the invalidation callback.
+ *
+ * Called once from _PG_init.
+ */
+void opening_dict_init(void)
+{
+    DefineCustomBoolVariable("chess.san_compression",
+                             "Compresses new SAN values with the opening dictionary.",
+                             "Stored games reference their longest opening line from chess_opening_dict.",
+                             &chess_san_compression,
+                             false,
+                             PGC_USERSET,
+                             0,
+                             NULL, NULL, NULL);
+
+    CacheRegisterRelcacheCallback(opening_dict_relcache_callback, (Datum) 0);
+}
+
+/**
+ * Makes every session read the dictionary again once the current transaction commits
+ * (and this one from the next command), as lines were added to it.
+ *
+ * @param rel The chess_opening_dict table.
+ */
+void opening_dict_changed(Relation rel)
+{
+    CacheInvalidateRelcache(rel);
+}
+
+/**
+ * Orders dictionary entries by id.
+ */
+static int opening_dict_cmp_id(const void *a, const void *b)
+{
+    int32 idA = ((const OpeningDictEntry *) a)->id;
+    int32 idB = ((const OpeningDictEntry *) b)->id;
+
+    return (idA > idB) - (idA < idB);
+}
+
+/**
+ * Orders dictionary entries bytewise by opening line.
+ */
+static int opening_dict_cmp_prefix(const void *a, const void *b)
+{
+    const OpeningDictEntry *entryA = (const OpeningDictEntry *) a;
+    const OpeningDictEntry *entryB = (const OpeningDictEntry *) b;
+    int result = memcmp(entryA->prefix, entryB->prefix, Min(entryA->len, entryB->len));
+
+    return result != 0 ? result : (entryA->len > entryB->len) - (entryA->len < entryB->len);
+}
+
+/**
+ * Reads the opening dictionary into backend memory.
+ *
+ * The table is looked up in the schema of the calling function, which is the
+ * extension schema.
+ *
+ * @param fnOid The OID of the calling extension function.
+ */
+static void opening_dict_load(Oid fnOid)
+{
+    char *schema, *query;
+    Oid namespaceOid;
+    MemoryContext oldContext;
+
+    if (!OidIsValid(fnOid))
+        ereport(ERROR, (errmsg("opening dictionary: cannot determine the extension schema")));
+
+    namespaceOid = get_func_namespace(fnOid);
+    schema = get_namespace_name(namespaceOid);
+    query = psprintf("SELECT id, prefix FROM %s.chess_opening_dict", quote_identifier(schema));
+
+    if (openingDictContext == NULL)
+        openingDictContext = AllocSetContextCreate(TopMemoryContext, "chess opening dictionary",
+                                                   ALLOCSET_SMALL_SIZES);
+    else
+        MemoryContextReset(openingDictContext);
+
+    openingDictById = NULL;
+    openingDictByPrefix = NULL;
+    openingDictSize = 0;
+    openingDictLoaded = false;
+    openingDictRelid = get_relname_relid("chess_opening_dict", namespaceOid);
+    openingDictInvalidated = false;
+
+    if (SPI_connect() != SPI_OK_CONNECT)
+        ereport(ERROR, (errmsg("opening dictionary: SPI_connect failed")));
+
+    if (SPI_execute(query, true, 0) != SPI_OK_SELECT)
+        ereport(ERROR, (errmsg("opening dictionary: cannot read %s.chess_opening_dict", schema)));
+
+    oldContext = MemoryContextSwitchTo(openingDictContext);
+
+    openingDictById = (OpeningDictEntry *) palloc((SPI_processed + 1) * sizeof(OpeningDictEntry));
+
+    for (uint64 i = 0; i < SPI_processed; i++) {
+        HeapTuple tuple = SPI_tuptable->vals[i];
+        TupleDesc tupdesc = SPI_tuptable->tupdesc;
+        bool idNull, prefixNull;
+        Datum id = SPI_getbinval(tuple, tupdesc, 1, &idNull);
+        Datum prefix = SPI_getbinval(tuple, tupdesc, 2, &prefixNull);
+        OpeningDictEntry *entry = &openingDictById[openingDictSize];
+
+        if (idNull || prefixNull)
+            continue;
+
+        entry->id = DatumGetInt32(id);
+        entry->prefix = TextDatumGetCString(prefix);
+        entry->len = strlen(entry->prefix);
+        openingDictSize++;
+    }
+
+    openingDictByPrefix = (OpeningDictEntry *) palloc((openingDictSize + 1) * sizeof(OpeningDictEntry));
+    memcpy(openingDictByPrefix, openingDictById, openingDictSize * sizeof(OpeningDictEntry));
+
+    MemoryContextSwitchTo(oldContext);
+
+    SPI_finish();
+
+    qsort(openingDictById, openingDictSize, sizeof(OpeningDictEntry), opening_dict_cmp_id);
+    qsort(openingDictByPrefix, openingDictSize, sizeof(OpeningDictEntry), opening_dict_cmp_prefix);
+
+    // Read again on next use if lines were added while it was being read.
+    openingDictLoaded = !openingDictInvalidated;
+}
+
+/**
+ * Finds the opening line referenced by a stored game.
+ *
+ * The dictionary is reloaded once if the id is unknown, as it may have been
+ * added since the dictionary was read.
+ *
+ * @param id The id of the opening line.
+ * @param fnOid The OID of the calling extension function.
+ * @return The dictionary entry.
+ */
+const OpeningDictEntry *opening_dict_lookup_id(int32 id, Oid fnOid)
+{
+    OpeningDictEntry key;
+    OpeningDictEntry *entry = NULL;
+
+    key.id = id;
+
+    if (openingDictLoaded)
+        entry = bsearch(&key, openingDictById, openingDictSize, sizeof(OpeningDictEntry), opening_dict_cmp_id);
+
+    if (entry == NULL) {
+        opening_dict_load(fnOid);
+        entry = bsearch(&key, openingDictById, openingDictSize, sizeof(OpeningDictEntry), opening_dict_cmp_id);
+    } else {
+        chess_stats_count(CHESS_STAT_CACHE_HITS, 1);
+    }
+
+    if (entry == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_CORRUPTED),
+                 errmsg("opening dictionary entry %d does not exist", id),
+                 errhint("Entries of chess_opening_dict must not be deleted while stored games reference them.")));
+
+    return entry;
+}
+
+/**
+ * Finds the longest opening line a game starts with.
+ *
+ * Only lines ending at a token boundary of the game (followed by a space or by
+ * the end of the game) are considered, longest first.
+ *
+ * @param game The game text.
+ * @param len The length of the game text.
+ * @param fnOid The OID of the calling extension function.
+ * @return The dictionary entry, or NULL if no line matches.
+ */
+const OpeningDictEntry *opening_dict_longest_prefix(const char *game, int len, Oid fnOid)
+{
+    if (!openingDictLoaded)
+        opening_dict_load(fnOid);
+
+    if (openingDictSize == 0)
+        return NULL;
+
+    for (int end = len; end > 0; end--) {
+        OpeningDictEntry key;
+        OpeningDictEntry *entry;
+
+        if (end < len && game[end] != ' ')
+            continue;
+
+        key.prefix = (char *) game;
+        key.len = end;
+
+        entry = bsearch(&key, openingDictByPrefix, openingDictSize, sizeof(OpeningDictEntry), opening_dict_cmp_prefix);
+
+        if (entry != NULL)
+            return entry;
+    }
+
+    return NULL;
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //OPENING_DICT_H
@@ -0,0 +1,262 @@
+/*
+ * position_bloom.h
+ *      Bloom filters of the BRIN operator class on SAN (san_brin_bloom_ops).
+ *
+ * The summary of a block range is a bloom filter of the hashes of all the board
+ * positions its games go through (see fen_position_hash). 'game @> fen' skips the
+ * ranges whose filter certainly lacks the position, which makes a very small index
+ * for append-only archives, where games inserted together share block ranges. The
+ * filter is sized from the operator class options: the expected number of distinct
+ * positions per range, by default derived from the pages_per_range of the index,
+ * and the false positive rate. A filter must fit on an index page, which bounds the
+ * positions it can hold at a given rate; a range holding many more positions than
+ * its filter saturates it and is always scanned, so large pages_per_range values
+ * defeat the index. It's part of a PostgreSQL extension for storing and querying
+ * chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "access/brin_page.h"
+#include "access/brin_tuple.h"
+#include "access/reloptions.h"
+#include "common/hashfn.h"
+#include "storage/bufpage.h"
+#include <math.h>
+
+#ifndef POSITION_BLOOM_H
+#define POSITION_BLOOM_H
+
+// Defaults and bounds of the operator class options; 0 positions derives them from pages_per_range.
+#define POSITION_BLOOM_DEFAULT_POSITIONS 0
+#define POSITION_BLOOM_MIN_POSITIONS 16
+#define POSITION_BLOOM_DEFAULT_FALSE_POSITIVE_RATE 0.01
+#define POSITION_BLOOM_MIN_FALSE_POSITIVE_RATE 0.0001
+#define POSITION_BLOOM_MAX_FALSE_POSITIVE_RATE 0.25
+
+// Largest filter fitting in a BRIN tuple alone on an index page.
+#define POSITION_BLOOM_MAX_SIZE \
+    MAXALIGN_DOWN(BLCKSZ - (MAXALIGN(SizeOfPageHeaderData + sizeof(ItemIdData)) + \
+                            MAXALIGN(sizeof(BrinSpecialSpace)) + SizeOfBrinTuple))
+
+// Estimated distinct positions per heap page: about 20 games, 50 positions new to the range each.
+#define POSITION_BLOOM_POSITIONS_PER_PAGE (BLCKSZ / 8)
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+/**
+ * Structure representing the options of san_brin_bloom_ops.
+ *
+ * @param vl_len_ Varlena header (do not touch directly).
+ * @param positionsPerRange The expected number of distinct positions in a block range.
+ * @param falsePositiveRate The expected false positive rate of the filters.
+ */
+typedef struct
+{
+    int32 vl_len_;
+    int positionsPerRange;
+    double falsePositiveRate;
+} PositionBloomOptions;
+
+/**
+ * Structure representing the bloom filter of a block range.
+ *
+ * Stored as a bytea value in the BRIN tuples.
+ *
+ * @param vl_len_ Varlena header (do not touch directly).
+ * @param nHashes The number of bits set per position.
+ * @param nBits The number of bits of the filter, a multiple of 8.
+ * @param bits The filter.
+ */
+typedef struct
+{
+    int32 vl_len_;
+    uint32 nHashes;
+    uint32 nBits;
+    uint8 bits[FLEXIBLE_ARRAY_MEMBER];
+} PositionBloom;
+
+#define POSITION_BLOOM_HDRSZ offsetof(PositionBloom, bits)
+#define DatumGetPositionBloom(x) ((PositionBloom *) PG_DETOAST_DATUM(x))
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+int position_bloom_max_positions(double rate);
+void position_bloom_options_init(local_relopts *relopts);
+PositionBloom *position_bloom_new(const PositionBloomOptions *opts, BlockNumber pagesPerRange);
+void position_bloom_add_hash(PositionBloom *filter, uint32 hash);
+bool position_bloom_contains_hash(const PositionBloom *filter, uint32 hash);
+void position_bloom_union_into(PositionBloom *dest, const PositionBloom *src);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+/**
+ * Returns the largest number of positions a filter fitting on an index page holds.
+ *
+ * @param rate The false positive rate of the filter.
+ * @return The number of positions of the optimal filter of POSITION_BLOOM_MAX_SIZE bytes.
+ */
+int position_bloom_max_positions(double rate)
+{
+    double nBits = (double) (POSITION_BLOOM_MAX_SIZE - POSITION_BLOOM_HDRSZ) * 8;
+
+    return (int) floor(nBits * M_LN2 * M_LN2 / -log(rate));
+}
+
+/**
+ * Rejects the options whose filter would not fit on an index page.
+ *
+ * Runs when the options are parsed, so CREATE INDEX fails even on an empty table.
+ */
+static void position_bloom_options_validate(void *parsed, relopt_value *vals, int nvals)
+{
+    const PositionBloomOptions *opts = (const PositionBloomOptions *) parsed;
+    int maxPositions = position_bloom_max_positions(opts->falsePositiveRate);
+
+    if (opts->positionsPerRange > maxPositions)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("the bloom filter is too large: positions_per_range %d exceeds %d at false_positive_rate %g",
+                        opts->positionsPerRange, maxPositions, opts->falsePositiveRate),
+                 errhint("Lower positions_per_range or raise false_positive_rate.")));
+}
+
+/**
+ * Declares the options of san_brin_bloom_ops.
+ *
+ * The bound of positions_per_range is the largest filter at the highest false
+ * positive rate; the combination of both options is checked once parsed.
+ *
+ * @param relopts The local options to fill.
+ */
+void position_bloom_options_init(local_relopts *relopts)
+{
+    init_local_reloptions(relopts, sizeof(PositionBloomOptions));
+
+    add_local_int_reloption(relopts, "positions_per_range",
+                            "expected number of distinct board positions in a block range, 0 to derive it from pages_per_range",
+                            POSITION_BLOOM_DEFAULT_POSITIONS, 0,
+                            position_bloom_max_positions(POSITION_BLOOM_MAX_FALSE_POSITIVE_RATE),
+                            offsetof(PositionBloomOptions, positionsPerRange));
+
+    add_local_real_reloption(relopts, "false_positive_rate",
+                             "expected false positive rate of the bloom filters",
+                             POSITION_BLOOM_DEFAULT_FALSE_POSITIVE_RATE,
+                             POSITION_BLOOM_MIN_FALSE_POSITIVE_RATE, POSITION_BLOOM_MAX_FALSE_POSITIVE_RATE,
+                             offsetof(PositionBloomOptions, falsePositiveRate));
+
+    register_reloptions_validator(relopts, position_bloom_options_validate);
+}
+
+/**
+ * Allocates an empty filter sized for the options of the index.
+ *
+ * The number of bits and of hashes are the optimal ones of a bloom filter holding
+ * the expected number of positions at the expected false positive rate. Without
+ * an explicit number of positions, it is estimated from the pages of a range and
+ * capped to the largest filter fitting on an index page.
+ *
+ * @param opts The options of the index, or NULL for the defaults.
+ * @param pagesPerRange The pages_per_range of the index.
+ * @return A palloc'd filter.
+ */
+PositionBloom *position_bloom_new(const PositionBloomOptions *opts, BlockNumber pagesPerRange)
+{
+    int positions = opts ? opts->positionsPerRange : POSITION_BLOOM_DEFAULT_POSITIONS;
+    double rate = opts ? opts->falsePositiveRate : POSITION_BLOOM_DEFAULT_FALSE_POSITIVE_RATE;
+    double nBits;
+    Size size;
+    PositionBloom *filter;
+
+    if (positions == 0)
+        positions = (int) Min((double) pagesPerRange * POSITION_BLOOM_POSITIONS_PER_PAGE,
+                              (double) position_bloom_max_positions(rate));
+
+    positions = Max(positions, POSITION_BLOOM_MIN_POSITIONS);
+    nBits = ceil(-positions * log(rate) / (M_LN2 * M_LN2));
+
+    // Whole bytes
+    nBits = ceil(nBits / 8) * 8;
+    size = POSITION_BLOOM_HDRSZ + (Size) nBits / 8;
+
+    if (size > POSITION_BLOOM_MAX_SIZE)
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg("the bloom filter is too large (%zu > %zu bytes)", size, (Size) POSITION_BLOOM_MAX_SIZE),
+                 errhint("Lower positions_per_range or raise false_positive_rate.")));
+
+    filter = (PositionBloom *) palloc0(size);
+    SET_VARSIZE(filter, size);
+    filter->nBits = (uint32) nBits;
+    filter->nHashes = Max(1, (uint32) rint(nBits / positions * M_LN2));
+
+    return filter;
+}
+
+/**
+ * Adds a position hash to a filter.
+ *
+ * The bits are derived from the hash by double hashing.
+ *
+ * @param filter The filter to update.
+ * @param hash The position hash, as computed by fen_position_hash.
+ */
+void position_bloom_add_hash(PositionBloom *filter, uint32 hash)
+{
+    uint32 step = hash_bytes_uint32(hash) | 1;
+
+    for (uint32 i = 0; i < filter->nHashes; i++) {
+        uint32 bit = (uint32) (((uint64) hash + (uint64) i * step) % filter->nBits);
+
+        filter->bits[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+/**
+ * Checks whether a filter may contain a position hash.
+ *
+ * @param filter The filter to probe.
+ * @param hash The position hash, as computed by fen_position_hash.
+ * @return false if the position is certainly absent, true if it may be present.
+ */
+bool position_bloom_contains_hash(const PositionBloom *filter, uint32 hash)
+{
+    uint32 step = hash_bytes_uint32(hash) | 1;
+
+    for (uint32 i = 0; i < filter->nHashes; i++) {
+        uint32 bit = (uint32) (((uint64) hash + (uint64) i * step) % filter->nBits);
+
+        if ((filter->bits[bit / 8] & (1 << (bit % 8))) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * ORs a filter into another one of the same index.
+ *
+ * @param dest The filter to update.
+ * @param src The filter to add, built with the same options.
+ */
+void position_bloom_union_into(PositionBloom *dest, const PositionBloom *src)
+{
+    Assert(dest->nBits == src->nBits && dest->nHashes == src->nHashes);
+
+    for (uint32 i = 0; i < dest->nBits / 8; i++)
+        dest->bits[i] |= src->bits[i];
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //POSITION_BLOOM_H
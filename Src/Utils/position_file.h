@@ -0,0 +1,666 @@
+/*
+ * position_file.h
+ *      Immutable position posting files of read-mostly game tables.
+ *
+ * chess_build_position_file(table) replays every game of a table once and writes a
+ * posting file mapping each position key (the 64-bit hash of the board positions,
+ * see fen_position_hash64) to the TIDs of the games reaching it. Backends map the
+ * file read-only and the custom scan of position_scan.h answers 'game @> fen' from
+ * it without going through an index or the buffer manager for the lookup. The file
+ * records the relfilenode and size of the table it was built from and is ignored
+ * once they change. Writes fitting in the existing pages (updates, inserts after
+ * deletes) change neither, so the build also installs a statement trigger on the
+ * table removing the file on any INSERT, UPDATE, DELETE or TRUNCATE: the scan never
+ * misses a game, and rechecks the rows it fetches. The file is meant for archives
+ * that are no longer modified and must be rebuilt after any change. It is removed
+ * when its table is dropped. It's part of a PostgreSQL extension for storing and
+ * querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "access/table.h"
+#include "access/tableam.h"
+#include "access/xact.h"
+#include "catalog/objectaccess.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "executor/tuptable.h"
+#include "storage/bufmgr.h"
+#include "storage/fd.h"
+#include "storage/itemptr.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+#include "DataTypes/SAN/SANPACKED.h"
+#include "DataTypes/FEN/FEN.h"
+#include "Utils/mapping_san_to_fan.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef POSITION_FILE_H
+#define POSITION_FILE_H
+
+// Directory of the posting files, relative to the data directory.
+#define POSITION_FILE_DIR "pg_chess"
+
+#define POSITION_FILE_MAGIC "CHESSPOS"
+#define POSITION_FILE_VERSION 1
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+/**
+ * Structure representing the header of a posting file.
+ *
+ * The header is followed by the keys, sorted by position key, and by the postings
+ * (TIDs sorted within each key), each array starting at a MAXALIGN'd offset.
+ *
+ * @param magic POSITION_FILE_MAGIC.
+ * @param version POSITION_FILE_VERSION.
+ * @param relid The table the file was built from.
+ * @param relfilenode The relfilenode of the table when the file was built.
+ * @param nblocks The number of blocks of the table when the file was built.
+ * @param attnum The SAN column of the table.
+ * @param nGames The number of games indexed.
+ * @param nKeys The number of distinct position keys.
+ * @param nPostings The number of postings.
+ */
+typedef struct
+{
+    char magic[8];
+    uint32 version;
+    Oid relid;
+    Oid relfilenode;
+    BlockNumber nblocks;
+    int32 attnum;
+    uint32 nGames;
+    uint64 nKeys;
+    uint64 nPostings;
+} PositionFileHeader;
+
+/**
+ * Structure representing a position key of a posting file.
+ *
+ * @param key The position key.
+ * @param first The index of its first posting.
+ * @param count The number of games reaching the position.
+ */
+typedef struct
+{
+    int64 key;
+    uint64 first;
+    uint64 count;
+} PositionFileKey;
+
+/**
+ * Structure representing a posting file mapped by the backend.
+ *
+ * @param relid The table the file belongs to.
+ * @param base The start of the mapping.
+ * @param size The size of the mapping.
+ * @param inode, mtime Identity of the mapped file, to notice rebuilds.
+ * @param header, keys, postings The parts of the file.
+ * @param next The next mapping of the list.
+ */
+typedef struct PositionFileMap
+{
+    Oid relid;
+    char *base;
+    Size size;
+    ino_t inode;
+    time_t mtime;
+    const PositionFileHeader *header;
+    const PositionFileKey *keys;
+    const ItemPointerData *postings;
+    struct PositionFileMap *next;
+} PositionFileMap;
+
+/**
+ * Structure representing a position key reached by a game, while building a file.
+ */
+typedef struct
+{
+    int64 key;
+    ItemPointerData tid;
+} PositionPosting;
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+void position_file_init(void);
+char *position_file_path(Oid relid);
+uint64 position_file_build(Oid relid, Oid sanTypeOid, FunctionCallInfo fcinfo);
+void position_file_install_trigger(Oid relid, Oid namespaceOid);
+void position_file_invalidate(Oid relid);
+const PositionFileMap *position_file_get(Relation rel);
+const PositionFileKey *position_file_lookup(const PositionFileMap *map, int64 key);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+// Posting files mapped by the backend, and the mappings replaced during the current transaction.
+static PositionFileMap *positionFileMaps = NULL;
+static PositionFileMap *positionFileRetired = NULL;
+static bool positionFileCallbackRegistered = false;
+
+// Relations dropped during the current transaction, whose posting files are removed at commit.
+static List *positionFileDropped = NIL;
+
+static object_access_hook_type position_file_prev_object_access_hook = NULL;
+
+static void position_file_register_callback(void);
+static void position_file_xact_callback(XactEvent event, void *arg);
+
+/**
+ * Notes the relations dropped, whose posting files are removed at commit.
+ */
+static void position_file_object_access(ObjectAccessType access, Oid classId, Oid objectId, int subId, void *arg)
+{
+    if (position_file_prev_object_access_hook)
+        position_file_prev_object_access_hook(access, classId, objectId, subId, arg);
+
+    if (access == OAT_DROP && classId == RelationRelationId && subId == 0) {
+        MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+        positionFileDropped = lappend_oid(positionFileDropped, objectId);
+        MemoryContextSwitchTo(oldContext);
+
+        position_file_register_callback();
+    }
+}
+
+/**
+ * Installs the hook removing the posting files of the dropped tables.
+ *
+ * Called once from _PG_init.
+ */
+void position_file_init(void)
+{
+    position_file_prev_object_access_hook = object_access_hook;
+    object_access_hook = position_file_object_access;
+}
+
+/**
+ * Returns the path of the posting file of a table, relative to the data directory.
+ */
+char *position_file_path(Oid relid)
+{
+    return psprintf("%s/%u_%u.pos", POSITION_FILE_DIR, MyDatabaseId, relid);
+}
+
+/**
+ * Orders postings by position key, then by TID.
+ */
+static int position_posting_cmp(const void *a, const void *b)
+{
+    const PositionPosting *postingA = (const PositionPosting *) a;
+    const PositionPosting *postingB = (const PositionPosting *) b;
+
+    if (postingA->key != postingB->key)
+        return postingA->key > postingB->key ? 1 : -1;
+
+    return ItemPointerCompare((ItemPointer) &postingA->tid, (ItemPointer) &postingB->tid);
+}
+
+/**
+ * Writes a buffer to a posting file being built.
+ */
+static void position_file_write(int fd, const void *buffer, Size length, const char *path)
+{
+    const char *p = (const char *) buffer;
+
+    while (length > 0) {
+        ssize_t written = write(fd, p, Min(length, (Size) 1 << 30));
+
+        if (written <= 0)
+            ereport(ERROR,
+                    (errcode_for_file_access(),
+                     errmsg("could not write position file \"%s\": %m", path)));
+
+        p += written;
+        length -= written;
+    }
+}
+
+/**
+ * Builds the posting file of a table.
+ *
+ * Every game of the first SAN column is replayed once; the file is written to a
+ * temporary name and renamed durably, so backends never map a partial file. The
+ * table is locked against writes until the end of the transaction and read with a
+ * snapshot taken once the lock is held, so no committed game is left out.
+ *
+ * @param relid The table to index.
+ * @param sanTypeOid The OID of the SAN type.
+ * @param fcinfo Function call info of the calling function (to decode games).
+ * @return The number of postings written.
+ */
+uint64 position_file_build(Oid relid, Oid sanTypeOid, FunctionCallInfo fcinfo)
+{
+    Relation rel = table_open(relid, ShareLock);
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    Snapshot snapshot;
+    PositionFileHeader header;
+    PositionPosting *postings;
+    PositionFileKey *keys;
+    ItemPointerData *tids;
+    uint64 nPostings = 0, maxPostings = 1024, nKeys = 0;
+    uint32 nGames = 0;
+    AttrNumber attnum = InvalidAttrNumber;
+    TableScanDesc scan;
+    TupleTableSlot *slot;
+    char *path, *tmpPath;
+    char padding[MAXIMUM_ALIGNOF] = {0};
+    MemoryContext gameContext, oldContext;
+    int fd;
+
+    for (int i = 0; i < tupdesc->natts && attnum == InvalidAttrNumber; i++) {
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+
+        if (!attr->attisdropped && attr->atttypid == sanTypeOid)
+            attnum = attr->attnum;
+    }
+
+    if (attnum == InvalidAttrNumber)
+        ereport(ERROR,
+                (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+                 errmsg("table \"%s\" has no SAN column", RelationGetRelationName(rel))));
+
+    postings = (PositionPosting *) MemoryContextAllocHuge(CurrentMemoryContext, maxPostings * sizeof(PositionPosting));
+
+    // Collect the distinct position keys of every game.
+    snapshot = RegisterSnapshot(GetLatestSnapshot());
+    scan = table_beginscan(rel, snapshot, 0, NULL);
+    slot = table_slot_create(rel, NULL);
+
+    // The decoded game and its FEN strings are released after each game.
+    gameContext = replay_context_create();
+
+    while (table_scan_getnextslot(scan, ForwardScanDirection, slot)) {
+        bool isNull;
+        Datum value = slot_getattr(slot, attnum, &isNull);
+        uint64 gameStart = nPostings;
+        char **fens;
+        int nFens;
+
+        CHECK_FOR_INTERRUPTS();
+
+        if (isNull)
+            continue;
+
+        MemoryContextReset(gameContext);
+        oldContext = MemoryContextSwitchTo(gameContext);
+        fens = san_to_fens(san_unpack(value, fcinfo), &nFens);
+        MemoryContextSwitchTo(oldContext);
+
+        if (nPostings + nFens > maxPostings) {
+            maxPostings = Max(maxPostings * 2, nPostings + nFens);
+            postings = (PositionPosting *) repalloc_huge(postings, maxPostings * sizeof(PositionPosting));
+        }
+
+        for (int i = 0; i < nFens; i++) {
+            postings[nPostings].key = fen_position_hash64(fens[i]);
+            postings[nPostings].tid = slot->tts_tid;
+            nPostings++;
+        }
+
+        // A game reaching a position several times is posted once.
+        qsort(postings + gameStart, nPostings - gameStart, sizeof(PositionPosting), position_posting_cmp);
+
+        if (nPostings > gameStart) {
+            uint64 last = gameStart;
+
+            for (uint64 i = gameStart + 1; i < nPostings; i++) {
+                if (postings[i].key != postings[last].key)
+                    postings[++last] = postings[i];
+            }
+
+            nPostings = last + 1;
+        }
+
+        nGames++;
+    }
+
+    MemoryContextDelete(gameContext);
+    ExecDropSingleTupleTableSlot(slot);
+    table_endscan(scan);
+    UnregisterSnapshot(snapshot);
+
+    qsort(postings, nPostings, sizeof(PositionPosting), position_posting_cmp);
+
+    // Split the postings into the key and TID arrays.
+    keys = (PositionFileKey *) MemoryContextAllocHuge(CurrentMemoryContext, Max(nPostings, 1) * sizeof(PositionFileKey));
+    tids = (ItemPointerData *) MemoryContextAllocHuge(CurrentMemoryContext, Max(nPostings, 1) * sizeof(ItemPointerData));
+
+    for (uint64 i = 0; i < nPostings; i++) {
+        if (nKeys == 0 || keys[nKeys - 1].key != postings[i].key) {
+            keys[nKeys].key = postings[i].key;
+            keys[nKeys].first = i;
+            keys[nKeys].count = 0;
+            nKeys++;
+        }
+
+        keys[nKeys - 1].count++;
+        tids[i] = postings[i].tid;
+    }
+
+    pfree(postings);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, POSITION_FILE_MAGIC, sizeof(header.magic));
+    header.version = POSITION_FILE_VERSION;
+    header.relid = relid;
+    header.relfilenode = rel->rd_rel->relfilenode;
+    header.nblocks = RelationGetNumberOfBlocks(rel);
+    header.attnum = attnum;
+    header.nGames = nGames;
+    header.nKeys = nKeys;
+    header.nPostings = nPostings;
+
+    // The lock is kept until the end of the transaction, after the file is in place.
+    table_close(rel, NoLock);
+
+    // Write the file under a temporary name, then rename it into place.
+    if (MakePGDirectory(POSITION_FILE_DIR) < 0 && errno != EEXIST)
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not create directory \"%s\": %m", POSITION_FILE_DIR)));
+
+    path = position_file_path(relid);
+    tmpPath = psprintf("%s.tmp", path);
+
+    fd = OpenTransientFile(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY);
+
+    if (fd < 0)
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not create position file \"%s\": %m", tmpPath)));
+
+    position_file_write(fd, &header, sizeof(header), tmpPath);
+    position_file_write(fd, padding, MAXALIGN(sizeof(header)) - sizeof(header), tmpPath);
+    position_file_write(fd, keys, nKeys * sizeof(PositionFileKey), tmpPath);
+    position_file_write(fd, tids, nPostings * sizeof(ItemPointerData), tmpPath);
+
+    if (pg_fsync(fd) != 0)
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not fsync position file \"%s\": %m", tmpPath)));
+
+    if (CloseTransientFile(fd) != 0)
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not close position file \"%s\": %m", tmpPath)));
+
+    (void) durable_rename(tmpPath, path, ERROR);
+
+    pfree(keys);
+    pfree(tids);
+    pfree(tmpPath);
+    pfree(path);
+
+    return nPostings;
+}
+
+/**
+ * Installs the trigger removing the posting file of a table on its next write.
+ *
+ * The trigger fires once per INSERT, UPDATE, DELETE or TRUNCATE statement, before
+ * any row is written, and calls chess_position_file_invalidate. It is replaced when
+ * the file is rebuilt.
+ *
+ * @param relid The table.
+ * @param namespaceOid The extension schema, holding the trigger function.
+ */
+void position_file_install_trigger(Oid relid, Oid namespaceOid)
+{
+    char *query = psprintf("CREATE OR REPLACE TRIGGER chess_position_file_invalidate "
+                           "BEFORE INSERT OR UPDATE OR DELETE OR TRUNCATE ON %s.%s "
+                           "FOR EACH STATEMENT EXECUTE FUNCTION %s.chess_position_file_invalidate()",
+                           quote_identifier(get_namespace_name(get_rel_namespace(relid))),
+                           quote_identifier(get_rel_name(relid)),
+                           quote_identifier(get_namespace_name(namespaceOid)));
+
+    if (SPI_connect() != SPI_OK_CONNECT)
+        ereport(ERROR, (errmsg("position file: SPI_connect failed")));
+
+    if (SPI_execute(query, false, 0) != SPI_OK_UTILITY)
+        ereport(ERROR, (errmsg("position file: cannot create the trigger of table \"%s\"", get_rel_name(relid))));
+
+    SPI_finish();
+    pfree(query);
+}
+
+/**
+ * Removes the posting file of a table, which no longer describes it.
+ *
+ * The removal is not transactional: a rolled back write still requires a rebuild.
+ * Backends notice the missing file when their next scan starts.
+ *
+ * @param relid The table.
+ */
+void position_file_invalidate(Oid relid)
+{
+    char *path = position_file_path(relid);
+
+    if (unlink(path) != 0 && errno != ENOENT)
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not remove position file \"%s\": %m", path)));
+
+    pfree(path);
+}
+
+/**
+ * Registers the transaction callback of the posting files, once per backend.
+ */
+static void position_file_register_callback(void)
+{
+    if (!positionFileCallbackRegistered) {
+        RegisterXactCallback(position_file_xact_callback, NULL);
+        positionFileCallbackRegistered = true;
+    }
+}
+
+/**
+ * Removes the posting files of the relations dropped by the committing transaction.
+ *
+ * Relations still in the catalog had their drop rolled back with a subtransaction.
+ */
+static void position_file_remove_dropped(void)
+{
+    ListCell *lc;
+
+    foreach (lc, positionFileDropped) {
+        Oid relid = lfirst_oid(lc);
+        char *path;
+
+        if (SearchSysCacheExists1(RELOID, ObjectIdGetDatum(relid)))
+            continue;
+
+        path = position_file_path(relid);
+
+        if (unlink(path) != 0 && errno != ENOENT)
+            ereport(WARNING,
+                    (errcode_for_file_access(),
+                     errmsg("could not remove position file \"%s\": %m", path)));
+
+        pfree(path);
+    }
+}
+
+/**
+ * Removes the posting files of the dropped tables before the transaction commits,
+ * and unmaps the posting files replaced during the transaction once it ends.
+ */
+static void position_file_xact_callback(XactEvent event, void *arg)
+{
+    if (event == XACT_EVENT_PRE_COMMIT)
+        position_file_remove_dropped();
+
+    if (event != XACT_EVENT_COMMIT && event != XACT_EVENT_ABORT &&
+        event != XACT_EVENT_PARALLEL_COMMIT && event != XACT_EVENT_PARALLEL_ABORT)
+        return;
+
+    list_free(positionFileDropped);
+    positionFileDropped = NIL;
+
+    while (positionFileRetired != NULL) {
+        PositionFileMap *map = positionFileRetired;
+
+        positionFileRetired = map->next;
+        munmap(map->base, map->size);
+        pfree(map);
+    }
+}
+
+/**
+ * Maps a posting file and checks its header.
+ *
+ * @return The mapping, allocated in TopMemoryContext, or NULL if the file is unusable.
+ */
+static PositionFileMap *position_file_map(Oid relid, const char *path, const struct stat *st)
+{
+    PositionFileMap *map;
+    const PositionFileHeader *header;
+    Size keysOffset = MAXALIGN(sizeof(PositionFileHeader));
+    char *base;
+    int fd;
+
+    if ((Size) st->st_size < keysOffset)
+        return NULL;
+
+    fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+
+    if (fd < 0)
+        return NULL;
+
+    base = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+    CloseTransientFile(fd);
+
+    if (base == MAP_FAILED)
+        return NULL;
+
+    header = (const PositionFileHeader *) base;
+
+    if (memcmp(header->magic, POSITION_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != POSITION_FILE_VERSION || header->relid != relid ||
+        keysOffset + header->nKeys * sizeof(PositionFileKey) +
+        header->nPostings * sizeof(ItemPointerData) != (Size) st->st_size) {
+        ereport(WARNING, (errmsg("ignoring invalid position file \"%s\"", path)));
+        munmap(base, st->st_size);
+        return NULL;
+    }
+
+    map = (PositionFileMap *) MemoryContextAllocZero(TopMemoryContext, sizeof(PositionFileMap));
+    map->relid = relid;
+    map->base = base;
+    map->size = st->st_size;
+    map->inode = st->st_ino;
+    map->mtime = st->st_mtime;
+    map->header = header;
+    map->keys = (const PositionFileKey *) (base + keysOffset);
+    map->postings = (const ItemPointerData *) (base + keysOffset + header->nKeys * sizeof(PositionFileKey));
+
+    return map;
+}
+
+/**
+ * Returns the mapped posting file of a table, if it has an up-to-date one.
+ *
+ * Mappings are kept for the life of the backend and replaced when the file is
+ * rebuilt; replaced mappings stay valid until the end of the transaction, as
+ * running scans may still read them.
+ *
+ * @param rel The table.
+ * @return The mapping, or NULL if the table has no usable posting file.
+ */
+const PositionFileMap *position_file_get(Relation rel)
+{
+    Oid relid = RelationGetRelid(rel);
+    PositionFileMap **link = &positionFileMaps;
+    PositionFileMap *map;
+    char *path = position_file_path(relid);
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        pfree(path);
+        return NULL;
+    }
+
+    for (map = positionFileMaps; map != NULL; link = &map->next, map = map->next) {
+        if (map->relid == relid)
+            break;
+    }
+
+    if (map != NULL && (map->inode != st.st_ino || map->mtime != st.st_mtime || map->size != (Size) st.st_size)) {
+        position_file_register_callback();
+
+        *link = map->next;
+        map->next = positionFileRetired;
+        positionFileRetired = map;
+        map = NULL;
+    }
+
+    if (map == NULL) {
+        map = position_file_map(relid, path, &st);
+
+        if (map != NULL) {
+            map->next = positionFileMaps;
+            positionFileMaps = map;
+        }
+    }
+
+    pfree(path);
+
+    // The file only describes the table as it was built.
+    if (map == NULL || map->header->relfilenode != rel->rd_rel->relfilenode ||
+        map->header->nblocks != RelationGetNumberOfBlocks(rel))
+        return NULL;
+
+    return map;
+}
+
+/**
+ * Finds a position key in a posting file.
+ *
+ * @param map The mapped posting file.
+ * @param key The position key.
+ * @return The key entry, or NULL if no game reaches the position.
+ */
+const PositionFileKey *position_file_lookup(const PositionFileMap *map, int64 key)
+{
+    uint64 low = 0, high = map->header->nKeys;
+
+    while (low < high) {
+        uint64 middle = low + (high - low) / 2;
+
+        if (map->keys[middle].key < key)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if (low < map->header->nKeys && map->keys[low].key == key)
+        return &map->keys[low];
+
+    return NULL;
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //POSITION_FILE_H
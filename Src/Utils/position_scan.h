@@ -0,0 +1,437 @@
+/*
+ * position_scan.h
+ *      Custom scan answering position lookups from a posting file.
+ *
+ * When a table has an up-to-date posting file (see position_file.h), the planner
+ * hook offers a 'Chess Position Scan' path for its 'game @> fen' restrictions: the
+ * position key of the board is looked up in the mapped file and the games are
+ * fetched by TID, with no replay. Every fetched row is rechecked against all the
+ * restrictions, the 'game @> fen' one included, so a game changed in place since the
+ * build, a TID reused after VACUUM or a key collision never yields a wrong row; the
+ * path competes with the other paths of the table on cost. A cached plan may outlive
+ * the file: when the file has become stale by the time the scan starts, it falls
+ * back to a sequential scan.
+ * Lookups go through the 64-bit position keys, as the chess_positions side table.
+ * It's part of a PostgreSQL extension for storing and querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "commands/explain.h"
+#include "executor/executor.h"
+#include "nodes/extensible.h"
+#include "optimizer/cost.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
+#include "optimizer/restrictinfo.h"
+#include "catalog/pg_class.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "DataTypes/FEN/FEN.h"
+#include "Utils/position_file.h"
+#include <math.h>
+
+#ifndef POSITION_SCAN_H
+#define POSITION_SCAN_H
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+/**
+ * Structure representing the state of a position scan.
+ *
+ * @param css The custom scan state (must be first).
+ * @param boardState The expression computing the searched board.
+ * @param map The posting file of the table, or NULL if it is stale.
+ * @param scan The sequential fallback scan.
+ * @param started Whether the board has been looked up.
+ * @param next, end The postings left to fetch.
+ */
+typedef struct
+{
+    CustomScanState css;
+    ExprState *boardState;
+    const PositionFileMap *map;
+    TableScanDesc scan;
+    bool started;
+    uint64 next;
+    uint64 end;
+} PositionScanState;
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+void position_scan_init(PGFunction containsBoard);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+// Whether the planner considers position scans ('chess.enable_position_file').
+static bool chess_enable_position_file = true;
+
+// The C function of the 'SAN @> FEN' operator, and its OID once seen.
+static PGFunction positionScanContainsBoard = NULL;
+static Oid positionScanContainsBoardOid = InvalidOid;
+
+static set_rel_pathlist_hook_type position_scan_prev_set_rel_pathlist_hook = NULL;
+
+static Plan *position_scan_plan(PlannerInfo *root, RelOptInfo *rel, CustomPath *best_path,
+                                List *tlist, List *clauses, List *custom_plans);
+static Node *position_scan_create_state(CustomScan *cscan);
+static void position_scan_begin(CustomScanState *node, EState *estate, int eflags);
+static TupleTableSlot *position_scan_exec(CustomScanState *node);
+static void position_scan_end(CustomScanState *node);
+static void position_scan_rescan(CustomScanState *node);
+static void position_scan_explain(CustomScanState *node, List *ancestors, ExplainState *es);
+
+static const CustomPathMethods position_path_methods = {
+    .CustomName = "Chess Position Scan",
+    .PlanCustomPath = position_scan_plan,
+};
+
+static const CustomScanMethods position_plan_methods = {
+    .CustomName = "Chess Position Scan",
+    .CreateCustomScanState = position_scan_create_state,
+};
+
+static const CustomExecMethods position_exec_methods = {
+    .CustomName = "Chess Position Scan",
+    .BeginCustomScan = position_scan_begin,
+    .ExecCustomScan = position_scan_exec,
+    .EndCustomScan = position_scan_end,
+    .ReScanCustomScan = position_scan_rescan,
+    .ExplainCustomScan = position_scan_explain,
+};
+
+/**
+ * Checks whether a function is the C function of the 'SAN @> FEN' operator.
+ */
+static bool position_scan_is_contains_board(Oid funcid)
+{
+    FmgrInfo finfo;
+
+    if (funcid == positionScanContainsBoardOid)
+        return true;
+
+    fmgr_info(funcid, &finfo);
+
+    if (finfo.fn_addr != positionScanContainsBoard)
+        return false;
+
+    positionScanContainsBoardOid = funcid;
+
+    return true;
+}
+
+/**
+ * Finds a restriction of the form 'game @> board' on the indexed SAN column.
+ *
+ * The board may be any expression not referencing the table and not volatile
+ * (constants and parameters), as it is evaluated once when the scan starts.
+ *
+ * @return The restriction, or NULL if there is none.
+ */
+static RestrictInfo *position_scan_find_clause(RelOptInfo *rel, AttrNumber attnum)
+{
+    ListCell *lc;
+
+    foreach (lc, rel->baserestrictinfo) {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+        OpExpr *op;
+        Var *var;
+        Expr *board;
+
+        if (!IsA(rinfo->clause, OpExpr))
+            continue;
+
+        op = (OpExpr *) rinfo->clause;
+
+        if (list_length(op->args) != 2)
+            continue;
+
+        var = (Var *) linitial(op->args);
+        board = (Expr *) lsecond(op->args);
+
+        if (!IsA(var, Var) || var->varno != rel->relid || var->varattno != attnum || var->varlevelsup != 0)
+            continue;
+
+        if (contain_var_clause((Node *) board) || contain_volatile_functions((Node *) board))
+            continue;
+
+        if (position_scan_is_contains_board(get_opcode(op->opno)))
+            return rinfo;
+    }
+
+    return NULL;
+}
+
+/**
+ * Adds a position scan path for the 'game @> board' restrictions of tables with a posting file.
+ */
+static void position_scan_set_rel_pathlist(PlannerInfo *root, RelOptInfo *rel, Index rti, RangeTblEntry *rte)
+{
+    const PositionFileMap *map;
+    RestrictInfo *rinfo;
+    CustomPath *cpath;
+    Relation relation;
+    double postings;
+    QualCost qualCost;
+
+    if (position_scan_prev_set_rel_pathlist_hook)
+        position_scan_prev_set_rel_pathlist_hook(root, rel, rti, rte);
+
+    if (!chess_enable_position_file || positionScanContainsBoard == NULL ||
+        rel->reloptkind != RELOPT_BASEREL || rte->rtekind != RTE_RELATION ||
+        rte->relkind != RELKIND_RELATION || rel->baserestrictinfo == NIL)
+        return;
+
+    relation = table_open(rte->relid, NoLock);
+    map = position_file_get(relation);
+    table_close(relation, NoLock);
+
+    if (map == NULL)
+        return;
+
+    rinfo = position_scan_find_clause(rel, (AttrNumber) map->header->attnum);
+
+    if (rinfo == NULL)
+        return;
+
+    // The posting count of a constant board is known exactly.
+    postings = rel->rows;
+
+    if (IsA(lsecond(((OpExpr *) rinfo->clause)->args), Const)) {
+        Const *board = (Const *) lsecond(((OpExpr *) rinfo->clause)->args);
+        const PositionFileKey *key = NULL;
+
+        if (!board->constisnull)
+            key = position_file_lookup(map, fen_position_hash64(((FEN *) DatumGetPointer(board->constvalue))->positions));
+
+        postings = key != NULL ? (double) key->count : 0;
+    }
+
+    cost_qual_eval(&qualCost, rel->baserestrictinfo, root);
+
+    cpath = makeNode(CustomPath);
+    cpath->path.pathtype = T_CustomScan;
+    cpath->path.parent = rel;
+    cpath->path.pathtarget = rel->reltarget;
+    cpath->path.param_info = NULL;
+    cpath->path.parallel_aware = false;
+    cpath->path.parallel_safe = rel->consider_parallel;
+    cpath->path.parallel_workers = 0;
+    cpath->path.rows = rel->rows;
+    cpath->path.startup_cost = qualCost.startup + cpu_operator_cost * log2(map->header->nKeys + 2);
+    cpath->path.total_cost = cpath->path.startup_cost +
+        postings * (random_page_cost + cpu_tuple_cost + qualCost.per_tuple) +
+        rel->rows * rel->reltarget->cost.per_tuple;
+    cpath->flags = 0;
+    cpath->custom_private = list_make1(rinfo);
+    cpath->methods = &position_path_methods;
+
+    add_path(rel, &cpath->path);
+}
+
+/**
+ * Creates the plan of a position scan.
+ *
+ * The 'game @> board' restriction is answered by the posting file but kept in the
+ * quals, which recheck every fetched row; its board expression is kept in custom_exprs.
+ */
+static Plan *position_scan_plan(PlannerInfo *root, RelOptInfo *rel, CustomPath *best_path,
+                                List *tlist, List *clauses, List *custom_plans)
+{
+    CustomScan *cscan = makeNode(CustomScan);
+    RestrictInfo *rinfo = linitial_node(RestrictInfo, best_path->custom_private);
+
+    cscan->scan.plan.targetlist = tlist;
+    cscan->scan.plan.qual = extract_actual_clauses(clauses, false);
+    cscan->scan.scanrelid = rel->relid;
+    cscan->flags = best_path->flags;
+    cscan->custom_exprs = list_make1(lsecond(((OpExpr *) rinfo->clause)->args));
+    cscan->methods = &position_plan_methods;
+
+    return &cscan->scan.plan;
+}
+
+/**
+ * Creates the state of a position scan.
+ */
+static Node *position_scan_create_state(CustomScan *cscan)
+{
+    PositionScanState *state = (PositionScanState *) palloc0(sizeof(PositionScanState));
+
+    NodeSetTag(state, T_CustomScanState);
+    state->css.flags = cscan->flags;
+    state->css.methods = &position_exec_methods;
+
+    return (Node *) state;
+}
+
+/**
+ * Starts a position scan.
+ *
+ * The posting file is looked up again, as it may have been rebuilt or have become
+ * stale since the plan was made.
+ */
+static void position_scan_begin(CustomScanState *node, EState *estate, int eflags)
+{
+    PositionScanState *state = (PositionScanState *) node;
+    CustomScan *cscan = (CustomScan *) node->ss.ps.plan;
+
+    state->boardState = ExecInitExpr((Expr *) linitial(cscan->custom_exprs), &node->ss.ps);
+    state->map = (eflags & EXEC_FLAG_EXPLAIN_ONLY) ? NULL : position_file_get(node->ss.ss_currentRelation);
+    state->scan = NULL;
+    state->started = false;
+}
+
+/**
+ * Returns the next game of the table when the posting file is stale; the quals filter them.
+ */
+static TupleTableSlot *position_scan_next_fallback(ScanState *node)
+{
+    PositionScanState *state = (PositionScanState *) node;
+    TupleTableSlot *slot = node->ss_ScanTupleSlot;
+
+    if (state->scan == NULL)
+        state->scan = table_beginscan(node->ss_currentRelation, node->ps.state->es_snapshot, 0, NULL);
+
+    if (table_scan_getnextslot(state->scan, ForwardScanDirection, slot))
+        return slot;
+
+    return ExecClearTuple(slot);
+}
+
+/**
+ * Returns the next game of the posting list visible to the scan snapshot.
+ */
+static TupleTableSlot *position_scan_next(ScanState *node)
+{
+    PositionScanState *state = (PositionScanState *) node;
+    TupleTableSlot *slot = node->ss_ScanTupleSlot;
+    Relation rel = node->ss_currentRelation;
+    Snapshot snapshot = node->ps.state->es_snapshot;
+
+    if (state->map == NULL)
+        return position_scan_next_fallback(node);
+
+    if (!state->started) {
+        ExprContext *econtext = node->ps.ps_ExprContext;
+        const PositionFileKey *key = NULL;
+        bool isNull;
+        Datum board;
+
+        ResetExprContext(econtext);
+        board = ExecEvalExprSwitchContext(state->boardState, econtext, &isNull);
+
+        if (!isNull)
+            key = position_file_lookup(state->map, fen_position_hash64(((FEN *) DatumGetPointer(board))->positions));
+
+        state->next = key != NULL ? key->first : 0;
+        state->end = key != NULL ? key->first + key->count : 0;
+        state->started = true;
+    }
+
+    while (state->next < state->end) {
+        ItemPointerData tid = state->map->postings[state->next++];
+
+        CHECK_FOR_INTERRUPTS();
+
+        if (table_tuple_fetch_row_version(rel, &tid, snapshot, slot))
+            return slot;
+    }
+
+    return ExecClearTuple(slot);
+}
+
+/**
+ * Checks a fetched row; every restriction, the looked up one included, is a plan qual.
+ */
+static bool position_scan_recheck(ScanState *node, TupleTableSlot *slot)
+{
+    return true;
+}
+
+/**
+ * Returns the next row of a position scan.
+ */
+static TupleTableSlot *position_scan_exec(CustomScanState *node)
+{
+    return ExecScan(&node->ss, position_scan_next, position_scan_recheck);
+}
+
+/**
+ * Ends a position scan; the posting file stays mapped for the next queries.
+ */
+static void position_scan_end(CustomScanState *node)
+{
+    PositionScanState *state = (PositionScanState *) node;
+
+    if (state->scan != NULL)
+        table_endscan(state->scan);
+}
+
+/**
+ * Restarts a position scan, looking the board up again.
+ */
+static void position_scan_rescan(CustomScanState *node)
+{
+    PositionScanState *state = (PositionScanState *) node;
+
+    if (state->scan != NULL)
+        table_rescan(state->scan, NULL);
+
+    state->started = false;
+}
+
+/**
+ * Shows the posting file in EXPLAIN.
+ */
+static void position_scan_explain(CustomScanState *node, List *ancestors, ExplainState *es)
+{
+    char *path = position_file_path(RelationGetRelid(node->ss.ss_currentRelation));
+
+    ExplainPropertyText("Position File", path, es);
+
+    if (es->analyze)
+        ExplainPropertyBool("Stale Position File", ((PositionScanState *) node)->map == NULL, es);
+}
+
+/**
+ * Defines the position scan settings and installs the planner hook.
+ *
+ * Called once from _PG_init.
+ *
+ * @param containsBoard The C function of the 'SAN @> FEN' operator.
+ */
+void position_scan_init(PGFunction containsBoard)
+{
+    DefineCustomBoolVariable("chess.enable_position_file",
+                             "Enables position scans through the posting files built by chess_build_position_file.",
+                             NULL,
+                             &chess_enable_position_file,
+                             true,
+                             PGC_USERSET,
+                             0,
+                             NULL, NULL, NULL);
+
+    positionScanContainsBoard = containsBoard;
+
+    RegisterCustomScanMethods(&position_plan_methods);
+
+    position_scan_prev_set_rel_pathlist_hook = set_rel_pathlist_hook;
+    set_rel_pathlist_hook = position_scan_set_rel_pathlist;
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //POSITION_SCAN_H
@@ -0,0 +1,222 @@
+/*
+ * position_worker.h
+ *      Background workers computing the positions of newly inserted games.
+ *
+ * Tables opt in with the chess_enqueue_positions trigger, which queues their new
+ * games in chess_position_queue. When 'chess.position_workers' is set and the library
+ * is loaded through shared_preload_libraries, that many background workers drain the
+ * queue in batches (chess_process_position_queue) and fill the chess_positions side
+ * table, so inserting transactions do not replay the games themselves. Workers take
+ * batches with SKIP LOCKED and run concurrently. It's part of a PostgreSQL extension
+ * for storing and querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "access/xact.h"
+#include "executor/spi.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/snapmgr.h"
+#include "Utils/chess_stats.h"
+
+#ifndef POSITION_WORKER_H
+#define POSITION_WORKER_H
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+void position_worker_init(void);
+PGDLLEXPORT void chess_position_worker_main(Datum mainArg) pg_attribute_noreturn();
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+// Number of background workers draining the queue ('chess.position_workers').
+static int chess_position_workers = 0;
+
+// Database the workers connect to ('chess.position_worker_database').
+static char *chess_position_worker_database = NULL;
+
+// Games taken from the queue per transaction ('chess.position_worker_batch_size').
+static int chess_position_worker_batch_size = 100;
+
+// Pause between two batches, in milliseconds ('chess.position_worker_delay').
+static int chess_position_worker_delay = 0;
+
+// Pause when the queue is empty, in milliseconds ('chess.position_worker_naptime').
+static int chess_position_worker_naptime = 1000;
+
+/**
+ * Defines the position worker settings and, when preloaded, registers the workers.
+ *
+ * Called once from _PG_init.
+ */
+void position_worker_init(void)
+{
+    BackgroundWorker worker;
+
+    DefineCustomIntVariable("chess.position_workers",
+                            "Number of background workers computing the positions of queued games.",
+                            "Workers are only started when the library is in shared_preload_libraries.",
+                            &chess_position_workers,
+                            0, 0, 64,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomStringVariable("chess.position_worker_database",
+                               "Database whose position queue the background workers drain.",
+                               NULL,
+                               &chess_position_worker_database,
+                               "postgres",
+                               PGC_POSTMASTER,
+                               0,
+                               NULL, NULL, NULL);
+
+    DefineCustomIntVariable("chess.position_worker_batch_size",
+                            "Number of queued games processed per transaction.",
+                            NULL,
+                            &chess_position_worker_batch_size,
+                            100, 1, 100000,
+                            PGC_SIGHUP,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("chess.position_worker_delay",
+                            "Pause of each position worker between two batches.",
+                            "Throttles the workers while the queue is not empty.",
+                            &chess_position_worker_delay,
+                            0, 0, 3600000,
+                            PGC_SIGHUP,
+                            GUC_UNIT_MS,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("chess.position_worker_naptime",
+                            "Pause of each position worker when the queue is empty.",
+                            NULL,
+                            &chess_position_worker_naptime,
+                            1000, 1, 3600000,
+                            PGC_SIGHUP,
+                            GUC_UNIT_MS,
+                            NULL, NULL, NULL);
+
+    if (!process_shared_preload_libraries_in_progress)
+        return;
+
+    memset(&worker, 0, sizeof(worker));
+    worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+    worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+    worker.bgw_restart_time = 10;
+    snprintf(worker.bgw_library_name, BGW_MAXLEN, "chess");
+    snprintf(worker.bgw_function_name, BGW_MAXLEN, "chess_position_worker_main");
+    snprintf(worker.bgw_type, BGW_MAXLEN, "chess position worker");
+
+    for (int i = 0; i < chess_position_workers; i++) {
+        snprintf(worker.bgw_name, BGW_MAXLEN, "chess position worker %d", i + 1);
+        worker.bgw_main_arg = Int32GetDatum(i);
+        RegisterBackgroundWorker(&worker);
+    }
+}
+
+/**
+ * Processes one batch of the position queue in its own transaction.
+ *
+ * @return The number of games processed, or -1 if the extension is not installed.
+ */
+static int position_worker_process_batch(void)
+{
+    int processed = -1;
+
+    SetCurrentStatementStartTimestamp();
+    StartTransactionCommand();
+    PushActiveSnapshot(GetTransactionSnapshot());
+
+    if (SPI_connect() != SPI_OK_CONNECT)
+        ereport(ERROR, (errmsg("chess position worker: SPI_connect failed")));
+
+    pgstat_report_activity(STATE_RUNNING, "processing the chess position queue");
+
+    // The extension is relocatable: find its schema first.
+    if (SPI_execute("SELECT n.nspname FROM pg_catalog.pg_extension e "
+                    "JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace "
+                    "WHERE e.extname = 'chess'", true, 1) == SPI_OK_SELECT && SPI_processed == 1) {
+        char *schema = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+        char *query = psprintf("SELECT %s.chess_process_position_queue(%d)",
+                               quote_identifier(schema), chess_position_worker_batch_size);
+        bool isNull;
+
+        if (SPI_execute(query, false, 0) != SPI_OK_SELECT || SPI_processed != 1)
+            ereport(ERROR, (errmsg("chess position worker: cannot process the position queue")));
+
+        processed = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isNull));
+    }
+
+    SPI_finish();
+    PopActiveSnapshot();
+    CommitTransactionCommand();
+
+    pgstat_report_stat(false);
+    pgstat_report_activity(STATE_IDLE, NULL);
+
+    return processed;
+}
+
+/**
+ * Main loop of a position worker.
+ *
+ * Batches are processed back to back (with 'chess.position_worker_delay' between
+ * them) while the queue has games, and the worker sleeps for
+ * 'chess.position_worker_naptime' once it is empty or if the extension is not
+ * installed in the database.
+ *
+ * @param mainArg The index of the worker.
+ */
+void chess_position_worker_main(Datum mainArg)
+{
+    pqsignal(SIGHUP, SignalHandlerForConfigReload);
+    pqsignal(SIGTERM, die);
+    BackgroundWorkerUnblockSignals();
+
+    BackgroundWorkerInitializeConnection(chess_position_worker_database, NULL, 0);
+
+    ereport(LOG, (errmsg("chess position worker %d started", DatumGetInt32(mainArg) + 1)));
+
+    for (;;) {
+        int processed;
+        long delay;
+
+        CHECK_FOR_INTERRUPTS();
+
+        if (ConfigReloadPending) {
+            ConfigReloadPending = false;
+            ProcessConfigFile(PGC_SIGHUP);
+        }
+
+        processed = position_worker_process_batch();
+
+        if (processed > 0)
+            chess_stats_count(CHESS_STAT_QUEUED_GAMES, processed);
+
+        delay = processed > 0 ? chess_position_worker_delay : chess_position_worker_naptime;
+
+        if (delay > 0) {
+            (void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH, delay, PG_WAIT_EXTENSION);
+            ResetLatch(MyLatch);
+        }
+    }
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //POSITION_WORKER_H
@@ -0,0 +1,315 @@
+/*
+ * variation_tree.h
+ *      Variation trees of SAN games.
+ *
+ * The side lines of a game are its variations in parentheses, which may be nested.
+ * A game is parsed into a flat tree: one line per variation, referencing the line
+ * it branches from and the half-move it replaces, and the moves of every line in the
+ * order of the text, pointing into it. Replaying the tree gives the board states of
+ * the side lines, which the GIN index keys apart from the mainline ones when its
+ * 'variations' option is set. It's part of a PostgreSQL extension for storing and
+ * querying chess games.
+ *
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "DataTypes/FEN/FEN.h"
+#include "Utils/chess_stats.h"
+#include "Utils/move_engine.h"
+#include "Utils/move_ngrams.h"
+
+#ifndef VARIATION_TREE_H
+#define VARIATION_TREE_H
+
+//---------------------------------------------------------------------DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+/**
+ * Structure representing a line of a variation tree.
+ *
+ * @param parent The line the variation branches from, -1 for the mainline.
+ * @param parentMoves The number of moves of the parent line read before the variation;
+ *        the variation replaces the last of them.
+ * @param ply The number of half-moves before the first move of the line.
+ * @param nMoves The number of moves of the line, its own variations left out.
+ */
+typedef struct
+{
+    int parent;
+    int parentMoves;
+    int ply;
+    int nMoves;
+} VariationLine;
+
+/**
+ * Structure representing a move of a variation tree.
+ *
+ * @param token The normalized move, pointing into the game.
+ * @param line The line of the move.
+ */
+typedef struct
+{
+    MoveToken token;
+    int line;
+} VariationMove;
+
+/**
+ * Structure representing the variation tree of a game.
+ *
+ * @param lines The lines, the mainline first; a variation comes after the line it
+ *        branches from.
+ * @param nLines The number of lines.
+ * @param moves The moves of all the lines, in the order of the text.
+ * @param nMoves The number of moves.
+ */
+typedef struct
+{
+    VariationLine *lines;
+    int nLines;
+    VariationMove *moves;
+    int nMoves;
+} VariationTree;
+
+/**
+ * State of a line while a variation tree is replayed.
+ *
+ * @param board The position after the last move played.
+ * @param before The position before the last move played.
+ * @param played The number of moves played.
+ * @param started Whether the starting position of the line was set.
+ * @param reached Whether the starting position of the line could be reached.
+ * @param stopped Whether no more moves of the line are played.
+ */
+typedef struct
+{
+    ChessBoard board;
+    ChessBoard before;
+    int played;
+    bool started;
+    bool reached;
+    bool stopped;
+} VariationReplay;
+
+//------------------------------------------------------------------END DATA TYPE DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//---------------------------------------------------------------------FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+void variation_tree_parse(const char *str, VariationTree *tree);
+char **variation_tree_fens(const VariationTree *tree, int **plies, int *nFens);
+void variation_tree_free(VariationTree *tree);
+
+//-----------------------------------------------------------------END FUNCTIONS DECLARATION--------------------------------------------------------------------//
+
+
+
+
+//------------------------------------------------------------------FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+/**
+ * Parses the variation tree of a game.
+ *
+ * Tokens are read as move_mainline_tokens reads them: comments, numeric annotation
+ * glyphs, move numbers and results are left out, so the moves of the mainline are
+ * the ones it returns. A closing parenthesis without an opening one is ignored, and
+ * the variations still open at the end of the text are closed there.
+ *
+ * @param str The null-terminated game.
+ * @param tree The tree to fill, its arrays palloc'd.
+ */
+void variation_tree_parse(const char *str, VariationTree *tree)
+{
+    const char *p = str;
+    int length = strlen(str);
+    int *open = (int *) palloc((length + 1) * sizeof(int)); // Open lines, innermost last
+    int depth = 0;
+
+    tree->lines = (VariationLine *) palloc((length + 1) * sizeof(VariationLine));
+    tree->moves = (VariationMove *) palloc((length / 2 + 1) * sizeof(VariationMove));
+    tree->nLines = 1;
+    tree->nMoves = 0;
+
+    tree->lines[0].parent = -1;
+    tree->lines[0].parentMoves = 0;
+    tree->lines[0].ply = 0;
+    tree->lines[0].nMoves = 0;
+    open[0] = 0;
+
+    while (*p) {
+        const char *begin;
+        VariationMove *move;
+
+        if (*p == '{') {
+            while (*p && *p != '}')
+                p++;
+            if (*p)
+                p++;
+            continue;
+        }
+
+        if (*p == ';') {
+            while (*p && *p != '\n')
+                p++;
+            continue;
+        }
+
+        if (*p == '(') {
+            const VariationLine *parent = &tree->lines[open[depth]];
+            VariationLine *line = &tree->lines[tree->nLines];
+
+            line->parent = open[depth];
+            line->parentMoves = parent->nMoves;
+            line->ply = parent->ply + Max(parent->nMoves - 1, 0);
+            line->nMoves = 0;
+
+            open[++depth] = tree->nLines++;
+            p++;
+            continue;
+        }
+
+        if (*p == ')') {
+            if (depth > 0)
+                depth--;
+            p++;
+            continue;
+        }
+
+        if (isspace((unsigned char) *p)) {
+            p++;
+            continue;
+        }
+
+        begin = p;
+
+        while (*p && !isspace((unsigned char) *p) && strchr("{};()", *p) == NULL)
+            p++;
+
+        if (*begin == '$')
+            continue;
+
+        move = &tree->moves[tree->nMoves];
+        move->token.len = normalize_move_token(begin, p - begin, &move->token.str);
+
+        if (move->token.len > 0 && !is_result_token(move->token.str, move->token.len)) {
+            move->line = open[depth];
+            tree->lines[open[depth]].nMoves++;
+            tree->nMoves++;
+        }
+    }
+
+    pfree(open);
+}
+
+/**
+ * Sets the starting position of a line, and of the lines it branches from.
+ *
+ * A variation starts from the position before the move it replaces. It is not
+ * reached when its parent line stopped before that move.
+ */
+static void variation_line_start(const VariationTree *tree, VariationReplay *replay, int line)
+{
+    const VariationLine *info = &tree->lines[line];
+    VariationReplay *state = &replay[line];
+    const VariationReplay *parent;
+
+    if (state->started)
+        return;
+
+    state->started = true;
+
+    if (info->parent < 0) {
+        board_init(&state->board);
+        state->reached = true;
+        return;
+    }
+
+    variation_line_start(tree, replay, info->parent);
+    parent = &replay[info->parent];
+
+    state->reached = parent->reached && parent->played >= info->parentMoves - 1;
+
+    if (!state->reached)
+        state->stopped = true;
+    else if (info->parentMoves > 0 && parent->played == info->parentMoves)
+        state->board = parent->before;
+    else
+        state->board = parent->board;
+}
+
+/**
+ * Replays a variation tree and collects the board states of its side lines.
+ *
+ * Every line is played from its starting position up to its first move that cannot
+ * be played, as san_to_fens plays the mainline. The mainline board states are not
+ * returned.
+ *
+ * @param tree The tree, as parsed by variation_tree_parse.
+ * @param plies Set to a palloc'd array of the half-move of each board state.
+ * @param nFens Set to the number of board states returned.
+ * @return A palloc'd array of palloc'd FEN strings, one per side line move played.
+ */
+char **variation_tree_fens(const VariationTree *tree, int **plies, int *nFens)
+{
+    VariationReplay *replay = (VariationReplay *) palloc0(tree->nLines * sizeof(VariationReplay));
+    char **result = (char **) palloc((tree->nMoves + 1) * sizeof(char *));
+    int played = 0;
+
+    *plies = (int *) palloc((tree->nMoves + 1) * sizeof(int));
+    *nFens = 0;
+
+    for (int i = 0; i < tree->nMoves; i++) {
+        const VariationMove *move = &tree->moves[i];
+        VariationReplay *state = &replay[move->line];
+
+        CHECK_FOR_INTERRUPTS();
+
+        variation_line_start(tree, replay, move->line);
+
+        if (state->stopped)
+            continue;
+
+        state->before = state->board;
+
+        if (!board_play_san(&state->board, move->token.str, move->token.len)) {
+            state->board = state->before;
+            state->stopped = true;
+            continue;
+        }
+
+        state->played++;
+        played++;
+
+        if (move->line == 0)
+            continue;
+
+        result[*nFens] = (char *) palloc(FEN_STR_LENGTH);
+        board_to_fen(&state->board, result[*nFens]);
+        (*plies)[*nFens] = tree->lines[move->line].ply + state->played;
+        (*nFens)++;
+    }
+
+    pfree(replay);
+
+    // Account for the replay in the extension statistics.
+    chess_stats_count(CHESS_STAT_REPLAYS, 1);
+    chess_stats_count(CHESS_STAT_PLIES_REPLAYED, played);
+
+    return result;
+}
+
+/**
+ * Releases the arrays of a variation tree.
+ *
+ * @param tree The tree, as parsed by variation_tree_parse.
+ */
+void variation_tree_free(VariationTree *tree)
+{
+    pfree(tree->lines);
+    pfree(tree->moves);
+}
+
+//--------------------------------------------------------------END FUNCTIONS IMPLEMENTATION--------------------------------------------------------------------//
+
+#endif //VARIATION_TREE_H
@@ -10,6 +10,17 @@ CREATE OR REPLACE FUNCTION san_out(SAN)
   LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
   AS 'MODULE_PATHNAME';
 
+-- Binary form, written by the pgn2copy tool for COPY ... (FORMAT binary)
+CREATE OR REPLACE FUNCTION san_recv(internal)
+  RETURNS SAN
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+  AS 'MODULE_PATHNAME';
+
+CREATE OR REPLACE FUNCTION san_send(SAN)
+  RETURNS bytea
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+  AS 'MODULE_PATHNAME';
+
 CREATE OR REPLACE FUNCTION fen_in(cstring)
   RETURNS FEN
   AS 'MODULE_PATHNAME'
@@ -21,9 +32,12 @@ CREATE OR REPLACE FUNCTION fen_out(FEN)
   LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 
 CREATE TYPE SAN (
-  internallength = 1000,
+  internallength = variable,
   input          = san_in,
-  output         = san_out
+  output         = san_out,
+  receive        = san_recv,
+  send           = san_send,
+  storage        = extended
 );
 
 CREATE TYPE FEN (
@@ -33,6 +47,80 @@ CREATE TYPE FEN (
   alignment = double
 );
 
+CREATE FUNCTION pgn_in(cstring)
+  RETURNS PGN
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION pgn_out(PGN)
+  RETURNS cstring
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE TYPE PGN (
+  internallength = variable,
+  input          = pgn_in,
+  output         = pgn_out,
+  storage        = extended
+);
+
+-- PGN values are accepted wherever SAN is, through their moves
+CREATE FUNCTION pgn_to_san(PGN)
+  RETURNS SAN
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE CAST (PGN AS SAN) WITH FUNCTION pgn_to_san(PGN) AS IMPLICIT;
+
+CREATE FUNCTION san_to_pgn(SAN)
+  RETURNS PGN
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE CAST (SAN AS PGN) WITH FUNCTION san_to_pgn(SAN) AS ASSIGNMENT;
+
+/* Opening dictionary used to compress stored games (chess.san_compression) */
+
+CREATE TABLE chess_opening_dict (
+  id     integer PRIMARY KEY,
+  prefix text NOT NULL UNIQUE
+);
+
+SELECT pg_catalog.pg_extension_config_dump('chess_opening_dict', '');
+
+-- Stored games are decoded with the dictionary lines they reference, and the SAN
+-- functions are immutable: lines may be added, never changed nor removed.
+CREATE FUNCTION chess_opening_dict_append_only()
+  RETURNS trigger
+  LANGUAGE plpgsql
+  AS $$
+BEGIN
+  RAISE EXCEPTION 'chess_opening_dict is append-only: % is not allowed', TG_OP
+    USING ERRCODE = 'object_not_in_prerequisite_state',
+          HINT = 'Stored games reference the dictionary lines; add a new line instead.';
+END
+$$;
+
+CREATE TRIGGER chess_opening_dict_append_only
+  BEFORE UPDATE OR DELETE ON chess_opening_dict
+  FOR EACH ROW EXECUTE FUNCTION chess_opening_dict_append_only();
+
+CREATE TRIGGER chess_opening_dict_append_only_truncate
+  BEFORE TRUNCATE ON chess_opening_dict
+  FOR EACH STATEMENT EXECUTE FUNCTION chess_opening_dict_append_only();
+
+REVOKE UPDATE, DELETE, TRUNCATE ON chess_opening_dict FROM PUBLIC;
+
+-- Sessions keep the dictionary in memory: inserts make them all read it again.
+CREATE FUNCTION chess_opening_dict_changed()
+  RETURNS trigger
+  AS 'MODULE_PATHNAME', 'chess_opening_dict_changed'
+  LANGUAGE C VOLATILE;
+
+CREATE TRIGGER chess_opening_dict_changed
+  AFTER INSERT ON chess_opening_dict
+  FOR EACH STATEMENT EXECUTE FUNCTION chess_opening_dict_changed();
+
 /* Functions */
 
 CREATE FUNCTION get_FirstMoves(SAN, integer)
@@ -40,9 +128,21 @@ CREATE FUNCTION get_FirstMoves(SAN, integer)
   AS 'MODULE_PATHNAME', 'get_FirstMoves'
   LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 
+-- Prunes the partitions keyed on opening_bucket (see chess.opening_bucket_depth)
+CREATE FUNCTION has_opening_support(internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'has_opening_support'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
 CREATE FUNCTION has_opening(SAN, SAN)
   RETURNS BOOLEAN
   AS 'MODULE_PATHNAME', 'has_opening'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE
+  SUPPORT has_opening_support;
+
+CREATE FUNCTION opening_bucket(SAN, integer)
+  RETURNS integer
+  AS 'MODULE_PATHNAME', 'opening_bucket'
   LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 
 CREATE FUNCTION get_board_state(SAN, integer)
@@ -50,11 +150,59 @@ CREATE FUNCTION get_board_state(SAN, integer)
   AS 'MODULE_PATHNAME', 'get_board_state'
   LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 
+-- Appended games keep their final position, read back by current_board without a replay
+CREATE FUNCTION san_append(SAN, text)
+  RETURNS SAN
+  AS 'MODULE_PATHNAME', 'san_append'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION current_board(SAN)
+  RETURNS FEN
+  AS 'MODULE_PATHNAME', 'current_board'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
 CREATE FUNCTION has_Board(SAN, FEN, integer)
   RETURNS BOOLEAN
   AS 'MODULE_PATHNAME', 'has_Board'
   LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 
+CREATE FUNCTION game_fingerprint(SAN)
+  RETURNS bigint
+  AS 'MODULE_PATHNAME', 'game_fingerprint'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+-- Immutable for generated columns and indexes, though they depend on the ECO table
+-- (chess.eco_file): rebuild those after the table changes.
+CREATE FUNCTION eco_code(SAN)
+  RETURNS text
+  AS 'MODULE_PATHNAME', 'eco_code'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION eco_name(SAN)
+  RETURNS text
+  AS 'MODULE_PATHNAME', 'eco_name'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION pgn_tag(PGN, text)
+  RETURNS text
+  AS 'MODULE_PATHNAME', 'pgn_tag'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION pgn_result(PGN)
+  RETURNS text
+  AS 'MODULE_PATHNAME', 'pgn_result'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION ply_count(PGN)
+  RETURNS integer
+  AS 'MODULE_PATHNAME', 'ply_count'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION ply_count(SAN)
+  RETURNS integer
+  AS 'MODULE_PATHNAME', 'ply_count_san'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
 
 /* B-tree */
 
@@ -142,13 +290,20 @@ CREATE OPERATOR ~~ (
   LEFTARG = SAN,
   RIGHTARG = TEXT,
   PROCEDURE = san_like,
-  COMMUTATOR = !~~
+  NEGATOR = !~~
 );
 
 CREATE OPERATOR !~~ (
   LEFTARG = SAN,
   RIGHTARG = TEXT,
-  PROCEDURE = san_not_like
+  PROCEDURE = san_not_like,
+  NEGATOR = ~~
+);
+
+CREATE OPERATOR || (
+  LEFTARG = SAN,
+  RIGHTARG = TEXT,
+  PROCEDURE = san_append
 );
 
 CREATE OPERATOR CLASS san_ops
@@ -163,8 +318,8 @@ DEFAULT FOR TYPE SAN USING btree AS
 
 /* GIN test */
 
-CREATE OR REPLACE FUNCTION gin_compare(internal, internal) 
-  RETURNS internal
+CREATE OR REPLACE FUNCTION gin_compare(text, text) 
+  RETURNS integer
   AS 'MODULE_PATHNAME', 'gin_compare'
   LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
 
@@ -183,10 +338,15 @@ CREATE OR REPLACE FUNCTION gin_consistent(internal, internal, internal, internal
   AS 'MODULE_PATHNAME', 'gin_consistent'
   LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
 
+CREATE OR REPLACE FUNCTION gin_tri_consistent(internal, internal, internal, internal, internal, internal, internal)
+  RETURNS internal 
+  AS 'MODULE_PATHNAME', 'gin_tri_consistent'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
 CREATE FUNCTION has_board_fn_operator(SAN, FEN)
   RETURNS boolean
   AS 'MODULE_PATHNAME', 'has_board_fn_operator'
-  LANGUAGE C STRICT;
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
 
 CREATE OR REPLACE FUNCTION fen_in_san_eq(SAN, FEN) 
   RETURNS BOOLEAN
@@ -210,11 +370,616 @@ CREATE OPERATOR = (
   NEGATOR = '<>'
 );
 
+-- Side to move, castling rights and en passant square included
+CREATE FUNCTION has_exact_board(SAN, FEN)
+  RETURNS boolean
+  AS 'MODULE_PATHNAME', 'has_exact_board'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE OPERATOR @= (
+  LEFTARG = SAN,
+  RIGHTARG = FEN,
+  PROCEDURE = has_exact_board,
+  restrict = contsel,
+  join = contjoinsel
+);
+
+-- Side lines (variations) included
+CREATE FUNCTION has_board_in_lines(SAN, FEN)
+  RETURNS boolean
+  AS 'MODULE_PATHNAME', 'has_board_in_lines'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE OPERATOR @@> (
+  LEFTARG = SAN,
+  RIGHTARG = FEN,
+  PROCEDURE = has_board_in_lines,
+  restrict = contsel,
+  join = contjoinsel
+);
+
+CREATE FUNCTION game_variations(
+    SAN,
+    OUT line integer,
+    OUT parent integer,
+    OUT ply integer,
+    OUT moves text)
+  RETURNS SETOF record
+  AS 'MODULE_PATHNAME', 'game_variations'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION has_all_boards(SAN, FEN[])
+  RETURNS boolean
+  AS 'MODULE_PATHNAME', 'has_all_boards'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION has_any_board(SAN, FEN[])
+  RETURNS boolean
+  AS 'MODULE_PATHNAME', 'has_any_board'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE OPERATOR @> (
+  LEFTARG = SAN,
+  RIGHTARG = FEN[],
+  PROCEDURE = has_all_boards,
+  restrict = contsel,
+  join = contjoinsel
+);
+
+CREATE OPERATOR && (
+  LEFTARG = SAN,
+  RIGHTARG = FEN[],
+  PROCEDURE = has_any_board,
+  restrict = areasel,
+  join = areajoinsel
+);
+
+CREATE FUNCTION reaches_in_order(SAN, FEN[])
+  RETURNS boolean
+  AS 'MODULE_PATHNAME', 'reaches_in_order'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION reaches_in_order_plies(SAN, FEN[])
+  RETURNS integer[]
+  AS 'MODULE_PATHNAME', 'reaches_in_order_plies'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE OPERATOR @>> (
+  LEFTARG = SAN,
+  RIGHTARG = FEN[],
+  PROCEDURE = reaches_in_order,
+  restrict = contsel,
+  join = contjoinsel
+);
+
+CREATE TYPE FENWINDOW;
+
+CREATE FUNCTION fenwindow_in(cstring)
+  RETURNS FENWINDOW
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION fenwindow_out(FENWINDOW)
+  RETURNS cstring
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE TYPE FENWINDOW (
+  internallength = 96,
+  input = fenwindow_in,
+  output = fenwindow_out,
+  alignment = double
+);
+
+CREATE FUNCTION fen_window(FEN, integer, integer)
+  RETURNS FENWINDOW
+  AS 'MODULE_PATHNAME', 'fen_window'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION reaches_window(SAN, FENWINDOW)
+  RETURNS boolean
+  AS 'MODULE_PATHNAME', 'reaches_window'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE OPERATOR @> (
+  LEFTARG = SAN,
+  RIGHTARG = FENWINDOW,
+  PROCEDURE = reaches_window,
+  restrict = contsel,
+  join = contjoinsel
+);
+
+-- Inlined by the planner, so that the '@>' operator can use the index.
+CREATE FUNCTION reaches_between(SAN, FEN, integer, integer)
+  RETURNS boolean
+  AS 'SELECT $1 @> fen_window($2, $3, $4)'
+  LANGUAGE SQL STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION first_ply_of(SAN, FEN)
+  RETURNS integer
+  AS 'MODULE_PATHNAME', 'first_ply_of'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION has_board_many(SAN, FEN[])
+  RETURNS integer[]
+  AS 'MODULE_PATHNAME', 'has_board_many'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION gin_options(internal)
+  RETURNS void
+  AS 'MODULE_PATHNAME', 'gin_options'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+-- Options: max_ply, skip_first, key ('placement' or 'full') and variations
 CREATE OPERATOR CLASS san_gin_ops
 DEFAULT FOR TYPE SAN USING gin AS
     OPERATOR 1 @> (SAN, FEN),
     OPERATOR 2 = (SAN, FEN),
-    FUNCTION 1 gin_compare(internal, internal),
+    OPERATOR 3 @> (SAN, FEN[]),
+    OPERATOR 4 && (SAN, FEN[]),
+    OPERATOR 5 @>> (SAN, FEN[]),
+    OPERATOR 6 @> (SAN, FENWINDOW),
+    OPERATOR 7 @= (SAN, FEN),
+    OPERATOR 8 @@> (SAN, FEN),
+    FUNCTION 1 gin_compare(text, text),
     FUNCTION 2 gin_extract_value(internal, internal, internal),
     FUNCTION 3 gin_extract_query(internal, internal, internal, internal, internal, internal, internal),
-    FUNCTION 4 gin_consistent(internal, internal, internal, internal, internal, internal, internal, internal);
\ No newline at end of file
+    FUNCTION 4 gin_consistent(internal, internal, internal, internal, internal, internal, internal, internal),
+    FUNCTION 6 gin_tri_consistent(internal, internal, internal, internal, internal, internal, internal),
+    FUNCTION 7 gin_options(internal),
+    STORAGE text;
+
+
+/* Move n-grams GIN */
+
+CREATE FUNCTION contains_moves(SAN, text)
+  RETURNS boolean
+  AS 'MODULE_PATHNAME', 'contains_moves'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE OPERATOR @@ (
+  LEFTARG = SAN,
+  RIGHTARG = TEXT,
+  PROCEDURE = contains_moves,
+  restrict = contsel,
+  join = contjoinsel
+);
+
+CREATE FUNCTION gin_moves_extract_value(internal, internal, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gin_moves_extract_value'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION gin_moves_extract_query(internal, internal, internal, internal, internal, internal, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gin_moves_extract_query'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION gin_moves_compare_partial(text, text, smallint, internal)
+  RETURNS integer
+  AS 'MODULE_PATHNAME', 'gin_moves_compare_partial'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION gin_moves_consistent(internal, internal, internal, internal, internal, internal, internal, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gin_moves_consistent'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION gin_moves_tri_consistent(internal, internal, internal, internal, internal, internal, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gin_moves_tri_consistent'
+  LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE OPERATOR CLASS san_moves_gin_ops
+FOR TYPE SAN USING gin AS
+    OPERATOR 1 ~~ (SAN, text),
+    OPERATOR 2 @@ (SAN, text),
+    FUNCTION 1 gin_compare(text, text),
+    FUNCTION 2 gin_moves_extract_value(internal, internal, internal),
+    FUNCTION 3 gin_moves_extract_query(internal, internal, internal, internal, internal, internal, internal),
+    FUNCTION 4 gin_moves_consistent(internal, internal, internal, internal, internal, internal, internal, internal),
+    FUNCTION 5 gin_moves_compare_partial(text, text, smallint, internal),
+    FUNCTION 6 gin_moves_tri_consistent(internal, internal, internal, internal, internal, internal, internal),
+    STORAGE text;
+
+
+/* GiST */
+
+CREATE TYPE sansig;
+
+CREATE FUNCTION sansig_in(cstring)
+  RETURNS sansig
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION sansig_out(sansig)
+  RETURNS cstring
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE TYPE sansig (
+  internallength = variable,
+  input = sansig_in,
+  output = sansig_out
+);
+
+CREATE FUNCTION gist_sig_consistent(internal, FEN, smallint, oid, internal)
+  RETURNS boolean
+  AS 'MODULE_PATHNAME', 'gist_sig_consistent'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_sig_union(internal, internal)
+  RETURNS sansig
+  AS 'MODULE_PATHNAME', 'gist_sig_union'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_sig_compress(internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_sig_compress'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_sig_decompress(internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_sig_decompress'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_sig_penalty(internal, internal, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_sig_penalty'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_sig_picksplit(internal, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_sig_picksplit'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_sig_same(sansig, sansig, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_sig_same'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR CLASS san_gist_ops
+FOR TYPE SAN USING gist AS
+    OPERATOR 1 @> (SAN, FEN),
+    FUNCTION 1 gist_sig_consistent(internal, FEN, smallint, oid, internal),
+    FUNCTION 2 gist_sig_union(internal, internal),
+    FUNCTION 3 gist_sig_compress(internal),
+    FUNCTION 4 gist_sig_decompress(internal),
+    FUNCTION 5 gist_sig_penalty(internal, internal, internal),
+    FUNCTION 6 gist_sig_picksplit(internal, internal),
+    FUNCTION 7 gist_sig_same(sansig, sansig, internal),
+    STORAGE sansig;
+
+/* Position bloom (BRIN) */
+
+CREATE FUNCTION brin_pos_bloom_opcinfo(internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'brin_pos_bloom_opcinfo'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION brin_pos_bloom_add_value(internal, internal, internal, internal)
+  RETURNS boolean
+  AS 'MODULE_PATHNAME', 'brin_pos_bloom_add_value'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION brin_pos_bloom_consistent(internal, internal, internal, integer)
+  RETURNS boolean
+  AS 'MODULE_PATHNAME', 'brin_pos_bloom_consistent'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION brin_pos_bloom_union(internal, internal, internal)
+  RETURNS boolean
+  AS 'MODULE_PATHNAME', 'brin_pos_bloom_union'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION brin_pos_bloom_options(internal)
+  RETURNS void
+  AS 'MODULE_PATHNAME', 'brin_pos_bloom_options'
+  LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+-- Lossy: the games of the matching block ranges are rechecked.
+CREATE OPERATOR CLASS san_brin_bloom_ops
+FOR TYPE SAN USING brin AS
+    OPERATOR 1 @> (SAN, FEN),
+    FUNCTION 1 brin_pos_bloom_opcinfo(internal),
+    FUNCTION 2 brin_pos_bloom_add_value(internal, internal, internal, internal),
+    FUNCTION 3 brin_pos_bloom_consistent(internal, internal, internal, integer),
+    FUNCTION 4 brin_pos_bloom_union(internal, internal, internal),
+    FUNCTION 5 brin_pos_bloom_options(internal),
+    STORAGE bytea;
+
+/* Similar games (GiST KNN) */
+
+CREATE FUNCTION san_distance(SAN, SAN)
+  RETURNS float8
+  AS 'MODULE_PATHNAME', 'san_distance'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR <-> (
+  LEFTARG = SAN,
+  RIGHTARG = SAN,
+  PROCEDURE = san_distance,
+  COMMUTATOR = <->
+);
+
+CREATE TYPE moveseq;
+
+CREATE FUNCTION moveseq_in(cstring)
+  RETURNS moveseq
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION moveseq_out(moveseq)
+  RETURNS cstring
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE TYPE moveseq (
+  internallength = variable,
+  input = moveseq_in,
+  output = moveseq_out
+);
+
+CREATE FUNCTION gist_moves_consistent(internal, SAN, smallint, oid, internal)
+  RETURNS bool
+  AS 'MODULE_PATHNAME', 'gist_moves_consistent'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_moves_union(internal, internal)
+  RETURNS moveseq
+  AS 'MODULE_PATHNAME', 'gist_moves_union'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_moves_compress(internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_moves_compress'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_moves_decompress(internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_moves_decompress'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_moves_penalty(internal, internal, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_moves_penalty'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_moves_picksplit(internal, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_moves_picksplit'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_moves_same(moveseq, moveseq, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_moves_same'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_moves_distance(internal, SAN, smallint, oid, internal)
+  RETURNS float8
+  AS 'MODULE_PATHNAME', 'gist_moves_distance'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR CLASS san_moves_gist_ops
+FOR TYPE SAN USING gist AS
+    OPERATOR 15 <-> (SAN, SAN) FOR ORDER BY pg_catalog.float_ops,
+    FUNCTION 1 gist_moves_consistent(internal, SAN, smallint, oid, internal),
+    FUNCTION 2 gist_moves_union(internal, internal),
+    FUNCTION 3 gist_moves_compress(internal),
+    FUNCTION 4 gist_moves_decompress(internal),
+    FUNCTION 5 gist_moves_penalty(internal, internal, internal),
+    FUNCTION 6 gist_moves_picksplit(internal, internal),
+    FUNCTION 7 gist_moves_same(moveseq, moveseq, internal),
+    FUNCTION 8 gist_moves_distance(internal, SAN, smallint, oid, internal),
+    STORAGE moveseq;
+
+/* Nearest positions (GiST KNN) */
+
+CREATE FUNCTION fen_distance(FEN, FEN)
+  RETURNS float8
+  AS 'MODULE_PATHNAME', 'fen_distance'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR <-> (
+  LEFTARG = FEN,
+  RIGHTARG = FEN,
+  PROCEDURE = fen_distance,
+  COMMUTATOR = <->
+);
+
+CREATE TYPE boardsig;
+
+CREATE FUNCTION boardsig_in(cstring)
+  RETURNS boardsig
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION boardsig_out(boardsig)
+  RETURNS cstring
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE TYPE boardsig (
+  internallength = variable,
+  input = boardsig_in,
+  output = boardsig_out,
+  alignment = double
+);
+
+CREATE FUNCTION gist_board_consistent(internal, FEN, smallint, oid, internal)
+  RETURNS bool
+  AS 'MODULE_PATHNAME', 'gist_board_consistent'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_board_union(internal, internal)
+  RETURNS boardsig
+  AS 'MODULE_PATHNAME', 'gist_board_union'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_board_compress(internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_board_compress'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_board_decompress(internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_board_decompress'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_board_penalty(internal, internal, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_board_penalty'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_board_picksplit(internal, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_board_picksplit'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_board_same(boardsig, boardsig, internal)
+  RETURNS internal
+  AS 'MODULE_PATHNAME', 'gist_board_same'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION gist_board_distance(internal, FEN, smallint, oid, internal)
+  RETURNS float8
+  AS 'MODULE_PATHNAME', 'gist_board_distance'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR CLASS fen_gist_ops
+DEFAULT FOR TYPE FEN USING gist AS
+    OPERATOR 15 <-> (FEN, FEN) FOR ORDER BY pg_catalog.float_ops,
+    FUNCTION 1 gist_board_consistent(internal, FEN, smallint, oid, internal),
+    FUNCTION 2 gist_board_union(internal, internal),
+    FUNCTION 3 gist_board_compress(internal),
+    FUNCTION 4 gist_board_decompress(internal),
+    FUNCTION 5 gist_board_penalty(internal, internal, internal),
+    FUNCTION 6 gist_board_picksplit(internal, internal),
+    FUNCTION 7 gist_board_same(boardsig, boardsig, internal),
+    FUNCTION 8 gist_board_distance(internal, FEN, smallint, oid, internal),
+    STORAGE boardsig;
+
+
+/* Position queue (background workers) */
+
+CREATE FUNCTION position_key(FEN)
+  RETURNS bigint
+  AS 'MODULE_PATHNAME', 'position_key'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION game_position_keys(
+    SAN,
+    OUT ply integer,
+    OUT position_key bigint)
+  RETURNS SETOF record
+  AS 'MODULE_PATHNAME', 'game_position_keys'
+  LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE TABLE chess_position_queue (
+  id bigserial PRIMARY KEY,
+  source regclass NOT NULL,
+  row_key bigint NOT NULL,
+  game SAN NOT NULL,
+  enqueued_at timestamptz NOT NULL DEFAULT now()
+);
+
+CREATE TABLE chess_positions (
+  source regclass NOT NULL,
+  row_key bigint NOT NULL,
+  ply integer NOT NULL,
+  position_key bigint NOT NULL,
+  PRIMARY KEY (source, row_key, ply)
+);
+
+CREATE INDEX chess_positions_position_key_idx ON chess_positions (position_key);
+
+SELECT pg_catalog.pg_extension_config_dump('chess_position_queue', '');
+SELECT pg_catalog.pg_extension_config_dump('chess_position_queue_id_seq', '');
+SELECT pg_catalog.pg_extension_config_dump('chess_positions', '');
+
+-- Trigger queuing the new rows of a table: chess_enqueue_positions(key column, game column).
+CREATE FUNCTION chess_enqueue_positions()
+  RETURNS trigger
+  LANGUAGE plpgsql
+  SET search_path FROM CURRENT
+  AS $$
+DECLARE
+  key bigint;
+  game SAN;
+BEGIN
+  IF TG_NARGS <> 2 THEN
+    RAISE EXCEPTION 'chess_enqueue_positions expects the key column and the game column as arguments';
+  END IF;
+
+  EXECUTE format('SELECT ($1).%I::bigint, ($1).%I', TG_ARGV[0], TG_ARGV[1]) INTO key, game USING NEW;
+
+  IF game IS NOT NULL THEN
+    INSERT INTO chess_position_queue (source, row_key, game) VALUES (TG_RELID, key, game);
+  END IF;
+
+  RETURN NULL;
+END
+$$;
+
+-- Moves one batch of queued games to chess_positions; returns the number of games processed.
+CREATE FUNCTION chess_process_position_queue(batch_size integer DEFAULT 100)
+  RETURNS integer
+  LANGUAGE sql
+  SET search_path FROM CURRENT
+  AS $$
+  WITH batch AS (
+    DELETE FROM chess_position_queue
+    WHERE id IN (SELECT id FROM chess_position_queue ORDER BY id LIMIT batch_size FOR UPDATE SKIP LOCKED)
+    RETURNING source, row_key, game
+  ), positions AS (
+    INSERT INTO chess_positions (source, row_key, ply, position_key)
+    SELECT b.source, b.row_key, k.ply, k.position_key
+    FROM batch b, game_position_keys(b.game) k
+    ON CONFLICT DO NOTHING
+  )
+  SELECT count(*)::integer FROM batch
+$$;
+
+CREATE VIEW chess_position_queue_lag AS
+  SELECT count(*) AS queued_games,
+         min(enqueued_at) AS oldest_enqueued_at,
+         COALESCE(now() - min(enqueued_at), interval '0') AS lag
+  FROM chess_position_queue;
+
+
+/* Position file */
+
+CREATE FUNCTION chess_build_position_file(regclass)
+  RETURNS bigint
+  AS 'MODULE_PATHNAME', 'chess_build_position_file'
+  LANGUAGE C STRICT VOLATILE PARALLEL UNSAFE;
+
+REVOKE ALL ON FUNCTION chess_build_position_file(regclass) FROM PUBLIC;
+
+-- Statement trigger installed on the table by chess_build_position_file: any write
+-- removes the posting file, which would otherwise miss the games written.
+CREATE FUNCTION chess_position_file_invalidate()
+  RETURNS trigger
+  AS 'MODULE_PATHNAME', 'chess_position_file_invalidate'
+  LANGUAGE C VOLATILE;
+
+
+/* Statistics */
+
+CREATE FUNCTION chess_stats(
+    OUT scope text,
+    OUT kind text,
+    OUT name text,
+    OUT value bigint,
+    OUT total_time_ms double precision)
+  RETURNS SETOF record
+  AS 'MODULE_PATHNAME', 'chess_stats'
+  LANGUAGE C STRICT VOLATILE PARALLEL RESTRICTED;
+
+CREATE FUNCTION chess_stats_reset()
+  RETURNS void
+  AS 'MODULE_PATHNAME', 'chess_stats_reset'
+  LANGUAGE C STRICT VOLATILE PARALLEL RESTRICTED;
+
+-- Also clears the server-wide counters shared by every session.
+REVOKE ALL ON FUNCTION chess_stats_reset() FROM PUBLIC;
@@ -15,6 +15,41 @@
 #include "utils/array.h"
 #include <catalog/pg_type_d.h>
 #include "Utils/mapping_san_to_fan.h"
+#include "Utils/chess_stats.h"
+#include "DataTypes/SANSIG/SANSIG.h"
+#include "Utils/position_bloom.h"
+#include "DataTypes/MOVESEQ/MOVESEQ.h"
+#include "DataTypes/BOARDSIG/BOARDSIG.h"
+#include "DataTypes/FENWINDOW/FENWINDOW.h"
+#include "Utils/move_ngrams.h"
+#include "Utils/eco.h"
+#include "Utils/opening_bucket.h"
+#include "Utils/variation_tree.h"
+#include "Utils/position_worker.h"
+#include "Utils/position_scan.h"
+#include <access/gist.h>
+#include <access/brin.h>
+#include <commands/trigger.h>
+#include <access/brin_internal.h>
+#include "utils/typcache.h"
+
+/**
+ * Initializes the extension when the library is loaded.
+ *
+ * Defines the extension settings and, when the library is listed in
+ * shared_preload_libraries, reserves the shared memory it uses.
+ */
+void _PG_init(void)
+{
+    chess_stats_init();
+    opening_dict_init();
+    eco_init();
+    opening_bucket_init();
+    san_packed_init();
+    position_worker_init();
+    position_file_init();
+    position_scan_init(has_board_fn_operator);
+}
 
 /**
  * Compares two SAN (Standard Algebraic Notation) structures.
@@ -48,8 +83,8 @@ static int san_compare(SAN *a, SAN *b)
  * Inputs a SAN string into PostgreSQL.
  *
  * This function takes a SAN string as input and allocates a SAN structure
- * to store the string. It sets the varlena length of the result and copies
- * the PGN string into the flexible array member of the SAN structure.
+ * to store the string, then encodes it into its stored varlena form, compressed
+ * with the opening dictionary when 'chess.san_compression' is on.
  *
  * @param fcinfo Function call info containing arguments.
  * @return A SAN structure containing the input string.
@@ -58,10 +93,13 @@ Datum san_in(PG_FUNCTION_ARGS)
 {
     SAN *result;
     char *pgn_str;
+    instr_time start;
 
     if (PG_ARGISNULL(0))
         ereport(ERROR, (errmsg("san_in: Argument(0) is null")));
 
+    chess_stats_begin(&start);
+
     pgn_str = PG_GETARG_CSTRING(0);
 
     result = (SAN *) palloc(sizeof(SAN));
@@ -70,7 +108,9 @@ Datum san_in(PG_FUNCTION_ARGS)
 
     PG_FREE_IF_COPY(pgn_str, 0);
 
-    PG_RETURN_POINTER(result);
+    chess_stats_end(CHESS_FN_SAN_IN, &start);
+
+    PG_RETURN_CHESSGAME_P(result);
 }
 /**
  * Outputs a SAN string from PostgreSQL.
@@ -86,23 +126,278 @@ Datum san_out(PG_FUNCTION_ARGS)
 {
     SAN *game;
     char *result;
+    instr_time start;
 
     if (PG_ARGISNULL(0))
         ereport(ERROR, (errmsg("san_out: Argument(0) is null")));
 
+    chess_stats_begin(&start);
+
     game = PG_GETARG_CHESSGAME_P(0);
 
     parsePGN_ToStr(game, &result);
 
     PG_FREE_IF_COPY(game, 0);
 
+    chess_stats_end(CHESS_FN_SAN_OUT, &start);
+
     PG_RETURN_CSTRING(result);
 }
+/**
+ * Receives a SAN type in binary form.
+ *
+ * The binary form is a version byte (SAN_BINARY_VERSION) followed by the game text,
+ * without terminator, as written by the pgn2copy tool for COPY ... (FORMAT binary).
+ * The text is converted from the client encoding and verified like the one of
+ * text_recv, then stored like the one of san_in, opening dictionary compression included.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The stored SAN value.
+ */
+Datum san_recv(PG_FUNCTION_ARGS)
+{
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    SAN *result;
+    char *str;
+    int version, len;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    version = pq_getmsgbyte(buf);
+
+    if (version != SAN_BINARY_VERSION)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                 errmsg("unsupported SAN binary format version %d", version)));
+
+    // Converted to the server encoding, whose validity is checked.
+    str = pq_getmsgtext(buf, buf->len - buf->cursor, &len);
+
+    if (memchr(str, '\0', len) != NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                 errmsg("invalid null character in SAN value")));
+
+    if (len >= MAX_PGN_LENGTH)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                 errmsg("SAN value is too long (%d > %d bytes)", len, MAX_PGN_LENGTH - 1)));
+
+    result = (SAN *) palloc(sizeof(SAN));
+    memcpy(result->data, str, len);
+    result->data[len] = '\0';
+    pfree(str);
+
+    chess_stats_end(CHESS_FN_SAN_RECV, &start);
+
+    PG_RETURN_CHESSGAME_P(result);
+}
+/**
+ * Sends a SAN type in binary form.
+ *
+ * The game text is converted to the client encoding, which san_recv converts it from.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A bytea holding the version byte and the game text (see san_recv).
+ */
+Datum san_send(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    StringInfoData buf;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    pq_begintypsend(&buf);
+    pq_sendbyte(&buf, SAN_BINARY_VERSION);
+    pq_sendtext(&buf, game->data, strlen(game->data));
+
+    pfree(game);
+
+    chess_stats_end(CHESS_FN_SAN_SEND, &start);
+
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+/**
+ * Checks if the text of a game ends with a result ('1-0', '0-1', '1/2-1/2' or '*').
+ */
+static bool san_has_result(const char *str)
+{
+    MoveToken *tokens;
+    int nTokens = move_raw_tokens(str, strlen(str), &tokens);
+    bool result = nTokens > 0 && is_result_token(tokens[nTokens - 1].str, tokens[nTokens - 1].len);
+
+    pfree(tokens);
+
+    return result;
+}
+/**
+ * Appends moves to a SAN type.
+ *
+ * The moves are played from the final position of the game, which is read from the
+ * stored value when it was built by san_append and replayed otherwise, and the result
+ * is stored with its new final position. Extending a live game move by move and
+ * reading its current position (current_board) therefore cost the same for a long
+ * game as for a short one. Move numbers are written as needed, and a result may end
+ * the moves. The checkpoints of the game (see SANIndex) are extended with the moves.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The game followed by the moves.
+ */
+Datum san_append(PG_FUNCTION_ARGS)
+{
+    text *movesText = CHESS_GETARG_TEXT_PP(1);
+    const char *moves = VARDATA_ANY(movesText);
+    int movesLen = VARSIZE_ANY_EXHDR(movesText);
+    int pos = 0, plies;
+    Datum packed;
+    SAN *game;
+    ChessBoard board;
+    SANIndex index;
+    StringInfoData buf;
+    bool finished, extend;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    // Detoasted once for the text, the final position and the header.
+    packed = PointerGetDatum(chess_stats_detoast_packed(PG_GETARG_DATUM(0)));
+    game = san_unpack(packed, fcinfo);
+
+    if (!san_unpack_board(packed, &board, &plies) && !san_to_board(game, &board, &plies))
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("san_append: half-move %d of the game cannot be played", plies + 1)));
+
+    // Headers without checkpoints for all the moves are rebuilt from the new text.
+    extend = san_unpack_index(packed, &index) && index.header.interval > 0 &&
+             index.header.interval == chess_san_checkpoint_interval && index.header.nMoves == plies;
+
+    finished = san_has_result(game->data);
+
+    initStringInfo(&buf);
+    appendStringInfoString(&buf, game->data);
+
+    while (pos < movesLen) {
+        const char *move;
+        int begin, moveLen, last;
+        bool isResult;
+        bool white = board.whiteToMove;
+        int number = board.fullmoveNumber;
+
+        while (pos < movesLen && isspace((unsigned char) moves[pos]))
+            pos++;
+
+        begin = pos;
+
+        while (pos < movesLen && !isspace((unsigned char) moves[pos]))
+            pos++;
+
+        // Bare move numbers are rewritten below.
+        moveLen = normalize_move_token(moves + begin, pos - begin, &move);
+
+        if (moveLen == 0)
+            continue;
+
+        if (finished)
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("san_append: the game is over")));
+
+        isResult = is_result_token(move, moveLen);
+
+        if (isResult) {
+            finished = true;
+        } else {
+            if (!board_play_san(&board, move, moveLen))
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("san_append: illegal move \"%.*s\"", moveLen, move)));
+            plies++;
+        }
+
+        last = buf.len - 1;
+
+        while (last >= 0 && isspace((unsigned char) buf.data[last]))
+            last--;
+
+        if (last >= 0 && last == buf.len - 1)
+            appendStringInfoChar(&buf, ' ');
+
+        // Black moves following a comment or a variation are numbered too.
+        if (!isResult && white)
+            appendStringInfo(&buf, "%d. ", number);
+        else if (!isResult && last >= 0 && (buf.data[last] == '}' || buf.data[last] == ')'))
+            appendStringInfo(&buf, "%d... ", number);
+
+        // Checked for each move, before it is added to the header: the arrays of the
+        // header are sized for the longest games.
+        if (buf.len + (moves + pos - move) >= MAX_PGN_LENGTH)
+            ereport(ERROR,
+                    (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                     errmsg("san_append: the game is too long (%d > %d bytes)",
+                            buf.len + (int) (moves + pos - move), MAX_PGN_LENGTH - 1)));
+
+        if (extend) {
+            index.header.plyCount++;
+            if (!isResult)
+                san_index_add_move(&index, buf.len, &board);
+        }
+
+        appendBinaryStringInfo(&buf, move, moves + pos - move);
+    }
+
+    memcpy(game->data, buf.data, buf.len + 1);
+    pfree(buf.data);
+
+    chess_stats_end(CHESS_FN_SAN_APPEND, &start);
+
+    PG_RETURN_POINTER(san_pack_index(game, extend ? &index : NULL, &board, plies, fcinfo));
+}
+/**
+ * Returns the final position of a SAN type.
+ *
+ * The position is read from the stored value when it was built by san_append. Other
+ * games are replayed up to the first move that cannot be played.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A FEN structure holding the position after the last move of the game.
+ */
+Datum current_board(PG_FUNCTION_ARGS)
+{
+    ChessBoard board;
+    int plies;
+    char fenStr[FEN_STR_LENGTH];
+    FEN *fen;
+    Datum packed;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    packed = PointerGetDatum(chess_stats_detoast_packed(PG_GETARG_DATUM(0)));
+
+    if (!san_unpack_board(packed, &board, &plies)) {
+        SAN *game = san_unpack(packed, fcinfo);
+
+        san_to_board(game, &board, &plies);
+        pfree(game);
+    }
+
+    board_to_fen(&board, fenStr);
+
+    fen = (FEN *) palloc(sizeof(FEN));
+    parseStr_ToFEN(fenStr, fen);
+
+    chess_stats_end(CHESS_FN_CURRENT_BOARD, &start);
+
+    PG_RETURN_POINTER(fen);
+}
 /**
  * Inputs a FEN string into PostgreSQL.
  *
- * This function takes a FEN string as input, validates it using the 
- * isValidFEN function, and then allocates and populates a FEN structure.
+ * This function takes a FEN string as input and parses it into a newly allocated
+ * FEN structure with parseStr_ToFEN, which validates the string in the same pass.
  * If the input FEN string is invalid, an error is reported.
  *
  * @param fcinfo Function call info containing arguments.
@@ -112,16 +407,14 @@ Datum fen_in(PG_FUNCTION_ARGS)
 {
     char *str;
     FEN *result;
+    instr_time start;
 
     if (PG_ARGISNULL(0))
         ereport(ERROR, (errmsg("fen_in: Argument(0) is null")));
 
-    str = PG_GETARG_CSTRING(0);
+    chess_stats_begin(&start);
 
-    if (!isValidFEN(str))
-        ereport(ERROR,
-                (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                 errmsg("invalid FEN representation: %s", str)));
+    str = PG_GETARG_CSTRING(0);
 
     result = (FEN *)palloc(sizeof(FEN));
 
@@ -129,6 +422,8 @@ Datum fen_in(PG_FUNCTION_ARGS)
 
     PG_FREE_IF_COPY(str, 0);
 
+    chess_stats_end(CHESS_FN_FEN_IN, &start);
+
     PG_RETURN_POINTER(result);
 }
 /**
@@ -145,18 +440,199 @@ Datum fen_out(PG_FUNCTION_ARGS)
 {
     FEN *cb;
     char* result;
+    instr_time start;
 
     if (PG_ARGISNULL(0))
         ereport(ERROR, (errmsg("fen_out: Argument(0) is null")));
 
+    chess_stats_begin(&start);
+
     cb = (FEN *)PG_GETARG_POINTER(0);
 
     result = parseFEN_ToStr(cb);
 
     PG_FREE_IF_COPY(cb, 0);
 
+    chess_stats_end(CHESS_FN_FEN_OUT, &start);
+
     PG_RETURN_CSTRING(pstrdup(result));
 }
+/**
+ * Inputs a game in PGN format into PostgreSQL.
+ *
+ * The tag pairs are parsed into the dictionary of the PGN value and the movetext
+ * is stored like a SAN value; the result and half-move count are computed once.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A PGN value.
+ */
+Datum pgn_in(PG_FUNCTION_ARGS)
+{
+    char *str = PG_GETARG_CSTRING(0);
+    struct varlena *result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    result = pgn_parse(str, fcinfo);
+
+    chess_stats_end(CHESS_FN_PGN_IN, &start);
+
+    PG_RETURN_POINTER(result);
+}
+/**
+ * Outputs a game in PGN format from PostgreSQL.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The tag pairs of the game, in input order, followed by its movetext.
+ */
+Datum pgn_out(PG_FUNCTION_ARGS)
+{
+    struct varlena *pgn = PG_GETARG_PGN_P(0);
+    char *result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    result = pgn_to_cstring(pgn, fcinfo);
+
+    chess_stats_end(CHESS_FN_PGN_OUT, &start);
+
+    PG_RETURN_CSTRING(result);
+}
+/**
+ * Casts a PGN value to a SAN type.
+ *
+ * The moves are kept in the stored SAN form, so they are copied without decoding.
+ * The cast is implicit: SAN functions and operators accept PGN values through it.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The moves of the game as a SAN type.
+ */
+Datum pgn_to_san(PG_FUNCTION_ARGS)
+{
+    struct varlena *pgn = PG_GETARG_PGN_P(0);
+    SANPacked *result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    result = pgn_get_moves(pgn);
+
+    chess_stats_end(CHESS_FN_PGN_TO_SAN, &start);
+
+    PG_RETURN_POINTER(result);
+}
+/**
+ * Casts a SAN type to a PGN value without tag pairs.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A PGN value holding the moves of the game.
+ */
+Datum san_to_pgn(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    struct varlena *result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    result = pgn_from_moves(game, fcinfo);
+
+    chess_stats_end(CHESS_FN_SAN_TO_PGN, &start);
+
+    PG_RETURN_POINTER(result);
+}
+/**
+ * Returns the value of a tag pair of a PGN value.
+ *
+ * The tag names are looked up in the sorted dictionary of the value, without
+ * parsing the game again.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The value of the tag, or NULL if the game has no such tag.
+ */
+Datum pgn_tag(PG_FUNCTION_ARGS)
+{
+    struct varlena *pgn = PG_GETARG_PGN_P(0);
+    char *name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    char *value;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    value = pgn_get_tag(pgn, name);
+
+    chess_stats_end(CHESS_FN_PGN_TAG, &start);
+
+    if (value == NULL)
+        PG_RETURN_NULL();
+
+    PG_RETURN_TEXT_P(cstring_to_text(value));
+}
+/**
+ * Returns the result of a PGN value.
+ *
+ * Only the fixed header of the value is read.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return '1-0', '0-1', '1/2-1/2', or '*' if the result is unknown.
+ */
+Datum pgn_result(PG_FUNCTION_ARGS)
+{
+    PGNHeader header;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    header = PG_GETARG_PGN_HEADER(0);
+
+    chess_stats_end(CHESS_FN_PGN_RESULT, &start);
+
+    PG_RETURN_TEXT_P(cstring_to_text(pgn_result_str(header.result)));
+}
+/**
+ * Returns the number of half-moves of a PGN value.
+ *
+ * Only the fixed header of the value is read.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The number of half-moves of the mainline.
+ */
+Datum ply_count(PG_FUNCTION_ARGS)
+{
+    PGNHeader header;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    header = PG_GETARG_PGN_HEADER(0);
+
+    chess_stats_end(CHESS_FN_PLY_COUNT, &start);
+
+    PG_RETURN_INT32(header.plyCount);
+}
+/**
+ * Returns the number of half-moves of a SAN type.
+ *
+ * Only the header of the value is read, for values stored with one.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The number of half-moves, counted like truncate_san counts them.
+ */
+Datum ply_count_san(PG_FUNCTION_ARGS)
+{
+    int32 result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    result = san_ply_count(PG_GETARG_DATUM(0), fcinfo);
+
+    chess_stats_end(CHESS_FN_PLY_COUNT_SAN, &start);
+
+    PG_RETURN_INT32(result);
+}
 /**
  * Checks if a chess game has a specific opening sequence.
  *
@@ -172,12 +648,15 @@ Datum has_opening(PG_FUNCTION_ARGS)
     bool result;
     SAN *game1, *game2;
     int opening_length, full_game_length;
+    instr_time start;
 
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         ereport(ERROR, (errmsg("has_opening: One of the arguments is null")));
 
-    game1 = (SAN*)PG_GETARG_POINTER(0);
-    game2 = (SAN*)PG_GETARG_POINTER(1);
+    chess_stats_begin(&start);
+
+    game1 = PG_GETARG_CHESSGAME_P(0);
+    game2 = PG_GETARG_CHESSGAME_P(1);
 
     full_game_length = strlen(game1->data);
     opening_length = strlen(game2->data);
@@ -190,8 +669,65 @@ Datum has_opening(PG_FUNCTION_ARGS)
     PG_FREE_IF_COPY(game1, 0);
     PG_FREE_IF_COPY(game2, 1);
 
+    chess_stats_end(CHESS_FN_HAS_OPENING, &start);
+
     PG_RETURN_BOOL(result);
 }
+/**
+ * Planner support function of has_opening.
+ *
+ * Simplifies has_opening calls on a constant opening by adding the condition on
+ * opening_bucket that prunes the partitions of other openings (see opening_bucket.h).
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The replacement expression, or NULL if the request is not handled.
+ */
+Datum has_opening_support(PG_FUNCTION_ARGS)
+{
+    Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+    Node *result = NULL;
+
+    if (IsA(rawreq, SupportRequestSimplify))
+        result = opening_bucket_simplify(((SupportRequestSimplify *) rawreq)->fcall, fcinfo);
+
+    PG_RETURN_POINTER(result);
+}
+/**
+ * Computes the opening bucket of a SAN type.
+ *
+ * The bucket is a hash of the first half-moves of the game, independent of the
+ * formatting. It is meant as a partition key: 'PARTITION BY LIST (opening_bucket(game, 4))'
+ * with partitions 'FOR VALUES IN (opening_bucket('1. e4 c5', 4), ...)'.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The bucket of the first 'depth' half-moves, or of all the moves of shorter games.
+ */
+Datum opening_bucket(PG_FUNCTION_ARGS)
+{
+    SAN *game;
+    int32 depth = PG_GETARG_INT32(1);
+    MoveToken *moves;
+    int nMoves;
+    int32 result;
+    instr_time start;
+
+    if (depth < 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("opening_bucket: depth must not be negative")));
+
+    chess_stats_begin(&start);
+
+    game = PG_GETARG_CHESSGAME_P(0);
+
+    nMoves = move_mainline_tokens(game->data, &moves);
+    result = opening_bucket_of_moves(moves, nMoves, depth);
+
+    pfree(moves);
+
+    chess_stats_end(CHESS_FN_OPENING_BUCKET, &start);
+
+    PG_RETURN_INT32(result);
+}
 /**
  * Retrieves the first N half-moves of a chess game.
  *
@@ -206,11 +742,14 @@ Datum get_FirstMoves(PG_FUNCTION_ARGS)
 {
     SAN *result, *inputGame;
     int nHalfMoves;
+    instr_time start;
 
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         ereport(ERROR, (errmsg("get_FirstMoves: One of the arguments is null")));
+
+    chess_stats_begin(&start);
    
-    inputGame = (SAN *) PG_GETARG_POINTER(0);
+    inputGame = PG_GETARG_CHESSGAME_P(0);
     nHalfMoves = PG_GETARG_INT32(1);
 
     if (nHalfMoves < 0) 
@@ -223,7 +762,9 @@ Datum get_FirstMoves(PG_FUNCTION_ARGS)
 
     PG_FREE_IF_COPY(inputGame, 0);
 
-    PG_RETURN_POINTER(result);
+    chess_stats_end(CHESS_FN_GET_FIRST_MOVES, &start);
+
+    PG_RETURN_CHESSGAME_P(result);
 }
 /**
  * Retrieves the board state at a specific half-move in a chess game.
@@ -238,25 +779,44 @@ Datum get_FirstMoves(PG_FUNCTION_ARGS)
 Datum get_board_state(PG_FUNCTION_ARGS) {
     FEN *fen;
     SAN *gameTruncated, *game;
+    SANIndex index;
+    ChessBoard board;
+    char fenStr[FEN_STR_LENGTH];
+    Datum packed;
 
     int half_moves;
     const char *fenConversionStrResult;
+    instr_time start;
 
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         ereport(ERROR, (errmsg("get_board_state: One of the arguments is null")));
 
-    game = (SAN *) PG_GETARG_POINTER(0);
+    chess_stats_begin(&start);
+
+    // Detoasted once for the text and the header.
+    packed = PointerGetDatum(chess_stats_detoast_packed(PG_GETARG_DATUM(0)));
+    game = san_unpack(packed, fcinfo);
     half_moves = PG_GETARG_INT32(1);
 
     if (half_moves < 0) 
         ereport(ERROR,(errmsg("get_board_state: Non-positive number of half moves")));
 
-    gameTruncated = truncate_san(game, half_moves); 
+    // Games stored with checkpoints are replayed from the nearest one.
+    if (san_unpack_index(packed, &index) && index.header.interval > 0) {
+        if (half_moves > index.header.plyCount)
+            ereport(ERROR, (errmsg("get_board_state: Game is incomplete or shorter than the requested number of half-moves")));
 
-    if (gameTruncated == NULL)
-        ereport(ERROR, (errmsg("get_board_state: Game is incomplete or shorter than the requested number of half-moves")));
+        san_index_board(&index, game->data, half_moves, &board);
+        board_to_fen(&board, fenStr);
+        fenConversionStrResult = fenStr;
+    } else {
+        gameTruncated = truncate_san(game, half_moves); 
 
-    fenConversionStrResult = san_to_fen(gameTruncated);
+        if (gameTruncated == NULL)
+            ereport(ERROR, (errmsg("get_board_state: Game is incomplete or shorter than the requested number of half-moves")));
+
+        fenConversionStrResult = san_to_fen(gameTruncated);
+    }
 
     if (fenConversionStrResult == NULL) {
         ereport(ERROR, (errmsg("get_board_state: No FEN result returned from mapping san to fen")));
@@ -268,6 +828,8 @@ Datum get_board_state(PG_FUNCTION_ARGS) {
 
     PG_FREE_IF_COPY(game, 0);
 
+    chess_stats_end(CHESS_FN_GET_BOARD_STATE, &start);
+
     PG_RETURN_POINTER(fen);
 }
 /**
@@ -287,11 +849,14 @@ Datum has_Board(PG_FUNCTION_ARGS){
     int input_half_moves;
     bool positions_match;
     const char *fenConversionStrResult;
+    instr_time start;
 
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2))
         ereport(ERROR, (errmsg("has_Board: One of the arguments is null")));
 
-    input_game = (SAN*) PG_GETARG_POINTER(0);
+    chess_stats_begin(&start);
+
+    input_game = PG_GETARG_CHESSGAME_P(0);
     input_board = (FEN*) PG_GETARG_POINTER(1);
     input_half_moves = PG_GETARG_INT32(2);
 
@@ -317,6 +882,8 @@ Datum has_Board(PG_FUNCTION_ARGS){
     PG_FREE_IF_COPY(input_game, 0);
     PG_FREE_IF_COPY(input_board, 1);
 
+    chess_stats_end(CHESS_FN_HAS_BOARD, &start);
+
     PG_RETURN_BOOL(positions_match);
 }
 /**
@@ -335,8 +902,8 @@ Datum san_lt(PG_FUNCTION_ARGS)
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         ereport(ERROR, (errmsg("san_lt: One of the arguments is null")));
 
-    a = (SAN *) PG_GETARG_POINTER(0);
-    b = (SAN *) PG_GETARG_POINTER(1);
+    a = PG_GETARG_CHESSGAME_P(0);
+    b = PG_GETARG_CHESSGAME_P(1);
 
     result = san_compare(a, b) > 0;
 
@@ -361,8 +928,8 @@ Datum san_eq(PG_FUNCTION_ARGS)
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         PG_RETURN_BOOL(false);
 
-    a = (SAN *) PG_GETARG_POINTER(0);
-    b = (SAN *) PG_GETARG_POINTER(1);
+    a = PG_GETARG_CHESSGAME_P(0);
+    b = PG_GETARG_CHESSGAME_P(1);
 
     result = san_compare(a, b) == 0;
 
@@ -387,8 +954,8 @@ Datum san_gt(PG_FUNCTION_ARGS)
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         ereport(ERROR, (errmsg("san_gt: One of the arguments is null")));
 
-    a = (SAN *) PG_GETARG_POINTER(0);
-    b = (SAN *) PG_GETARG_POINTER(1);
+    a = PG_GETARG_CHESSGAME_P(0);
+    b = PG_GETARG_CHESSGAME_P(1);
 
     result = san_compare(a, b) > 0;
 
@@ -413,8 +980,8 @@ Datum san_gt_eq(PG_FUNCTION_ARGS)
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         ereport(ERROR, (errmsg("san_gt_eq: One of the arguments is null")));
 
-    a = (SAN *) PG_GETARG_POINTER(0);
-    b = (SAN *) PG_GETARG_POINTER(1);
+    a = PG_GETARG_CHESSGAME_P(0);
+    b = PG_GETARG_CHESSGAME_P(1);
 
     result = san_compare(a, b) >= 0;
 
@@ -439,8 +1006,8 @@ Datum san_lt_eq(PG_FUNCTION_ARGS)
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         ereport(ERROR, (errmsg("san_gt_eq: One of the arguments is null")));
 
-    a = (SAN *) PG_GETARG_POINTER(0);
-    b = (SAN *) PG_GETARG_POINTER(1);
+    a = PG_GETARG_CHESSGAME_P(0);
+    b = PG_GETARG_CHESSGAME_P(1);
 
     result = san_compare(a, b) <= 0;
 
@@ -465,8 +1032,8 @@ Datum san_cmp(PG_FUNCTION_ARGS)
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         ereport(ERROR, (errmsg("san_cmp: One of the arguments is null")));
 
-    a = (SAN *) PG_GETARG_POINTER(0);
-    b = (SAN *) PG_GETARG_POINTER(1);
+    a = PG_GETARG_CHESSGAME_P(0);
+    b = PG_GETARG_CHESSGAME_P(1);
 
     cmp_result = san_compare(a, b);
 
@@ -489,12 +1056,15 @@ Datum san_like(PG_FUNCTION_ARGS)
     text *pattern, *san_text;
 
     bool result;
+    instr_time start;
 
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         ereport(ERROR, (errmsg("san_like: One of the arguments is null")));
 
-    san = (SAN *) PG_GETARG_POINTER(0);
-    pattern = PG_GETARG_TEXT_PP(1);
+    chess_stats_begin(&start);
+
+    san = PG_GETARG_CHESSGAME_P(0);
+    pattern = CHESS_GETARG_TEXT_PP(1);
     san_text = cstring_to_text(san->data);
 
     result = DatumGetBool(DirectFunctionCall2(textlike, 
@@ -506,6 +1076,8 @@ Datum san_like(PG_FUNCTION_ARGS)
     PG_FREE_IF_COPY(san, 0);
     PG_FREE_IF_COPY(pattern, 1);
 
+    chess_stats_end(CHESS_FN_SAN_LIKE, &start);
+
     PG_RETURN_BOOL(result);
 }
 /**
@@ -522,12 +1094,15 @@ Datum san_not_like(PG_FUNCTION_ARGS)
     text *pattern, *san_text;
 
     bool like_result;
+    instr_time start;
 
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         ereport(ERROR, (errmsg("san_not_like: One of the arguments is null")));
+
+    chess_stats_begin(&start);
     
-    san = (SAN *) PG_GETARG_POINTER(0);
-    pattern = PG_GETARG_TEXT_PP(1);
+    san = PG_GETARG_CHESSGAME_P(0);
+    pattern = CHESS_GETARG_TEXT_PP(1);
     san_text = cstring_to_text(san->data);
 
     like_result = DatumGetBool(DirectFunctionCall2(textlike, 
@@ -539,104 +1114,178 @@ Datum san_not_like(PG_FUNCTION_ARGS)
     PG_FREE_IF_COPY(san, 0);
     PG_FREE_IF_COPY(pattern, 1);
 
+    chess_stats_end(CHESS_FN_SAN_NOT_LIKE, &start);
+
     PG_RETURN_BOOL(!like_result);
 }
 /**
- * Extracts FEN strings from a SAN type for each half-move up to the end of the game.
- * 
- * This function iterates over each half-move in a SAN representation of a chess game,
- * truncates the game at each half-move, converts it to FEN format, and accumulates
- * these FEN strings into an array.
+ * Builds the GIN key of a board state tagged with a ply bucket.
+ *
+ * @param fenStr The board state, as a FEN string.
+ * @param opts The options of the index.
+ * @param bucket The ply bucket of the key.
+ * @return The key, a palloc'd text.
+ */
+static Datum gin_board_key(const char *fenStr, const ChessGinOptions *opts, int bucket)
+{
+    if (opts->key == CHESS_GIN_KEY_FULL)
+        return PointerGetDatum(fen_state_ply_text(fenStr, bucket));
+
+    return PointerGetDatum(fen_position_ply_text(fenStr, bucket));
+}
+/**
+ * Extracts the board positions of every board state of a SAN type.
+ * 
+ * This function replays a SAN representation of a chess game once and collects
+ * the board positions (first FEN field) of the initial position and of the position
+ * after each half-move, tagged with the ply bucket of the half-move and with the
+ * bucket of all the half-moves (CHESS_GIN_ALL_PLIES_BUCKET), as text values.
+ * These are the keys of the GIN index. The options of the index restrict the keys to
+ * the half-moves from 'skip_first' to 'max_ply', add the side to move, castling
+ * rights and en passant square to them when 'key' is 'full', and add a marker key
+ * for each side of the range the game has board states in. When 'variations' is
+ * set, the board states of the side lines are added too, tagged with the side line
+ * buckets (CHESS_GIN_SIDE_LINE_BUCKET and CHESS_GIN_SIDE_LINE_ALL_PLIES_BUCKET).
  *
  * @param fcinfo Function call info containing arguments.
- * @return Pointer to an array of Datum, each containing a FEN string; or NULL if no moves are available.
+ * @return Pointer to an array of Datum, each containing the key of a board state.
  */
 Datum fens_from_san(PG_FUNCTION_ARGS){
     int32 *nkeys;
-    ArrayBuildState *astate;
-    SAN *san, *gameTruncated;
-
-    int i;
-    const char *fenConversionStrResult;
+    SAN *san;
+    const ChessGinOptions *opts;
+    Datum *keys;
+    char **fens, **sideFens = NULL;
+    int nFens, nSideFens = 0, lastPly;
+    int *sidePlies = NULL;
+    bool after;
+    MemoryContext replayContext, oldContext;
 
     san = (SAN *) PG_GETARG_POINTER(0);
     nkeys = (int32 *) PG_GETARG_POINTER(1);
+    opts = (const ChessGinOptions *) PG_GETARG_POINTER(2);
 
-    i = 0;
-    *nkeys = 0;
-    astate = NULL;
-
-    while (true) {
+    // The FEN strings only live until the keys are built.
+    replayContext = replay_context_create();
+    oldContext = MemoryContextSwitchTo(replayContext);
+    fens = san_to_fens(san, &nFens);
 
-        gameTruncated = truncate_san(san, i);
+    if (opts->variations && strchr(san->data, '(') != NULL) {
+        VariationTree tree;
 
-        if (gameTruncated == NULL)
-            break;
+        variation_tree_parse(san->data, &tree);
+        sideFens = variation_tree_fens(&tree, &sidePlies, &nSideFens);
+    }
 
-        fenConversionStrResult = san_to_fen(gameTruncated);
+    MemoryContextSwitchTo(oldContext);
 
-        if (fenConversionStrResult == NULL)
-            ereport(ERROR, (errmsg("No FEN result returned from mapping san to fen")));
+    lastPly = (opts->maxPly >= 0) ? Min(nFens - 1, opts->maxPly) : nFens - 1;
+    after = lastPly < nFens - 1;
 
-        astate = accumArrayResult(astate, CStringGetTextDatum(fenConversionStrResult),
-                                  false, TEXTOID, CurrentMemoryContext);
+    keys = (Datum *) palloc((2 * (nFens + nSideFens) + 2) * sizeof(Datum));
+    *nkeys = 0;
 
-        (*nkeys)++;
-        i++;
+    for (int i = opts->skipFirst; i <= lastPly; i++) {
+        keys[(*nkeys)++] = gin_board_key(fens[i], opts, CHESS_GIN_PLY_BUCKET(i));
+        keys[(*nkeys)++] = gin_board_key(fens[i], opts, CHESS_GIN_ALL_PLIES_BUCKET);
     }
 
-    PG_FREE_IF_COPY(san, 0);
-
-    if (*nkeys > 0) {
+    for (int i = 0; i < nSideFens; i++) {
+        int ply = sidePlies[i];
 
-        Datum *keys = (Datum *) palloc(*nkeys * sizeof(Datum));
+        // The board states before 'skip_first' are behind the marker key already.
+        if (ply < opts->skipFirst)
+            continue;
 
-        for (i = 0; i < *nkeys; i++) {
-            keys[i] = astate->dvalues[i];
+        if (opts->maxPly >= 0 && ply > opts->maxPly) {
+            after = true;
+            continue;
         }
 
-        PG_RETURN_POINTER(keys);
-
-    } else {
-        PG_RETURN_NULL();
+        keys[(*nkeys)++] = gin_board_key(sideFens[i], opts, CHESS_GIN_SIDE_LINE_BUCKET(ply));
+        keys[(*nkeys)++] = gin_board_key(sideFens[i], opts, CHESS_GIN_SIDE_LINE_ALL_PLIES_BUCKET);
     }
+
+    // Every game has its initial position before a skipped start.
+    if (opts->skipFirst > 0)
+        keys[(*nkeys)++] = CStringGetTextDatum(CHESS_GIN_BEFORE_KEY);
+
+    if (after)
+        keys[(*nkeys)++] = CStringGetTextDatum(CHESS_GIN_AFTER_KEY);
+
+    MemoryContextDelete(replayContext);
+
+    PG_FREE_IF_COPY(san, 0);
+
+    PG_RETURN_POINTER(keys);
 }
 /**
  * Compares two text values for GIN indexing, specifically for chess game keys.
  * 
  * This function is used in the context of GIN index operations to compare two keys
- * (text values) and determine their ordering.
+ * (board positions stored as text) and determine their ordering. Keys are compared
+ * bytewise, as only their equality matters.
  *
  * @param fcinfo Function call info containing arguments.
- * @return Integer representing the comparison result: -1, 0, or 1.
+ * @return Integer representing the comparison result: negative, 0, or positive.
  */
 Datum gin_compare(PG_FUNCTION_ARGS)
 {
     text *key1 = PG_GETARG_TEXT_PP(0);
     text *key2 = PG_GETARG_TEXT_PP(1);
 
-    char *key1Str = text_to_cstring(key1);
-    char *key2Str = text_to_cstring(key2);
+    int len1 = VARSIZE_ANY_EXHDR(key1);
+    int len2 = VARSIZE_ANY_EXHDR(key2);
+    int32 result = memcmp(VARDATA_ANY(key1), VARDATA_ANY(key2), Min(len1, len2));
 
-    int32 result = DatumGetInt32(DirectFunctionCall2Coll(btint4cmp,
-                                                        PG_GET_COLLATION(),
-                                                        PointerGetDatum(key1),
-                                                        PointerGetDatum(key2)));
-
-                                                         
-    pfree(key1Str);
-    pfree(key2Str);
+    if (result == 0)
+        result = (len1 > len2) - (len1 < len2);
 
     PG_FREE_IF_COPY(key1, 0);
     PG_FREE_IF_COPY(key2, 1);
 
     PG_RETURN_INT32(result);
 }
+/**
+ * Returns the options of a san_gin_ops support function call.
+ *
+ * @param fcinfo Function call info of the support function.
+ * @return The options of the index, or the defaults (every half-move, piece placement keys).
+ */
+static const ChessGinOptions *gin_get_options(FunctionCallInfo fcinfo)
+{
+    static const ChessGinOptions defaults = {0, -1, 0, CHESS_GIN_KEY_PLACEMENT, false};
+
+    if (PG_HAS_OPCLASS_OPTIONS())
+        return (const ChessGinOptions *) PG_GET_OPCLASS_OPTIONS();
+
+    return &defaults;
+}
+/**
+ * Checks whether a san_gin_ops search scans the whole index.
+ *
+ * Piece placements are not in the keys of a 'full' index, nor side lines in the keys
+ * of an index without 'variations'. Searches without a window on an index restricted
+ * by 'skip_first' or 'max_ply' would need the marker keys, which nearly every game
+ * carries (every game with 'skip_first', every game longer than 'max_ply'): only the
+ * windows inside the indexed half-moves are selective. The games of a whole index
+ * scan are rechecked.
+ *
+ * @param strategy The strategy of the search.
+ * @param opts The options of the index.
+ * @return true if the search scans the whole index.
+ */
+static bool gin_scans_whole_index(StrategyNumber strategy, const ChessGinOptions *opts)
+{
+    return (opts->key == CHESS_GIN_KEY_FULL && strategy != CHESS_GIN_REACHES_EXACT_STRATEGY) ||
+           (strategy == CHESS_GIN_REACHES_ANY_LINE_STRATEGY && !opts->variations) ||
+           (strategy != CHESS_GIN_REACHES_WINDOW_STRATEGY && (opts->skipFirst > 0 || opts->maxPly >= 0));
+}
 /**
  * Extracts indexable keys from a SAN type for GIN indexing.
  * 
- * This function is used for GIN index operations. It extracts FEN representations
- * from a given SAN type and prepares them as keys for indexing.
+ * This function is used for GIN index operations. It extracts the board positions
+ * of every board state of a given SAN type and prepares them as keys for indexing.
  *
  * @param fcinfo Function call info containing arguments.
  * @return Pointer to an array of keys (Datum) for GIN indexing.
@@ -647,11 +1296,14 @@ Datum gin_extract_value(PG_FUNCTION_ARGS) {
     Datum *keys;
     int32 *nkeys;
     bool **nullFlags;
+    instr_time start;
 
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2))
         ereport(ERROR, (errmsg("gin_extract_value: One of the arguments is null")));
 
-    san = (SAN *) PG_GETARG_POINTER(0);
+    chess_stats_begin(&start);
+
+    san = PG_GETARG_CHESSGAME_P(0);
     nkeys = (int32 *) PG_GETARG_POINTER(1);
     nullFlags = (bool **) PG_GETARG_POINTER(2);
 
@@ -661,92 +1313,293 @@ Datum gin_extract_value(PG_FUNCTION_ARGS) {
                                             PG_GET_COLLATION(), 
                                             PointerGetDatum(san),
                                             PointerGetDatum(nkeys),
-                                            BoolGetDatum(false),
+                                            PointerGetDatum(gin_get_options(fcinfo)),
                                             PointerGetDatum(NULL)); 
 
     *nullFlags = NULL;
 
     PG_FREE_IF_COPY(san, 0);
 
+    chess_stats_count(CHESS_STAT_GIN_KEYS, *nkeys);
+    chess_stats_end(CHESS_FN_GIN_EXTRACT_VALUE, &start);
+
     PG_RETURN_POINTER(keys);
 }
 /**
- * Extracts a query key from a FEN type for GIN indexing.
+ * Structure describing the GIN query keys of a search.
+ *
+ * The keys of each searched board come first, one per ply bucket searched, followed
+ * by the marker keys of the games having board states outside of the indexed range
+ * of half-moves, which may reach the boards there.
+ *
+ * @param keysPerBoard The number of bucket keys of each board (0 if the searched
+ *        half-moves are all outside of the indexed range).
+ * @param nMarkers The number of marker keys, after the bucket keys.
+ */
+typedef struct
+{
+    int keysPerBoard;
+    int nMarkers;
+} GinQueryShape;
+/**
+ * Adds the GIN query keys of a board searched within a range of ply buckets.
+ *
+ * One key is added per bucket, so the board is found if any of them is present.
+ *
+ * @param keys The array of query keys to fill.
+ * @param nkeys The number of keys already in the array, updated.
+ * @param fenStr The board searched, as a FEN string.
+ * @param opts The options of the index.
+ * @param minBucket The first ply bucket.
+ * @param maxBucket The last ply bucket, inclusive.
+ */
+static void add_board_query_keys(Datum *keys, int32 *nkeys, const char *fenStr, const ChessGinOptions *opts,
+                                 int minBucket, int maxBucket)
+{
+    for (int bucket = minBucket; bucket <= maxBucket; bucket++)
+        keys[(*nkeys)++] = gin_board_key(fenStr, opts, bucket);
+}
+/**
+ * Extracts the query keys from a FEN, FEN[] or FENWINDOW type for GIN indexing.
  * 
- * Used in GIN index search operations, this function takes a FEN type,
- * extracts its board position as a key, and prepares it for querying the GIN index.
+ * Used in GIN index search operations, this function takes a FEN type ('@>', '=', '@='
+ * and '@@>'), a FEN array ('@>' all, '&&' any and '@>>' in order) or a FEN window ('@>'
+ * within a range of half-moves), and prepares the keys for querying the GIN index.
+ * Index keys carry the ply bucket of the board state, so each board is looked up once
+ * per bucket overlapping the window; searches spanning every indexed half-move look
+ * it up once, under the bucket of all the half-moves. The marker keys of the games
+ * with board states outside of the indexed half-moves follow when a window covers
+ * them. An empty array matches every game in the "all" and "in order" modes and none
+ * in the "any" mode. The searches the keys cannot answer selectively scan the whole
+ * index (see gin_scans_whole_index): the piece placements of an index with 'full'
+ * keys, the side lines ('@@>') of an index without 'variations', and the searches
+ * without a window of an index restricted by 'skip_first' or 'max_ply'.
  *
  * @param fcinfo Function call info containing arguments.
- * @return Pointer to an array of one key (Datum) representing the query.
+ * @return Pointer to an array of keys (Datum) representing the query.
  */
 Datum gin_extract_query(PG_FUNCTION_ARGS) {
 
-    FEN  *itemValue;
-    Datum *keys, query;
+    Datum *keys;
     int32 *nkeys, *searchMode;
+    Pointer **extraData;
+    StrategyNumber strategy;
+    const ChessGinOptions *opts;
+    GinQueryShape *shape;
+    FEN **boards;
+    int nBoards;
+    int32 minPly = 0, maxPly = PG_INT32_MAX, firstIndexed, lastIndexed;
+    int minBucket, maxBucket, minSideBucket, maxSideBucket;
+    instr_time start;
 
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) || PG_ARGISNULL(3) ||
         PG_ARGISNULL(4) || PG_ARGISNULL(5) || PG_ARGISNULL(6)) {
         ereport(ERROR, (errmsg("gin_extract_query: One of the arguments is null")));
     }
 
-    query = PG_GETARG_DATUM(0);
+    chess_stats_begin(&start);
+
     nkeys = (int32 *) PG_GETARG_POINTER(1);
-    itemValue =(FEN *) DatumGetPointer(query);
+    strategy = PG_GETARG_UINT16(2);
+    extraData = (Pointer **) PG_GETARG_POINTER(4);
     searchMode = (int32 *) PG_GETARG_POINTER(6);
+    opts = gin_get_options(fcinfo);
 
-    *nkeys = 1;
-    keys = (Datum *) palloc(*nkeys * sizeof(Datum));
-    keys[0] = CStringGetTextDatum(itemValue->positions);
-
+    *nkeys = 0;
     *searchMode = GIN_SEARCH_MODE_DEFAULT;
 
+    switch (strategy) {
+        case CHESS_GIN_CONTAINS_STRATEGY:
+        case CHESS_GIN_EQUAL_STRATEGY:
+        case CHESS_GIN_REACHES_EXACT_STRATEGY:
+        case CHESS_GIN_REACHES_ANY_LINE_STRATEGY:
+            boards = (FEN **) palloc(sizeof(FEN *));
+            boards[0] = (FEN *) PG_GETARG_POINTER(0);
+            nBoards = 1;
+            break;
+        case CHESS_GIN_CONTAINS_ALL_STRATEGY:
+        case CHESS_GIN_CONTAINS_ANY_STRATEGY:
+        case CHESS_GIN_REACHES_IN_ORDER_STRATEGY:
+            boards = fen_array_elements(PG_GETARG_ARRAYTYPE_P(0), &nBoards);
+            break;
+        case CHESS_GIN_REACHES_WINDOW_STRATEGY: {
+            FENWINDOW *window = (FENWINDOW *) PG_GETARG_POINTER(0);
+
+            boards = (FEN **) palloc(sizeof(FEN *));
+            boards[0] = &window->board;
+            nBoards = 1;
+            minPly = window->min_ply;
+            maxPly = window->max_ply;
+            break;
+        }
+        default:
+            elog(ERROR, "gin_extract_query: unrecognized strategy number: %d", strategy);
+            boards = NULL;
+            nBoards = 0;
+    }
+
+    // Every game goes through all the positions of an empty array.
+    if (nBoards == 0) {
+        if (strategy != CHESS_GIN_CONTAINS_ANY_STRATEGY)
+            *searchMode = GIN_SEARCH_MODE_ALL;
+
+        pfree(boards);
+        chess_stats_end(CHESS_FN_GIN_EXTRACT_QUERY, &start);
+        PG_RETURN_POINTER(NULL);
+    }
+
+    // The searches the keys cannot answer selectively
+    if (gin_scans_whole_index(strategy, opts)) {
+        *searchMode = GIN_SEARCH_MODE_ALL;
+
+        pfree(boards);
+        chess_stats_end(CHESS_FN_GIN_EXTRACT_QUERY, &start);
+        PG_RETURN_POINTER(NULL);
+    }
+
+    // The searched half-moves that are indexed
+    firstIndexed = Max(minPly, opts->skipFirst);
+    lastIndexed = (opts->maxPly >= 0) ? Min(maxPly, opts->maxPly) : maxPly;
+
+    // A search spanning every indexed half-move needs a single key per board.
+    if (minPly <= opts->skipFirst && (opts->maxPly >= 0 ? maxPly >= opts->maxPly : maxPly == PG_INT32_MAX)) {
+        minBucket = maxBucket = CHESS_GIN_ALL_PLIES_BUCKET;
+        minSideBucket = maxSideBucket = CHESS_GIN_SIDE_LINE_ALL_PLIES_BUCKET;
+    } else {
+        minBucket = CHESS_GIN_PLY_BUCKET(firstIndexed);
+        maxBucket = CHESS_GIN_PLY_BUCKET(lastIndexed);
+        minSideBucket = CHESS_GIN_SIDE_LINE_BUCKET(firstIndexed);
+        maxSideBucket = CHESS_GIN_SIDE_LINE_BUCKET(lastIndexed);
+    }
+
+    shape = (GinQueryShape *) palloc(sizeof(GinQueryShape));
+    shape->keysPerBoard = (firstIndexed <= lastIndexed) ? maxBucket - minBucket + 1 : 0;
+    shape->nMarkers = 0;
+
+    // The side line buckets are searched too.
+    if (strategy == CHESS_GIN_REACHES_ANY_LINE_STRATEGY)
+        shape->keysPerBoard *= 2;
+
+    keys = (Datum *) palloc((nBoards * shape->keysPerBoard + 2) * sizeof(Datum));
+
+    for (int i = 0; i < nBoards && shape->keysPerBoard > 0; i++) {
+        const char *fenStr = parseFEN_ToStr(boards[i]);
+
+        add_board_query_keys(keys, nkeys, fenStr, opts, minBucket, maxBucket);
+
+        if (strategy == CHESS_GIN_REACHES_ANY_LINE_STRATEGY)
+            add_board_query_keys(keys, nkeys, fenStr, opts, minSideBucket, maxSideBucket);
+    }
+
+    // The games with unindexed board states in the searched half-moves may match there.
+    if (minPly < opts->skipFirst) {
+        keys[(*nkeys)++] = CStringGetTextDatum(CHESS_GIN_BEFORE_KEY);
+        shape->nMarkers++;
+    }
+
+    if (opts->maxPly >= 0 && maxPly > opts->maxPly) {
+        keys[(*nkeys)++] = CStringGetTextDatum(CHESS_GIN_AFTER_KEY);
+        shape->nMarkers++;
+    }
+
+    *extraData = (Pointer *) palloc(*nkeys * sizeof(Pointer));
+    for (int i = 0; i < *nkeys; i++)
+        (*extraData)[i] = (Pointer) shape;
+
+    pfree(boards);
+
+    chess_stats_end(CHESS_FN_GIN_EXTRACT_QUERY, &start);
+
     PG_RETURN_POINTER(keys);
 }
 /**
- * Checks if indexed keys are consistent with a given query key in GIN index searches.
+ * Checks if indexed keys are consistent with the query keys in GIN index searches.
  * 
  * This function is used to determine if a particular GIN index entry matches the search condition,
- * specifically for chess game positions.
+ * specifically for chess game positions. A board is found if the key of any of its ply buckets is
+ * present, and may be found if a marker key is present: the game has unindexed board states in the
+ * searched half-moves. The "any" strategy needs one board found, the other strategies need all of
+ * them. The index does not know the order of the board states nor their exact half-moves, so the
+ * "in order" and window strategies need a recheck, and so do the searches of exact board states in
+ * piece placement keys and the searches scanning the whole index.
  *
  * @param fcinfo Function call info containing arguments.
- * @return Boolean indicating whether the indexed keys are consistent with the query key.
+ * @return Boolean indicating whether the indexed keys are consistent with the query keys.
  */
 Datum gin_consistent(PG_FUNCTION_ARGS)
 {
     bool *check = (bool *) PG_GETARG_POINTER(0);
-    Datum query = PG_GETARG_DATUM(2);
+    StrategyNumber strategy = PG_GETARG_UINT16(1);
     int32 nkeys = PG_GETARG_INT32(3);
+    Pointer *extraData = (Pointer *) PG_GETARG_POINTER(4);
     bool *recheck = (bool *) PG_GETARG_POINTER(5);
-    Datum *queryKeys = (Datum *) PG_GETARG_POINTER(6);
+    const ChessGinOptions *opts = gin_get_options(fcinfo);
+
+    bool matchAny = (strategy == CHESS_GIN_CONTAINS_ANY_STRATEGY);
+    bool result = !matchAny;
+    bool marked = false;
+    GinQueryShape *shape;
+    int32 nBoardKeys;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    *recheck = (strategy == CHESS_GIN_REACHES_IN_ORDER_STRATEGY ||
+                strategy == CHESS_GIN_REACHES_WINDOW_STRATEGY ||
+                (strategy == CHESS_GIN_REACHES_ANY_LINE_STRATEGY && !opts->variations) ||
+                (strategy == CHESS_GIN_REACHES_EXACT_STRATEGY) != (opts->key == CHESS_GIN_KEY_FULL));
+
+    // Empty arrays and whole index scans
+    if (nkeys == 0) {
+        if (gin_scans_whole_index(strategy, opts))
+            *recheck = true;
+        chess_stats_end(CHESS_FN_GIN_CONSISTENT, &start);
+        PG_RETURN_BOOL(true);
+    }
 
-    FEN queryFen;
-    char *queryFenStr = text_to_cstring(DatumGetTextP(query));
-    parseStr_ToFEN(queryFenStr, &queryFen);
-    pfree(queryFenStr);
+    shape = (GinQueryShape *) extraData[0];
+    nBoardKeys = nkeys - shape->nMarkers;
 
-    for (int i = 0; i < nkeys; i++) {
-        if (check[i]) {
-            FEN keyFen;
-            char *keyFenStr = text_to_cstring(DatumGetTextP(queryKeys[i]));
-            parseStr_ToFEN(keyFenStr, &keyFen);
-            pfree(keyFenStr);
-
-            if (strcmp(queryFen.positions, keyFen.positions) == 0) {
-                *recheck = true;
-                PG_RETURN_BOOL(true);
-            }
+    for (int j = nBoardKeys; j < nkeys; j++)
+        marked = marked || check[j];
+
+    // Without bucket keys, every board is as found as the markers tell.
+    if (shape->keysPerBoard == 0) {
+        *recheck = true;
+        chess_stats_end(CHESS_FN_GIN_CONSISTENT, &start);
+        PG_RETURN_BOOL(marked);
+    }
+
+    for (int i = 0; i < nBoardKeys; i += shape->keysPerBoard) {
+        bool found = false;
+
+        for (int j = i; j < i + shape->keysPerBoard && !found; j++)
+            found = check[j];
+
+        // The board may be among the unindexed board states of the game.
+        if (!found && marked) {
+            found = true;
+            *recheck = true;
+        }
+
+        if (found == matchAny) {
+            result = matchAny;
+            break;
         }
     }
 
-    *recheck = true;
-    PG_RETURN_BOOL(false);
+    chess_stats_end(CHESS_FN_GIN_CONSISTENT, &start);
+
+    PG_RETURN_BOOL(result);
 }
 /**
  * Performs a ternary consistency check for GIN index operations.
  * 
  * This function is used in GIN index searches to return a ternary value (MAYBE, TRUE, FALSE)
- * indicating the consistency of the index keys with a given query.
+ * indicating the consistency of the index keys with a given query. It lets GIN skip
+ * fetching the posting lists that cannot change the result, intersecting them for the
+ * "all" strategies and uniting them for the "any" strategy. Boards missing from the
+ * indexed board states of a game with a marker key are MAYBE.
  *
  * @param fcinfo Function call info containing arguments.
  * @return GinTernaryValue indicating the consistency result.
@@ -754,130 +1607,2284 @@ Datum gin_consistent(PG_FUNCTION_ARGS)
 Datum gin_tri_consistent(PG_FUNCTION_ARGS)
 {
     GinTernaryValue *check = (GinTernaryValue *) PG_GETARG_POINTER(0);
-    Datum query = PG_GETARG_DATUM(2);
+    StrategyNumber strategy = PG_GETARG_UINT16(1);
     int32 nkeys = PG_GETARG_INT32(3);
-    Datum *queryKeys = (Datum *) PG_GETARG_POINTER(5);
+    Pointer *extraData = (Pointer *) PG_GETARG_POINTER(4);
+    const ChessGinOptions *opts = gin_get_options(fcinfo);
+
+    bool matchAny = (strategy == CHESS_GIN_CONTAINS_ANY_STRATEGY);
+    GinTernaryValue decisive = matchAny ? GIN_TRUE : GIN_FALSE;
+    GinTernaryValue result = matchAny ? GIN_FALSE : GIN_TRUE;
+    GinTernaryValue marked = GIN_FALSE;
+    GinQueryShape *shape;
+    int32 nBoardKeys;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    // Empty arrays and whole index scans
+    if (nkeys == 0) {
+        result = gin_scans_whole_index(strategy, opts) ||
+                 strategy == CHESS_GIN_REACHES_IN_ORDER_STRATEGY ? GIN_MAYBE : GIN_TRUE;
+        chess_stats_end(CHESS_FN_GIN_TRI_CONSISTENT, &start);
+        PG_RETURN_GIN_TERNARY_VALUE(result);
+    }
 
-    GinTernaryValue result = GIN_MAYBE;
+    shape = (GinQueryShape *) extraData[0];
+    nBoardKeys = nkeys - shape->nMarkers;
 
-    for (int i = 0; i < nkeys; i++) {
-        if (check[i] == GIN_FALSE) 
-            return GIN_FALSE;
+    for (int j = nBoardKeys; j < nkeys && marked != GIN_TRUE; j++) {
+        if (check[j] != GIN_FALSE)
+            marked = check[j];
+    }
+
+    // A marked game may reach any board among its unindexed board states.
+    if (marked != GIN_FALSE)
+        marked = GIN_MAYBE;
+
+    if (shape->keysPerBoard == 0) {
+        chess_stats_end(CHESS_FN_GIN_TRI_CONSISTENT, &start);
+        PG_RETURN_GIN_TERNARY_VALUE(marked);
+    }
 
-        if (check[i] == GIN_TRUE) {
+    for (int i = 0; i < nBoardKeys; i += shape->keysPerBoard) {
+        GinTernaryValue found = GIN_FALSE;
 
-            char *queryFenStr = TextDatumGetCString(queryKeys[i]);
-            char *gameFenStr = TextDatumGetCString(query);
+        // A board is found as soon as one of its bucket keys is present.
+        for (int j = i; j < i + shape->keysPerBoard && found != GIN_TRUE; j++) {
+            if (check[j] != GIN_FALSE)
+                found = check[j];
+        }
+
+        if (found == GIN_FALSE)
+            found = marked;
 
-            if (strcmp(queryFenStr, gameFenStr) == 0) 
-                result = GIN_TRUE;
+        if (found == decisive) {
+            result = decisive;
+            break;
         }
+
+        if (found == GIN_MAYBE)
+            result = GIN_MAYBE;
     }
 
+    // The order and half-moves of the board states, and the exact board states of
+    // piece placement keys, have to be rechecked on the game.
+    if (result == GIN_TRUE && (strategy == CHESS_GIN_REACHES_IN_ORDER_STRATEGY ||
+                               strategy == CHESS_GIN_REACHES_WINDOW_STRATEGY ||
+                               (strategy == CHESS_GIN_REACHES_EXACT_STRATEGY) != (opts->key == CHESS_GIN_KEY_FULL)))
+        result = GIN_MAYBE;
+
+    chess_stats_end(CHESS_FN_GIN_TRI_CONSISTENT, &start);
+
     PG_RETURN_GIN_TERNARY_VALUE(result);
 }
+/**
+ * Declares the options of the san_gin_ops operator class.
+ *
+ * 'max_ply' and 'skip_first' restrict the indexed half-moves, 'key' chooses between
+ * piece placement keys ('placement') and exact board state keys ('full'), and
+ * 'variations' adds the board states of the side lines, for '@@>'.
+ *
+ * @param fcinfo Function call info containing arguments.
+ */
+Datum gin_options(PG_FUNCTION_ARGS)
+{
+    static relopt_enum_elt_def keyValues[] = {
+        {"placement", CHESS_GIN_KEY_PLACEMENT},
+        {"full", CHESS_GIN_KEY_FULL},
+        {(const char *) NULL}
+    };
+    local_relopts *relopts = (local_relopts *) PG_GETARG_POINTER(0);
+
+    init_local_reloptions(relopts, sizeof(ChessGinOptions));
+
+    add_local_int_reloption(relopts, "max_ply",
+                            "last half-move indexed (-1 for all of them)",
+                            -1, -1, PG_INT32_MAX,
+                            offsetof(ChessGinOptions, maxPly));
+
+    add_local_int_reloption(relopts, "skip_first",
+                            "number of half-moves not indexed at the start of the games",
+                            0, 0, PG_INT32_MAX,
+                            offsetof(ChessGinOptions, skipFirst));
+
+    add_local_enum_reloption(relopts, "key",
+                             "board state fields of the keys",
+                             keyValues, CHESS_GIN_KEY_PLACEMENT,
+                             "Valid values are \"placement\" and \"full\".",
+                             offsetof(ChessGinOptions, key));
+
+    add_local_bool_reloption(relopts, "variations",
+                             "whether the board states of the side lines are indexed",
+                             false,
+                             offsetof(ChessGinOptions, variations));
+
+    PG_RETURN_VOID();
+}
 /**
  * Determines if a given FEN type matches any board state in a SAN type.
  * 
- * This function iterates through each move of a SAN type, converts it to FEN, and checks
- * if it matches a given FEN type, representing a specific board state.
+ * The game is replayed a single time with san_to_fens, which reads the moves as the
+ * GIN index keys are extracted, and each board state is compared with the given FEN
+ * type. Only the board positions take part in the comparison.
  *
  * @param fcinfo Function call info containing arguments.
  * @return Boolean value - true if a matching board state is found; false otherwise.
  */
 Datum has_board_fn_operator(PG_FUNCTION_ARGS)
 {
-    FEN *input_fen, *result_fen;
-    SAN *san, *gameTruncated;
-    
-    int i;
-    bool result;
-    const char *fenConversionStrResult;
+    FEN *input_fen;
+    SAN *san;
+    char **fens;
+    int nFens;
+    bool result = false;
+    MemoryContext replayContext, oldContext;
+    instr_time start;
 
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         ereport(ERROR, (errmsg("has_board_fn_operator: One of the arguments is null\n")));
 
-    result_fen = (FEN *)palloc(sizeof(FEN)); 
-    input_fen = (FEN *) PG_GETARG_POINTER(1);
-    san = (SAN *) PG_GETARG_CHESSGAME_P(0);
-
-    i=0;
-    result = false;
-
-    while (true) {
+    chess_stats_begin(&start);
 
-        gameTruncated = truncate_san(san, i);
+    input_fen = (FEN *) PG_GETARG_POINTER(1);
+    san = PG_GETARG_CHESSGAME_P(0);
 
-        if (gameTruncated == NULL)
-            break;
+    // The board states are released with the replay context.
+    replayContext = replay_context_create();
+    oldContext = MemoryContextSwitchTo(replayContext);
+    fens = san_to_fens(san, &nFens);
+    MemoryContextSwitchTo(oldContext);
 
-        fenConversionStrResult = san_to_fen(gameTruncated);
+    for (int i = 0; i < nFens && !result; i++)
+        result = fen_same_position(fens[i], input_fen->positions);
 
-        if (fenConversionStrResult == NULL)
-            ereport(ERROR, (errmsg("has_board_fn_operator: No FEN result returned from mapping san to fen")));
+    MemoryContextDelete(replayContext);
 
-        parseStr_ToFEN(fenConversionStrResult, result_fen);
+    PG_FREE_IF_COPY(san, 0);
 
-        if (strcmp(result_fen->positions, input_fen->positions) == 0)
-        {
-            result = true;
-            break;
-        }
-        
-        i++;
-    }
+    chess_stats_end(CHESS_FN_HAS_BOARD_OPERATOR, &start);
 
     PG_RETURN_BOOL(result);
 }
 /**
  * Determines if a given FEN type matches any board state in a SAN type.
  * 
- * Similar to 'has_board_fn_operator', this function iterates through each move of a SAN type,
- * converts it to FEN, and checks if it matches the provided FEN type.
+ * Similar to 'has_board_fn_operator', this function replays the SAN type once with
+ * san_to_fens and checks if one of its board states matches the provided FEN type.
  *
  * @param fcinfo Function call info containing arguments.
  * @return Boolean value - true if a matching board state is found; false otherwise.
  */
 Datum fen_in_san_eq(PG_FUNCTION_ARGS) {
 
-    FEN *input_board, *result_fen;
-    SAN *input_game, *gameTruncated;
-
-    int i;
-    bool result;
-    const char *fenConversionStrResult;
+    FEN *input_board;
+    SAN *input_game;
+    char **fens;
+    int nFens;
+    bool result = false;
+    MemoryContext replayContext, oldContext;
+    instr_time start;
 
     if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
         ereport(ERROR, (errmsg("fen_in_san_eq: One of the arguments is null\n")));
 
-    i=0;
-    result = false;
-    result_fen = (FEN *)palloc(sizeof(FEN));
-    input_game = (SAN *)PG_GETARG_POINTER(1);
-    input_board = (FEN *)PG_GETARG_POINTER(0);
+    chess_stats_begin(&start);
 
-    while (true) {
+    input_game = PG_GETARG_CHESSGAME_P(0);
+    input_board = (FEN *)PG_GETARG_POINTER(1);
 
-        gameTruncated = truncate_san(input_game, i);
+    // The board states are released with the replay context.
+    replayContext = replay_context_create();
+    oldContext = MemoryContextSwitchTo(replayContext);
+    fens = san_to_fens(input_game, &nFens);
+    MemoryContextSwitchTo(oldContext);
 
-        if (gameTruncated == NULL)
-            break;
+    for (int i = 0; i < nFens && !result; i++)
+        result = fen_same_position(fens[i], input_board->positions);
 
-        fenConversionStrResult = san_to_fen(gameTruncated);
+    MemoryContextDelete(replayContext);
+
+    PG_FREE_IF_COPY(input_game, 0);
+
+    chess_stats_end(CHESS_FN_FEN_IN_SAN_EQ, &start);
+
+    PG_RETURN_BOOL(result);
+}
+/**
+ * Determines if a SAN type reaches the exact board state of a FEN type.
+ *
+ * Implements the '@=' (SAN, FEN) operator. Unlike '@>', the side to move, the castling
+ * rights and the en passant square must match too; only the clocks are ignored. As in
+ * the board states of get_board_state, an en passant square is only set when an en
+ * passant capture is legal.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Boolean value - true if the board state is found in the game.
+ */
+Datum has_exact_board(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    FEN *board = (FEN *) PG_GETARG_POINTER(1);
+    char *state = pstrdup(parseFEN_ToStr(board));
+    char **fens;
+    int nFens;
+    bool result = false;
+    MemoryContext replayContext, oldContext;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    replayContext = replay_context_create();
+    oldContext = MemoryContextSwitchTo(replayContext);
+    fens = san_to_fens(game, &nFens);
+    MemoryContextSwitchTo(oldContext);
+
+    for (int i = 0; i < nFens && !result; i++)
+        result = fen_same_state(fens[i], state);
+
+    MemoryContextDelete(replayContext);
+    pfree(state);
+
+    chess_stats_end(CHESS_FN_HAS_EXACT_BOARD, &start);
+
+    PG_RETURN_BOOL(result);
+}
+/**
+ * Determines if a SAN type or one of its side lines goes through the board of a FEN type.
+ *
+ * Implements the '@@>' (SAN, FEN) operator. The mainline board states are searched as
+ * '@>' searches them, then the ones of the variations, nested ones included. Only the
+ * board positions take part in the comparison.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Boolean value - true if the board is found in the game or in a side line.
+ */
+Datum has_board_in_lines(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    FEN *board = (FEN *) PG_GETARG_POINTER(1);
+    char **fens;
+    int nFens;
+    bool result = false;
+    MemoryContext replayContext, oldContext;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    replayContext = replay_context_create();
+    oldContext = MemoryContextSwitchTo(replayContext);
+    fens = san_to_fens(game, &nFens);
+
+    for (int i = 0; i < nFens && !result; i++)
+        result = fen_same_position(fens[i], board->positions);
+
+    if (!result && strchr(game->data, '(') != NULL) {
+        VariationTree tree;
+        int *plies;
+
+        variation_tree_parse(game->data, &tree);
+        fens = variation_tree_fens(&tree, &plies, &nFens);
+
+        for (int i = 0; i < nFens && !result; i++)
+            result = fen_same_position(fens[i], board->positions);
+    }
+
+    MemoryContextSwitchTo(oldContext);
+    MemoryContextDelete(replayContext);
+
+    chess_stats_end(CHESS_FN_HAS_BOARD_IN_LINES, &start);
+
+    PG_RETURN_BOOL(result);
+}
+/**
+ * Returns the variation tree of a SAN type.
+ *
+ * One row (line, parent, ply, moves) is returned per line, the mainline first as line
+ * 0 with a NULL parent. 'ply' is the number of half-moves before the first move of
+ * the line, and 'moves' holds the moves of the line without move numbers, comments,
+ * annotations or its own variations.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A set of (line, parent, ply, moves) rows.
+ */
+Datum game_variations(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    SAN *game;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    VariationTree tree;
+    StringInfoData *lineMoves;
+    instr_time start;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("game_variations: set-valued function called in context that cannot accept a set")));
 
-        if (fenConversionStrResult == NULL)
-            ereport(ERROR, (errmsg("has_board_fn_operator: No FEN result returned from mapping san to fen")));
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        ereport(ERROR, (errmsg("game_variations: return type must be a row type")));
 
-        parseStr_ToFEN(fenConversionStrResult, result_fen);
+    chess_stats_begin(&start);
 
-        if (strcmp(result_fen->positions, input_board->positions) == 0)
-        {
-            result = true;
+    game = PG_GETARG_CHESSGAME_P(0);
+
+    variation_tree_parse(game->data, &tree);
+    lineMoves = (StringInfoData *) palloc(tree.nLines * sizeof(StringInfoData));
+
+    for (int i = 0; i < tree.nLines; i++)
+        initStringInfo(&lineMoves[i]);
+
+    for (int i = 0; i < tree.nMoves; i++) {
+        StringInfo moves = &lineMoves[tree.moves[i].line];
+
+        if (moves->len > 0)
+            appendStringInfoChar(moves, ' ');
+
+        appendBinaryStringInfo(moves, tree.moves[i].token.str, tree.moves[i].token.len);
+    }
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+
+    for (int i = 0; i < tree.nLines; i++) {
+        Datum values[4];
+        bool nulls[4] = {false, tree.lines[i].parent < 0, false, false};
+
+        values[0] = Int32GetDatum(i);
+        values[1] = Int32GetDatum(tree.lines[i].parent);
+        values[2] = Int32GetDatum(tree.lines[i].ply);
+        values[3] = CStringGetTextDatum(lineMoves[i].data);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+
+    for (int i = 0; i < tree.nLines; i++)
+        pfree(lineMoves[i].data);
+
+    pfree(lineMoves);
+    variation_tree_free(&tree);
+
+    chess_stats_end(CHESS_FN_GAME_VARIATIONS, &start);
+
+    return (Datum) 0;
+}
+/**
+ * Checks the board states of a SAN type against an array of FEN types.
+ *
+ * The game is replayed once, and every board of the array is looked up among
+ * its board states. Only the board positions take part in the comparison.
+ *
+ * @param game The SAN type to check.
+ * @param array The FEN array.
+ * @param matchAll Whether all the boards must be found, rather than any of them.
+ * @return true if all (or any) of the boards are board states of the game.
+ */
+static bool game_has_boards(SAN *game, ArrayType *array, bool matchAll)
+{
+    FEN **boards;
+    char **fens;
+    int nBoards, nFens;
+    bool result = matchAll;
+    MemoryContext replayContext, oldContext;
+
+    boards = fen_array_elements(array, &nBoards);
+
+    if (nBoards == 0) {
+        pfree(boards);
+        return matchAll;
+    }
+
+    replayContext = replay_context_create();
+    oldContext = MemoryContextSwitchTo(replayContext);
+    fens = san_to_fens(game, &nFens);
+    MemoryContextSwitchTo(oldContext);
+
+    for (int i = 0; i < nBoards; i++) {
+        bool found = false;
+
+        CHECK_FOR_INTERRUPTS();
+
+        for (int j = 0; j < nFens && !found; j++)
+            found = fen_same_position(fens[j], boards[i]->positions);
+
+        if (found != matchAll) {
+            result = found;
             break;
         }
-        
-        i++;
     }
 
+    MemoryContextDelete(replayContext);
+    pfree(boards);
+
+    return result;
+}
+/**
+ * Determines if a SAN type goes through all the board states of a FEN array.
+ *
+ * Implements the '@>' (SAN, FEN[]) operator. An empty array is always contained.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Boolean value - true if every board of the array is found in the game.
+ */
+Datum has_all_boards(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+    bool result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    result = game_has_boards(game, array, true);
+
+    PG_FREE_IF_COPY(array, 1);
+
+    chess_stats_end(CHESS_FN_HAS_ALL_BOARDS, &start);
+
+    PG_RETURN_BOOL(result);
+}
+/**
+ * Determines if a SAN type goes through any of the board states of a FEN array.
+ *
+ * Implements the '&&' (SAN, FEN[]) operator. An empty array never overlaps.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Boolean value - true if at least one board of the array is found in the game.
+ */
+Datum has_any_board(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+    bool result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    result = game_has_boards(game, array, false);
+
+    PG_FREE_IF_COPY(array, 1);
+
+    chess_stats_end(CHESS_FN_HAS_ANY_BOARD, &start);
+
     PG_RETURN_BOOL(result);
-}
\ No newline at end of file
+}
+/**
+ * Looks for the board states of a FEN array, in order, in a SAN type.
+ *
+ * The game is replayed once. Each board of the array is matched against the earliest
+ * board state that comes strictly after the match of the previous board; taking the
+ * earliest match never prevents the following boards from being found.
+ *
+ * @param game The SAN type to check.
+ * @param array The FEN array.
+ * @param plies Set to a palloc'd array of the matching half-move of each board, or NULL.
+ * @param nPlies Set to the number of boards in the array.
+ * @return true if all the boards are found in the given order.
+ */
+static bool game_boards_in_order(SAN *game, ArrayType *array, int **plies, int *nPlies)
+{
+    FEN **boards;
+    char **fens;
+    int nBoards, nFens;
+    int ply = 0;
+    bool result = true;
+    MemoryContext replayContext, oldContext;
+
+    boards = fen_array_elements(array, &nBoards);
+
+    *nPlies = nBoards;
+    *plies = (int *) palloc(Max(nBoards, 1) * sizeof(int));
+
+    if (nBoards == 0) {
+        pfree(boards);
+        return true;
+    }
+
+    replayContext = replay_context_create();
+    oldContext = MemoryContextSwitchTo(replayContext);
+    fens = san_to_fens(game, &nFens);
+    MemoryContextSwitchTo(oldContext);
+
+    for (int i = 0; i < nBoards && result; i++) {
+        CHECK_FOR_INTERRUPTS();
+
+        while (ply < nFens && !fen_same_position(fens[ply], boards[i]->positions))
+            ply++;
+
+        if (ply == nFens)
+            result = false;
+        else
+            (*plies)[i] = ply++;
+    }
+
+    MemoryContextDelete(replayContext);
+    pfree(boards);
+
+    if (!result) {
+        pfree(*plies);
+        *plies = NULL;
+    }
+
+    return result;
+}
+/**
+ * Determines if a SAN type goes through the board states of a FEN array in order.
+ *
+ * Implements the '@>>' (SAN, FEN[]) operator: every board must be reached strictly
+ * after the previous one. An empty array is always reached.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Boolean value - true if the boards are found in the game, in order.
+ */
+Datum reaches_in_order(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+    int *plies, nPlies;
+    bool result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    result = game_boards_in_order(game, array, &plies, &nPlies);
+
+    if (plies != NULL)
+        pfree(plies);
+
+    PG_FREE_IF_COPY(array, 1);
+
+    chess_stats_end(CHESS_FN_REACHES_IN_ORDER, &start);
+
+    PG_RETURN_BOOL(result);
+}
+/**
+ * Reports the half-moves at which a SAN type reaches the board states of a FEN array in order.
+ *
+ * Uses the same matching as reaches_in_order, from a single replay of the game. Half-move 0
+ * is the initial position.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return An integer array with the half-move of each board, or NULL if they are not reached in order.
+ */
+Datum reaches_in_order_plies(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+    ArrayType *result;
+    Datum *elems;
+    int *plies, nPlies;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    if (!game_boards_in_order(game, array, &plies, &nPlies)) {
+        chess_stats_end(CHESS_FN_REACHES_IN_ORDER_PLIES, &start);
+        PG_RETURN_NULL();
+    }
+
+    elems = (Datum *) palloc(Max(nPlies, 1) * sizeof(Datum));
+
+    for (int i = 0; i < nPlies; i++)
+        elems[i] = Int32GetDatum(plies[i]);
+
+    result = construct_array(elems, nPlies, INT4OID, sizeof(int32), true, TYPALIGN_INT);
+
+    pfree(elems);
+    pfree(plies);
+
+    PG_FREE_IF_COPY(array, 1);
+
+    chess_stats_end(CHESS_FN_REACHES_IN_ORDER_PLIES, &start);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+/**
+ * Finds the first half-move at which a SAN type reaches a board state within a range.
+ *
+ * @param game The SAN type to replay.
+ * @param positions The board positions searched (FEN.positions).
+ * @param minPly The first half-move of the range.
+ * @param maxPly The last half-move of the range, inclusive.
+ * @return The half-move of the first match (0 is the initial position), or -1.
+ */
+static int game_first_ply_of(SAN *game, const char *positions, int32 minPly, int32 maxPly)
+{
+    char **fens;
+    int nFens;
+    int result = -1;
+    MemoryContext replayContext, oldContext;
+
+    replayContext = replay_context_create();
+    oldContext = MemoryContextSwitchTo(replayContext);
+    fens = san_to_fens(game, &nFens);
+    MemoryContextSwitchTo(oldContext);
+
+    for (int ply = minPly; ply < nFens && ply <= maxPly; ply++) {
+        if (fen_same_position(fens[ply], positions)) {
+            result = ply;
+            break;
+        }
+    }
+
+    MemoryContextDelete(replayContext);
+
+    return result;
+}
+/**
+ * Parses a FENWINDOW type from a string in PostgreSQL.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A pointer to the FENWINDOW structure.
+ */
+Datum fenwindow_in(PG_FUNCTION_ARGS)
+{
+    char *str = PG_GETARG_CSTRING(0);
+
+    PG_RETURN_POINTER(parseStr_ToFENWINDOW(str));
+}
+/**
+ * Outputs a FENWINDOW structure as a string in PostgreSQL.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A string representing the FENWINDOW structure.
+ */
+Datum fenwindow_out(PG_FUNCTION_ARGS)
+{
+    FENWINDOW *window = (FENWINDOW *) PG_GETARG_POINTER(0);
+
+    PG_RETURN_CSTRING(parseFENWINDOW_ToStr(window));
+}
+/**
+ * Builds a FENWINDOW type from a FEN type and a range of half-moves.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A pointer to the FENWINDOW structure.
+ */
+Datum fen_window(PG_FUNCTION_ARGS)
+{
+    FEN *board = (FEN *) PG_GETARG_POINTER(0);
+    int32 minPly = PG_GETARG_INT32(1);
+    int32 maxPly = PG_GETARG_INT32(2);
+
+    PG_RETURN_POINTER(make_fen_window(board, minPly, maxPly));
+}
+/**
+ * Determines if a SAN type reaches the board state of a FEN window within its range.
+ *
+ * Implements the '@>' (SAN, FENWINDOW) operator, used by reaches_between.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Boolean value - true if the board is reached at a half-move of the range.
+ */
+Datum reaches_window(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    FENWINDOW *window = (FENWINDOW *) PG_GETARG_POINTER(1);
+    bool result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    result = game_first_ply_of(game, window->board.positions, window->min_ply, window->max_ply) >= 0;
+
+    chess_stats_end(CHESS_FN_REACHES_WINDOW, &start);
+
+    PG_RETURN_BOOL(result);
+}
+/**
+ * Finds the first half-move at which a SAN type reaches a board state.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The half-move of the first match (0 is the initial position), or NULL.
+ */
+Datum first_ply_of(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    FEN *board = (FEN *) PG_GETARG_POINTER(1);
+    int result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    result = game_first_ply_of(game, board->positions, 0, PG_INT32_MAX);
+
+    chess_stats_end(CHESS_FN_FIRST_PLY_OF, &start);
+
+    if (result < 0)
+        PG_RETURN_NULL();
+
+    PG_RETURN_INT32(result);
+}
+/**
+ * Entry of the probe table of has_board_many: the hash of a board position and
+ * the index of the board in the query array.
+ */
+typedef struct
+{
+    uint32 hash;
+    int index;
+} BoardProbe;
+
+/**
+ * Orders probe entries by hash, then by array index.
+ */
+static int board_probe_cmp(const void *a, const void *b)
+{
+    const BoardProbe *pa = (const BoardProbe *) a;
+    const BoardProbe *pb = (const BoardProbe *) b;
+
+    if (pa->hash != pb->hash)
+        return pa->hash < pb->hash ? -1 : 1;
+
+    return pa->index - pb->index;
+}
+/**
+ * Finds the first half-move at which a SAN type reaches each board state of a FEN array.
+ *
+ * The game is replayed once. The boards are hashed into a sorted probe table, and the
+ * board state of each half-move is looked up in it, so that the cost grows with the
+ * length of the game rather than with its length times the number of boards. Hash
+ * matches are confirmed by comparing the board positions.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return An integer array with the first half-move of each board (0 is the initial
+ *         position), NULL for the boards that are never reached.
+ */
+Datum has_board_many(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+    ArrayType *result;
+    FEN **boards;
+    BoardProbe *probes;
+    Datum *elems;
+    bool *nulls;
+    char **fens;
+    int nBoards, nFens, remaining;
+    int dims[1], lbs[1];
+    MemoryContext replayContext, oldContext;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    boards = fen_array_elements(array, &nBoards);
+
+    elems = (Datum *) palloc0(Max(nBoards, 1) * sizeof(Datum));
+    nulls = (bool *) palloc(Max(nBoards, 1) * sizeof(bool));
+    probes = (BoardProbe *) palloc(Max(nBoards, 1) * sizeof(BoardProbe));
+
+    for (int i = 0; i < nBoards; i++) {
+        nulls[i] = true;
+        probes[i].hash = fen_position_hash(boards[i]->positions);
+        probes[i].index = i;
+    }
+
+    qsort(probes, nBoards, sizeof(BoardProbe), board_probe_cmp);
+
+    replayContext = replay_context_create();
+    oldContext = MemoryContextSwitchTo(replayContext);
+    fens = nBoards > 0 ? san_to_fens(game, &nFens) : NULL;
+    MemoryContextSwitchTo(oldContext);
+
+    remaining = nBoards;
+
+    for (int ply = 0; remaining > 0 && ply < nFens; ply++) {
+        uint32 hash = fen_position_hash(fens[ply]);
+        int low = 0, high = nBoards;
+
+        CHECK_FOR_INTERRUPTS();
+
+        // First probe entry whose hash is not lower than the one of the board state
+        while (low < high) {
+            int mid = low + (high - low) / 2;
+
+            if (probes[mid].hash < hash)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+
+        for (int i = low; i < nBoards && probes[i].hash == hash; i++) {
+            int index = probes[i].index;
+
+            if (nulls[index] && fen_same_position(fens[ply], boards[index]->positions)) {
+                elems[index] = Int32GetDatum(ply);
+                nulls[index] = false;
+                remaining--;
+            }
+        }
+    }
+
+    MemoryContextDelete(replayContext);
+
+    dims[0] = nBoards;
+    lbs[0] = 1;
+
+    if (nBoards == 0)
+        result = construct_empty_array(INT4OID);
+    else
+        result = construct_md_array(elems, nulls, 1, dims, lbs, INT4OID, sizeof(int32), true, TYPALIGN_INT);
+
+    pfree(probes);
+    pfree(nulls);
+    pfree(elems);
+    pfree(boards);
+
+    PG_FREE_IF_COPY(array, 1);
+
+    chess_stats_end(CHESS_FN_HAS_BOARD_MANY, &start);
+
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+/**
+ * Determines if a SAN type contains a sequence of moves.
+ *
+ * Implements the '@@' (SAN, text) operator. Both the game and the searched moves are
+ * reduced to their normalized mainline moves, so move numbers, comments, variations and
+ * check/annotation suffixes are ignored; the moves must then be found one after the other.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Boolean value - true if the moves are played contiguously in the game.
+ */
+Datum contains_moves(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    char *query = text_to_cstring(CHESS_GETARG_TEXT_PP(1));
+    MoveToken *gameMoves, *queryMoves;
+    int nGameMoves, nQueryMoves;
+    bool result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    nGameMoves = move_mainline_tokens(game->data, &gameMoves);
+    nQueryMoves = move_mainline_tokens(query, &queryMoves);
+
+    result = move_tokens_contain(gameMoves, nGameMoves, queryMoves, nQueryMoves);
+
+    pfree(gameMoves);
+    pfree(queryMoves);
+    pfree(query);
+
+    chess_stats_end(CHESS_FN_CONTAINS_MOVES, &start);
+
+    PG_RETURN_BOOL(result);
+}
+/**
+ * Computes the fingerprint of a SAN type.
+ *
+ * The fingerprint is a hash of the normalized mainline moves, so games differing only
+ * by whitespace, move numbering, comments, variations or annotations share it. It is
+ * meant for unique and hash indexes on game_fingerprint(game), which detect re-delivered
+ * games with one 8-byte lookup; distinct games may still collide.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The 64-bit fingerprint of the game.
+ */
+Datum game_fingerprint(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    MoveToken *moves;
+    int nMoves;
+    int64 result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    nMoves = move_mainline_tokens(game->data, &moves);
+    result = (int64) move_tokens_fingerprint(moves, nMoves);
+
+    pfree(moves);
+
+    chess_stats_end(CHESS_FN_GAME_FINGERPRINT, &start);
+
+    PG_RETURN_INT64(result);
+}
+/**
+ * Returns the ECO code of a SAN type.
+ *
+ * The game is classified by its longest matching line of the ECO table, following
+ * the moves of the game or, for transpositions, the positions it reaches.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The ECO code (e.g. 'B90'), or NULL if the game matches no line.
+ */
+Datum eco_code(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    const EcoTrie *trie;
+    int entry;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    trie = eco_trie_get();
+    entry = eco_classify(trie, game);
+
+    chess_stats_end(CHESS_FN_ECO_CODE, &start);
+
+    if (entry < 0)
+        PG_RETURN_NULL();
+
+    PG_RETURN_TEXT_P(cstring_to_text(ECO_TRIE_ENTRIES(trie)[entry].code));
+}
+/**
+ * Returns the ECO opening name of a SAN type.
+ *
+ * The game is classified as by eco_code.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The opening name (e.g. 'Sicilian Defense: Najdorf Variation'), or NULL if the game matches no line.
+ */
+Datum eco_name(PG_FUNCTION_ARGS)
+{
+    SAN *game = PG_GETARG_CHESSGAME_P(0);
+    const EcoTrie *trie;
+    int entry;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    trie = eco_trie_get();
+    entry = eco_classify(trie, game);
+
+    chess_stats_end(CHESS_FN_ECO_NAME, &start);
+
+    if (entry < 0)
+        PG_RETURN_NULL();
+
+    PG_RETURN_TEXT_P(cstring_to_text(ECO_TRIE_STRING(trie, ECO_TRIE_ENTRIES(trie)[entry].name)));
+}
+/**
+ * Extracts the move n-gram keys from a SAN type for GIN indexing.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Pointer to an array of keys (Datum) for GIN indexing.
+ */
+Datum gin_moves_extract_value(PG_FUNCTION_ARGS)
+{
+    SAN *san = PG_GETARG_CHESSGAME_P(0);
+    int32 *nkeys = (int32 *) PG_GETARG_POINTER(1);
+    bool **nullFlags = (bool **) PG_GETARG_POINTER(2);
+    Datum *keys;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    keys = move_ngram_value_keys(san->data, nkeys);
+    *nullFlags = NULL;
+
+    chess_stats_count(CHESS_STAT_GIN_KEYS, *nkeys);
+    chess_stats_end(CHESS_FN_GIN_EXTRACT_VALUE, &start);
+
+    PG_RETURN_POINTER(keys);
+}
+/**
+ * Extracts the move n-gram query keys from a LIKE pattern or a sequence of moves.
+ *
+ * A pattern without any usable token gives no key, and falls back to a full index scan.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Pointer to an array of keys (Datum) representing the query.
+ */
+Datum gin_moves_extract_query(PG_FUNCTION_ARGS)
+{
+    text *query = PG_GETARG_TEXT_PP(0);
+    int32 *nkeys = (int32 *) PG_GETARG_POINTER(1);
+    StrategyNumber strategy = PG_GETARG_UINT16(2);
+    bool **pmatch = (bool **) PG_GETARG_POINTER(3);
+    int32 *searchMode = (int32 *) PG_GETARG_POINTER(6);
+    Datum *keys;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    switch (strategy) {
+        case CHESS_GIN_MOVES_LIKE_STRATEGY:
+            keys = move_ngram_like_keys(VARDATA_ANY(query), VARSIZE_ANY_EXHDR(query), nkeys, pmatch);
+            break;
+        case CHESS_GIN_MOVES_CONTAINS_STRATEGY: {
+            char *moves = text_to_cstring(query);
+            MoveToken *tokens;
+            int nTokens;
+
+            nTokens = move_mainline_tokens(moves, &tokens);
+            keys = move_ngram_sequence_keys(tokens, nTokens, nkeys);
+            break;
+        }
+        default:
+            elog(ERROR, "gin_moves_extract_query: unrecognized strategy number: %d", strategy);
+            keys = NULL;
+    }
+
+    *searchMode = (*nkeys == 0) ? GIN_SEARCH_MODE_ALL : GIN_SEARCH_MODE_DEFAULT;
+
+    chess_stats_end(CHESS_FN_GIN_EXTRACT_QUERY, &start);
+
+    PG_RETURN_POINTER(keys);
+}
+/**
+ * Compares a prefix query key with an index key.
+ *
+ * Used for the piece moves of LIKE patterns followed by a wildcard.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return 0 if the index key starts with the prefix, 1 past the matching keys.
+ */
+Datum gin_moves_compare_partial(PG_FUNCTION_ARGS)
+{
+    text *prefix = PG_GETARG_TEXT_PP(0);
+    text *key = PG_GETARG_TEXT_PP(1);
+    int prefixLen = VARSIZE_ANY_EXHDR(prefix);
+
+    if (VARSIZE_ANY_EXHDR(key) >= prefixLen &&
+        memcmp(VARDATA_ANY(prefix), VARDATA_ANY(key), prefixLen) == 0)
+        PG_RETURN_INT32(0);
+
+    PG_RETURN_INT32(1);
+}
+/**
+ * Checks if indexed move n-grams are consistent with the query keys.
+ *
+ * All the keys are required. n-grams do not capture the whole pattern, so matches
+ * are always rechecked.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Boolean indicating whether the game may match the query.
+ */
+Datum gin_moves_consistent(PG_FUNCTION_ARGS)
+{
+    bool *check = (bool *) PG_GETARG_POINTER(0);
+    int32 nkeys = PG_GETARG_INT32(3);
+    bool *recheck = (bool *) PG_GETARG_POINTER(5);
+    bool result = true;
+
+    for (int i = 0; i < nkeys && result; i++)
+        result = check[i];
+
+    *recheck = true;
+
+    PG_RETURN_BOOL(result);
+}
+/**
+ * Performs a ternary consistency check of indexed move n-grams.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return GIN_FALSE if a key is missing, GIN_MAYBE otherwise.
+ */
+Datum gin_moves_tri_consistent(PG_FUNCTION_ARGS)
+{
+    GinTernaryValue *check = (GinTernaryValue *) PG_GETARG_POINTER(0);
+    int32 nkeys = PG_GETARG_INT32(3);
+
+    for (int i = 0; i < nkeys; i++) {
+        if (check[i] == GIN_FALSE)
+            PG_RETURN_GIN_TERNARY_VALUE(GIN_FALSE);
+    }
+
+    PG_RETURN_GIN_TERNARY_VALUE(GIN_MAYBE);
+}
+/**
+ * Rejects textual input of position signatures.
+ *
+ * Signatures only exist as GiST index keys, so they cannot be typed in.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Never returns.
+ */
+Datum sansig_in(PG_FUNCTION_ARGS)
+{
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("sansig_in: cannot accept a value of type sansig")));
+
+    PG_RETURN_VOID();
+}
+/**
+ * Outputs a position signature as a summary of its bits.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A string describing how many bits of the signature are set.
+ */
+Datum sansig_out(PG_FUNCTION_ARGS)
+{
+    SANSIG *sig = DatumGetSANSIG(PG_GETARG_DATUM(0));
+    char *result;
+
+    if (SANSIG_ISALLTRUE(sig))
+        result = pstrdup("all true bits");
+    else {
+        int count = sansig_count_bits(sig);
+        result = psprintf("%d true bits, %d false bits", count, SANSIG_BITS - count);
+    }
+
+    PG_FREE_IF_COPY(sig, 0);
+
+    PG_RETURN_CSTRING(result);
+}
+/**
+ * Compresses a GiST entry into a position signature.
+ *
+ * Leaf entries hold a SAN game: the game is replayed once and the hash of every
+ * board position it goes through is added to a new signature. Inner entries that
+ * have every bit set are replaced by a compact all-true signature.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The compressed GiST entry.
+ */
+Datum gist_sig_compress(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    GISTENTRY *retval = entry;
+
+    if (entry->leafkey) {
+        SANSIG *sig = sansig_new(false);
+        MemoryContext replayContext = replay_context_create();
+        MemoryContext oldContext = MemoryContextSwitchTo(replayContext);
+        char **fens;
+        int nFens;
+
+        // Only the signature outlives the replay.
+        fens = san_to_fens(san_unpack(entry->key, fcinfo), &nFens);
+        MemoryContextSwitchTo(oldContext);
+
+        for (int i = 0; i < nFens; i++)
+            sansig_add_hash(sig, fen_position_hash(fens[i]));
+
+        MemoryContextDelete(replayContext);
+
+        retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+        gistentryinit(*retval, PointerGetDatum(sig), entry->rel, entry->page, entry->offset, false);
+    } else {
+        SANSIG *sig = DatumGetSANSIG(entry->key);
+
+        if (!SANSIG_ISALLTRUE(sig) && sansig_count_bits(sig) == SANSIG_BITS) {
+            retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+            gistentryinit(*retval, PointerGetDatum(sansig_new(true)), entry->rel, entry->page, entry->offset, false);
+        }
+    }
+
+    PG_RETURN_POINTER(retval);
+}
+/**
+ * Decompresses a GiST entry holding a position signature.
+ *
+ * Signatures are stored as is, so this only detoasts the key if needed.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The decompressed GiST entry.
+ */
+Datum gist_sig_decompress(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    SANSIG *key = DatumGetSANSIG(entry->key);
+
+    if (key != (SANSIG *) DatumGetPointer(entry->key)) {
+        GISTENTRY *retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+
+        gistentryinit(*retval, PointerGetDatum(key), entry->rel, entry->page, entry->offset, false);
+
+        PG_RETURN_POINTER(retval);
+    }
+
+    PG_RETURN_POINTER(entry);
+}
+/**
+ * Checks if a position signature may contain a queried board position.
+ *
+ * Used for the '@>' operator: the hash of the queried board positions is looked up
+ * in the signature. Signatures are lossy, so matching rows are always rechecked.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Boolean indicating whether the subtree or game may contain the position.
+ */
+Datum gist_sig_consistent(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    FEN *query = (FEN *) PG_GETARG_POINTER(1);
+    bool *recheck = (bool *) PG_GETARG_POINTER(4);
+    SANSIG *key = DatumGetSANSIG(entry->key);
+
+    *recheck = true;
+
+    PG_RETURN_BOOL(sansig_contains_hash(key, fen_position_hash(query->positions)));
+}
+/**
+ * Computes the union of a set of position signatures.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The bitwise OR of the signatures.
+ */
+Datum gist_sig_union(PG_FUNCTION_ARGS)
+{
+    GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+    int *size = (int *) PG_GETARG_POINTER(1);
+    SANSIG *result = sansig_new(false);
+
+    for (int i = 0; i < entryvec->n; i++) {
+        SANSIG *sig = DatumGetSANSIG(entryvec->vector[i].key);
+
+        if (SANSIG_ISALLTRUE(sig)) {
+            pfree(result);
+            result = sansig_new(true);
+            break;
+        }
+
+        sansig_union_into(result, sig);
+    }
+
+    *size = VARSIZE(result);
+
+    PG_RETURN_POINTER(result);
+}
+/**
+ * Computes the penalty of inserting a signature below another one.
+ *
+ * The penalty is the number of bits the new signature would add.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Pointer to the penalty.
+ */
+Datum gist_sig_penalty(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *origentry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    GISTENTRY *newentry = (GISTENTRY *) PG_GETARG_POINTER(1);
+    float *penalty = (float *) PG_GETARG_POINTER(2);
+
+    *penalty = (float) sansig_added_bits(DatumGetSANSIG(origentry->key), DatumGetSANSIG(newentry->key));
+
+    PG_RETURN_POINTER(penalty);
+}
+/**
+ * Splits a page of position signatures in two.
+ *
+ * The two signatures that are furthest apart (Hamming distance) seed the two
+ * sides; every other entry goes to the side whose signature it extends the least.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Pointer to the filled GIST_SPLITVEC.
+ */
+Datum gist_sig_picksplit(PG_FUNCTION_ARGS)
+{
+    GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+    GIST_SPLITVEC *v = (GIST_SPLITVEC *) PG_GETARG_POINTER(1);
+    OffsetNumber maxoff = entryvec->n - 1;
+    OffsetNumber seed_1 = FirstOffsetNumber, seed_2 = OffsetNumberNext(FirstOffsetNumber);
+    SANSIG *left, *right;
+    int waste = -1;
+
+    v->spl_left = (OffsetNumber *) palloc((maxoff + 2) * sizeof(OffsetNumber));
+    v->spl_right = (OffsetNumber *) palloc((maxoff + 2) * sizeof(OffsetNumber));
+    v->spl_nleft = 0;
+    v->spl_nright = 0;
+
+    // Pick the two signatures that are furthest apart as seeds.
+    for (OffsetNumber k = FirstOffsetNumber; k < maxoff; k = OffsetNumberNext(k)) {
+        for (OffsetNumber j = OffsetNumberNext(k); j <= maxoff; j = OffsetNumberNext(j)) {
+            int distance = sansig_distance(DatumGetSANSIG(entryvec->vector[k].key),
+                                           DatumGetSANSIG(entryvec->vector[j].key));
+
+            if (distance > waste) {
+                waste = distance;
+                seed_1 = k;
+                seed_2 = j;
+            }
+        }
+    }
+
+    left = sansig_new(false);
+    right = sansig_new(false);
+    sansig_union_into(left, DatumGetSANSIG(entryvec->vector[seed_1].key));
+    sansig_union_into(right, DatumGetSANSIG(entryvec->vector[seed_2].key));
+
+    // Distribute the entries to the side they extend the least.
+    for (OffsetNumber j = FirstOffsetNumber; j <= maxoff; j = OffsetNumberNext(j)) {
+        SANSIG *sig = DatumGetSANSIG(entryvec->vector[j].key);
+        int cost_left, cost_right;
+
+        if (j == seed_1) {
+            v->spl_left[v->spl_nleft++] = j;
+            continue;
+        }
+        if (j == seed_2) {
+            v->spl_right[v->spl_nright++] = j;
+            continue;
+        }
+
+        cost_left = sansig_added_bits(left, sig);
+        cost_right = sansig_added_bits(right, sig);
+
+        if (cost_left < cost_right || (cost_left == cost_right && v->spl_nleft < v->spl_nright)) {
+            sansig_union_into(left, sig);
+            v->spl_left[v->spl_nleft++] = j;
+        } else {
+            sansig_union_into(right, sig);
+            v->spl_right[v->spl_nright++] = j;
+        }
+    }
+
+    v->spl_ldatum = PointerGetDatum(left);
+    v->spl_rdatum = PointerGetDatum(right);
+
+    PG_RETURN_POINTER(v);
+}
+/**
+ * Checks if two position signatures are identical.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Pointer to the boolean result.
+ */
+Datum gist_sig_same(PG_FUNCTION_ARGS)
+{
+    SANSIG *a = DatumGetSANSIG(PG_GETARG_DATUM(0));
+    SANSIG *b = DatumGetSANSIG(PG_GETARG_DATUM(1));
+    bool *result = (bool *) PG_GETARG_POINTER(2);
+
+    if (SANSIG_ISALLTRUE(a) || SANSIG_ISALLTRUE(b))
+        *result = SANSIG_ISALLTRUE(a) && SANSIG_ISALLTRUE(b);
+    else
+        *result = memcmp(a->sign, b->sign, SANSIG_LEN) == 0;
+
+    PG_RETURN_POINTER(result);
+}
+/**
+ * Describes the summary of the BRIN bloom operator class on SAN.
+ *
+ * The summary of a block range is a single bloom filter, stored as a bytea value.
+ * Null games are handled by BRIN itself.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Pointer to the BrinOpcInfo.
+ */
+Datum brin_pos_bloom_opcinfo(PG_FUNCTION_ARGS)
+{
+    BrinOpcInfo *result = (BrinOpcInfo *) palloc0(MAXALIGN(SizeofBrinOpcInfo(1)));
+
+    result->oi_nstored = 1;
+    result->oi_regular_nulls = true;
+    result->oi_opaque = NULL;
+    result->oi_typcache[0] = lookup_type_cache(BYTEAOID, 0);
+
+    PG_RETURN_POINTER(result);
+}
+/**
+ * Adds a game to the summary of a block range.
+ *
+ * The game is replayed once and the hash of every board position it goes through
+ * is added to the bloom filter of the range, created on the first game and sized
+ * for the pages_per_range of the index.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Boolean indicating whether the summary was modified.
+ */
+Datum brin_pos_bloom_add_value(PG_FUNCTION_ARGS)
+{
+    BrinDesc *bdesc = (BrinDesc *) PG_GETARG_POINTER(0);
+    BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+    Datum newval = PG_GETARG_DATUM(2);
+    PositionBloomOptions *opts = PG_HAS_OPCLASS_OPTIONS() ? (PositionBloomOptions *) PG_GET_OPCLASS_OPTIONS() : NULL;
+    PositionBloom *filter;
+    MemoryContext replayContext, oldContext;
+    char **fens;
+    int nFens;
+    bool updated = false;
+
+    if (column->bv_allnulls) {
+        filter = position_bloom_new(opts, BrinGetPagesPerRange(bdesc->bd_index));
+        column->bv_allnulls = false;
+        updated = true;
+    } else {
+        filter = DatumGetPositionBloom(column->bv_values[0]);
+    }
+
+    // Only the filter outlives the replay.
+    replayContext = replay_context_create();
+    oldContext = MemoryContextSwitchTo(replayContext);
+    fens = san_to_fens(san_unpack(newval, fcinfo), &nFens);
+    MemoryContextSwitchTo(oldContext);
+
+    for (int i = 0; i < nFens; i++) {
+        uint32 hash = fen_position_hash(fens[i]);
+
+        if (!position_bloom_contains_hash(filter, hash)) {
+            position_bloom_add_hash(filter, hash);
+            updated = true;
+        }
+    }
+
+    MemoryContextDelete(replayContext);
+
+    column->bv_values[0] = PointerGetDatum(filter);
+
+    PG_RETURN_BOOL(updated);
+}
+/**
+ * Checks if a block range may hold games reaching the queried board positions.
+ *
+ * Used for the '@>' operator: the hash of each queried board position is looked up
+ * in the bloom filter of the range. Filters are lossy, so the games of the matching
+ * ranges are always rechecked.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Boolean indicating whether the range must be scanned.
+ */
+Datum brin_pos_bloom_consistent(PG_FUNCTION_ARGS)
+{
+    BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+    ScanKey *keys = (ScanKey *) PG_GETARG_POINTER(2);
+    int nkeys = PG_GETARG_INT32(3);
+    PositionBloom *filter = DatumGetPositionBloom(column->bv_values[0]);
+
+    for (int i = 0; i < nkeys; i++) {
+        FEN *query = (FEN *) DatumGetPointer(keys[i]->sk_argument);
+
+        if (!position_bloom_contains_hash(filter, fen_position_hash(query->positions)))
+            PG_RETURN_BOOL(false);
+    }
+
+    PG_RETURN_BOOL(true);
+}
+/**
+ * Merges the summaries of two block ranges.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Always true; the first summary is replaced by the bitwise OR of both filters.
+ */
+Datum brin_pos_bloom_union(PG_FUNCTION_ARGS)
+{
+    BrinValues *col_a = (BrinValues *) PG_GETARG_POINTER(1);
+    BrinValues *col_b = (BrinValues *) PG_GETARG_POINTER(2);
+    PositionBloom *filter_a = DatumGetPositionBloom(col_a->bv_values[0]);
+    PositionBloom *filter_b = DatumGetPositionBloom(col_b->bv_values[0]);
+
+    position_bloom_union_into(filter_a, filter_b);
+
+    col_a->bv_values[0] = PointerGetDatum(filter_a);
+
+    PG_RETURN_BOOL(true);
+}
+/**
+ * Declares the options of the BRIN bloom operator class on SAN.
+ *
+ * @param fcinfo Function call info containing arguments.
+ */
+Datum brin_pos_bloom_options(PG_FUNCTION_ARGS)
+{
+    local_relopts *relopts = (local_relopts *) PG_GETARG_POINTER(0);
+
+    position_bloom_options_init(relopts);
+
+    PG_RETURN_VOID();
+}
+/**
+ * Computes the distance between two SAN types.
+ *
+ * The distance is the edit distance between the mainline move sequences of the
+ * games (inserted, deleted or substituted moves), plus 1 - shared prefix / longest
+ * game, so that among games with as many edits the ones sharing a longer opening
+ * come first. Identical mainlines are at distance 0.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The distance between the games.
+ */
+Datum san_distance(PG_FUNCTION_ARGS)
+{
+    SAN *a = PG_GETARG_CHESSGAME_P(0);
+    SAN *b = PG_GETARG_CHESSGAME_P(1);
+    uint32 *movesA, *movesB;
+    int nA, nB;
+    float8 result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    movesA = moveseq_game_moves(a->data, &nA);
+    movesB = moveseq_game_moves(b->data, &nB);
+
+    result = moveseq_distance(movesA, nA, movesB, nB);
+
+    pfree(movesA);
+    pfree(movesB);
+
+    chess_stats_end(CHESS_FN_SAN_DISTANCE, &start);
+
+    PG_RETURN_FLOAT8(result);
+}
+/**
+ * Rejects textual input of move sequences.
+ *
+ * Move sequences only exist as GiST index keys, so they cannot be typed in.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Never returns.
+ */
+Datum moveseq_in(PG_FUNCTION_ARGS)
+{
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("moveseq_in: cannot accept a value of type moveseq")));
+
+    PG_RETURN_VOID();
+}
+/**
+ * Outputs a move sequence as a summary of its contents.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A string describing the stored moves and the range of game lengths.
+ */
+Datum moveseq_out(PG_FUNCTION_ARGS)
+{
+    MOVESEQ *key = DatumGetMOVESEQ(PG_GETARG_DATUM(0));
+    char *result;
+
+    result = psprintf("%d moves, games of %d to %d moves%s", key->nMoves, key->minMoves, key->maxMoves,
+                      (key->flags & MOVESEQ_TRUNCATED) ? " (truncated)" : "");
+
+    PG_FREE_IF_COPY(key, 0);
+
+    PG_RETURN_CSTRING(result);
+}
+/**
+ * Compresses a GiST entry into a move sequence.
+ *
+ * Leaf entries hold a SAN game, whose mainline moves are hashed; no replay is
+ * needed. Inner entries are stored as is.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The compressed GiST entry.
+ */
+Datum gist_moves_compress(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    GISTENTRY *retval = entry;
+
+    if (entry->leafkey) {
+        SAN *san = san_unpack(entry->key, fcinfo);
+        uint32 *moves;
+        int nMoves;
+
+        moves = moveseq_game_moves(san->data, &nMoves);
+
+        retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+        gistentryinit(*retval, PointerGetDatum(moveseq_from_moves(moves, nMoves)),
+                      entry->rel, entry->page, entry->offset, false);
+
+        pfree(moves);
+        pfree(san);
+    }
+
+    PG_RETURN_POINTER(retval);
+}
+/**
+ * Decompresses a GiST entry holding a move sequence.
+ *
+ * Move sequences are stored as is, so this only detoasts the key if needed.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The decompressed GiST entry.
+ */
+Datum gist_moves_decompress(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    MOVESEQ *key = DatumGetMOVESEQ(entry->key);
+
+    if (key != (MOVESEQ *) DatumGetPointer(entry->key)) {
+        GISTENTRY *retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+
+        gistentryinit(*retval, PointerGetDatum(key), entry->rel, entry->page, entry->offset, false);
+
+        PG_RETURN_POINTER(retval);
+    }
+
+    PG_RETURN_POINTER(entry);
+}
+/**
+ * Checks if a move sequence may match a search.
+ *
+ * The operator class only supports ordering by '<->', which does not filter any
+ * entry, so every entry is consistent.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Always true.
+ */
+Datum gist_moves_consistent(PG_FUNCTION_ARGS)
+{
+    bool *recheck = (bool *) PG_GETARG_POINTER(4);
+
+    *recheck = false;
+
+    PG_RETURN_BOOL(true);
+}
+/**
+ * Computes the union of a set of move sequences.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The moves shared by the sequences and the range of their lengths.
+ */
+Datum gist_moves_union(PG_FUNCTION_ARGS)
+{
+    GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+    int *size = (int *) PG_GETARG_POINTER(1);
+    MOVESEQ **keys = (MOVESEQ **) palloc(entryvec->n * sizeof(MOVESEQ *));
+    MOVESEQ *result;
+
+    for (int i = 0; i < entryvec->n; i++)
+        keys[i] = DatumGetMOVESEQ(entryvec->vector[i].key);
+
+    result = moveseq_union(keys, entryvec->n);
+    *size = VARSIZE(result);
+
+    pfree(keys);
+
+    PG_RETURN_POINTER(result);
+}
+/**
+ * Computes the penalty of inserting a move sequence below another one.
+ *
+ * The penalty is the number of shared moves the subtree would lose, plus a small
+ * part of the growth of its length range.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Pointer to the penalty.
+ */
+Datum gist_moves_penalty(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *origentry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    GISTENTRY *newentry = (GISTENTRY *) PG_GETARG_POINTER(1);
+    float *penalty = (float *) PG_GETARG_POINTER(2);
+    MOVESEQ *orig = DatumGetMOVESEQ(origentry->key);
+    MOVESEQ *add = DatumGetMOVESEQ(newentry->key);
+    int shared = moveseq_common_prefix(orig->moves, orig->nMoves, add->moves, add->nMoves);
+    int growth = Max(orig->minMoves - add->minMoves, 0) + Max(add->maxMoves - orig->maxMoves, 0);
+
+    *penalty = (float) (orig->nMoves - shared) + 0.1f * growth;
+
+    PG_RETURN_POINTER(penalty);
+}
+/**
+ * Entry of a page being split, with its position in the entry vector.
+ */
+typedef struct
+{
+    OffsetNumber offset;
+    MOVESEQ *key;
+} MoveSplitEntry;
+
+/**
+ * Orders picksplit entries by their move sequence.
+ */
+static int gist_moves_picksplit_cmp(const void *a, const void *b)
+{
+    return moveseq_cmp(((const MoveSplitEntry *) a)->key, ((const MoveSplitEntry *) b)->key);
+}
+/**
+ * Splits a page of move sequences in two.
+ *
+ * The entries are sorted by their moves and split in the middle, so that games
+ * sharing an opening stay together and the two sides keep long shared prefixes.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Pointer to the filled GIST_SPLITVEC.
+ */
+Datum gist_moves_picksplit(PG_FUNCTION_ARGS)
+{
+    GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+    GIST_SPLITVEC *v = (GIST_SPLITVEC *) PG_GETARG_POINTER(1);
+    OffsetNumber maxoff = entryvec->n - 1;
+    int nEntries = maxoff - FirstOffsetNumber + 1;
+    int half = nEntries / 2;
+    MoveSplitEntry *entries = (MoveSplitEntry *) palloc(nEntries * sizeof(MoveSplitEntry));
+    MOVESEQ **keys = (MOVESEQ **) palloc(nEntries * sizeof(MOVESEQ *));
+
+    v->spl_left = (OffsetNumber *) palloc((maxoff + 2) * sizeof(OffsetNumber));
+    v->spl_right = (OffsetNumber *) palloc((maxoff + 2) * sizeof(OffsetNumber));
+    v->spl_nleft = 0;
+    v->spl_nright = 0;
+
+    for (OffsetNumber j = FirstOffsetNumber; j <= maxoff; j = OffsetNumberNext(j)) {
+        entries[j - FirstOffsetNumber].offset = j;
+        entries[j - FirstOffsetNumber].key = DatumGetMOVESEQ(entryvec->vector[j].key);
+    }
+
+    qsort(entries, nEntries, sizeof(MoveSplitEntry), gist_moves_picksplit_cmp);
+
+    for (int i = 0; i < nEntries; i++) {
+        keys[i] = entries[i].key;
+
+        if (i < half)
+            v->spl_left[v->spl_nleft++] = entries[i].offset;
+        else
+            v->spl_right[v->spl_nright++] = entries[i].offset;
+    }
+
+    v->spl_ldatum = PointerGetDatum(moveseq_union(keys, half));
+    v->spl_rdatum = PointerGetDatum(moveseq_union(keys + half, nEntries - half));
+
+    pfree(entries);
+    pfree(keys);
+
+    PG_RETURN_POINTER(v);
+}
+/**
+ * Checks if two move sequences are identical.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Pointer to the boolean result.
+ */
+Datum gist_moves_same(PG_FUNCTION_ARGS)
+{
+    MOVESEQ *a = DatumGetMOVESEQ(PG_GETARG_DATUM(0));
+    MOVESEQ *b = DatumGetMOVESEQ(PG_GETARG_DATUM(1));
+    bool *result = (bool *) PG_GETARG_POINTER(2);
+
+    *result = VARSIZE(a) == VARSIZE(b) && memcmp(a, b, VARSIZE(a)) == 0;
+
+    PG_RETURN_POINTER(result);
+}
+/**
+ * Computes the distance between a query game and a move sequence, for KNN searches.
+ *
+ * Inner entries and leaf entries of long games return a lower bound of the
+ * distance (the latter rechecked with '<->'); other leaf entries the exact one.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The (bound of the) distance.
+ */
+Datum gist_moves_distance(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    SAN *query = PG_GETARG_CHESSGAME_P(1);
+    bool *recheck = (bool *) PG_GETARG_POINTER(4);
+    MOVESEQ *key = DatumGetMOVESEQ(entry->key);
+    uint32 *moves;
+    int nMoves;
+    float8 result;
+
+    moves = moveseq_game_moves(query->data, &nMoves);
+
+    *recheck = GIST_LEAF(entry) && !MOVESEQ_ISEXACT(key);
+    result = moveseq_lower_bound(key, moves, nMoves);
+
+    pfree(moves);
+
+    PG_RETURN_FLOAT8(result);
+}
+/**
+ * Computes the distance between two FEN types.
+ *
+ * The distance is the number of squares holding a different piece (or a piece
+ * on one board and none on the other); the other FEN fields are ignored.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The number of differing squares, between 0 and 64.
+ */
+Datum fen_distance(PG_FUNCTION_ARGS)
+{
+    FEN *a = (FEN *) PG_GETARG_POINTER(0);
+    FEN *b = (FEN *) PG_GETARG_POINTER(1);
+    BOARDSIG *sigA, *sigB;
+    int result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    sigA = boardsig_from_positions(a->positions);
+    sigB = boardsig_from_positions(b->positions);
+    result = boardsig_distance(sigA, sigB);
+
+    pfree(sigA);
+    pfree(sigB);
+
+    chess_stats_end(CHESS_FN_FEN_DISTANCE, &start);
+
+    PG_RETURN_FLOAT8((float8) result);
+}
+/**
+ * Rejects textual input of board signatures.
+ *
+ * Board signatures only exist as GiST index keys, so they cannot be typed in.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Never returns.
+ */
+Datum boardsig_in(PG_FUNCTION_ARGS)
+{
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("boardsig_in: cannot accept a value of type boardsig")));
+
+    PG_RETURN_VOID();
+}
+/**
+ * Outputs a board signature as the number of contents each square may have.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A string of 64 digits, one per square from a8 to h1.
+ */
+Datum boardsig_out(PG_FUNCTION_ARGS)
+{
+    BOARDSIG *sig = DatumGetBOARDSIG(PG_GETARG_DATUM(0));
+    char *result = (char *) palloc(65);
+
+    for (int square = 0; square < 64; square++) {
+        int count = 0;
+
+        for (int i = 0; i < BOARDSIG_CONTENTS; i++)
+            count += (sig->boards[i] >> square) & 1;
+
+        result[square] = count < 10 ? '0' + count : 'a' + count - 10;
+    }
+    result[64] = '\0';
+
+    PG_FREE_IF_COPY(sig, 0);
+
+    PG_RETURN_CSTRING(result);
+}
+/**
+ * Compresses a GiST entry into a board signature.
+ *
+ * Leaf entries hold a FEN, whose board positions give the signature. Inner
+ * entries are stored as is.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The compressed GiST entry.
+ */
+Datum gist_board_compress(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    GISTENTRY *retval = entry;
+
+    if (entry->leafkey) {
+        FEN *fen = (FEN *) DatumGetPointer(entry->key);
+
+        retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+        gistentryinit(*retval, PointerGetDatum(boardsig_from_positions(fen->positions)),
+                      entry->rel, entry->page, entry->offset, false);
+    }
+
+    PG_RETURN_POINTER(retval);
+}
+/**
+ * Decompresses a GiST entry holding a board signature.
+ *
+ * Board signatures are stored as is, so this only detoasts the key if needed.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The decompressed GiST entry.
+ */
+Datum gist_board_decompress(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    BOARDSIG *sig = DatumGetBOARDSIG(entry->key);
+
+    if (sig != (BOARDSIG *) DatumGetPointer(entry->key)) {
+        GISTENTRY *retval = (GISTENTRY *) palloc(sizeof(GISTENTRY));
+
+        gistentryinit(*retval, PointerGetDatum(sig), entry->rel, entry->page, entry->offset, false);
+
+        PG_RETURN_POINTER(retval);
+    }
+
+    PG_RETURN_POINTER(entry);
+}
+/**
+ * Checks if a board signature may match a search.
+ *
+ * The operator class only supports ordering by '<->', which does not filter any
+ * entry, so every entry is consistent.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Always true.
+ */
+Datum gist_board_consistent(PG_FUNCTION_ARGS)
+{
+    bool *recheck = (bool *) PG_GETARG_POINTER(4);
+
+    *recheck = false;
+
+    PG_RETURN_BOOL(true);
+}
+/**
+ * Computes the union of a set of board signatures.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The bitwise OR of the signatures.
+ */
+Datum gist_board_union(PG_FUNCTION_ARGS)
+{
+    GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+    int *size = (int *) PG_GETARG_POINTER(1);
+    BOARDSIG *result = boardsig_new();
+
+    for (int i = 0; i < entryvec->n; i++)
+        boardsig_union_into(result, DatumGetBOARDSIG(entryvec->vector[i].key));
+
+    *size = VARSIZE(result);
+
+    PG_RETURN_POINTER(result);
+}
+/**
+ * Computes the penalty of inserting a board signature below another one.
+ *
+ * The penalty is the number of square contents the signature would add.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Pointer to the penalty.
+ */
+Datum gist_board_penalty(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *origentry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    GISTENTRY *newentry = (GISTENTRY *) PG_GETARG_POINTER(1);
+    float *penalty = (float *) PG_GETARG_POINTER(2);
+
+    *penalty = (float) boardsig_added_bits(DatumGetBOARDSIG(origentry->key), DatumGetBOARDSIG(newentry->key));
+
+    PG_RETURN_POINTER(penalty);
+}
+/**
+ * Splits a page of board signatures in two.
+ *
+ * The two signatures that are furthest apart (Hamming distance) seed the two
+ * sides; every other entry goes to the side whose signature it extends the least.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Pointer to the filled GIST_SPLITVEC.
+ */
+Datum gist_board_picksplit(PG_FUNCTION_ARGS)
+{
+    GistEntryVector *entryvec = (GistEntryVector *) PG_GETARG_POINTER(0);
+    GIST_SPLITVEC *v = (GIST_SPLITVEC *) PG_GETARG_POINTER(1);
+    OffsetNumber maxoff = entryvec->n - 1;
+    OffsetNumber seed_1 = FirstOffsetNumber, seed_2 = OffsetNumberNext(FirstOffsetNumber);
+    BOARDSIG *left, *right;
+    int waste = -1;
+
+    v->spl_left = (OffsetNumber *) palloc((maxoff + 2) * sizeof(OffsetNumber));
+    v->spl_right = (OffsetNumber *) palloc((maxoff + 2) * sizeof(OffsetNumber));
+    v->spl_nleft = 0;
+    v->spl_nright = 0;
+
+    // Pick the two signatures that are furthest apart as seeds.
+    for (OffsetNumber k = FirstOffsetNumber; k < maxoff; k = OffsetNumberNext(k)) {
+        for (OffsetNumber j = OffsetNumberNext(k); j <= maxoff; j = OffsetNumberNext(j)) {
+            int distance = boardsig_bit_distance(DatumGetBOARDSIG(entryvec->vector[k].key),
+                                                 DatumGetBOARDSIG(entryvec->vector[j].key));
+
+            if (distance > waste) {
+                waste = distance;
+                seed_1 = k;
+                seed_2 = j;
+            }
+        }
+    }
+
+    left = boardsig_new();
+    right = boardsig_new();
+    boardsig_union_into(left, DatumGetBOARDSIG(entryvec->vector[seed_1].key));
+    boardsig_union_into(right, DatumGetBOARDSIG(entryvec->vector[seed_2].key));
+
+    // Distribute the entries to the side they extend the least.
+    for (OffsetNumber j = FirstOffsetNumber; j <= maxoff; j = OffsetNumberNext(j)) {
+        BOARDSIG *sig = DatumGetBOARDSIG(entryvec->vector[j].key);
+        int cost_left, cost_right;
+
+        if (j == seed_1) {
+            v->spl_left[v->spl_nleft++] = j;
+            continue;
+        }
+        if (j == seed_2) {
+            v->spl_right[v->spl_nright++] = j;
+            continue;
+        }
+
+        cost_left = boardsig_added_bits(left, sig);
+        cost_right = boardsig_added_bits(right, sig);
+
+        if (cost_left < cost_right || (cost_left == cost_right && v->spl_nleft < v->spl_nright)) {
+            boardsig_union_into(left, sig);
+            v->spl_left[v->spl_nleft++] = j;
+        } else {
+            boardsig_union_into(right, sig);
+            v->spl_right[v->spl_nright++] = j;
+        }
+    }
+
+    v->spl_ldatum = PointerGetDatum(left);
+    v->spl_rdatum = PointerGetDatum(right);
+
+    PG_RETURN_POINTER(v);
+}
+/**
+ * Checks if two board signatures are identical.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return Pointer to the boolean result.
+ */
+Datum gist_board_same(PG_FUNCTION_ARGS)
+{
+    BOARDSIG *a = DatumGetBOARDSIG(PG_GETARG_DATUM(0));
+    BOARDSIG *b = DatumGetBOARDSIG(PG_GETARG_DATUM(1));
+    bool *result = (bool *) PG_GETARG_POINTER(2);
+
+    *result = memcmp(a->boards, b->boards, sizeof(a->boards)) == 0;
+
+    PG_RETURN_POINTER(result);
+}
+/**
+ * Computes the distance between a query position and a board signature, for KNN searches.
+ *
+ * The distance is exact for leaf entries and a lower bound for inner ones, so
+ * no recheck is needed.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The (bound of the) number of differing squares.
+ */
+Datum gist_board_distance(PG_FUNCTION_ARGS)
+{
+    GISTENTRY *entry = (GISTENTRY *) PG_GETARG_POINTER(0);
+    FEN *query = (FEN *) PG_GETARG_POINTER(1);
+    bool *recheck = (bool *) PG_GETARG_POINTER(4);
+    BOARDSIG *querySig = boardsig_from_positions(query->positions);
+    int result;
+
+    *recheck = false;
+    result = boardsig_distance(DatumGetBOARDSIG(entry->key), querySig);
+
+    pfree(querySig);
+
+    PG_RETURN_FLOAT8((float8) result);
+}
+/**
+ * Returns the position key of a FEN type.
+ *
+ * The key is a 64-bit hash of the board positions, as stored in the chess_positions
+ * side table filled by the position workers.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The position key.
+ */
+Datum position_key(PG_FUNCTION_ARGS)
+{
+    FEN *board = (FEN *) PG_GETARG_POINTER(0);
+    int64 result;
+    instr_time start;
+
+    chess_stats_begin(&start);
+
+    result = fen_position_hash64(board->positions);
+
+    chess_stats_end(CHESS_FN_POSITION_KEY, &start);
+
+    PG_RETURN_INT64(result);
+}
+/**
+ * Returns the position key of every board state of a SAN type.
+ *
+ * The game is replayed once; one row (ply, position_key) is returned per board
+ * state, ply 0 being the initial position.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A set of (ply, position_key) rows.
+ */
+Datum game_position_keys(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    SAN *game;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    MemoryContext replayContext;
+    char **fens;
+    int nFens;
+    instr_time start;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("game_position_keys: set-valued function called in context that cannot accept a set")));
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        ereport(ERROR, (errmsg("game_position_keys: return type must be a row type")));
+
+    chess_stats_begin(&start);
+
+    game = PG_GETARG_CHESSGAME_P(0);
+
+    replayContext = replay_context_create();
+    oldcontext = MemoryContextSwitchTo(replayContext);
+    fens = san_to_fens(game, &nFens);
+
+    MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+
+    for (int ply = 0; ply < nFens; ply++) {
+        Datum values[2];
+        bool nulls[2] = {false, false};
+
+        values[0] = Int32GetDatum(ply);
+        values[1] = Int64GetDatum(fen_position_hash64(fens[ply]));
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+    MemoryContextDelete(replayContext);
+
+    chess_stats_end(CHESS_FN_GAME_POSITION_KEYS, &start);
+
+    return (Datum) 0;
+}
+/**
+ * Builds the position posting file of a table.
+ *
+ * The games of the first SAN column of the table are replayed once and the file
+ * mapping each position key to the games reaching it is written to the data
+ * directory, replacing the previous one. 'game @> fen' restrictions on the table
+ * are then answered from the file as long as the table is not modified.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return The number of (position, game) postings written.
+ */
+Datum chess_build_position_file(PG_FUNCTION_ARGS)
+{
+    Oid relid = PG_GETARG_OID(0);
+    Oid namespaceOid = get_func_namespace(fcinfo->flinfo->fn_oid);
+    Oid sanTypeOid;
+    uint64 result;
+    instr_time start;
+
+    // The SAN type lives in the extension schema, next to this function.
+    sanTypeOid = GetSysCacheOid2(TYPENAMENSP, Anum_pg_type_oid,
+                                 CStringGetDatum("san"), ObjectIdGetDatum(namespaceOid));
+
+    if (!OidIsValid(sanTypeOid))
+        ereport(ERROR, (errmsg("chess_build_position_file: cannot find the SAN type")));
+
+    chess_stats_begin(&start);
+
+    // Installed first: it locks the table against writes until the end of the transaction.
+    position_file_install_trigger(relid, namespaceOid);
+    result = position_file_build(relid, sanTypeOid, fcinfo);
+
+    chess_stats_end(CHESS_FN_BUILD_POSITION_FILE, &start);
+
+    PG_RETURN_INT64((int64) result);
+}
+/**
+ * Removes the posting file of the table a trigger fires on.
+ *
+ * Statement trigger installed by chess_build_position_file: writes that fit in the
+ * existing pages leave the size of the table unchanged, so the file would otherwise
+ * go on answering 'game @> fen' without the games they add or change.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return NULL, as a statement trigger.
+ */
+Datum chess_position_file_invalidate(PG_FUNCTION_ARGS)
+{
+    TriggerData *trigdata = (TriggerData *) fcinfo->context;
+    instr_time start;
+
+    if (!CALLED_AS_TRIGGER(fcinfo))
+        ereport(ERROR,
+                (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+                 errmsg("chess_position_file_invalidate: not called by trigger manager")));
+
+    chess_stats_begin(&start);
+
+    position_file_invalidate(RelationGetRelid(trigdata->tg_relation));
+
+    chess_stats_end(CHESS_FN_POSITION_FILE_INVALIDATE, &start);
+
+    PG_RETURN_POINTER(NULL);
+}
+/**
+ * Makes every session read the opening dictionary again after lines are added.
+ *
+ * Statement trigger on chess_opening_dict: the sessions keep the dictionary in
+ * memory, and inserts send no invalidation of the table by themselves.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return NULL, as a statement trigger.
+ */
+Datum chess_opening_dict_changed(PG_FUNCTION_ARGS)
+{
+    TriggerData *trigdata = (TriggerData *) fcinfo->context;
+    instr_time start;
+
+    if (!CALLED_AS_TRIGGER(fcinfo))
+        ereport(ERROR,
+                (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+                 errmsg("chess_opening_dict_changed: not called by trigger manager")));
+
+    chess_stats_begin(&start);
+
+    opening_dict_changed(trigdata->tg_relation);
+
+    chess_stats_end(CHESS_FN_OPENING_DICT_CHANGED, &start);
+
+    PG_RETURN_POINTER(NULL);
+}
+/**
+ * Reports the extension runtime statistics.
+ *
+ * Returns one row per counter and per tracked function, first for the current
+ * backend and then, when the library is preloaded, for the whole server.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return A set of (scope, kind, name, value, total_time_ms) rows.
+ */
+Datum chess_stats(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("chess_stats: set-valued function called in context that cannot accept a set")));
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        ereport(ERROR, (errmsg("chess_stats: return type must be a row type")));
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+
+    chess_stats_fill(tupstore, tupdesc);
+
+    MemoryContextSwitchTo(oldcontext);
+
+    return (Datum) 0;
+}
+/**
+ * Resets the extension runtime statistics.
+ *
+ * Clears the counters of the current backend and, when the library is preloaded,
+ * the server-wide counters.
+ *
+ * @param fcinfo Function call info containing arguments.
+ * @return void
+ */
+Datum chess_stats_reset(PG_FUNCTION_ARGS)
+{
+    chess_stats_reset_all();
+
+    PG_RETURN_VOID();
+}
@@ -17,13 +17,70 @@
 #include "libpq/pqformat.h"
 #include "DataTypes/SAN/SAN.h"
 #include "DataTypes/FEN/FEN.h"
+#include "DataTypes/SAN/SANPACKED.h"
+#include "DataTypes/PGN/PGN.h"
 
 #ifndef CHESS_H
 #define CHESS_H
 
-// Macros to simplify retrieving and returning chessgame data types in PostgreSQL functions.
-#define PG_GETARG_CHESSGAME_P(n) ((SAN *)PG_GETARG_POINTER(n))
-#define PG_RETURN_CHESSGAME_P(p) PG_RETURN_POINTER(p)
+// PG_GETARG_CHESSGAME_P and PG_RETURN_CHESSGAME_P (SANPACKED.h) convert chessgame data
+// types between their stored and decoded forms in PostgreSQL functions.
+
+// Strategy numbers of the operators of the san_gin_ops operator class.
+#define CHESS_GIN_CONTAINS_STRATEGY 1     // SAN @> FEN
+#define CHESS_GIN_EQUAL_STRATEGY 2        // SAN = FEN
+#define CHESS_GIN_CONTAINS_ALL_STRATEGY 3 // SAN @> FEN[]
+#define CHESS_GIN_CONTAINS_ANY_STRATEGY 4 // SAN && FEN[]
+#define CHESS_GIN_REACHES_IN_ORDER_STRATEGY 5 // SAN @>> FEN[]
+#define CHESS_GIN_REACHES_WINDOW_STRATEGY 6 // SAN @> FENWINDOW
+#define CHESS_GIN_REACHES_EXACT_STRATEGY 7 // SAN @= FEN
+#define CHESS_GIN_REACHES_ANY_LINE_STRATEGY 8 // SAN @@> FEN
+
+// Strategy numbers of the operators of the san_moves_gin_ops operator class.
+#define CHESS_GIN_MOVES_LIKE_STRATEGY 1     // SAN ~~ text
+#define CHESS_GIN_MOVES_CONTAINS_STRATEGY 2 // SAN @@ text
+
+// GIN keys are tagged with the ply bucket of the board state, 16 half-moves wide.
+// The last bucket holds every half-move from 496 on.
+#define CHESS_GIN_PLY_BUCKET_SIZE 16
+#define CHESS_GIN_PLY_BUCKETS 32
+#define CHESS_GIN_PLY_BUCKET(ply) Min((ply) / CHESS_GIN_PLY_BUCKET_SIZE, CHESS_GIN_PLY_BUCKETS - 1)
+
+// Board states of the side lines (option 'variations') are tagged with the buckets
+// following the mainline ones, so the mainline searches never see them.
+#define CHESS_GIN_SIDE_LINE_BUCKET(ply) (CHESS_GIN_PLY_BUCKETS + CHESS_GIN_PLY_BUCKET(ply))
+
+// Every indexed board state is also tagged with a bucket covering all the half-moves,
+// so the searches spanning every indexed half-move look a board up under one key.
+#define CHESS_GIN_ALL_PLIES_BUCKET (2 * CHESS_GIN_PLY_BUCKETS)
+#define CHESS_GIN_SIDE_LINE_ALL_PLIES_BUCKET (2 * CHESS_GIN_PLY_BUCKETS + 1)
+
+// Values of the 'key' option of san_gin_ops: the board state fields of the GIN keys.
+#define CHESS_GIN_KEY_PLACEMENT 0 // Piece placement only
+#define CHESS_GIN_KEY_FULL 1      // Piece placement, side to move, castling rights and en passant square
+
+// GIN keys of the games having board states before 'skip_first' or after 'max_ply',
+// which are not indexed.
+#define CHESS_GIN_BEFORE_KEY "#before"
+#define CHESS_GIN_AFTER_KEY "#after"
+
+/**
+ * Structure representing the options of the san_gin_ops operator class.
+ *
+ * @param vl_len_ Varlena header (do not touch directly).
+ * @param maxPly The last half-move indexed, or -1 for all of them.
+ * @param skipFirst The number of half-moves not indexed at the start of the games.
+ * @param key The board state fields of the keys (CHESS_GIN_KEY_*).
+ * @param variations Whether the board states of the side lines are indexed too.
+ */
+typedef struct
+{
+    int32 vl_len_;
+    int maxPly;
+    int skipFirst;
+    int key;
+    bool variations;
+} ChessGinOptions;
 
 PG_MODULE_MAGIC;
 
@@ -35,12 +92,44 @@ Datum san_in(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(san_out);
 Datum san_out(PG_FUNCTION_ARGS);
 
+PG_FUNCTION_INFO_V1(san_recv);
+Datum san_recv(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(san_send);
+Datum san_send(PG_FUNCTION_ARGS);
+
 PG_FUNCTION_INFO_V1(fen_in);
 Datum fen_in(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(fen_out);
 Datum fen_out(PG_FUNCTION_ARGS);
 
+PG_FUNCTION_INFO_V1(pgn_in);
+Datum pgn_in(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pgn_out);
+Datum pgn_out(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pgn_to_san);
+Datum pgn_to_san(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(san_to_pgn);
+Datum san_to_pgn(PG_FUNCTION_ARGS);
+
+/* PGN Functions */
+
+PG_FUNCTION_INFO_V1(pgn_tag);
+Datum pgn_tag(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(pgn_result);
+Datum pgn_result(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(ply_count);
+Datum ply_count(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(ply_count_san);
+Datum ply_count_san(PG_FUNCTION_ARGS);
+
 /* Chess Functions */
 
 PG_FUNCTION_INFO_V1(has_Board);
@@ -49,6 +138,18 @@ Datum has_Board(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(has_opening);
 Datum has_opening(PG_FUNCTION_ARGS);
 
+PG_FUNCTION_INFO_V1(has_opening_support);
+Datum has_opening_support(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(opening_bucket);
+Datum opening_bucket(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(san_append);
+Datum san_append(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(current_board);
+Datum current_board(PG_FUNCTION_ARGS);
+
 PG_FUNCTION_INFO_V1(get_FirstMoves);
 Datum get_FirstMoves(PG_FUNCTION_ARGS);
 
@@ -103,10 +204,226 @@ Datum gin_consistent(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(gin_tri_consistent);
 Datum gin_tri_consistent(PG_FUNCTION_ARGS);
 
+PG_FUNCTION_INFO_V1(gin_options);
+Datum gin_options(PG_FUNCTION_ARGS);
+
 PG_FUNCTION_INFO_V1(has_board_fn_operator);
 Datum has_board_fn_operator(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(fen_in_san_eq);
 Datum fen_in_san_eq(PG_FUNCTION_ARGS);
 
+PG_FUNCTION_INFO_V1(has_exact_board);
+Datum has_exact_board(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(has_board_in_lines);
+Datum has_board_in_lines(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(game_variations);
+Datum game_variations(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(has_all_boards);
+Datum has_all_boards(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(has_any_board);
+Datum has_any_board(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(reaches_in_order);
+Datum reaches_in_order(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(reaches_in_order_plies);
+Datum reaches_in_order_plies(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(fenwindow_in);
+Datum fenwindow_in(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(fenwindow_out);
+Datum fenwindow_out(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(fen_window);
+Datum fen_window(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(reaches_window);
+Datum reaches_window(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(first_ply_of);
+Datum first_ply_of(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(has_board_many);
+Datum has_board_many(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(contains_moves);
+Datum contains_moves(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(game_fingerprint);
+Datum game_fingerprint(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(eco_code);
+Datum eco_code(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(eco_name);
+Datum eco_name(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gin_moves_extract_value);
+Datum gin_moves_extract_value(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gin_moves_extract_query);
+Datum gin_moves_extract_query(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gin_moves_compare_partial);
+Datum gin_moves_compare_partial(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gin_moves_consistent);
+Datum gin_moves_consistent(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gin_moves_tri_consistent);
+Datum gin_moves_tri_consistent(PG_FUNCTION_ARGS);
+
+/* GiST */
+
+PG_FUNCTION_INFO_V1(sansig_in);
+Datum sansig_in(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(sansig_out);
+Datum sansig_out(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_sig_compress);
+Datum gist_sig_compress(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_sig_decompress);
+Datum gist_sig_decompress(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_sig_consistent);
+Datum gist_sig_consistent(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_sig_union);
+Datum gist_sig_union(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_sig_penalty);
+Datum gist_sig_penalty(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_sig_picksplit);
+Datum gist_sig_picksplit(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_sig_same);
+Datum gist_sig_same(PG_FUNCTION_ARGS);
+
+/* Position bloom (BRIN) */
+
+PG_FUNCTION_INFO_V1(brin_pos_bloom_opcinfo);
+Datum brin_pos_bloom_opcinfo(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(brin_pos_bloom_add_value);
+Datum brin_pos_bloom_add_value(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(brin_pos_bloom_consistent);
+Datum brin_pos_bloom_consistent(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(brin_pos_bloom_union);
+Datum brin_pos_bloom_union(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(brin_pos_bloom_options);
+Datum brin_pos_bloom_options(PG_FUNCTION_ARGS);
+
+/* Move similarity (GiST KNN) */
+
+PG_FUNCTION_INFO_V1(san_distance);
+Datum san_distance(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(moveseq_in);
+Datum moveseq_in(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(moveseq_out);
+Datum moveseq_out(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_moves_compress);
+Datum gist_moves_compress(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_moves_decompress);
+Datum gist_moves_decompress(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_moves_consistent);
+Datum gist_moves_consistent(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_moves_union);
+Datum gist_moves_union(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_moves_penalty);
+Datum gist_moves_penalty(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_moves_picksplit);
+Datum gist_moves_picksplit(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_moves_same);
+Datum gist_moves_same(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_moves_distance);
+Datum gist_moves_distance(PG_FUNCTION_ARGS);
+
+/* Nearest positions (GiST KNN) */
+
+PG_FUNCTION_INFO_V1(fen_distance);
+Datum fen_distance(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(boardsig_in);
+Datum boardsig_in(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(boardsig_out);
+Datum boardsig_out(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_board_compress);
+Datum gist_board_compress(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_board_decompress);
+Datum gist_board_decompress(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_board_consistent);
+Datum gist_board_consistent(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_board_union);
+Datum gist_board_union(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_board_penalty);
+Datum gist_board_penalty(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_board_picksplit);
+Datum gist_board_picksplit(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_board_same);
+Datum gist_board_same(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(gist_board_distance);
+Datum gist_board_distance(PG_FUNCTION_ARGS);
+
+/* Position queue */
+
+PG_FUNCTION_INFO_V1(position_key);
+Datum position_key(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(game_position_keys);
+Datum game_position_keys(PG_FUNCTION_ARGS);
+
+/* Position file */
+
+PG_FUNCTION_INFO_V1(chess_build_position_file);
+Datum chess_build_position_file(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(chess_position_file_invalidate);
+Datum chess_position_file_invalidate(PG_FUNCTION_ARGS);
+
+/* Opening dictionary */
+
+PG_FUNCTION_INFO_V1(chess_opening_dict_changed);
+Datum chess_opening_dict_changed(PG_FUNCTION_ARGS);
+
+/* Statistics */
+
+void _PG_init(void);
+
+PG_FUNCTION_INFO_V1(chess_stats);
+Datum chess_stats(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(chess_stats_reset);
+Datum chess_stats_reset(PG_FUNCTION_ARGS);
+
 #endif // CHESS_H
\ No newline at end of file
@@ -0,0 +1,102 @@
+import chess
+import random
+import sys
+import psycopg2
+import psycopg2.extras
+
+# Database connection parameters
+db_params = {
+    "dbname": "ExtensionTest",
+    "user": "postgres",
+    "password": "1122",
+    "host": "localhost",  # or your database server address
+    "port": "5432"
+}
+
+# Number of games scanned (first argument), inserted in batches
+games_count = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+batch_size = 10000
+
+# Values of max_parallel_workers_per_gather compared
+worker_steps = [0, 1, 2, 4, 8]
+
+# Scans timed at each step: each one replays every game of the table
+queries = {
+    "@>": "SELECT count(*) FROM bench_games "
+          "WHERE game_notation @> 'r1bqkbnr/pppp1ppp/2n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R b KQkq - 3 3'",
+    "has_Board": "SELECT count(*) FROM bench_games "
+                 "WHERE has_Board(game_notation, 'rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2', 2)",
+    "get_board_state": "SELECT count(DISTINCT get_board_state(game_notation, 10)::text) FROM bench_games",
+}
+
+def generate_chess_game():
+    board = chess.Board()
+    moves = []
+
+    # Randomize the length of the game
+    max_plies = random.randint(20, 140)
+
+    while not board.is_game_over(claim_draw=True) and len(moves) < max_plies:
+        move = random.choice(list(board.legal_moves))
+        if board.turn == chess.WHITE:
+            moves.append(f"{board.fullmove_number}. {board.san(move)}")
+        else:
+            moves.append(board.san(move))
+        board.push(move)
+
+    return ' '.join(moves)
+
+def populate(cursor):
+    cursor.execute("DROP TABLE IF EXISTS bench_games")
+    cursor.execute("CREATE TABLE bench_games (id serial PRIMARY KEY, game_notation SAN)")
+
+    inserted = 0
+    while inserted < games_count:
+        count = min(batch_size, games_count - inserted)
+        games = [(generate_chess_game(),) for _ in range(count)]
+        psycopg2.extras.execute_values(cursor, "INSERT INTO bench_games (game_notation) VALUES %s", games, page_size=1000)
+        inserted += count
+        print(f"{inserted} games inserted.")
+
+    cursor.execute("ANALYZE bench_games")
+
+def time_query(cursor, query, workers):
+    # Parallel plans are forced regardless of the table size, so that only the worker count varies
+    cursor.execute(f"SET max_parallel_workers_per_gather = {workers}")
+    cursor.execute("SET parallel_setup_cost = 0")
+    cursor.execute("SET parallel_tuple_cost = 0")
+    cursor.execute("SET min_parallel_table_scan_size = 0")
+    cursor.execute(f"EXPLAIN (ANALYZE, FORMAT JSON) {query}")
+    plan = cursor.fetchone()[0][0]
+
+    return plan["Execution Time"], find_workers_launched(plan["Plan"])
+
+def find_workers_launched(node):
+    if "Workers Launched" in node:
+        return node["Workers Launched"]
+
+    for child in node.get("Plans", []):
+        launched = find_workers_launched(child)
+        if launched is not None:
+            return launched
+
+    return 0
+
+# Main execution
+connection = psycopg2.connect(**db_params)
+connection.autocommit = True
+try:
+    cursor = connection.cursor()
+    populate(cursor)
+
+    for name, query in queries.items():
+        baseline = None
+        print(f"\n{name} ({games_count} games)")
+        print("workers  launched  time (ms)  speedup")
+
+        for workers in worker_steps:
+            elapsed, launched = time_query(cursor, query, workers)
+            baseline = baseline or elapsed
+            print(f"{workers:7}  {launched:8}  {elapsed:9.1f}  {baseline / elapsed:6.2f}x")
+finally:
+    connection.close()
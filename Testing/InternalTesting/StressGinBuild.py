@@ -0,0 +1,120 @@
+import chess
+import random
+import sys
+import psycopg2
+import psycopg2.extras
+
+# Database connection parameters
+db_params = {
+    "dbname": "ExtensionTest",
+    "user": "postgres",
+    "password": "1122",
+    "host": "localhost",  # The backend memory is read from /proc, so the server must run on this host
+    "port": "5432"
+}
+
+# Number of games to index (first argument), inserted in batches
+games_count = int(sys.argv[1]) if len(sys.argv) > 1 else 1000000
+batch_size = 10000
+
+# Fractions of the table indexed at each step, and of the games scanned with '@>'
+index_steps = [0.01, 0.1, 1.0]
+scan_steps = [100, 1000]
+
+# Allowed growth of the peak memory between the first and the last step
+tolerance = 1.25
+slack_kb = 16 * 1024
+
+def generate_long_game():
+    board = chess.Board()
+    moves = []
+
+    # Long games: 100 to 200 moves, unless the game ends before
+    max_plies = random.randint(200, 400)
+
+    while not board.is_game_over(claim_draw=True) and len(moves) < max_plies:
+        move = random.choice(list(board.legal_moves))
+        if board.turn == chess.WHITE:
+            moves.append(f"{board.fullmove_number}. {board.san(move)}")
+        else:
+            moves.append(board.san(move))
+        board.push(move)
+
+    return ' '.join(moves)
+
+def populate(connection):
+    cursor = connection.cursor()
+    cursor.execute("DROP TABLE IF EXISTS stress_games")
+    cursor.execute("CREATE TABLE stress_games (id serial PRIMARY KEY, game_notation SAN)")
+
+    inserted = 0
+    while inserted < games_count:
+        count = min(batch_size, games_count - inserted)
+        games = [(generate_long_game(),) for _ in range(count)]
+        psycopg2.extras.execute_values(cursor, "INSERT INTO stress_games (game_notation) VALUES %s", games, page_size=1000)
+        connection.commit()
+        inserted += count
+        print(f"{inserted} games inserted.")
+
+def backend_peak_kb(cursor):
+    # Peak resident memory of the backend serving the cursor (VmHWM)
+    cursor.execute("SELECT pg_backend_pid()")
+    pid = cursor.fetchone()[0]
+
+    with open(f"/proc/{pid}/status") as status:
+        for line in status:
+            if line.startswith("VmHWM:"):
+                return int(line.split()[1])
+
+    raise RuntimeError(f"Cannot read the peak memory of backend {pid}")
+
+def measure(statement):
+    # Each measure runs in a new backend, so that its peak only covers the statement
+    connection = psycopg2.connect(**db_params)
+    try:
+        cursor = connection.cursor()
+        cursor.execute("SET maintenance_work_mem = '64MB'")
+        cursor.execute("SET max_parallel_workers_per_gather = 0")
+        baseline = backend_peak_kb(cursor)
+        cursor.execute(statement)
+        connection.commit()
+        return backend_peak_kb(cursor) - baseline
+    finally:
+        connection.close()
+
+def check_flat(name, peaks):
+    first, last = peaks[0][1], peaks[-1][1]
+    for size, peak in peaks:
+        print(f"{name}: {size} games, peak backend memory +{peak} kB")
+
+    if last > first * tolerance + slack_kb:
+        print(f"{name}: peak memory grows with the number of games ({first} kB -> {last} kB)")
+        return False
+
+    return True
+
+# Main execution
+connection = psycopg2.connect(**db_params)
+try:
+    populate(connection)
+finally:
+    connection.close()
+
+index_peaks = []
+for fraction in index_steps:
+    size = int(games_count * fraction)
+    index_peaks.append((size, measure(
+        "CREATE INDEX stress_games_gin ON stress_games USING gin (game_notation san_gin_ops) "
+        f"WHERE id <= {size}")))
+    measure("DROP INDEX stress_games_gin")
+
+scan_peaks = []
+for size in scan_steps:
+    scan_peaks.append((size, measure(
+        "SELECT count(*) FROM stress_games WHERE id <= "
+        f"{size} AND game_notation @> 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1'")))
+
+ok = check_flat("CREATE INDEX", index_peaks)
+ok = check_flat("@> scan", scan_peaks) and ok
+
+sys.exit(0 if ok else 1)
@@ -49,6 +49,14 @@ INSERT INTO test_chess_board (gameboard) VALUES ('rnbqkbnr/pp1ppppp/8/2p5/4P3/8/
 -- Read form the table
 SELECT * FROM test_chess_board;
 
+-- Invalid FEN strings are rejected with the position of the error
+INSERT INTO test_chess_board (gameboard) VALUES ('rnbqkbnr/pppppppp/7/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1');
+-- Expected Result : ERROR, 'Rank 6 has 7 squares instead of 8 at position 20.'
+INSERT INTO test_chess_board (gameboard) VALUES ('rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq e3 0 1');
+-- Expected Result : ERROR, 'The en passant square must be "-" or a square of rank 6 at position 52.'
+INSERT INTO test_chess_board (gameboard) VALUES ('rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQQBNR w KQkq - 0 1');
+-- Expected Result : ERROR, 'White has 0 kings instead of 1 at position 1.'
+
 -- Clean up
 DROP TABLE test_chess_board;
 ------------------------------------------------------------------------------------------------------------------------
@@ -58,6 +66,56 @@ DROP TABLE test_chess_board;
 
 
 
+------------------------------------------------------------------------------------------------------------------------
+---------------------------------------PGN Data type testing inserting/reading------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+--  Table for PGN games, with their header tags
+CREATE TABLE pgn_games (
+    id serial PRIMARY KEY,
+    game PGN
+);
+
+INSERT INTO pgn_games (game) VALUES
+(E'[Event "Tata Steel"]\n[White "Carlsen, Magnus"]\n[Black "Caruana, Fabiano"]\n[WhiteElo "2835"]\n[Result "1-0"]\n\n1. e4 e5 2. Nf3 Nc6\n3. Bb5 a6 1-0'),
+(E'[Event "Casual \\"blitz\\""]\n[White "Anand"]\n\n1. d4 d5 2. c4 e6 *'),
+('1. e4 c5 2. Nf3 d6');
+
+-- Tags are output in input order, with the movetext on one line
+SELECT game FROM pgn_games WHERE id = 1;
+-- Expected Result : [Event "Tata Steel"] ... [Result "1-0"], blank line, '1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 1-0'
+
+SELECT id, pgn_tag(game, 'White'), pgn_tag(game, 'WhiteElo')::integer, pgn_result(game), ply_count(game)
+FROM pgn_games ORDER BY id;
+-- Expected Result : 1 | Carlsen, Magnus | 2835 | 1-0 | 6
+--                   2 | Anand           |      | *   | 4
+--                   3 |                 |      | *   | 4
+
+SELECT pgn_tag(game, 'Event') FROM pgn_games WHERE id = 2;
+-- Expected Result : Casual "blitz"
+
+-- PGN values are accepted wherever SAN is
+SELECT id FROM pgn_games WHERE game @> 'r1bqkbnr/1ppp1ppp/p1n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 0 4';
+-- Expected Result : 1
+
+SELECT get_FirstMoves(game, 2) FROM pgn_games WHERE id = 3;
+-- Expected Result : 1. e4 c5
+
+SELECT ply_count('1. e4 e5 2. Nf3'::SAN::PGN);
+-- Expected Result : 3
+
+INSERT INTO pgn_games (game) VALUES (E'[Event "a"]\n[Event "b"]\n1. e4');
+-- Expected Result : ERROR, 'Duplicate tag "Event".'
+
+-- Clean up
+DROP TABLE pgn_games;
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
 
 ------------------------------------------------------------------------------------------------------------------------
 -----------------------------------------has opening functions test-----------------------------------------------------
@@ -206,6 +264,18 @@ SELECT get_board_state('1. e4 e5 2. Nf3 Nc6 3. Bc4 Bc5 4. b4 Bxb4 5. c3 Bc5 ', 1
 select get_board_state(game_notation, 2) FROM favorite_games WHERE id = 1;
 -- Expected Result : 'rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2'
 
+SELECT get_board_state('1. e4 Nf6 2. e5 d5', 4);
+-- Expected Result : 'rnbqkb1r/ppp1pppp/5n2/3pP3/8/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 3'
+
+SELECT get_board_state('1. e4 e5 2. Nf3 Nc6 3. Bc4 Bc5 4. O-O Nf6 5. Re1 O-O', 10);
+-- Expected Result : 'r1bq1rk1/pppp1ppp/2n2n2/2b1p3/2B1P3/5N2/PPPP1PPP/RNBQR1K1 w - - 8 6'
+
+SELECT get_board_state('1. h4 g5 2. hxg5 h5 3. gxh6 Nf6 4. h7 Ng8 5. hxg8=N', 9);
+-- Expected Result : 'rnbqkbNr/pppppp2/8/8/8/8/PPPPPPP1/RNBQKBNR b KQkq - 0 5'
+
+SELECT get_board_state('1. d4 e6 2. e3 Bb4+ 3. Nc3 a6 4. Ne2', 7);
+-- Expected Result : 'rnbqk1nr/1ppp1ppp/p3p3/8/1b1P4/2N1P3/PPP1NPPP/R1BQKB1R b KQkq - 1 4'
+
 
 -- Clean up
 DROP TABLE favorite_games;
@@ -221,11 +291,16 @@ DROP TABLE favorite_games;
 ------------------------------------------------------------------------------------------------------------------------
 
 SELECT has_board('Invalid SAN string', 'invalid FEN string', 5);
--- Expected Result :  'failed to parse FEN string: invalid FEN string'
+-- Expected Result :  'invalid FEN representation: "invalid FEN string"'
 
 SELECT has_board('1. e4 c5 2. Nf3 d6 3. d4 cxd4 4. Nxd4 Nf6 5. Nc3 a6', 'rnbqkb1r/1p2pppp/p2p1n2/8/3NP3/2N5/PPP2PPP/R1BQKB1R b KQkq - 0 5', 10);
 -- Expected Result : 'true'
 
+-- The operators read the moves as the index keys are extracted, move numbers attached to moves included
+SELECT '1.e4 e5 2.Nf3'::san @> 'rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2'::fen,
+       '1.e4 e5 2.Nf3'::san = 'rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2'::fen;
+-- Expected Result : 'true', 'true'
+
 ------------------------------------------------------------------------------------------------------------------------
 ------------------------------------------------------------------------------------------------------------------------
 ------------------------------------------------------------------------------------------------------------------------
@@ -270,6 +345,43 @@ WHERE has_board(game,
 
 
 
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------Binary COPY--------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+CREATE TABLE copy_games (
+    id integer,
+    game_notation SAN
+);
+
+INSERT INTO copy_games VALUES
+(1, '1. e4 e5 2. Nf3 Nc6 3. Bb5 a6'),
+(2, '1. d4 d5 2. c4 e6 3. Nc3 Nf6');
+
+-- The binary form is the one written by the pgn2copy tool
+COPY copy_games TO '/tmp/chess_copy_games.bin' WITH (FORMAT binary);
+
+CREATE TABLE copy_games_loaded (LIKE copy_games);
+
+COPY copy_games_loaded FROM '/tmp/chess_copy_games.bin' WITH (FORMAT binary);
+
+SELECT count(*) FROM copy_games JOIN copy_games_loaded USING (id)
+WHERE copy_games.game_notation = copy_games_loaded.game_notation;
+-- Expected Result : 2
+
+SELECT game_notation FROM copy_games_loaded WHERE id = 2;
+-- Expected Result : '1. d4 d5 2. c4 e6 3. Nc3 Nf6'
+
+DROP TABLE copy_games, copy_games_loaded;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
 ------------------------------------------------------------------------------------------------------------------------
 -----------------------------------------------------B-Tree Index-------------------------------------------------------
 ------------------------------------------------------------------------------------------------------------------------
@@ -374,10 +486,984 @@ WHERE  has_board(game_notation::san, 'r1br2k1/pp2bppp/1qnppn2/6B1/4P3/1NN2P2/PPP
 
 select get_board_state('insert a san here', 10)
 
+INSERT INTO favorite_games(game_notation) VALUES
+('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6'),
+('1. d4 d5 2. c4 e6 3. Nc3 Nf6'),
+('1. e4 c5 2. Nf3 d6 3. d4 cxd4');
+
+-- Multi-position queries
+SELECT id FROM favorite_games
+WHERE game_notation @> ARRAY['rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1',
+                             'rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2']::fen[];
+-- Expected Result : 3
+
+SELECT id FROM favorite_games
+WHERE game_notation && ARRAY['rnbqkbnr/pppppppp/8/8/3P4/8/PPP1PPPP/RNBQKBNR b KQkq - 0 1',
+                             'rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2']::fen[] ORDER BY id;
+-- Expected Result : 2, 3
+
+SELECT count(*) FROM favorite_games WHERE game_notation @> ARRAY[]::fen[];
+-- Expected Result : 3
+
+SELECT count(*) FROM favorite_games WHERE game_notation && ARRAY[]::fen[];
+-- Expected Result : 0
+
+SELECT count(*) FROM favorite_games
+WHERE game_notation = 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1'::fen;
+-- Expected Result : 3
+
+-- Ordered position sequences
+SELECT id FROM favorite_games
+WHERE game_notation @>> ARRAY['rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1',
+                              'r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3']::fen[];
+-- Expected Result : 1
+
+SELECT count(*) FROM favorite_games
+WHERE game_notation @>> ARRAY['r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3',
+                              'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1']::fen[];
+-- Expected Result : 0
+
+SELECT reaches_in_order_plies('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6',
+                              ARRAY['rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1',
+                                    'r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3']::fen[]);
+-- Expected Result : {1,4}
+
+-- Ply-bounded position search
+SELECT id FROM favorite_games
+WHERE reaches_between(game_notation, 'r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3', 2, 6);
+-- Expected Result : 1
+
+SELECT count(*) FROM favorite_games
+WHERE reaches_between(game_notation, 'r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3', 5, 20);
+-- Expected Result : 0
+
+EXPLAIN SELECT id FROM favorite_games
+WHERE reaches_between(game_notation, 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1', 0, 10);
+-- Expected Result : Bitmap Index Scan on idx_chessgame_board_states
+
+SELECT first_ply_of('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6', 'r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3');
+-- Expected Result : 4
+
+SELECT first_ply_of('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6', 'rnbqkbnr/pppppppp/8/8/3P4/8/PPP1PPPP/RNBQKBNR b KQkq - 0 1');
+-- Expected Result : NULL
+
+SELECT has_board_many('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6', ARRAY['r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3',
+                                                          'rnbqkbnr/pppppppp/8/8/3P4/8/PPP1PPPP/RNBQKBNR b KQkq - 0 1',
+                                                          'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1',
+                                                          'r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3']::FEN[]);
+-- Expected Result : {4,NULL,0,4}
+
+SELECT has_board_many('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6', ARRAY[]::FEN[]);
+-- Expected Result : {}
+
+SELECT 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 [0,10]'::fenwindow;
+-- Expected Result : 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 [0,10]'
+
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------GIN Index Options--------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+CREATE TABLE gin_option_games (
+    id serial PRIMARY KEY,
+    game_notation SAN
+);
+
+INSERT INTO gin_option_games(game_notation) VALUES
+('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6'),
+('1. d4 d5 2. c4 e6 3. Nc3 Nf6'),
+('1. Nf3 Nf6 2. Rg1 Rg8 3. Rh1 Rh8 4. Ng1 Ng8 5. e4');
+
+-- '@=' also compares the side to move, the castling rights and the en passant square
+SELECT has_exact_board('1. Nf3 Nf6 2. Rg1 Rg8 3. Rh1 Rh8 4. Ng1 Ng8 5. e4', 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1');
+-- Expected Result : false
+
+SELECT has_exact_board('1. Nf3 Nf6 2. Rg1 Rg8 3. Rh1 Rh8 4. Ng1 Ng8 5. e4', 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b Qq - 0 5');
+-- Expected Result : true
+
+SET enable_seqscan = off;
+
+CREATE INDEX idx_gin_option_games ON gin_option_games USING gin (game_notation san_gin_ops(key = 'full'));
+
+SELECT id FROM gin_option_games WHERE game_notation @= 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1';
+-- Expected Result : 1
+
+EXPLAIN SELECT id FROM gin_option_games WHERE game_notation @= 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1';
+-- Expected Result : Bitmap Index Scan on idx_gin_option_games
+
+-- Piece placements are rechecked on every game of a 'full' index
+SELECT id FROM gin_option_games WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1'::fen ORDER BY id;
+-- Expected Result : 1, 3
+
+DROP INDEX idx_gin_option_games;
+
+CREATE INDEX idx_gin_option_games ON gin_option_games USING gin (game_notation san_gin_ops(max_ply = 4));
+
+-- Game 3 reaches the position after the indexed half-moves: searches without a window scan the whole index
+SELECT id FROM gin_option_games WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1'::fen ORDER BY id;
+-- Expected Result : 1, 3
+
+SELECT id FROM gin_option_games WHERE reaches_between(game_notation, 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1', 0, 2);
+-- Expected Result : 1
+
+DROP INDEX idx_gin_option_games;
+
+CREATE INDEX idx_gin_option_games ON gin_option_games USING gin (game_notation san_gin_ops(skip_first = 2));
+
+SELECT count(*) FROM gin_option_games WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1'::fen;
+-- Expected Result : 3
+
+SELECT id FROM gin_option_games WHERE reaches_between(game_notation, 'r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3', 2, 10);
+-- Expected Result : 1
+
+SET enable_seqscan = on;
+
+DROP TABLE gin_option_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------Move n-grams GIN Index--------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+CREATE TABLE moves_games (
+    id serial PRIMARY KEY,
+    game_notation SAN
+);
+
+INSERT INTO moves_games(game_notation) VALUES
+('1. e4 e5 2. Nf3 Nc6 3. Bc4 Nf6 4. Ng5 d5 5. exd5 Nxd5 6. Nxf7'),
+('1. d4 Nf6 2. c4 e6 3. Nc3 Bb4 {Nimzo-Indian} 4. e3 O-O 5. Bd3 d5 6. Nf3 c5 7. O-O Nc6 8. Bxh7+'),
+('1. e4 c5 2. Nf3 (2. Nc3 Nc6) 2... d6 3. d4 cxd4');
+
+CREATE INDEX idx_moves_games ON moves_games USING gin (game_notation san_moves_gin_ops);
+
+SET enable_seqscan = off;
+
+SELECT id FROM moves_games WHERE game_notation LIKE '%Bxh7+%';
+-- Expected Result : 2
+
+SELECT id FROM moves_games WHERE game_notation LIKE '% Nf3 Nc6 %';
+-- Expected Result : 1
+
+SELECT id FROM moves_games WHERE game_notation @@ 'Nf3 Nc6 3. Bc4';
+-- Expected Result : 1
+
+SELECT id FROM moves_games WHERE game_notation @@ '2. Nf3 d6';
+-- Expected Result : 3 (the variation 2. Nc3 is skipped)
+
+SELECT count(*) FROM moves_games WHERE game_notation @@ 'Nc3 Nc6';
+-- Expected Result : 0 (moves of variations are not part of the game)
+
+SELECT count(*) FROM moves_games WHERE game_notation LIKE '%Nc3 Nc6%';
+-- Expected Result : 1 (LIKE matches the raw text)
+
+EXPLAIN SELECT id FROM moves_games WHERE game_notation LIKE '%Bxh7+%';
+-- Expected Result : Bitmap Index Scan on idx_moves_games
+
+SET enable_seqscan = on;
+
+DROP TABLE moves_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------------GiST Index---------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+CREATE TABLE gist_games (
+    id serial PRIMARY KEY,
+    game_notation SAN
+);
+
+INSERT INTO gist_games(game_notation) VALUES
+('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6'),
+('1. d4 d5 2. c4 e6 3. Nc3 Nf6'),
+('1. e4 c5 2. Nf3 d6 3. d4 cxd4');
+
+CREATE INDEX idx_gist_games ON gist_games USING gist (game_notation san_gist_ops);
+
+SET enable_seqscan = off;
+
+SELECT id FROM gist_games
+WHERE game_notation @> 'r1bqkbnr/pppp1ppp/2n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R b KQkq - 3 3'::fen;
+-- Expected Result : 1
+
+SELECT count(*) FROM gist_games
+WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1'::fen;
+-- Expected Result : 3
+
+EXPLAIN SELECT id FROM gist_games
+WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/3P4/8/PPP1PPPP/RNBQKBNR b KQkq - 0 1'::fen;
+-- Expected Result : Bitmap Index Scan on idx_gist_games
+
+SET enable_seqscan = on;
+
+DROP TABLE gist_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------------BRIN Bloom Index---------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+CREATE TABLE brin_games (
+    id serial PRIMARY KEY,
+    game_notation SAN
+);
+
+INSERT INTO brin_games(game_notation) VALUES
+('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6'),
+('1. d4 d5 2. c4 e6 3. Nc3 Nf6'),
+('1. e4 c5 2. Nf3 d6 3. d4 cxd4');
+
+CREATE INDEX idx_brin_games ON brin_games USING brin (game_notation san_brin_bloom_ops(positions_per_range = 256, false_positive_rate = 0.05))
+WITH (pages_per_range = 1);
+
+SET enable_seqscan = off;
+
+SELECT id FROM brin_games
+WHERE game_notation @> 'r1bqkbnr/pppp1ppp/2n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R b KQkq - 3 3'::fen;
+-- Expected Result : 1
+
+SELECT count(*) FROM brin_games
+WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/3P4/8/PPP1PPPP/RNBQKBNR b KQkq - 0 1'::fen;
+-- Expected Result : 1
+
+EXPLAIN SELECT id FROM brin_games
+WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/3P4/8/PPP1PPPP/RNBQKBNR b KQkq - 0 1'::fen;
+-- Expected Result : Bitmap Index Scan on idx_brin_games
+
+SET enable_seqscan = on;
+
+-- Without positions_per_range, the filters are sized for pages_per_range
+CREATE INDEX idx_brin_games_default ON brin_games USING brin (game_notation san_brin_bloom_ops) WITH (pages_per_range = 2);
+DROP INDEX idx_brin_games_default;
+
+-- Options whose filter does not fit on an index page are rejected, even on an empty table
+CREATE TABLE brin_games_empty (game_notation SAN);
+
+CREATE INDEX idx_brin_games_too_large ON brin_games_empty USING brin (game_notation san_brin_bloom_ops(positions_per_range = 20000));
+-- Expected Result : ERROR:  the bloom filter is too large: positions_per_range 20000 exceeds 6787 at false_positive_rate 0.01 (with 8kB pages)
+
+CREATE INDEX idx_brin_games_too_large ON brin_games_empty USING brin (game_notation san_brin_bloom_ops(positions_per_range = 20000, false_positive_rate = 0.25));
+-- Expected Result : CREATE INDEX
+
+DROP TABLE brin_games_empty;
+DROP TABLE brin_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------Similar Games (KNN)------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+SELECT '1. e4 e5 2. Nf3 Nc6 3. Bb5'::san <-> '1.e4 e5 2.Nf3 {main line} Nc6 3. Bb5+';
+-- Expected Result : 0
+
+SELECT round(('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6'::san <-> '1. e4 e5 2. Nf3 Nc6 3. Bb5 Nf6')::numeric, 3);
+-- Expected Result : 1.167
+
+CREATE TABLE knn_games (
+    id serial PRIMARY KEY,
+    game_notation SAN
+);
+
+INSERT INTO knn_games(game_notation) VALUES
+('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6'),
+('1. d4 d5 2. c4 e6 3. Nc3 Nf6'),
+('1. e4 c5 2. Nf3 d6 3. d4 cxd4'),
+('1. e4 e5 2. Nf3 Nc6 3. Bc4 Bc5');
+
+CREATE INDEX idx_knn_games ON knn_games USING gist (game_notation san_moves_gist_ops);
+
+SET enable_seqscan = off;
+
+SELECT id FROM knn_games
+ORDER BY game_notation <-> '1. e4 e5 2. Nf3 Nc6 3. Bb5 Nf6'
+LIMIT 3;
+-- Expected Result : 1, 4, 3
+
+EXPLAIN SELECT id FROM knn_games
+ORDER BY game_notation <-> '1. e4 e5 2. Nf3 Nc6 3. Bb5 Nf6'
+LIMIT 3;
+-- Expected Result : Index Scan using idx_knn_games, Order By: (game_notation <-> ...)
+
+SET enable_seqscan = on;
+
+DROP TABLE knn_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------Nearest Positions (KNN)--------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+SELECT 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1'::fen <-> 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR b KQkq - 0 5'::fen;
+-- Expected Result : 0
+
+SELECT 'rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1'::fen <-> 'rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2'::fen;
+-- Expected Result : 4
+
+CREATE TABLE knn_positions (
+    id serial PRIMARY KEY,
+    board FEN
+);
+
+INSERT INTO knn_positions(board)
+SELECT get_board_state('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 4. Ba4 Nf6 5. O-O Be7', n)
+FROM generate_series(0, 10) AS n;
+
+CREATE INDEX idx_knn_positions ON knn_positions USING gist (board);
+
+SET enable_seqscan = off;
+
+SELECT id FROM knn_positions
+ORDER BY board <-> 'r1bqkb1r/pppp1ppp/2n2n2/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4'
+LIMIT 1;
+-- Expected Result : 6
+
+SELECT board <-> 'r1bqkb1r/pppp1ppp/2n2n2/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4' AS distance
+FROM knn_positions
+ORDER BY board <-> 'r1bqkb1r/pppp1ppp/2n2n2/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4'
+LIMIT 3;
+-- Expected Result : 2, 4, 4
+
+EXPLAIN SELECT id FROM knn_positions
+ORDER BY board <-> 'r1bqkb1r/pppp1ppp/2n2n2/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4'
+LIMIT 3;
+-- Expected Result : Index Scan using idx_knn_positions, Order By: (board <-> ...)
+
+SET enable_seqscan = on;
+
+DROP TABLE knn_positions;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------Game Fingerprint---------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+SELECT game_fingerprint('1. e4 e5 2. Nf3 Nc6 3. Bb5') = game_fingerprint('1.e4 e5  2.Nf3 {main line} Nc6 3. Bb5+!');
+-- Expected Result : true
+
+SELECT game_fingerprint('1. e4 e5 2. Nf3 Nc6 (2... d6) 3. O-O') = game_fingerprint('1. e4 e5 2. Nf3 Nc6 3. 0-0');
+-- Expected Result : true
+
+SELECT game_fingerprint('1. e4 e5 2. Nf3 Nc6') = game_fingerprint('1. e4 e5 2. Nf3 Nf6');
+-- Expected Result : false
+
+CREATE TABLE feed_games (
+    id serial PRIMARY KEY,
+    game_notation SAN
+);
+
+CREATE UNIQUE INDEX feed_games_fingerprint_idx ON feed_games (game_fingerprint(game_notation));
+
+INSERT INTO feed_games(game_notation) VALUES ('1. d4 d5 2. c4 e6 3. Nc3 Nf6')
+ON CONFLICT ((game_fingerprint(game_notation))) DO NOTHING;
+
+INSERT INTO feed_games(game_notation) VALUES ('1.d4 d5 2.c4 e6 {QGD} 3.Nc3 Nf6')
+ON CONFLICT ((game_fingerprint(game_notation))) DO NOTHING;
+
+SELECT count(*) FROM feed_games;
+-- Expected Result : 1
+
+DROP TABLE feed_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+
+
 
 ------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------ECO Classification-------------------------------------------------------
 ------------------------------------------------------------------------------------------------------------------------
+
+SELECT eco_code('1. e4 c5 2. Nf3 d6 3. d4 cxd4 4. Nxd4 Nf6 5. Nc3 a6 6. Be3 e5'),
+       eco_name('1. e4 c5 2. Nf3 d6 3. d4 cxd4 4. Nxd4 Nf6 5. Nc3 a6 6. Be3 e5');
+-- Expected Result : B90 | Sicilian Defense: Najdorf Variation
+
+SELECT eco_code('1.e4 e6 2.d4 d5 3.Nc3 Bb4 {Winawer} 4.e5');
+-- Expected Result : C15
+
+-- Transposition: the moves leave the table after 1. Nf3 Nf6, the position is the Queen's Indian Defense
+SELECT eco_code('1. Nf3 Nf6 2. c4 e6 3. d4 b6 4. g3'), eco_name('1. Nf3 Nf6 2. c4 e6 3. d4 b6 4. g3');
+-- Expected Result : E12 | Queen's Indian Defense
+
+SELECT eco_code('1. h4 e5');
+-- Expected Result : NULL
+
+CREATE TABLE eco_games (
+    id serial PRIMARY KEY,
+    game_notation SAN,
+    eco text GENERATED ALWAYS AS (eco_code(game_notation)) STORED
+);
+
+INSERT INTO eco_games(game_notation) VALUES
+('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 4. Ba4 Nf6 5. O-O Be7 6. Re1 b5'),
+('1. d4 d5 2. c4 c6 3. Nf3 Nf6'),
+('1. c4 e5 2. Nc3 Nf6');
+
+SELECT id, eco FROM eco_games ORDER BY id;
+-- Expected Result : 1 | C84, 2 | D10, 3 | A20
+
+DROP TABLE eco_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+
+
+
 ------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------Opening Buckets----------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+-- The bucket depends only on the first half-moves, not on the formatting
+SELECT opening_bucket('1. e4 c5 2. Nf3 d6', 2) = opening_bucket('1.e4 c5+ 2. Nc3', 2);
+-- Expected Result : true
+
+SELECT opening_bucket('1. e4 c5 2. Nf3 d6', 2) = opening_bucket('1. e4 e5 2. Nf3 Nc6', 2);
+-- Expected Result : false
+
+-- Games shorter than the depth hash all their moves
+SELECT opening_bucket('1. e4', 2) = opening_bucket('1. e4 c5', 1);
+-- Expected Result : true
+
+CREATE TABLE games_by_opening (
+  id serial,
+  game_notation SAN
+) PARTITION BY LIST (opening_bucket(game_notation, 2));
+
+CREATE TABLE games_sicilian PARTITION OF games_by_opening FOR VALUES IN (opening_bucket('1. e4 c5', 2));
+CREATE TABLE games_open PARTITION OF games_by_opening FOR VALUES IN (opening_bucket('1. e4 e5', 2));
+CREATE TABLE games_other_openings PARTITION OF games_by_opening DEFAULT;
+
+INSERT INTO games_by_opening(game_notation) VALUES
+('1. e4 c5 2. Nf3 d6 3. d4 cxd4 4. Nxd4 Nf6 5. Nc3 a6'),
+('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6'),
+('1. d4 d5 2. c4 e6 3. Nc3 Nf6'),
+('1. e4 c5 2. Nc3 Nc6');
+
+SET chess.opening_bucket_depth = 2;
+
+EXPLAIN (COSTS OFF)
+SELECT id FROM games_by_opening
+WHERE has_opening(game_notation, '1. e4 c5 2. Nf3');
+-- Expected Result : Seq Scan on games_sicilian only
+
+SELECT id FROM games_by_opening
+WHERE has_opening(game_notation, '1. e4 c5 2. Nf3')
+ORDER BY id;
+-- Expected Result : 1
+
+-- 'R1' could be the start of 'R1e2': the last move is not used for pruning
+EXPLAIN (COSTS OFF)
+SELECT id FROM games_by_opening
+WHERE has_opening(game_notation, '1. e4 R1');
+-- Expected Result : Append over the three partitions
+
+RESET chess.opening_bucket_depth;
+
+EXPLAIN (COSTS OFF)
+SELECT id FROM games_by_opening
+WHERE has_opening(game_notation, '1. e4 c5 2. Nf3');
+-- Expected Result : Append over the three partitions
+
+DROP TABLE games_by_opening;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------Live Games---------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+CREATE TABLE live_games (
+  id serial PRIMARY KEY,
+  game_notation SAN
+);
+
+INSERT INTO live_games(game_notation) VALUES ('1. e4 e5 2. Nf3');
+
+-- Move numbers are added as needed
+UPDATE live_games SET game_notation = game_notation || 'Nc6';
+UPDATE live_games SET game_notation = game_notation || 'Bb5';
+
+SELECT game_notation FROM live_games;
+-- Expected Result : 1. e4 e5 2. Nf3 Nc6 3. Bb5
+
+-- Read from the stored final position, without replaying the game
+SELECT current_board(game_notation) FROM live_games;
+-- Expected Result : r1bqkbnr/pppp1ppp/2n5/1B2p3/4P3/5N2/PPPP1PPP/RNBQK2R b KQkq - 3 3
+
+SELECT current_board('1. e4 e5 2. Nf3');
+-- Expected Result : rnbqkbnr/pppp1ppp/8/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2
+
+SELECT san_append('1. e4 e5', '2. Nf3 Nc6 3. Bb5+');
+-- Expected Result : 1. e4 e5 2. Nf3 Nc6 3. Bb5+
+
+SELECT san_append('1. e4 {Best by test}', 'e5 Nf3');
+-- Expected Result : 1. e4 {Best by test} 1... e5 2. Nf3
+
+-- Only the new moves are checked
+UPDATE live_games SET game_notation = game_notation || 'Ke3';
+-- Expected Result : ERROR: san_append: illegal move "Ke3"
+
+SELECT san_append('1. f3 e5 2. g4', 'Qh4# 0-1');
+-- Expected Result : 1. f3 e5 2. g4 Qh4# 0-1
+
+SELECT san_append('1. f3 e5 2. g4 Qh4# 0-1', 'Kf2');
+-- Expected Result : ERROR: san_append: the game is over
+
+DROP TABLE live_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------Board Checkpoints--------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+SET chess.san_checkpoint_interval = 4;
+
+CREATE TABLE checkpointed_games (
+  id serial PRIMARY KEY,
+  game_notation SAN
+);
+
+INSERT INTO checkpointed_games(game_notation) VALUES
+('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 4. Ba4 Nf6 5. O-O Be7'),
+('1. e4 {King pawn} e5 2. Nf3');
+
+RESET chess.san_checkpoint_interval;
+
+-- Read from the header of the values
+SELECT id, ply_count(game_notation) FROM checkpointed_games ORDER BY id;
+-- Expected Result : (1, 10), (2, 3)
+
+SELECT chess_stats_reset();
+
+-- Replayed from the position after 8 half-moves
+SELECT get_board_state(game_notation, 9) FROM checkpointed_games WHERE id = 1;
+-- Expected Result : r1bqkb1r/1ppp1ppp/p1n2n2/4p3/B3P3/5N2/PPPP1PPP/RNBQ1RK1 b kq - 3 5
+
+SELECT name, value FROM chess_stats()
+WHERE scope = 'backend' AND name IN ('replays', 'plies_replayed', 'cache_hits');
+-- Expected Result : replays = 0, plies_replayed = 1, cache_hits = 1
+
+SELECT get_board_state(game_notation, 11) FROM checkpointed_games WHERE id = 1;
+-- Expected Result : ERROR: get_board_state: Game is incomplete or shorter than the requested number of half-moves
+
+-- Games with comments are stored without checkpoints and replayed
+SELECT get_board_state(game_notation, 3) FROM checkpointed_games WHERE id = 2;
+-- Expected Result : rnbqkbnr/pppp1ppp/8/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2
+
+-- Appending past the longest game fails before the checkpoints are extended
+SET chess.san_checkpoint_interval = 4;
+SELECT '1. Nf3'::san || repeat(' Nf6 Ng1 Ng8 Nf3', 300);
+-- Expected Result : ERROR: san_append: the game is too long
+RESET chess.san_checkpoint_interval;
+
+SELECT chess_stats_reset();
+DROP TABLE checkpointed_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
 
 
 
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------Variations---------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+CREATE TABLE annotated_games (
+  id serial PRIMARY KEY,
+  game_notation SAN
+);
+
+INSERT INTO annotated_games(game_notation) VALUES
+('1. e4 e5 (1... c5 2. Nf3 (2. Nc3 Nc6) d6) 2. Nf3 Nc6 3. Bb5 a6'),
+('1. e4 c5 2. Nc3 Nc6'),
+('1. d4 d5 (1... Nf6 {Indian (any)}) 2. c4');
+
+-- Nested variations are skipped as a whole
+SELECT ply_count(game_notation) FROM annotated_games WHERE id = 1;
+-- Expected Result : 6
+
+SELECT get_board_state(game_notation, 3) FROM annotated_games WHERE id = 1;
+-- Expected Result : rnbqkbnr/pppp1ppp/8/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R b KQkq - 1 2
+
+SELECT * FROM game_variations((SELECT game_notation FROM annotated_games WHERE id = 1));
+-- Expected Result :
+-- line | parent | ply | moves
+--    0 |        |   0 | e4 e5 Nf3 Nc6 Bb5 a6
+--    1 |      0 |   1 | c5 Nf3 d6
+--    2 |      1 |   2 | Nc3 Nc6
+
+-- The Sicilian is only reached in the side lines of game 1
+SELECT id FROM annotated_games WHERE game_notation @> 'rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2'::fen ORDER BY id;
+-- Expected Result : 2
+
+SELECT id FROM annotated_games WHERE game_notation @@> 'rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2'::fen ORDER BY id;
+-- Expected Result : 1, 2
+
+SET enable_seqscan = off;
+
+CREATE INDEX idx_annotated_games ON annotated_games USING gin (game_notation san_gin_ops(variations = true));
+
+SELECT id FROM annotated_games WHERE game_notation @@> 'r1bqkbnr/pp1ppppp/2n5/2p5/4P3/2N5/PPPP1PPP/R1BQKBNR w KQkq - 2 3'::fen ORDER BY id;
+-- Expected Result : 1, 2
+
+EXPLAIN SELECT id FROM annotated_games WHERE game_notation @@> 'r1bqkbnr/pp1ppppp/2n5/2p5/4P3/2N5/PPPP1PPP/R1BQKBNR w KQkq - 2 3'::fen;
+-- Expected Result : Bitmap Index Scan on idx_annotated_games
+
+-- The side line keys are not looked up by the mainline operators
+SELECT id FROM annotated_games WHERE game_notation @> 'rnbqkb1r/pppppppp/5n2/8/3P4/8/PPP1PPPP/RNBQKBNR w KQkq - 1 2'::fen ORDER BY id;
+-- Expected Result : (no rows)
+
+SELECT id FROM annotated_games WHERE game_notation @@> 'rnbqkb1r/pppppppp/5n2/8/3P4/8/PPP1PPPP/RNBQKBNR w KQkq - 1 2'::fen ORDER BY id;
+-- Expected Result : 3
+
+SET enable_seqscan = on;
+
+DROP TABLE annotated_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------Opening Dictionary-------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+-- The lines stay in the append-only dictionary, so a rerun keeps them
+INSERT INTO chess_opening_dict(id, prefix) VALUES
+(1, '1. e4 e5 2. Nf3 Nc6 3. Bb5'),
+(2, '1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 4. Ba4 Nf6 5. O-O Be7')
+ON CONFLICT (id) DO NOTHING;
+
+CREATE TABLE dict_games (
+    id serial PRIMARY KEY,
+    game_notation SAN
+);
+
+SET chess.san_compression = on;
+
+INSERT INTO dict_games(game_notation) VALUES
+('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6 4. Ba4 Nf6 5. O-O Be7 6. Re1 b5 7. Bb3 d6'),
+('1. e4 e5 2. Nf3 Nc6 3. Bb5 Nf6'),
+('1. e4 e5 2. Nf3 Nc6 3. Bc4 Bc5');
+
+SET chess.san_compression = off;
+
+SELECT game_notation FROM dict_games ORDER BY id;
+-- Expected Result : the three games, unchanged
+
+SELECT id, pg_column_size(game_notation) FROM dict_games ORDER BY id;
+-- Expected Result : games 1 and 2 are stored smaller than their text (they reference lines 2 and 1)
+
+SELECT id FROM dict_games WHERE has_opening(game_notation, '1. e4 e5 2. Nf3 Nc6 3. Bb5');
+-- Expected Result : 1, 2
+
+-- A line added after the dictionary was read is used by the next games stored
+INSERT INTO chess_opening_dict(id, prefix) VALUES
+(3, '1. e4 e5 2. Nf3 Nc6 3. Bc4 Bc5 4. c3 Nf6')
+ON CONFLICT (id) DO NOTHING;
+
+SET chess.san_compression = on;
+
+INSERT INTO dict_games(game_notation) VALUES
+('1. e4 e5 2. Nf3 Nc6 3. Bc4 Bc5 4. c3 Nf6 5. d4 exd4');
+
+SET chess.san_compression = off;
+
+SELECT id, pg_column_size(game_notation) FROM dict_games WHERE id = 4;
+-- Expected Result : game 4 is stored smaller than its text (it references line 3)
+
+-- The dictionary is append-only, as stored games reference its lines
+UPDATE chess_opening_dict SET prefix = '1. d4' WHERE id = 1;
+-- Expected Result : ERROR: chess_opening_dict is append-only: UPDATE is not allowed
+
+DELETE FROM chess_opening_dict WHERE id IN (1, 2);
+-- Expected Result : ERROR: chess_opening_dict is append-only: DELETE is not allowed
+
+DROP TABLE dict_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------Position Queue-----------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+CREATE TABLE queued_games (
+    id serial PRIMARY KEY,
+    game_notation SAN
+);
+
+CREATE TRIGGER queued_games_positions AFTER INSERT ON queued_games
+FOR EACH ROW EXECUTE FUNCTION chess_enqueue_positions('id', 'game_notation');
+
+INSERT INTO queued_games(game_notation) VALUES
+('1. e4 c5 2. Nf3 d6 3. d4 cxd4 4. Nxd4 Nf6 5. Nc3 a6'),
+('1. d4 d5 2. c4 e6');
+
+SELECT queued_games FROM chess_position_queue_lag;
+-- Expected Result : 2
+
+-- Without background workers (chess.position_workers = 0), batches can be processed by hand
+SELECT chess_process_position_queue(10);
+-- Expected Result : 2
+
+SELECT queued_games, lag FROM chess_position_queue_lag;
+-- Expected Result : 0 | 00:00:00
+
+SELECT g.id
+FROM queued_games g
+JOIN chess_positions p ON p.source = 'queued_games'::regclass AND p.row_key = g.id
+WHERE p.position_key = position_key('rnbqkb1r/1p2pppp/p2p1n2/8/3NP3/2N5/PPP2PPP/R1BQKB1R w KQkq - 0 6');
+-- Expected Result : 1
+
+SELECT count(*) FROM chess_positions WHERE source = 'queued_games'::regclass;
+-- Expected Result : 16 (11 board states for the first game, 5 for the second)
+
+DELETE FROM chess_positions WHERE source = 'queued_games'::regclass;
+DROP TABLE queued_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+-----------------------------------------------Position File------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+CREATE TABLE archived_games (
+    id serial PRIMARY KEY,
+    game_notation SAN
+);
+
+INSERT INTO archived_games(game_notation) VALUES
+('1. e4 c5 2. Nf3 d6 3. d4 cxd4 4. Nxd4 Nf6 5. Nc3 a6'),
+('1. d4 d5 2. c4 e6'),
+('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6');
+
+SELECT chess_build_position_file('archived_games');
+-- Expected Result : 23 (11, 5 and 7 distinct board states)
+
+-- The table is tiny: keep the planner from preferring a sequential scan
+SET enable_seqscan = off;
+
+EXPLAIN (COSTS OFF)
+SELECT id FROM archived_games
+WHERE game_notation @> 'rnbqkb1r/1p2pppp/p2p1n2/8/3NP3/2N5/PPP2PPP/R1BQKB1R w KQkq - 0 6';
+-- Expected Result : Custom Scan (Chess Position Scan) on archived_games, with the @> restriction as Filter
+
+SELECT id FROM archived_games
+WHERE game_notation @> 'rnbqkb1r/1p2pppp/p2p1n2/8/3NP3/2N5/PPP2PPP/R1BQKB1R w KQkq - 0 6';
+-- Expected Result : 1
+
+SELECT id FROM archived_games
+WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1'
+ORDER BY id;
+-- Expected Result : 1, 3
+
+-- Any write removes the file, even one fitting in the existing pages
+UPDATE archived_games SET game_notation = '1. d4 d5' WHERE id = 3;
+SELECT id FROM archived_games
+WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1'
+ORDER BY id;
+-- Expected Result : 1
+
+EXPLAIN (COSTS OFF)
+SELECT id FROM archived_games
+WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1';
+-- Expected Result : Seq Scan on archived_games
+
+-- An insert into the space freed by a delete leaves the size of the table unchanged
+DELETE FROM archived_games WHERE id = 2;
+VACUUM archived_games;
+SELECT chess_build_position_file('archived_games');
+-- Expected Result : 14 (11 and 3 distinct board states)
+
+INSERT INTO archived_games(game_notation) VALUES ('1. e4 e6');
+
+EXPLAIN (COSTS OFF)
+SELECT id FROM archived_games
+WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1';
+-- Expected Result : Seq Scan on archived_games
+
+SELECT id FROM archived_games
+WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1'
+ORDER BY id;
+-- Expected Result : 1, 4
+
+-- The file is ignored once the table is rewritten, until it is rebuilt
+TRUNCATE archived_games;
+INSERT INTO archived_games(game_notation) VALUES
+('1. e4 c5 2. Nf3 d6 3. d4 cxd4 4. Nxd4 Nf6 5. Nc3 a6'),
+('1. e4 c5');
+
+EXPLAIN (COSTS OFF)
+SELECT id FROM archived_games
+WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1';
+-- Expected Result : Seq Scan on archived_games
+
+SET chess.enable_position_file = off;
+SELECT chess_build_position_file('archived_games');
+-- Expected Result : 14
+
+EXPLAIN (COSTS OFF)
+SELECT id FROM archived_games
+WHERE game_notation @> 'rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1';
+-- Expected Result : Seq Scan on archived_games
+
+RESET chess.enable_position_file;
+RESET enable_seqscan;
+DROP TABLE archived_games;
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+
+
+
+
+
+
+
+------------------------------------------------------------------------------------------------------------------------
+----------------------------------------------------Statistics----------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+
+SELECT chess_stats_reset();
+SET chess.track_timing = on;
+
+SELECT get_board_state('1. e4 e5 2. Nf3 Nc6 3. Bb5 a6', 4);
+
+SELECT name, value FROM chess_stats() WHERE scope = 'backend' AND kind = 'counter';
+-- Expected Result : replays = 1, plies_replayed = 4
+
+SELECT name, value, total_time_ms FROM chess_stats() WHERE scope = 'backend' AND name = 'get_board_state';
+-- Expected Result : value = 1, total_time_ms > 0
+
+SET chess.track_timing = off;
+SELECT chess_stats_reset();
+
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
+------------------------------------------------------------------------------------------------------------------------
@@ -5,13 +5,6 @@
 # Define the path to your extension source code
 EXTENSION_DIR="./Src"
 
-echo "Starting installation of dependencies..."
-
-# Install the chess library for Python
-pip install chess
-
-echo "Dependencies installed."
-
 echo "Building and installing the PostgreSQL extension..."
 
 # Navigate to the extension directory